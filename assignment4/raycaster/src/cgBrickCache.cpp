@@ -0,0 +1,61 @@
+#include "cgBrickCache.h"
+
+namespace {
+
+// Evict least recently used bricks until the cache fits its capacity
+// (the caller holds the lock)
+void evictBricks(cg::BrickLRUCache *cache)
+{
+    while (cache->entries.size() > cache->capacity) {
+        cache->lookup.erase(cache->entries.back().first);
+        cache->entries.pop_back();
+    }
+}
+
+} // namespace
+
+
+
+namespace cg {
+
+BrickDataPtr brickCacheFind(BrickLRUCache *cache, std::size_t index)
+{
+    std::lock_guard<std::mutex> lock(cache->mutex);
+    auto it = cache->lookup.find(index);
+    if (it == cache->lookup.end()) {
+        return BrickDataPtr();
+    }
+    cache->entries.splice(cache->entries.begin(), cache->entries, it->second);
+    return it->second->second;
+}
+
+BrickDataPtr brickCacheInsert(BrickLRUCache *cache, std::size_t index, BrickDataPtr data)
+{
+    std::lock_guard<std::mutex> lock(cache->mutex);
+    auto it = cache->lookup.find(index);
+    if (it != cache->lookup.end()) {
+        return it->second->second;
+    }
+    if (cache->capacity > 0) {
+        cache->entries.push_front(std::make_pair(index, data));
+        cache->lookup[index] = cache->entries.begin();
+        evictBricks(cache);
+    }
+    return data;
+}
+
+void brickCacheSetCapacity(BrickLRUCache *cache, std::size_t capacity)
+{
+    std::lock_guard<std::mutex> lock(cache->mutex);
+    cache->capacity = capacity;
+    evictBricks(cache);
+}
+
+void brickCacheClear(BrickLRUCache *cache)
+{
+    std::lock_guard<std::mutex> lock(cache->mutex);
+    cache->entries.clear();
+    cache->lookup.clear();
+}
+
+} // namespace cg
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <cstddef>
+#include <cstdint>
+
+namespace cg {
+
+// Brick voxels shared between a brick cache and its users, so that
+// evicting a brick from the cache does not invalidate it
+typedef std::shared_ptr<const std::vector<std::uint8_t> > BrickDataPtr;
+
+// Struct for a small least-recently-used cache of bricks, indexed by
+// linear brick index. All functions below are thread-safe.
+struct BrickLRUCache {
+    std::size_t capacity;  // max number of cached bricks
+    std::list<std::pair<std::size_t, BrickDataPtr> > entries;  // most recent first
+    std::unordered_map<std::size_t,
+        std::list<std::pair<std::size_t, BrickDataPtr> >::iterator> lookup;
+    std::mutex mutex;
+
+    BrickLRUCache() :
+        capacity(64)
+    {}
+};
+
+// Returns the cached brick with the given index and marks it as most
+// recently used, or an empty pointer if the brick is not cached
+BrickDataPtr brickCacheFind(BrickLRUCache *cache, std::size_t index);
+
+// Adds a brick to the cache, evicting the least recently used bricks
+// if the cache is full. If the brick was added concurrently by another
+// thread, the cached copy is returned instead of data.
+BrickDataPtr brickCacheInsert(BrickLRUCache *cache, std::size_t index, BrickDataPtr data);
+
+// Sets the capacity of the cache (in bricks) and evicts bricks as needed
+void brickCacheSetCapacity(BrickLRUCache *cache, std::size_t capacity);
+
+// Removes all bricks from the cache
+void brickCacheClear(BrickLRUCache *cache);
+
+} // namespace cg
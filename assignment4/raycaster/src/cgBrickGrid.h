@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstddef>
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+namespace cg {
+
+// Struct for the partitioning of a volume into cubic bricks. Bricks are
+// numbered in x-fastest order; bricks at the upper borders may be only
+// partially covered by the volume.
+struct BrickGrid {
+    glm::ivec3 dimensions;  // volume dimensions
+    int brickSize;  // brick edge length in voxels
+    glm::ivec3 numBricks;  // number of bricks along each axis
+
+    BrickGrid() :
+        dimensions(glm::ivec3(0, 0, 0)),
+        brickSize(1),
+        numBricks(glm::ivec3(0, 0, 0))
+    {}
+};
+
+// Creates a brick grid for a volume of the given dimensions
+inline BrickGrid brickGridCreate(const glm::ivec3 &dimensions, int brickSize)
+{
+    BrickGrid grid;
+    grid.dimensions = dimensions;
+    grid.brickSize = brickSize;
+    grid.numBricks = (dimensions + glm::ivec3(brickSize - 1)) / brickSize;
+    return grid;
+}
+
+// Returns the total number of bricks in the grid
+inline std::size_t brickGridNumBricks(const BrickGrid &grid)
+{
+    return std::size_t(grid.numBricks.x) * std::size_t(grid.numBricks.y) *
+           std::size_t(grid.numBricks.z);
+}
+
+// Returns the linear index of the brick at brick coordinates (bx, by, bz)
+inline std::size_t brickGridIndex(const BrickGrid &grid, const glm::ivec3 &brick)
+{
+    return (std::size_t(brick.z) * grid.numBricks.y + brick.y) * grid.numBricks.x + brick.x;
+}
+
+// Returns the brick coordinates of the brick with the given linear index
+inline glm::ivec3 brickGridCoord(const BrickGrid &grid, std::size_t index)
+{
+    int x = int(index % grid.numBricks.x);
+    index /= grid.numBricks.x;
+    int y = int(index % grid.numBricks.y);
+    int z = int(index / grid.numBricks.y);
+    return glm::ivec3(x, y, z);
+}
+
+// Returns the first voxel covered by a brick
+inline glm::ivec3 brickGridBrickOrigin(const BrickGrid &grid, const glm::ivec3 &brick)
+{
+    return brick * grid.brickSize;
+}
+
+// Returns the number of voxels of the volume covered by a brick along
+// each axis (smaller than brickSize for border bricks)
+inline glm::ivec3 brickGridBrickExtent(const BrickGrid &grid, const glm::ivec3 &brick)
+{
+    return glm::min(glm::ivec3(grid.brickSize), grid.dimensions - brick * grid.brickSize);
+}
+
+} // namespace cg
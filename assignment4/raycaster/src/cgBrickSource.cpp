@@ -0,0 +1,176 @@
+#include "cgBrickSource.h"
+#include "cgVolumeConvert.h"
+
+#include <iostream>
+#include <algorithm>
+#include <vector>
+#include <cstring>
+
+namespace {
+
+// Reads numBytes bytes at the given file offset (the caller holds the
+// file lock)
+bool readAt(std::ifstream &file, std::uint64_t offset, std::uint8_t *dst, std::size_t numBytes)
+{
+    file.clear();
+    file.seekg(std::streamoff(offset));
+    file.read(reinterpret_cast<char *>(dst), std::streamsize(numBytes));
+    return bool(file);
+}
+
+} // namespace
+
+
+
+namespace cg {
+
+bool brickSourceOpenVTK(VTKBrickSource *source, const std::string &filename,
+                        int brickSize, std::size_t memoryBudget)
+{
+    if (source->file.is_open()) {
+        source->file.close();
+    }
+    brickCacheClear(&source->cache);
+    if (brickSize <= 0 || !volumeReadVTKInfo(&source->info, filename)) {
+        return false;
+    }
+    if (!source->info.binary) {
+        std::cerr << "Cannot stream " << filename << ": ASCII data has no fixed offsets"
+                  << std::endl;
+        return false;
+    }
+
+    source->file.open(filename.c_str(), std::ios::binary);
+    if (!source->file.is_open()) {
+        std::cerr << "Could not open " << filename << std::endl;
+        return false;
+    }
+    const glm::ivec3 &dims = source->info.dimensions;
+    std::uint64_t numBytes = std::uint64_t(dims.x) * std::uint64_t(dims.y) * std::uint64_t(dims.z) *
+                             datatypeSizeInBytes(source->info.datatype);
+    source->file.seekg(0, std::ios::end);
+    std::streamoff fileSize = source->file.tellg();
+    if (fileSize < 0 || std::uint64_t(fileSize) < source->info.dataOffset + numBytes) {
+        std::cerr << "Unexpected end of data in " << filename << std::endl;
+        source->file.close();
+        return false;
+    }
+
+    source->grid = brickGridCreate(dims, brickSize);
+    source->memoryBudget = memoryBudget;
+    brickCacheSetCapacity(&source->cache, memoryBudget / brickSourceBrickSizeInBytes(*source));
+    return true;
+}
+
+std::size_t brickSourceBrickSizeInBytes(const VTKBrickSource &source)
+{
+    return std::size_t(source.grid.brickSize) * source.grid.brickSize * source.grid.brickSize *
+           datatypeSizeInBytes(source.info.datatype);
+}
+
+// Read the brick slice by slice. Where the rows of a brick slice lie
+// close together in the file, the whole span is read at once instead
+// of seeking to every row.
+bool brickSourceReadBrick(VTKBrickSource *source, const glm::ivec3 &brick, std::uint8_t *dst)
+{
+    const BrickGrid &grid = source->grid;
+    const glm::ivec3 &dims = source->info.dimensions;
+    std::size_t elementSize = datatypeSizeInBytes(source->info.datatype);
+    int bs = grid.brickSize;
+    glm::ivec3 origin = brickGridBrickOrigin(grid, brick);
+    glm::ivec3 extent = brickGridBrickExtent(grid, brick);
+
+    std::size_t rowBytes = extent.x * elementSize;
+    std::size_t fileRowBytes = dims.x * elementSize;
+    std::size_t dstRowBytes = bs * elementSize;
+    std::size_t dstSliceBytes = bs * dstRowBytes;
+    std::size_t spanBytes = (extent.y - 1) * fileRowBytes + rowBytes;
+    bool readSpans = spanBytes <= 4 * extent.y * rowBytes;
+    std::vector<std::uint8_t> span(readSpans ? spanBytes : 0);
+
+    {
+        std::lock_guard<std::mutex> lock(source->fileMutex);
+        for (int z = 0; z < extent.z; z++) {
+            std::uint64_t offset = source->info.dataOffset +
+                ((std::uint64_t(origin.z + z) * dims.y + origin.y) * dims.x + origin.x) * elementSize;
+            std::uint8_t *slice = dst + z * dstSliceBytes;
+            if (readSpans) {
+                if (!readAt(source->file, offset, &span[0], spanBytes)) {
+                    return false;
+                }
+                for (int y = 0; y < extent.y; y++) {
+                    std::memcpy(slice + y * dstRowBytes, &span[y * fileRowBytes], rowBytes);
+                }
+            }
+            else {
+                for (int y = 0; y < extent.y; y++) {
+                    if (!readAt(source->file, offset + y * fileRowBytes, slice + y * dstRowBytes,
+                                rowBytes)) {
+                        return false;
+                    }
+                }
+            }
+        }
+    }
+
+    // Pad the brick by repeating the last voxel, row and slice
+    for (int z = 0; z < extent.z; z++) {
+        std::uint8_t *slice = dst + z * dstSliceBytes;
+        for (int y = 0; y < extent.y; y++) {
+            std::uint8_t *row = slice + y * dstRowBytes;
+            for (int x = extent.x; x < bs; x++) {
+                std::memcpy(row + x * elementSize, row + (extent.x - 1) * elementSize, elementSize);
+            }
+        }
+        for (int y = extent.y; y < bs; y++) {
+            std::memcpy(slice + y * dstRowBytes, slice + (extent.y - 1) * dstRowBytes, dstRowBytes);
+        }
+    }
+    for (int z = extent.z; z < bs; z++) {
+        std::memcpy(dst + z * dstSliceBytes, dst + (extent.z - 1) * dstSliceBytes, dstSliceBytes);
+    }
+
+    if (source->info.swapBytes) {
+        swapBytes(dst, dst, std::size_t(bs) * bs * bs, elementSize);
+    }
+    return true;
+}
+
+bool brickSourceReadSlab(VTKBrickSource *source, int firstSlice, int numSlices, std::uint8_t *dst)
+{
+    const glm::ivec3 &dims = source->info.dimensions;
+    if (firstSlice < 0 || numSlices < 0 || firstSlice + numSlices > dims.z) {
+        return false;
+    }
+    std::size_t elementSize = datatypeSizeInBytes(source->info.datatype);
+    std::size_t numElements = std::size_t(dims.x) * std::size_t(dims.y) * std::size_t(numSlices);
+    std::uint64_t offset = source->info.dataOffset +
+        std::uint64_t(dims.x) * std::uint64_t(dims.y) * std::uint64_t(firstSlice) * elementSize;
+    {
+        std::lock_guard<std::mutex> lock(source->fileMutex);
+        if (!readAt(source->file, offset, dst, numElements * elementSize)) {
+            return false;
+        }
+    }
+    if (source->info.swapBytes) {
+        swapBytes(dst, dst, numElements, elementSize);
+    }
+    return true;
+}
+
+BrickDataPtr brickSourceBrick(VTKBrickSource *source, std::size_t index)
+{
+    BrickDataPtr cached = brickCacheFind(&source->cache, index);
+    if (cached) {
+        return cached;
+    }
+
+    std::shared_ptr<std::vector<std::uint8_t> > voxels =
+        std::make_shared<std::vector<std::uint8_t> >(brickSourceBrickSizeInBytes(*source));
+    if (!brickSourceReadBrick(source, brickGridCoord(source->grid, index), &(*voxels)[0])) {
+        return BrickDataPtr();
+    }
+    return brickCacheInsert(&source->cache, index, voxels);
+}
+
+} // namespace cg
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "cgVolume.h"
+#include "cgBrickGrid.h"
+#include "cgBrickCache.h"
+
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+namespace cg {
+
+// Struct for a volume that is streamed brick by brick from a binary VTK
+// file instead of being read into memory as a whole, so that it may be
+// larger than RAM. Brick offsets are computed from the VTK header, so
+// no preprocessing is needed. Bricks are read on demand and kept in an
+// LRU cache of at most memoryBudget bytes.
+struct VTKBrickSource {
+    VTKFileInfo info;  // header of the file
+    BrickGrid grid;  // brick layout
+    std::size_t memoryBudget;  // max size of cached bricks in bytes
+    std::ifstream file;
+    std::mutex fileMutex;  // serializes seeks and reads
+    BrickLRUCache cache;
+
+    VTKBrickSource() :
+        memoryBudget(0)
+    {}
+};
+
+// Opens a binary VTK file for streaming. Returns false if the file
+// cannot be opened, is ASCII (has no fixed brick offsets), or is
+// truncated.
+bool brickSourceOpenVTK(VTKBrickSource *source, const std::string &filename,
+                        int brickSize = 32, std::size_t memoryBudget = 256u << 20);
+
+// Returns the size in bytes of one brick of the source
+std::size_t brickSourceBrickSizeInBytes(const VTKBrickSource &source);
+
+// Reads a brick from the file into dst (brickSize^3 voxels in native
+// byte order, padded like in .cgvol files) without going through the
+// cache. Safe to call from several threads. Returns true on success,
+// false otherwise.
+bool brickSourceReadBrick(VTKBrickSource *source, const glm::ivec3 &brick, std::uint8_t *dst);
+
+// Reads numSlices whole slices starting at firstSlice into dst (in
+// native byte order) with a single sequential read. Safe to call from
+// several threads. Returns true on success, false otherwise.
+bool brickSourceReadSlab(VTKBrickSource *source, int firstSlice, int numSlices, std::uint8_t *dst);
+
+// Returns the brick with the given linear index, reading it from the
+// file if it is not cached. Returns an empty pointer on read errors.
+BrickDataPtr brickSourceBrick(VTKBrickSource *source, std::size_t index);
+
+} // namespace cg
@@ -0,0 +1,477 @@
+#include "cgDerivedCache.h"
+#include "cgParallel.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <thread>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+
+#include <sys/stat.h>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <direct.h>
+#include <sys/utime.h>
+#else
+#include <dirent.h>
+#include <utime.h>
+#endif
+
+namespace {
+
+// File layout (native byte order):
+//
+// DerivedFileHeader
+// data (at dataOffset, aligned to dataAlignment)
+
+const char derivedMagic[8] = { 'C', 'G', 'D', 'E', 'R', '\r', '\n', '\x1a' };
+const std::uint32_t derivedVersion = 1;
+const std::uint32_t byteOrderMark = 0x01020304;
+const std::uint64_t dataAlignment = 4096;
+
+struct DerivedFileHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t byteOrderMark;
+    std::uint64_t contentHash;  // hash of the data the product is derived from
+    std::uint64_t keyHash;  // hash of kind and parameters
+    std::uint64_t dataOffset;
+    std::uint64_t dataSize;
+    std::uint64_t checksum;  // hashBytes() of the data
+};
+
+// Size limit of the cache directory if $CG_CACHE_MAX_MB is not set
+const std::uint64_t defaultCacheSizeLimit = std::uint64_t(16) << 30;
+
+// Bytes hashed per chunk (and per task) by hashBytes()
+const std::size_t hashChunkSize = 1 << 20;
+
+const std::uint64_t prime1 = 0x9e3779b185ebca87ull;
+const std::uint64_t prime2 = 0xc2b2ae3d27d4eb4full;
+const std::uint64_t prime3 = 0x165667b19e3779f9ull;
+
+inline std::uint64_t rotl(std::uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+// Final mix, so that every input bit affects every output bit
+inline std::uint64_t avalanche(std::uint64_t h)
+{
+    h ^= h >> 33;
+    h *= prime2;
+    h ^= h >> 29;
+    h *= prime3;
+    h ^= h >> 32;
+    return h;
+}
+
+// Hash one chunk, four independent lanes of 64-bit words at a time
+std::uint64_t hashChunk(const std::uint8_t *data, std::size_t size)
+{
+    std::uint64_t lanes[4] = { prime1 + prime2, prime2, 0, std::uint64_t(0) - prime1 };
+    std::size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        for (int l = 0; l < 4; l++) {
+            std::uint64_t word;
+            std::memcpy(&word, data + i + 8 * l, 8);
+            lanes[l] = rotl(lanes[l] + word * prime2, 31) * prime1;
+        }
+    }
+    std::uint64_t h = rotl(lanes[0], 1) + rotl(lanes[1], 7) + rotl(lanes[2], 12) + rotl(lanes[3], 18);
+    for (; i + 8 <= size; i += 8) {
+        std::uint64_t word;
+        std::memcpy(&word, data + i, 8);
+        h = rotl(h ^ (rotl(word * prime2, 31) * prime1), 27) * prime1 + prime3;
+    }
+    for (; i < size; i++) {
+        h = rotl(h ^ (data[i] * prime3), 11) * prime1;
+    }
+    return avalanche(h ^ size);
+}
+
+std::string hexString(std::uint64_t value)
+{
+    char buffer[17];
+    std::snprintf(buffer, sizeof(buffer), "%016llx", static_cast<unsigned long long>(value));
+    return buffer;
+}
+
+// Hash of the kind and parameters of a product
+std::uint64_t keyHash(const std::string &kind, const std::string &parameters)
+{
+    std::string key = kind + '\0' + parameters;
+    return cg::hashBytes(key.data(), key.size());
+}
+
+// Create a directory and its parents (existing ones are fine)
+bool makeDirectories(const std::string &path)
+{
+    for (std::size_t i = 1; i <= path.size(); i++) {
+        if (i == path.size() || path[i] == '/' || path[i] == '\\') {
+            std::string parent = path.substr(0, i);
+#ifdef _WIN32
+            int result = _mkdir(parent.c_str());
+#else
+            int result = mkdir(parent.c_str(), 0755);
+#endif
+            if (result != 0 && errno != EEXIST && i == path.size()) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// A file of the cache directory, for trimming the cache
+struct CacheFile {
+    std::string filename;
+    std::uint64_t size;
+    std::time_t lastAccess;
+};
+
+bool hasSuffix(const std::string &name, const std::string &suffix)
+{
+    return name.size() >= suffix.size() &&
+           name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// List the products and converted files in the cache directory
+void listCacheFiles(const std::string &directory, std::vector<CacheFile> *files)
+{
+    std::vector<std::string> names;
+#ifdef _WIN32
+    WIN32_FIND_DATAA data;
+    HANDLE handle = FindFirstFileA((directory + "\\*").c_str(), &data);
+    if (handle == INVALID_HANDLE_VALUE) {
+        return;
+    }
+    do {
+        names.push_back(data.cFileName);
+    } while (FindNextFileA(handle, &data));
+    FindClose(handle);
+#else
+    DIR *dir = opendir(directory.c_str());
+    if (dir == nullptr) {
+        return;
+    }
+    while (dirent *entry = readdir(dir)) {
+        names.push_back(entry->d_name);
+    }
+    closedir(dir);
+#endif
+    for (std::size_t i = 0; i < names.size(); i++) {
+        if (!hasSuffix(names[i], ".cgd") && !hasSuffix(names[i], ".cgvol")) {
+            continue;
+        }
+        CacheFile file;
+        file.filename = directory + "/" + names[i];
+        struct stat st;
+        if (stat(file.filename.c_str(), &st) == 0 && (st.st_mode & S_IFMT) == S_IFREG) {
+            file.size = std::uint64_t(st.st_size);
+            file.lastAccess = std::max(st.st_atime, st.st_mtime);
+            files->push_back(file);
+        }
+    }
+}
+
+// Set the access time of a file to now, keeping its modification time
+// (which keys converted files, see derivedCacheFileKey()). Mounts that
+// do not update access times on reads still get LRU order this way.
+void touchCacheFile(const std::string &filename, const struct stat &st)
+{
+#ifdef _WIN32
+    struct _utimbuf times;
+    times.actime = std::time(nullptr);
+    times.modtime = st.st_mtime;
+    _utime(filename.c_str(), &times);
+#else
+    struct utimbuf times;
+    times.actime = std::time(nullptr);
+    times.modtime = st.st_mtime;
+    utime(filename.c_str(), &times);
+#endif
+}
+
+} // namespace
+
+
+
+namespace cg {
+
+std::uint64_t hashBytes(const void *data, std::size_t size, std::uint64_t seed)
+{
+    const std::uint8_t *bytes = static_cast<const std::uint8_t *>(data);
+    std::size_t numChunks = (size + hashChunkSize - 1) / hashChunkSize;
+    std::vector<std::uint64_t> chunkHashes(numChunks);
+    parallelFor(0, numChunks, [&](std::size_t first, std::size_t last) {
+        for (std::size_t c = first; c < last; c++) {
+            std::size_t offset = c * hashChunkSize;
+            chunkHashes[c] = hashChunk(bytes + offset, std::min(hashChunkSize, size - offset));
+        }
+    }, 4);
+
+    std::uint64_t h = avalanche(seed + prime3) ^ size;
+    for (std::size_t c = 0; c < numChunks; c++) {
+        h = rotl(h ^ chunkHashes[c], 27) * prime1 + prime2;
+    }
+    return avalanche(h);
+}
+
+std::uint64_t volumeContentHash(const VolumeBase &volume)
+{
+    std::ostringstream header;
+    header << volume.dimensions.x << ' ' << volume.dimensions.y << ' ' << volume.dimensions.z << ' '
+           << volume.origin.x << ' ' << volume.origin.y << ' ' << volume.origin.z << ' '
+           << volume.spacing.x << ' ' << volume.spacing.y << ' ' << volume.spacing.z << ' '
+           << volume.datatype;
+    std::string headerString = header.str();
+    std::uint64_t seed = hashBytes(headerString.data(), headerString.size());
+    return hashBytes(volume.data.empty() ? nullptr : &volume.data[0], volume.data.size(), seed);
+}
+
+std::string derivedCacheDirectory()
+{
+    const char *directory = std::getenv("CG_CACHE_DIR");
+    if (directory != nullptr && directory[0] != '\0') {
+        return directory;
+    }
+#ifdef _WIN32
+    const char *base = std::getenv("LOCALAPPDATA");
+    if (base != nullptr && base[0] != '\0') {
+        return std::string(base) + "/cg-raycaster";
+    }
+#else
+    const char *base = std::getenv("XDG_CACHE_HOME");
+    if (base != nullptr && base[0] != '\0') {
+        return std::string(base) + "/cg-raycaster";
+    }
+    const char *home = std::getenv("HOME");
+    if (home != nullptr && home[0] != '\0') {
+        return std::string(home) + "/.cache/cg-raycaster";
+    }
+#endif
+    return ".cg-cache";
+}
+
+std::uint64_t derivedCacheSizeLimit()
+{
+    const char *limit = std::getenv("CG_CACHE_MAX_MB");
+    if (limit != nullptr && limit[0] != '\0') {
+        return std::uint64_t(std::strtoull(limit, nullptr, 10)) << 20;
+    }
+    return defaultCacheSizeLimit;
+}
+
+void derivedCacheTrim(const std::string &directory, std::uint64_t maxBytes,
+                      const std::string &keepFilename)
+{
+    std::vector<CacheFile> files;
+    listCacheFiles(directory, &files);
+    std::uint64_t totalBytes = 0;
+    for (std::size_t i = 0; i < files.size(); i++) {
+        totalBytes += files[i].size;
+    }
+    if (totalBytes <= maxBytes) {
+        return;
+    }
+
+    // Least recently used first. Files that are mapped can be removed
+    // too: their mappings stay valid until closed (except on Windows,
+    // where removing them fails and they are kept).
+    std::sort(files.begin(), files.end(), [](const CacheFile &a, const CacheFile &b) {
+        return a.lastAccess < b.lastAccess;
+    });
+    for (std::size_t i = 0; i < files.size() && totalBytes > maxBytes; i++) {
+        if (files[i].filename != keepFilename && std::remove(files[i].filename.c_str()) == 0) {
+            totalBytes -= files[i].size;
+        }
+    }
+}
+
+std::uint64_t derivedCacheSourceHash(const std::string &directory, const std::string &filename,
+                                     const VolumeBase &volume)
+{
+    // The remembered hash is a product of the file name, valid for the
+    // file's current size and modification time
+    // (directories and patterns of slice stacks are always hashed)
+    struct stat st;
+    if (stat(filename.c_str(), &st) != 0 || (st.st_mode & S_IFMT) != S_IFREG) {
+        return volumeContentHash(volume);
+    }
+    std::uint64_t nameHash = hashBytes(filename.data(), filename.size());
+    std::ostringstream parameters;
+    parameters << "size=" << st.st_size << ";mtime=" << st.st_mtime;
+
+    DerivedArtifact artifact;
+    std::uint64_t contentHash = 0;
+    if (derivedCacheLoad(&artifact, directory, nameHash, "source", parameters.str()) &&
+        artifact.size == sizeof(contentHash)) {
+        std::memcpy(&contentHash, artifact.data, sizeof(contentHash));
+        return contentHash;
+    }
+    contentHash = volumeContentHash(volume);
+    derivedCacheStore(directory, nameHash, "source", parameters.str(),
+                      reinterpret_cast<const std::uint8_t *>(&contentHash), sizeof(contentHash));
+    return contentHash;
+}
+
+std::uint64_t derivedCacheFileKey(const std::string &filename)
+{
+    struct stat st;
+    if (stat(filename.c_str(), &st) != 0 || (st.st_mode & S_IFMT) != S_IFREG) {
+        return 0;
+    }
+    std::ostringstream key;
+    key << filename << '\0' << st.st_size << '\0' << st.st_mtime;
+    std::string keyString = key.str();
+    return hashBytes(keyString.data(), keyString.size());
+}
+
+std::string derivedCacheConvertedPath(const std::string &directory,
+                                      const std::string &sourceFilename,
+                                      const std::string &extension)
+{
+    std::uint64_t key = derivedCacheFileKey(sourceFilename);
+    if (key == 0) {
+        return std::string();
+    }
+    if (!makeDirectories(directory)) {
+        std::cerr << "Could not create " << directory << std::endl;
+    }
+    return directory + "/" + hexString(key) + "-converted" + extension;
+}
+
+std::string derivedCachePath(const std::string &directory, std::uint64_t contentHash,
+                             const std::string &kind, const std::string &parameters)
+{
+    return directory + "/" + hexString(contentHash) + "-" + kind + "-" +
+           hexString(keyHash(kind, parameters)) + ".cgd";
+}
+
+bool derivedCacheLoad(DerivedArtifact *artifact, const std::string &directory,
+                      std::uint64_t contentHash, const std::string &kind,
+                      const std::string &parameters, bool verify)
+{
+    std::string filename = derivedCachePath(directory, contentHash, kind, parameters);
+    struct stat st;
+    if (stat(filename.c_str(), &st) != 0 || !mappedFileOpen(&artifact->file, filename)) {
+        return false;
+    }
+    touchCacheFile(filename, st);
+
+    DerivedFileHeader header;
+    bool valid = artifact->file.size >= sizeof(header);
+    if (valid) {
+        std::memcpy(&header, artifact->file.data, sizeof(header));
+        valid = std::memcmp(header.magic, derivedMagic, sizeof(header.magic)) == 0 &&
+                header.version == derivedVersion && header.byteOrderMark == byteOrderMark &&
+                header.contentHash == contentHash &&
+                header.keyHash == keyHash(kind, parameters) &&
+                header.dataOffset >= sizeof(header) &&
+                header.dataOffset + header.dataSize == artifact->file.size;
+    }
+    if (valid && verify) {
+        valid = hashBytes(artifact->file.data + header.dataOffset,
+                          std::size_t(header.dataSize)) == header.checksum;
+    }
+    if (!valid) {
+        std::cerr << filename << " is not a valid cache file" << std::endl;
+        mappedFileClose(&artifact->file);
+        return false;
+    }
+    artifact->data = artifact->file.data + header.dataOffset;
+    artifact->size = std::size_t(header.dataSize);
+    std::vector<std::uint8_t>().swap(artifact->buffer);
+    return true;
+}
+
+bool derivedCacheStore(const std::string &directory, std::uint64_t contentHash,
+                       const std::string &kind, const std::string &parameters,
+                       const std::uint8_t *data, std::size_t size)
+{
+    if (!makeDirectories(directory)) {
+        std::cerr << "Could not create " << directory << std::endl;
+        return false;
+    }
+
+    DerivedFileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, derivedMagic, sizeof(header.magic));
+    header.version = derivedVersion;
+    header.byteOrderMark = byteOrderMark;
+    header.contentHash = contentHash;
+    header.keyHash = keyHash(kind, parameters);
+    header.dataOffset = dataAlignment;
+    header.dataSize = size;
+    header.checksum = hashBytes(data, size);
+
+    // The temporary name is unique to this thread and moment
+    std::string filename = derivedCachePath(directory, contentHash, kind, parameters);
+    std::ostringstream suffix;
+    suffix << ".tmp" << std::hash<std::thread::id>()(std::this_thread::get_id()) << "-"
+           << std::chrono::steady_clock::now().time_since_epoch().count();
+    std::string tempFilename = filename + suffix.str();
+    {
+        std::ofstream os(tempFilename.c_str(), std::ios::binary | std::ios::trunc);
+        if (!os.is_open()) {
+            std::cerr << "Could not open " << tempFilename << " for writing" << std::endl;
+            return false;
+        }
+        std::vector<char> padding(std::size_t(header.dataOffset) - sizeof(header), 0);
+        os.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        os.write(&padding[0], std::streamsize(padding.size()));
+        os.write(reinterpret_cast<const char *>(data), std::streamsize(size));
+        if (!os) {
+            std::cerr << "Could not write " << tempFilename << std::endl;
+            os.close();
+            std::remove(tempFilename.c_str());
+            return false;
+        }
+    }
+#ifdef _WIN32
+    std::remove(filename.c_str());  // rename does not replace files here
+#endif
+    if (std::rename(tempFilename.c_str(), filename.c_str()) != 0) {
+        std::remove(tempFilename.c_str());
+        return false;
+    }
+    derivedCacheTrim(directory, derivedCacheSizeLimit(), filename);
+    return true;
+}
+
+bool derivedCacheGet(DerivedArtifact *artifact, const std::string &directory,
+                     std::uint64_t contentHash, const std::string &kind,
+                     const std::string &parameters, const DerivedCompute &compute)
+{
+    if (derivedCacheLoad(artifact, directory, contentHash, kind, parameters)) {
+        return true;
+    }
+    std::vector<std::uint8_t> buffer;
+    if (!compute(&buffer)) {
+        return false;
+    }
+
+    // Map the stored file rather than keeping the buffer, so that the
+    // product can be paged out like any other cached one
+    if (derivedCacheStore(directory, contentHash, kind, parameters,
+                          buffer.empty() ? nullptr : &buffer[0], buffer.size()) &&
+        derivedCacheLoad(artifact, directory, contentHash, kind, parameters)) {
+        return true;
+    }
+    mappedFileClose(&artifact->file);
+    artifact->buffer.swap(buffer);
+    artifact->data = artifact->buffer.empty() ? nullptr : &artifact->buffer[0];
+    artifact->size = artifact->buffer.size();
+    return true;
+}
+
+} // namespace cg
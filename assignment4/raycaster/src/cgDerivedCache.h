@@ -0,0 +1,109 @@
+#pragma once
+
+#include "cgVolume.h"
+#include "cgMappedFile.h"
+
+#include <vector>
+#include <string>
+#include <functional>
+#include <cstddef>
+#include <cstdint>
+
+namespace cg {
+
+// Struct for a product derived from volume data (a histogram,
+// gradients, a downsampled level, ...) as read from the derived data
+// cache. The data is either mapped from the cache file or, if it could
+// not be stored, held in memory.
+struct DerivedArtifact {
+    const std::uint8_t *data;  // first byte of the product
+    std::size_t size;  // size of the product in bytes
+    MappedFile file;  // mapping that owns the data (if mapped)
+    std::vector<std::uint8_t> buffer;  // owns the data otherwise
+
+    DerivedArtifact() :
+        data(nullptr),
+        size(0)
+    {}
+};
+
+// Function that computes a derived product into a buffer. Returns true
+// on success.
+typedef std::function<bool(std::vector<std::uint8_t> *data)> DerivedCompute;
+
+// Returns a 64-bit hash of a block of bytes. Blocks are hashed in
+// fixed-size chunks in parallel, so the result does not depend on the
+// number of threads.
+std::uint64_t hashBytes(const void *data, std::size_t size, std::uint64_t seed = 0);
+
+// Returns a 64-bit hash of the content of a volume image: dimensions,
+// origin, spacing, data type and voxels
+std::uint64_t volumeContentHash(const VolumeBase &volume);
+
+// Returns the directory of the derived data cache: $CG_CACHE_DIR if
+// set, otherwise a directory in the user's cache directory
+std::string derivedCacheDirectory();
+
+// Returns the size limit of the derived data cache in bytes:
+// $CG_CACHE_MAX_MB megabytes if set, otherwise 16 GB
+std::uint64_t derivedCacheSizeLimit();
+
+// Removes the least recently used products and converted files from the
+// cache directory until it holds at most maxBytes, except keepFilename.
+// Loading a product counts as a use.
+void derivedCacheTrim(const std::string &directory, std::uint64_t maxBytes,
+                      const std::string &keepFilename = std::string());
+
+// Returns the content hash of a volume read from the given file (see
+// volumeContentHash()), remembered in the cache directory for as long
+// as the file keeps its size and modification time, so that a file is
+// only hashed once
+std::uint64_t derivedCacheSourceHash(const std::string &directory, const std::string &filename,
+                                     const VolumeBase &volume);
+
+// Returns a key for products derived from a whole file whose content is
+// too large to hash (e.g., a streamed volume), made up of the file's
+// name, size and modification time. Returns zero if the file does not
+// exist.
+std::uint64_t derivedCacheFileKey(const std::string &filename);
+
+// Returns the path of a file converted as a whole from the given source
+// file (e.g., a native volume cache file converted from a VTK file),
+// with the given extension, keyed like derivedCacheFileKey(). Creates
+// the cache directory if needed, so that the file can be written.
+// Returns an empty string if the source file does not exist.
+std::string derivedCacheConvertedPath(const std::string &directory,
+                                      const std::string &sourceFilename,
+                                      const std::string &extension);
+
+// Returns the path of the cache file of a product of the given kind
+// (e.g., "histogram") and parameters (e.g., "bins=256"), derived from
+// data with the given content hash
+std::string derivedCachePath(const std::string &directory, std::uint64_t contentHash,
+                             const std::string &kind, const std::string &parameters);
+
+// Maps a product from the cache. The file is checked against the key
+// (content hash, kind and parameters) and its size; with verify set,
+// the checksum of the data is checked too. Returns false if the
+// product is not cached or the file is invalid.
+bool derivedCacheLoad(DerivedArtifact *artifact, const std::string &directory,
+                      std::uint64_t contentHash, const std::string &kind,
+                      const std::string &parameters, bool verify = false);
+
+// Stores a product in the cache. The file is written under a temporary
+// name and renamed when complete, so that readers (also in other
+// processes) never see partial files. The cache is then trimmed to its
+// size limit (see derivedCacheTrim()). Returns true on success, false
+// otherwise.
+bool derivedCacheStore(const std::string &directory, std::uint64_t contentHash,
+                       const std::string &kind, const std::string &parameters,
+                       const std::uint8_t *data, std::size_t size);
+
+// Maps a product from the cache (see derivedCacheLoad()), or computes
+// it with compute and stores it for the next time. Returns false only
+// if the product is not cached and cannot be computed.
+bool derivedCacheGet(DerivedArtifact *artifact, const std::string &directory,
+                     std::uint64_t contentHash, const std::string &kind,
+                     const std::string &parameters, const DerivedCompute &compute);
+
+} // namespace cg
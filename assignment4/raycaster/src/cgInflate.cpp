@@ -0,0 +1,502 @@
+#include "cgInflate.h"
+
+#include <cstring>
+
+namespace {
+
+const unsigned maxCodeBits = 15;
+const unsigned fastBits = 10;  // codes up to this length are decoded with one lookup
+const unsigned maxSymbols = 288;
+
+// Output produced between two progress reports
+const std::size_t progressInterval = 1u << 20;
+
+const std::uint16_t lengthBase[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+const std::uint8_t lengthExtra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+const std::uint16_t distanceBase[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+const std::uint8_t distanceExtra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+const std::uint8_t codeLengthOrder[19] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+// Struct for a canonical Huffman code. Short codes are looked up
+// directly in fast; longer ones are decoded bit by bit from the
+// code length counts.
+struct Huffman {
+    std::uint16_t fast[1 << fastBits];  // (symbol << 4) | length, or 0
+    std::uint16_t count[maxCodeBits + 1];  // number of codes of each length
+    std::uint16_t symbol[maxSymbols];  // symbols ordered by code
+};
+
+// Struct for reading the LSB-first bit stream. Past the end of the
+// input, zero bits are shifted in and counted in padBits, so that
+// truncated input can be detected after the fact.
+struct BitReader {
+    const std::uint8_t *next;
+    const std::uint8_t *end;
+    std::uint64_t bits;
+    unsigned numBits;
+    unsigned padBits;
+};
+
+void refill(BitReader *br)
+{
+    while (br->numBits <= 56) {
+        if (br->next < br->end) {
+            br->bits |= std::uint64_t(*br->next++) << br->numBits;
+        }
+        else {
+            br->padBits += 8;
+        }
+        br->numBits += 8;
+    }
+}
+
+// Takes n <= 16 bits (the caller has refilled)
+unsigned getBits(BitReader *br, unsigned n)
+{
+    unsigned value = unsigned(br->bits & ((std::uint64_t(1) << n) - 1));
+    br->bits >>= n;
+    br->numBits -= n;
+    return value;
+}
+
+bool isTruncated(const BitReader &br)
+{
+    return br.padBits > br.numBits;
+}
+
+unsigned reverseBits(unsigned code, unsigned length)
+{
+    unsigned reversed = 0;
+    for (unsigned i = 0; i < length; i++) {
+        reversed = (reversed << 1) | ((code >> i) & 1);
+    }
+    return reversed;
+}
+
+// Build the decoding tables from code lengths. Returns false for
+// over-subscribed codes; incomplete codes are accepted (unused codes
+// fail when decoded).
+bool buildHuffman(Huffman *h, const std::uint8_t *lengths, unsigned n)
+{
+    std::memset(h->count, 0, sizeof(h->count));
+    for (unsigned i = 0; i < n; i++) {
+        h->count[lengths[i]]++;
+    }
+    h->count[0] = 0;
+    int left = 1;
+    for (unsigned len = 1; len <= maxCodeBits; len++) {
+        left = (left << 1) - h->count[len];
+        if (left < 0) {
+            return false;
+        }
+    }
+
+    std::uint16_t offsets[maxCodeBits + 1];
+    offsets[1] = 0;
+    for (unsigned len = 1; len < maxCodeBits; len++) {
+        offsets[len + 1] = std::uint16_t(offsets[len] + h->count[len]);
+    }
+    for (unsigned i = 0; i < n; i++) {
+        if (lengths[i] != 0) {
+            h->symbol[offsets[lengths[i]]++] = std::uint16_t(i);
+        }
+    }
+
+    std::memset(h->fast, 0, sizeof(h->fast));
+    unsigned code = 0, index = 0;
+    for (unsigned len = 1; len <= fastBits; len++) {
+        for (unsigned i = 0; i < h->count[len]; i++) {
+            std::uint16_t entry = std::uint16_t((h->symbol[index++] << 4) | len);
+            for (unsigned j = reverseBits(code++, len); j < (1u << fastBits); j += 1u << len) {
+                h->fast[j] = entry;
+            }
+        }
+        code <<= 1;
+    }
+    return true;
+}
+
+// Decode one symbol (the caller has refilled). Returns -1 for codes
+// that are not part of the code.
+int decodeSymbol(BitReader *br, const Huffman &h)
+{
+    unsigned entry = h.fast[br->bits & ((1u << fastBits) - 1)];
+    if (entry != 0) {
+        getBits(br, entry & 15);
+        return int(entry >> 4);
+    }
+
+    std::uint64_t bits = br->bits;
+    int code = 0, first = 0, index = 0;
+    for (unsigned len = 1; len <= maxCodeBits; len++) {
+        code |= int(bits & 1);
+        bits >>= 1;
+        int count = h.count[len];
+        if (code - count < first) {
+            getBits(br, len);
+            return h.symbol[index + (code - first)];
+        }
+        index += count;
+        first = (first + count) << 1;
+        code <<= 1;
+    }
+    return -1;
+}
+
+bool fail(std::string *errorMessage, const char *message)
+{
+    if (errorMessage != nullptr) {
+        *errorMessage = message;
+    }
+    return false;
+}
+
+// Read the code lengths of a dynamic block and build its tables
+bool readDynamicTables(BitReader *br, Huffman *literals, Huffman *distances,
+                       std::string *errorMessage)
+{
+    refill(br);
+    unsigned numLiterals = getBits(br, 5) + 257;
+    unsigned numDistances = getBits(br, 5) + 1;
+    unsigned numCodeLengths = getBits(br, 4) + 4;
+    if (numLiterals > 286 || numDistances > 30) {
+        return fail(errorMessage, "invalid block header");
+    }
+
+    std::uint8_t lengths[maxSymbols + 32] = {0};
+    for (unsigned i = 0; i < numCodeLengths; i++) {
+        refill(br);
+        lengths[codeLengthOrder[i]] = std::uint8_t(getBits(br, 3));
+    }
+    Huffman codeLengths;
+    if (!buildHuffman(&codeLengths, lengths, 19)) {
+        return fail(errorMessage, "invalid code lengths");
+    }
+
+    std::memset(lengths, 0, sizeof(lengths));
+    unsigned n = numLiterals + numDistances;
+    for (unsigned i = 0; i < n; ) {
+        refill(br);
+        int symbol = decodeSymbol(br, codeLengths);
+        if (symbol < 0) {
+            return fail(errorMessage, "invalid code lengths");
+        }
+        if (symbol < 16) {
+            lengths[i++] = std::uint8_t(symbol);
+            continue;
+        }
+        std::uint8_t value = 0;
+        unsigned repeat = 0;
+        if (symbol == 16) {
+            if (i == 0) {
+                return fail(errorMessage, "invalid code lengths");
+            }
+            value = lengths[i - 1];
+            repeat = 3 + getBits(br, 2);
+        }
+        else if (symbol == 17) {
+            repeat = 3 + getBits(br, 3);
+        }
+        else {
+            repeat = 11 + getBits(br, 7);
+        }
+        if (i + repeat > n) {
+            return fail(errorMessage, "invalid code lengths");
+        }
+        while (repeat-- > 0) {
+            lengths[i++] = value;
+        }
+    }
+    if (isTruncated(*br)) {
+        return fail(errorMessage, "unexpected end of data");
+    }
+    if (lengths[256] == 0 ||
+        !buildHuffman(literals, lengths, numLiterals) ||
+        !buildHuffman(distances, lengths + numLiterals, numDistances)) {
+        return fail(errorMessage, "invalid code lengths");
+    }
+    return true;
+}
+
+void buildFixedTables(Huffman *literals, Huffman *distances)
+{
+    std::uint8_t lengths[maxSymbols];
+    for (unsigned i = 0; i < maxSymbols; i++) {
+        lengths[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+    }
+    buildHuffman(literals, lengths, maxSymbols);
+    std::memset(lengths, 5, 30);
+    buildHuffman(distances, lengths, 30);
+}
+
+// Decode the symbols of a compressed block
+bool inflateBlock(BitReader *br, const Huffman &literals, const Huffman &distances,
+                  const std::uint8_t *windowStart, std::uint8_t **out, std::uint8_t *outEnd,
+                  std::string *errorMessage)
+{
+    std::uint8_t *dst = *out;
+    for (;;) {
+        refill(br);
+        int symbol = decodeSymbol(br, literals);
+        if (symbol < 256) {
+            if (symbol < 0) {
+                return fail(errorMessage, "invalid literal/length code");
+            }
+            if (dst == outEnd) {
+                return fail(errorMessage, "more data than expected");
+            }
+            *dst++ = std::uint8_t(symbol);
+        }
+        else if (symbol == 256) {
+            break;
+        }
+        else {
+            symbol -= 257;
+            if (symbol >= 29) {
+                return fail(errorMessage, "invalid literal/length code");
+            }
+            std::size_t length = lengthBase[symbol] + getBits(br, lengthExtra[symbol]);
+            int distanceSymbol = decodeSymbol(br, distances);
+            if (distanceSymbol < 0 || distanceSymbol >= 30) {
+                return fail(errorMessage, "invalid distance code");
+            }
+            std::size_t distance = distanceBase[distanceSymbol] +
+                                   getBits(br, distanceExtra[distanceSymbol]);
+            if (distance > std::size_t(dst - windowStart)) {
+                return fail(errorMessage, "distance too far back");
+            }
+            if (length > std::size_t(outEnd - dst)) {
+                return fail(errorMessage, "more data than expected");
+            }
+            const std::uint8_t *from = dst - distance;
+            if (distance >= length) {
+                std::memcpy(dst, from, length);
+            }
+            else {
+                for (std::size_t i = 0; i < length; i++) {
+                    dst[i] = from[i];
+                }
+            }
+            dst += length;
+        }
+        if (isTruncated(*br)) {
+            return fail(errorMessage, "unexpected end of data");
+        }
+    }
+    *out = dst;
+    return !isTruncated(*br) || fail(errorMessage, "unexpected end of data");
+}
+
+// Copy a stored block, first from the bit buffer, then from the input
+bool copyStoredBlock(BitReader *br, std::uint8_t **out, std::uint8_t *outEnd,
+                     std::string *errorMessage)
+{
+    getBits(br, (br->numBits - br->padBits) % 8);
+    refill(br);
+    unsigned length = getBits(br, 16);
+    unsigned check = getBits(br, 16);
+    if (isTruncated(*br)) {
+        return fail(errorMessage, "unexpected end of data");
+    }
+    if (length != (~check & 0xffff)) {
+        return fail(errorMessage, "invalid stored block length");
+    }
+    if (length > std::size_t(outEnd - *out)) {
+        return fail(errorMessage, "more data than expected");
+    }
+    while (length > 0 && br->numBits - br->padBits >= 8) {
+        *(*out)++ = std::uint8_t(getBits(br, 8));
+        length--;
+    }
+    if (length > 0) {
+        br->bits = 0;
+        br->numBits = 0;
+        br->padBits = 0;
+        if (length > std::size_t(br->end - br->next)) {
+            return fail(errorMessage, "unexpected end of data");
+        }
+        std::memcpy(*out, br->next, length);
+        br->next += length;
+        *out += length;
+    }
+    return true;
+}
+
+// Little-endian 32-bit value
+std::uint32_t readUInt32(const std::uint8_t *p)
+{
+    return std::uint32_t(p[0]) | (std::uint32_t(p[1]) << 8) | (std::uint32_t(p[2]) << 16) |
+           (std::uint32_t(p[3]) << 24);
+}
+
+} // namespace
+
+
+
+namespace cg {
+
+// Decode block by block. Bytes more than one window behind the output
+// position are final, which is what is reported as progress.
+bool inflateRaw(const std::uint8_t *src, std::size_t srcSize, std::uint8_t *dst,
+                std::size_t dstSize, std::size_t *srcUsed, std::size_t *dstUsed,
+                std::string *errorMessage, const InflateProgress &progress)
+{
+    BitReader br = { src, src + srcSize, 0, 0, 0 };
+    std::uint8_t *out = dst;
+    std::uint8_t *outEnd = dst + dstSize;
+    std::size_t reported = 0;
+    Huffman literals, distances;
+    bool fixedTables = false;
+    bool last = false;
+    while (!last) {
+        refill(&br);
+        last = getBits(&br, 1) == 1;
+        unsigned type = getBits(&br, 2);
+        bool ok = false;
+        if (type == 0) {
+            fixedTables = false;
+            ok = copyStoredBlock(&br, &out, outEnd, errorMessage);
+        }
+        else if (type == 1) {
+            if (!fixedTables) {
+                buildFixedTables(&literals, &distances);
+                fixedTables = true;
+            }
+            ok = inflateBlock(&br, literals, distances, dst, &out, outEnd, errorMessage);
+        }
+        else if (type == 2) {
+            fixedTables = false;
+            ok = readDynamicTables(&br, &literals, &distances, errorMessage) &&
+                 inflateBlock(&br, literals, distances, dst, &out, outEnd, errorMessage);
+        }
+        else {
+            ok = fail(errorMessage, "invalid block type");
+        }
+        if (!ok) {
+            return false;
+        }
+
+        std::size_t produced = std::size_t(out - dst);
+        if (progress && produced >= reported + progressInterval + inflateWindowSize) {
+            reported = produced - inflateWindowSize;
+            progress(reported);
+        }
+    }
+    if (isTruncated(br)) {
+        return fail(errorMessage, "unexpected end of data");
+    }
+
+    // Drop the padding of the last byte; whole bytes left in the bit
+    // buffer were not used
+    getBits(&br, (br.numBits - br.padBits) % 8);
+    if (srcUsed != nullptr) {
+        *srcUsed = std::size_t(br.next - src) - (br.numBits - br.padBits) / 8;
+    }
+    if (dstUsed != nullptr) {
+        *dstUsed = std::size_t(out - dst);
+    }
+    if (progress) {
+        progress(std::size_t(out - dst));
+    }
+    return true;
+}
+
+bool inflateGzip(const std::uint8_t *src, std::size_t srcSize, std::uint8_t *dst,
+                 std::size_t dstSize, std::string *errorMessage, const InflateProgress &progress)
+{
+    std::size_t pos = 0;
+    std::size_t produced = 0;
+    do {
+        // Member header (RFC 1952)
+        if (srcSize - pos < 18 || src[pos] != 0x1f || src[pos + 1] != 0x8b || src[pos + 2] != 8) {
+            return fail(errorMessage, "not gzip data");
+        }
+        std::uint8_t flags = src[pos + 3];
+        pos += 10;
+        if (flags & 4) {  // FEXTRA
+            pos += 2 + (std::size_t(src[pos]) | (std::size_t(src[pos + 1]) << 8));
+        }
+        for (int field = 8; field <= 16; field <<= 1) {  // FNAME, FCOMMENT
+            if (flags & field) {
+                while (pos < srcSize && src[pos] != 0) {
+                    pos++;
+                }
+                pos++;
+            }
+        }
+        if (flags & 2) {  // FHCRC
+            pos += 2;
+        }
+        if (pos >= srcSize) {
+            return fail(errorMessage, "unexpected end of data");
+        }
+
+        std::size_t base = produced;
+        InflateProgress memberProgress;
+        if (progress) {
+            memberProgress = [&](std::size_t numBytes) { progress(base + numBytes); };
+        }
+        std::size_t used = 0, memberSize = 0;
+        if (!inflateRaw(src + pos, srcSize - pos, dst + produced, dstSize - produced,
+                        &used, &memberSize, errorMessage, memberProgress)) {
+            return false;
+        }
+        pos += used;
+        if (srcSize - pos < 8) {
+            return fail(errorMessage, "unexpected end of data");
+        }
+        if (readUInt32(src + pos + 4) != std::uint32_t(memberSize)) {
+            return fail(errorMessage, "size mismatch in gzip trailer");
+        }
+        pos += 8;
+        produced += memberSize;
+
+        // Some tools pad the file with zeros after the last member
+        while (pos < srcSize && src[pos] == 0) {
+            pos++;
+        }
+    } while (pos < srcSize);
+
+    if (produced != dstSize) {
+        return fail(errorMessage, "unexpected end of data");
+    }
+    return true;
+}
+
+bool inflateZlib(const std::uint8_t *src, std::size_t srcSize, std::uint8_t *dst,
+                 std::size_t dstSize, std::string *errorMessage, const InflateProgress &progress)
+{
+    // Stream header (RFC 1950)
+    if (srcSize < 2 || (src[0] & 15) != 8 || (src[0] >> 4) > 7 ||
+        ((unsigned(src[0]) << 8) | src[1]) % 31 != 0) {
+        return fail(errorMessage, "not zlib data");
+    }
+    if (src[1] & 0x20) {
+        return fail(errorMessage, "preset dictionaries are not supported");
+    }
+    std::size_t produced = 0;
+    if (!inflateRaw(src + 2, srcSize - 2, dst, dstSize, nullptr, &produced, errorMessage,
+                    progress)) {
+        return false;
+    }
+    if (produced != dstSize) {
+        return fail(errorMessage, "unexpected end of data");
+    }
+    return true;
+}
+
+} // namespace cg
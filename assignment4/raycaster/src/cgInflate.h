@@ -0,0 +1,43 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+namespace cg {
+
+// Callback reporting how many bytes at the start of the output buffer
+// are final, i.e., will neither be written nor read again by the
+// decoder. Called from the decoding thread.
+typedef std::function<void(std::size_t numBytes)> InflateProgress;
+
+// Distance that back-references of the decoder may reach behind the
+// current output position (the DEFLATE window size)
+const std::size_t inflateWindowSize = 32768;
+
+// Decompresses a raw DEFLATE stream from src straight into dst, using
+// dst itself as the history window (no intermediate buffers). The
+// stream must produce at most dstSize bytes. On success, srcUsed and
+// dstUsed (if not null) are set to the number of bytes consumed and
+// produced. Returns false with errorMessage set (if not null) on
+// corrupt, truncated, or oversized data.
+bool inflateRaw(const std::uint8_t *src, std::size_t srcSize, std::uint8_t *dst,
+                std::size_t dstSize, std::size_t *srcUsed, std::size_t *dstUsed,
+                std::string *errorMessage = nullptr,
+                const InflateProgress &progress = InflateProgress());
+
+// Decompresses gzip data (one or more concatenated members) into dst,
+// which must be exactly the size of the uncompressed data. The sizes in
+// the member trailers are checked; CRCs are not.
+bool inflateGzip(const std::uint8_t *src, std::size_t srcSize, std::uint8_t *dst,
+                 std::size_t dstSize, std::string *errorMessage = nullptr,
+                 const InflateProgress &progress = InflateProgress());
+
+// Decompresses a zlib stream into dst, which must be exactly the size
+// of the uncompressed data. The Adler-32 checksum is not checked.
+bool inflateZlib(const std::uint8_t *src, std::size_t srcSize, std::uint8_t *dst,
+                 std::size_t dstSize, std::string *errorMessage = nullptr,
+                 const InflateProgress &progress = InflateProgress());
+
+} // namespace cg
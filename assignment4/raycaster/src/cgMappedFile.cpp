@@ -0,0 +1,133 @@
+#include "cgMappedFile.h"
+
+#include <iostream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace cg {
+
+MappedFile::MappedFile() :
+    data(nullptr),
+    size(0),
+#ifdef _WIN32
+    fileHandle(nullptr),
+    mappingHandle(nullptr)
+#else
+    fd(-1)
+#endif
+{}
+
+MappedFile::~MappedFile()
+{
+    mappedFileClose(this);
+}
+
+#ifdef _WIN32
+
+bool mappedFileOpen(MappedFile *file, const std::string &filename)
+{
+    mappedFileClose(file);
+
+    HANDLE fileHandle = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                                    nullptr, OPEN_EXISTING,
+                                    FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (fileHandle == INVALID_HANDLE_VALUE) {
+        std::cerr << "Could not open " << filename << std::endl;
+        return false;
+    }
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart == 0) {
+        CloseHandle(fileHandle);
+        return false;
+    }
+    HANDLE mappingHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mappingHandle == nullptr) {
+        CloseHandle(fileHandle);
+        return false;
+    }
+    void *view = MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+    if (view == nullptr) {
+        CloseHandle(mappingHandle);
+        CloseHandle(fileHandle);
+        return false;
+    }
+
+    file->fileHandle = fileHandle;
+    file->mappingHandle = mappingHandle;
+    file->data = static_cast<const std::uint8_t *>(view);
+    file->size = static_cast<std::size_t>(fileSize.QuadPart);
+    return true;
+}
+
+void mappedFileClose(MappedFile *file)
+{
+    if (file->data != nullptr) {
+        UnmapViewOfFile(file->data);
+    }
+    if (file->mappingHandle != nullptr) {
+        CloseHandle(static_cast<HANDLE>(file->mappingHandle));
+    }
+    if (file->fileHandle != nullptr) {
+        CloseHandle(static_cast<HANDLE>(file->fileHandle));
+    }
+    file->data = nullptr;
+    file->size = 0;
+    file->fileHandle = nullptr;
+    file->mappingHandle = nullptr;
+}
+
+#else
+
+bool mappedFileOpen(MappedFile *file, const std::string &filename)
+{
+    mappedFileClose(file);
+
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Could not open " << filename << std::endl;
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        ::close(fd);
+        return false;
+    }
+    void *view = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (view == MAP_FAILED) {
+        ::close(fd);
+        return false;
+    }
+    // Volume files are read front to back, so ask for aggressive readahead
+    madvise(view, st.st_size, MADV_SEQUENTIAL);
+
+    file->fd = fd;
+    file->data = static_cast<const std::uint8_t *>(view);
+    file->size = static_cast<std::size_t>(st.st_size);
+    return true;
+}
+
+void mappedFileClose(MappedFile *file)
+{
+    if (file->data != nullptr) {
+        munmap(const_cast<std::uint8_t *>(file->data), file->size);
+    }
+    if (file->fd >= 0) {
+        ::close(file->fd);
+    }
+    file->data = nullptr;
+    file->size = 0;
+    file->fd = -1;
+}
+
+#endif
+
+} // namespace cg
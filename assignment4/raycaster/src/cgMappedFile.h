@@ -0,0 +1,37 @@
+#pragma once
+
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+namespace cg {
+
+// Struct for a read-only memory mapping of a whole file. The mapping
+// is released when the struct is destroyed, so it cannot be copied.
+struct MappedFile {
+    const std::uint8_t *data;  // first byte of the mapped file
+    std::size_t size;  // file size in bytes
+#ifdef _WIN32
+    void *fileHandle;
+    void *mappingHandle;
+#else
+    int fd;
+#endif
+
+    MappedFile();
+    ~MappedFile();
+
+private:
+    MappedFile(const MappedFile &);
+    MappedFile &operator=(const MappedFile &);
+};
+
+// Maps a file into memory for reading. Any previous mapping held by
+// the struct is released first. Returns true on success, false
+// otherwise (empty files cannot be mapped).
+bool mappedFileOpen(MappedFile *file, const std::string &filename);
+
+// Releases the mapping (if any)
+void mappedFileClose(MappedFile *file);
+
+} // namespace cg
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <cstddef>
+
+namespace cg {
+
+// Returns the number of threads to use for parallel loops
+inline std::size_t numWorkerThreads()
+{
+    std::size_t n = std::thread::hardware_concurrency();
+    return n > 0 ? n : 1;
+}
+
+// Splits [begin, end) into one contiguous range per worker thread and
+// calls fn(rangeBegin, rangeEnd) for each range in parallel. Ranges
+// are at least minRangeSize items long (except possibly the last one).
+// Returns when all ranges have been processed. The calling thread
+// processes one of the ranges itself.
+template<typename Function>
+void parallelFor(std::size_t begin, std::size_t end, Function fn, std::size_t minRangeSize = 1)
+{
+    if (end <= begin) {
+        return;
+    }
+    std::size_t n = end - begin;
+    minRangeSize = std::max<std::size_t>(minRangeSize, 1);
+    std::size_t numRanges = std::min(numWorkerThreads(), (n + minRangeSize - 1) / minRangeSize);
+    if (numRanges <= 1) {
+        fn(begin, end);
+        return;
+    }
+
+    std::vector<std::thread> threads;
+    threads.reserve(numRanges - 1);
+    std::size_t rangeSize = n / numRanges;
+    std::size_t remainder = n % numRanges;
+    std::size_t rangeBegin = begin;
+    for (std::size_t i = 0; i < numRanges; i++) {
+        std::size_t rangeEnd = rangeBegin + rangeSize + (i < remainder ? 1 : 0);
+        if (i + 1 < numRanges) {
+            threads.push_back(std::thread(fn, rangeBegin, rangeEnd));
+        }
+        else {
+            fn(rangeBegin, rangeEnd);
+        }
+        rangeBegin = rangeEnd;
+    }
+    for (auto it = threads.begin(); it != threads.end(); ++it) {
+        it->join();
+    }
+}
+
+} // namespace cg
@@ -0,0 +1,332 @@
+#include "cgParseASCII.h"
+#include "cgParallel.h"
+
+#include <vector>
+#include <sstream>
+#include <limits>
+#include <cmath>
+
+namespace {
+
+// Inputs smaller than this are parsed on the calling thread only
+const std::size_t minChunkSizeInBytes = 1 << 16;
+
+inline bool isSpace(char c)
+{
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\v' || c == '\f';
+}
+
+inline bool isDigit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+inline char toLower(char c)
+{
+    return (c >= 'A' && c <= 'Z') ? char(c - 'A' + 'a') : c;
+}
+
+// Case-insensitive comparison of token [begin, end) against a lower
+// case word
+bool tokenEquals(const char *begin, const char *end, const char *word)
+{
+    for (; begin != end && *word != '\0'; ++begin, ++word) {
+        if (toLower(*begin) != *word) {
+            return false;
+        }
+    }
+    return begin == end && *word == '\0';
+}
+
+// Parse an integer token in [minValue, maxValue]
+bool parseInteger(const char *begin, const char *end, long long minValue,
+                  long long maxValue, long long *value)
+{
+    bool negative = false;
+    if (begin != end && (*begin == '-' || *begin == '+')) {
+        negative = (*begin == '-');
+        ++begin;
+    }
+    if (begin == end) {
+        return false;
+    }
+    long long result = 0;
+    for (; begin != end; ++begin) {
+        if (!isDigit(*begin)) {
+            return false;
+        }
+        result = result * 10 + (*begin - '0');
+        if (result > maxValue + 1) {  // avoid overflow on long inputs
+            return false;
+        }
+    }
+    if (negative) {
+        result = -result;
+    }
+    if (result < minValue || result > maxValue) {
+        return false;
+    }
+    *value = result;
+    return true;
+}
+
+// Parse a floating point token (decimal or scientific notation, inf
+// or nan)
+bool parseFloat(const char *begin, const char *end, float *value)
+{
+    bool negative = false;
+    if (begin != end && (*begin == '-' || *begin == '+')) {
+        negative = (*begin == '-');
+        ++begin;
+    }
+    if (tokenEquals(begin, end, "inf") || tokenEquals(begin, end, "infinity")) {
+        *value = negative ? -std::numeric_limits<float>::infinity() :
+                            std::numeric_limits<float>::infinity();
+        return true;
+    }
+    if (tokenEquals(begin, end, "nan")) {
+        *value = std::numeric_limits<float>::quiet_NaN();
+        return true;
+    }
+
+    // Accumulate up to 19 significant digits in an integer mantissa and
+    // track the decimal exponent separately
+    unsigned long long mantissa = 0;
+    int numSignificant = 0;
+    int exponent = 0;
+    int numDigits = 0;
+    for (; begin != end && isDigit(*begin); ++begin, ++numDigits) {
+        if (numSignificant < 19) {
+            mantissa = mantissa * 10 + (*begin - '0');
+            numSignificant += (mantissa > 0) ? 1 : 0;
+        }
+        else {
+            exponent++;
+        }
+    }
+    if (begin != end && *begin == '.') {
+        for (++begin; begin != end && isDigit(*begin); ++begin, ++numDigits) {
+            if (numSignificant < 19) {
+                mantissa = mantissa * 10 + (*begin - '0');
+                numSignificant += (mantissa > 0) ? 1 : 0;
+                exponent--;
+            }
+        }
+    }
+    if (numDigits == 0) {
+        return false;
+    }
+    if (begin != end && (*begin == 'e' || *begin == 'E')) {
+        long long e = 0;
+        if (!parseInteger(begin + 1, end, -100000, 100000, &e)) {
+            return false;
+        }
+        exponent += int(e);
+        begin = end;
+    }
+    if (begin != end) {
+        return false;
+    }
+
+    static const double powersOf10[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    double result = double(mantissa);
+    if (mantissa != 0) {
+        if (exponent >= 0 && exponent <= 22) {
+            result *= powersOf10[exponent];
+        }
+        else if (exponent < 0 && exponent >= -22) {
+            result /= powersOf10[-exponent];
+        }
+        else {
+            result *= std::pow(10.0, double(exponent));
+        }
+    }
+    *value = float(negative ? -result : result);
+    return true;
+}
+
+// Parse one token of the given type and store it at voxels[index]
+template<typename T>
+bool parseIntegerToken(const char *begin, const char *end, std::uint8_t *voxels, std::size_t index)
+{
+    long long value = 0;
+    if (!parseInteger(begin, end, std::numeric_limits<T>::min(),
+                      std::numeric_limits<T>::max(), &value)) {
+        return false;
+    }
+    reinterpret_cast<T *>(voxels)[index] = static_cast<T>(value);
+    return true;
+}
+
+bool parseFloatToken(const char *begin, const char *end, std::uint8_t *voxels, std::size_t index)
+{
+    return parseFloat(begin, end, &reinterpret_cast<float *>(voxels)[index]);
+}
+
+typedef bool (*TokenParser)(const char *, const char *, std::uint8_t *, std::size_t);
+
+TokenParser tokenParserForDatatype(const std::string &datatype)
+{
+    if (datatype == "uint8") {
+        return parseIntegerToken<std::uint8_t>;
+    }
+    else if (datatype == "uint16") {
+        return parseIntegerToken<std::uint16_t>;
+    }
+    else if (datatype == "int16") {
+        return parseIntegerToken<std::int16_t>;
+    }
+    else if (datatype == "uint32") {
+        return parseIntegerToken<std::uint32_t>;
+    }
+    else if (datatype == "float32") {
+        return parseFloatToken;
+    }
+    return nullptr;
+}
+
+// Count whitespace-separated tokens in [begin, end)
+std::size_t countTokens(const char *begin, const char *end)
+{
+    std::size_t count = 0;
+    bool inToken = false;
+    for (; begin != end; ++begin) {
+        bool space = isSpace(*begin);
+        count += (!space && !inToken) ? 1 : 0;
+        inToken = !space;
+    }
+    return count;
+}
+
+// State of one chunk of the input
+struct Chunk {
+    const char *begin;
+    const char *end;
+    std::size_t numTokens;  // tokens in the chunk
+    std::size_t firstIndex;  // voxel index of the first token
+    const char *errorToken;  // first token that failed to parse (or null)
+    const char *errorTokenEnd;
+
+    Chunk() :
+        begin(nullptr),
+        end(nullptr),
+        numTokens(0),
+        firstIndex(0),
+        errorToken(nullptr),
+        errorTokenEnd(nullptr)
+    {}
+};
+
+// Parse the tokens of a chunk into their final voxel positions
+void parseChunk(Chunk *chunk, TokenParser parser, std::uint8_t *voxels, std::size_t numVoxels)
+{
+    std::size_t index = chunk->firstIndex;
+    const char *p = chunk->begin;
+    while (index < numVoxels) {
+        while (p != chunk->end && isSpace(*p)) {
+            ++p;
+        }
+        if (p == chunk->end) {
+            break;
+        }
+        const char *tokenBegin = p;
+        while (p != chunk->end && !isSpace(*p)) {
+            ++p;
+        }
+        if (!parser(tokenBegin, p, voxels, index)) {
+            chunk->errorToken = tokenBegin;
+            chunk->errorTokenEnd = p;
+            return;
+        }
+        index++;
+    }
+}
+
+} // namespace
+
+
+
+namespace cg {
+
+bool parseASCIIVoxels(const char *begin, const char *end, const std::string &datatype,
+                      std::uint8_t *voxels, std::size_t numVoxels,
+                      std::size_t baseOffset, std::string *errorMessage)
+{
+    TokenParser parser = tokenParserForDatatype(datatype);
+    if (parser == nullptr) {
+        if (errorMessage != nullptr) {
+            *errorMessage = "Unsupported data type " + datatype;
+        }
+        return false;
+    }
+
+    // Split the input into chunks that start and end on whitespace, so
+    // that no token straddles two chunks
+    std::size_t size = end - begin;
+    std::size_t numChunks = std::max<std::size_t>(1, std::min(numWorkerThreads() * 4,
+                                                              size / minChunkSizeInBytes));
+    std::vector<Chunk> chunks(numChunks);
+    const char *chunkBegin = begin;
+    for (std::size_t i = 0; i < numChunks; i++) {
+        const char *chunkEnd = end;
+        if (i + 1 < numChunks) {
+            chunkEnd = std::max(chunkBegin, begin + (size / numChunks) * (i + 1));
+            while (chunkEnd != end && !isSpace(*chunkEnd)) {
+                ++chunkEnd;
+            }
+        }
+        chunks[i].begin = chunkBegin;
+        chunks[i].end = chunkEnd;
+        chunkBegin = chunkEnd;
+    }
+
+    // First pass: count tokens per chunk to find where each chunk's
+    // values go in the output
+    parallelFor(0, numChunks, [&](std::size_t first, std::size_t last) {
+        for (std::size_t i = first; i < last; i++) {
+            chunks[i].numTokens = countTokens(chunks[i].begin, chunks[i].end);
+        }
+    });
+    std::size_t numTokens = 0;
+    for (std::size_t i = 0; i < numChunks; i++) {
+        chunks[i].firstIndex = numTokens;
+        numTokens += chunks[i].numTokens;
+    }
+    if (numTokens < numVoxels) {
+        if (errorMessage != nullptr) {
+            std::ostringstream ss;
+            ss << "Expected " << numVoxels << " values, but found only " << numTokens
+               << " (data ends at byte offset " << baseOffset + size << ")";
+            *errorMessage = ss.str();
+        }
+        return false;
+    }
+
+    // Second pass: parse the chunks that contain wanted values
+    parallelFor(0, numChunks, [&](std::size_t first, std::size_t last) {
+        for (std::size_t i = first; i < last; i++) {
+            if (chunks[i].firstIndex < numVoxels) {
+                parseChunk(&chunks[i], parser, voxels, numVoxels);
+            }
+        }
+    });
+    for (std::size_t i = 0; i < numChunks; i++) {
+        if (chunks[i].errorToken != nullptr) {
+            if (errorMessage != nullptr) {
+                std::ostringstream ss;
+                ss << "Invalid " << datatype << " value '"
+                   << std::string(chunks[i].errorToken, chunks[i].errorTokenEnd)
+                   << "' at byte offset " << baseOffset + (chunks[i].errorToken - begin);
+                *errorMessage = ss.str();
+            }
+            return false;
+        }
+    }
+
+    return true;
+}
+
+} // namespace cg
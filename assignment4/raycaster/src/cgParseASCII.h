@@ -0,0 +1,24 @@
+#pragma once
+
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+namespace cg {
+
+// Parses whitespace-separated ASCII numbers from the character range
+// [begin, end) into voxels, which must have room for numVoxels values
+// of the given data type ("uint8", "uint16", "int16", "uint32" or
+// "float32"). The range is split into chunks on whitespace boundaries
+// that are parsed on all worker threads; values are written directly
+// to their final position. Numbers are parsed independently of the
+// current locale. Tokens after the first numVoxels values are ignored.
+//
+// Returns true on success. On failure, errorMessage (if not null)
+// describes the problem, including the byte offset of the offending
+// token relative to baseOffset (e.g., the offset of begin in the file).
+bool parseASCIIVoxels(const char *begin, const char *end, const std::string &datatype,
+                      std::uint8_t *voxels, std::size_t numVoxels,
+                      std::size_t baseOffset = 0, std::string *errorMessage = nullptr);
+
+} // namespace cg
@@ -1,7 +1,12 @@
 #include "cgVolume.h"
+#include "cgMappedFile.h"
+#include "cgParseASCII.h"
+#include "cgVolumeConvert.h"
 
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <iterator>
 #include <cstdio>
 #include <cstring>
 
@@ -24,19 +29,13 @@ struct VTKHeader {
     {}
 };
 
-// Check if file is a valid VTK file
-bool isVTKFile(const std::string &filename)
+// Check if the first header line identifies a VTK file
+bool isVTKHeaderLine(const std::string &line)
 {
-    std::ifstream f(filename, std::ios::binary);
-    if (!f.is_open()) {
-        std::cerr << "Could not open " << filename << std::endl;
-        return false;
-    }
-
+    std::istringstream ss(line);
     std::string checkvtk;
-    f >> checkvtk; // #
-    f >> checkvtk; // vtk
-    f.close();
+    ss >> checkvtk; // #
+    ss >> checkvtk; // vtk
     if (!(checkvtk == "vtk" || checkvtk == "VTK")) {
         return false;
     }
@@ -148,85 +147,99 @@ bool isLittleEndian()
     return data.c[0] == 1;
 }
 
-// Swap byte order of 2-byte element
-void swap2Bytes(unsigned char* &ptr)
+// Number of voxels described by the header
+std::size_t numElements(const VTKHeader &header)
 {
-    unsigned char tmp;
-    tmp = ptr[0]; ptr[0] = ptr[1]; ptr[1] = tmp;
+    return std::size_t(header.dimensions[0]) * std::size_t(header.dimensions[1]) *
+           std::size_t(header.dimensions[2]);
 }
 
-// Swap byte order of 4-byte element
-void swap4Bytes(unsigned char* &ptr)
+// Convert n elements of the file's data type from src into
+// volume->data in parallel over slices. The byte order is swapped if
+// needed, and if datatype is not empty, the values are converted to that
+// type (optionally mapping their range to the full range of the type if
+// the type changes).
+// src may point to volume->data when no type conversion is requested.
+bool convertData(const std::uint8_t *src, bool swap, const VTKHeader &header,
+                 const std::string &datatype, bool normalize, cg::VolumeBase *volume)
 {
-    unsigned char tmp;
-    tmp = ptr[0]; ptr[0] = ptr[3]; ptr[3] = tmp;
-    tmp = ptr[1]; ptr[1] = ptr[2]; ptr[2] = tmp;
-}
-
-// Swap byte order of image data elements
-template<typename T>
-void swapByteOrder(std::vector<T> *imageData)
-{
-    int numElements = imageData->size();
-    int elementSizeInBytes = sizeof(T);
-    unsigned char *elementPointer = reinterpret_cast<unsigned char *>(&(*imageData)[0]);
-    switch (elementSizeInBytes) {
-    case 2: // uint16, int16
-        for (int i = 0; i < numElements; i++, elementPointer += elementSizeInBytes) {
-            swap2Bytes(elementPointer);
-        }
-        break;
-    case 4: // uint32, float32
-        for (int i = 0; i < numElements; i++, elementPointer += elementSizeInBytes) {
-            swap4Bytes(elementPointer);
-        }
-        break;
-    default:
-        break;
+    std::size_t n = numElements(header);
+    cg::VoxelConversion conversion;
+    conversion.srcDatatype = header.datatype;
+    conversion.dstDatatype = datatype.empty() ? header.datatype : datatype;
+    conversion.swapBytes = swap;
+    std::size_t dstSize = cg::voxelSizeInBytes(conversion.dstDatatype);
+    if (dstSize == 0) {
+        std::cerr << "Unsupported data type " << datatype << std::endl;
+        return false;
     }
-}
-
-// Read image data in binary format
-template<typename T>
-void readVTKBinary(std::ifstream &is, std::vector<T> *imageData, int n)
-{
-    if (isLittleEndian()) {
-        is.read(reinterpret_cast<char *>(&(*imageData)[0]), sizeof(T) * n);
-        swapByteOrder(imageData);
+    if (conversion.dstDatatype != header.datatype && normalize) {
+        float minValue, maxValue;
+        cg::voxelValueRange(header.datatype, swap, src, n, &minValue, &maxValue);
+        cg::voxelConversionNormalize(&conversion, minValue, maxValue);
     }
-    else {
-        is.read(reinterpret_cast<char *>(&(*imageData)[0]), sizeof(T) * n);
+
+    if (src != volume->data.data()) {
+        volume->data.resize(n * dstSize);
     }
+    std::size_t sliceLength = std::size_t(header.dimensions.x) * std::size_t(header.dimensions.y);
+    return cg::convertVoxelsParallel(conversion, &volume->data[0], src, n, sliceLength);
 }
 
-// Read image data in ASCII format
-template<typename T>
-void readVTKASCII(std::ifstream &is, std::vector<T> *imageData, int n)
+// Read image data in ASCII format from a memory range into a raw
+// buffer of the header's data type. The values are parsed in parallel.
+bool readASCIIData(const char *begin, const char *end, std::size_t fileOffset,
+                   const VTKHeader &header, std::uint8_t *imageData, std::size_t numElements,
+                   const std::string &filename)
 {
-    T value;
-    for(int i = 0; i < n; i++) {
-        is >> value;
-        imageData->push_back(value);
+    std::string errorMessage;
+    if (!cg::parseASCIIVoxels(begin, end, header.datatype, imageData, numElements,
+                              fileOffset, &errorMessage)) {
+        std::cerr << "Could not read " << filename << ": " << errorMessage << std::endl;
+        return false;
     }
+    return true;
 }
 
-// Read the header part (the first ten lines) of the file
-bool readHeader(const std::string filename, VTKHeader *header)
+// Check and extract header information from the header strings
+bool extractHeader(const std::vector<std::string> &headerLines, VTKHeader *header)
 {
-    std::ifstream VTKFile(filename, std::ios::binary);
-    if (!VTKFile.is_open()) {
-        std::cerr << "Could not open " << filename << std::endl;
+    if (headerLines.empty() || !isVTKHeaderLine(headerLines[0])) {
+        return false;
+    }
+    if (!extractFormat(headerLines, header)) {
+        return false;
+    }
+    if (!extractDimensions(headerLines, header)) {
+        return false;
+    }
+    if (!extractOrigin(headerLines, header)) {
+        return false;
+    }
+    if (!extractSpacing(headerLines, header)) {
         return false;
     }
+    if (!extractDataType(headerLines, header)) {
+        return false;
+    }
+    if (header->dimensions.x <= 0 || header->dimensions.y <= 0 || header->dimensions.z <= 0) {
+        return false;
+    }
+
+    return true;
+}
 
-    // Read header
-    int numHeaderLines = 10;
+// Number of header lines before the data section
+const int numHeaderLines = 10;
+
+// Read the header part (the first ten lines) from a stream
+bool readHeader(std::istream &is, VTKHeader *header)
+{
     std::vector<std::string> headerLines;
     for (int i = 0; i < numHeaderLines; i++) {
         std::string line;
-        std::getline(VTKFile, line);
+        std::getline(is, line);
         if (line.empty()) {
-            VTKFile.close();
             return false;
         }
         else {
@@ -234,60 +247,135 @@ bool readHeader(const std::string filename, VTKHeader *header)
         }
     }
 
-    // Extract header information
-    if (!extractFormat(headerLines, header)) {
-        return false;
+    return extractHeader(headerLines, header);
+}
+
+// Parse the header part (the first ten lines) from a memory buffer.
+// On success, dataOffset is set to the first byte after the header.
+bool parseHeader(const std::uint8_t *buffer, std::size_t size, VTKHeader *header,
+                 std::size_t *dataOffset)
+{
+    std::vector<std::string> headerLines;
+    std::size_t pos = 0;
+    for (int i = 0; i < numHeaderLines; i++) {
+        const void *lineEnd = std::memchr(buffer + pos, '\n', size - pos);
+        if (lineEnd == nullptr) {
+            return false;
+        }
+        std::size_t lineLength = static_cast<const std::uint8_t *>(lineEnd) - (buffer + pos);
+        if (lineLength == 0) {
+            return false;
+        }
+        headerLines.push_back(std::string(reinterpret_cast<const char *>(buffer + pos), lineLength));
+        pos += lineLength + 1;
     }
-    if (!extractDimensions(headerLines, header)) {
+
+    if (!extractHeader(headerLines, header)) {
         return false;
     }
-    if (!extractOrigin(headerLines, header)) {
+    *dataOffset = pos;
+    return true;
+}
+
+// Copy header information into the volume
+void applyHeader(const VTKHeader &header, const std::string &datatype, cg::VolumeBase *volume)
+{
+    volume->dimensions = header.dimensions;
+    volume->origin = header.origin;
+    volume->spacing = header.spacing;
+    volume->datatype = datatype.empty() ? header.datatype : datatype;
+}
+
+// Read a VTK file that has been mapped into memory. Binary data is
+// byte-swapped and converted straight into the volume's buffer.
+bool loadMappedVTK(cg::VolumeBase *volume, const cg::MappedFile &file, const std::string &filename,
+                   const std::string &datatype, bool normalize)
+{
+    VTKHeader header;
+    std::size_t dataOffset = 0;
+    if (!parseHeader(file.data, file.size, &header, &dataOffset)) {
         return false;
     }
-    if (!extractSpacing(headerLines, header)) {
-        return false;
+
+    std::size_t n = numElements(header);
+    std::size_t nBytes = n * cg::datatypeSizeInBytes(header.datatype);
+    if (header.binary) {
+        if (file.size - dataOffset < nBytes) {
+            std::cerr << "Unexpected end of data in " << filename << std::endl;
+            return false;
+        }
+        if (!convertData(file.data + dataOffset, isLittleEndian(), header, datatype, normalize, volume)) {
+            return false;
+        }
     }
-    if (!extractDataType(headerLines, header)) {
-        return false;
+    else {
+        std::vector<std::uint8_t> imageData(nBytes);
+        const char *text = reinterpret_cast<const char *>(file.data);
+        if (!readASCIIData(text + dataOffset, text + file.size, dataOffset, header,
+                           &imageData[0], n, filename)) {
+            return false;
+        }
+        if (datatype.empty()) {
+            volume->data.swap(imageData);
+        }
+        else if (!convertData(&imageData[0], false, header, datatype, normalize, volume)) {
+            return false;
+        }
     }
 
+    applyHeader(header, datatype, volume);
     return true;
 }
 
-// Read the data part of the file
-template<typename VoxelType>
-bool readData(const std::string filename, const VTKHeader &header, std::vector<VoxelType> *imageData)
+// Read a VTK file through a file stream. Used when the file cannot be
+// memory mapped; a file that cannot be opened at all has already been
+// reported by mappedFileOpen().
+bool loadStreamVTK(cg::VolumeBase *volume, const std::string &filename,
+                   const std::string &datatype, bool normalize)
 {
     std::ifstream VTKFile(filename, std::ios::binary);
     if (!VTKFile.is_open()) {
-        std::cerr << "Could not open " << filename << std::endl;
         return false;
     }
 
-    // Jump to data
-    int numHeaderLines = 10;
-    for (int i = 0; i < numHeaderLines; i++) {
-        std::string line;
-        std::getline(VTKFile, line);
-        if (line.empty()) {
-            VTKFile.close();
-            return false;
-        }
+    VTKHeader header;
+    if (!readHeader(VTKFile, &header)) {
+        return false;
     }
 
-    // Read data
-    glm::ivec3 dimensions = header.dimensions;
-    int numElements = dimensions[0] * dimensions[1] * dimensions[2];
-    imageData->clear();
-    imageData->reserve(numElements);
+    std::size_t n = numElements(header);
+    std::size_t nBytes = n * cg::datatypeSizeInBytes(header.datatype);
+    std::vector<std::uint8_t> imageData(nBytes);
     if (header.binary) {
-        imageData->resize(numElements);
-        readVTKBinary(VTKFile, imageData, numElements);
+        VTKFile.read(reinterpret_cast<char *>(&imageData[0]), nBytes);
+        if (std::size_t(VTKFile.gcount()) != nBytes) {
+            std::cerr << "Unexpected end of data in " << filename << std::endl;
+            return false;
+        }
     }
     else {
-        readVTKASCII(VTKFile, imageData, numElements);
+        std::size_t dataOffset = std::size_t(VTKFile.tellg());
+        std::vector<char> text((std::istreambuf_iterator<char>(VTKFile)),
+                               std::istreambuf_iterator<char>());
+        if (text.empty() || !readASCIIData(&text[0], &text[0] + text.size(), dataOffset,
+                                           header, &imageData[0], n, filename)) {
+            return false;
+        }
+    }
+
+    // Without type conversion, the data is swapped in place
+    bool swap = header.binary && isLittleEndian();
+    if (datatype.empty()) {
+        volume->data.swap(imageData);
+        if (swap && !convertData(&volume->data[0], swap, header, datatype, normalize, volume)) {
+            return false;
+        }
+    }
+    else if (!convertData(&imageData[0], swap, header, datatype, normalize, volume)) {
+        return false;
     }
 
+    applyHeader(header, datatype, volume);
     return true;
 }
 
@@ -313,73 +401,46 @@ namespace cg {
 // SCALARS image_data unsigned_char\n
 // LOOKUP_TABLE default\n
 // raw data........\n
-bool volumeLoadVTK(VolumeBase *volume, const std::string &filename)
+//
+// The file is memory mapped and only read once; the data is converted
+// directly into volume->data. If the file cannot be mapped, it is read
+// through a file stream instead.
+bool volumeLoadVTK(VolumeBase *volume, const std::string &filename,
+                   const std::string &datatype, bool normalize)
 {
-    if (!isVTKFile(filename)) {
-        return false;
+    MappedFile file;
+    if (mappedFileOpen(&file, filename)) {
+        return loadMappedVTK(volume, file, filename, datatype, normalize);
     }
+    return loadStreamVTK(volume, filename, datatype, normalize);
+}
 
-    // Read header
-    VTKHeader header;
-    if (!readHeader(filename, &header)) {
+// Read the header through a stream, so that files of any size can be
+// inspected
+bool volumeReadVTKInfo(VTKFileInfo *info, const std::string &filename)
+{
+    std::ifstream is(filename.c_str(), std::ios::binary);
+    if (!is.is_open()) {
+        std::cerr << "Could not open " << filename << std::endl;
         return false;
     }
 
-    // Read data
-    if (header.datatype == "uint8") {
-        std::vector<uint8_t> imageData;
-        if (!readData(filename, header, &imageData)) {
-            return false;
-        }
-        size_t nBytes = imageData.size() * sizeof(imageData[0]);
-        volume->data.resize(nBytes);
-        std::memcpy(&volume->data[0], &imageData[0], nBytes);
-    }
-    else if (header.datatype == "uint16") {
-        std::vector<uint16_t> imageData;
-        if (!readData(filename, header, &imageData)) {
-            return false;
-        }
-        size_t nBytes = imageData.size() * sizeof(imageData[0]);
-        volume->data.resize(nBytes);
-        std::memcpy(&volume->data[0], &imageData[0], nBytes);
-    }
-    else if (header.datatype == "int16") {
-        std::vector<int16_t> imageData;
-        if (!readData(filename, header, &imageData)) {
-            return false;
-        }
-        size_t nBytes = imageData.size() * sizeof(imageData[0]);
-        volume->data.resize(nBytes);
-        std::memcpy(&volume->data[0], &imageData[0], nBytes);
-    }
-    else if (header.datatype == "uint32") {
-        std::vector<uint32_t> imageData;
-        if (!readData(filename, header, &imageData)) {
-            return false;
-        }
-        size_t nBytes = imageData.size() * sizeof(imageData[0]);
-        volume->data.resize(nBytes);
-        std::memcpy(&volume->data[0], &imageData[0], nBytes);
-    }
-    else if (header.datatype == "float32") {
-        std::vector<float> imageData;
-        if (!readData(filename, header, &imageData)) {
-            return false;
-        }
-        size_t nBytes = imageData.size() * sizeof(imageData[0]);
-        volume->data.resize(nBytes);
-        std::memcpy(&volume->data[0], &imageData[0], nBytes);
+    VTKHeader header;
+    if (!readHeader(is, &header)) {
+        return false;
     }
-    else {
+    std::streamoff dataOffset = is.tellg();
+    if (dataOffset < 0) {
         return false;
     }
 
-    volume->dimensions = header.dimensions;
-    volume->origin = header.origin;
-    volume->spacing = header.spacing;
-    volume->datatype = header.datatype;
-
+    info->dimensions = header.dimensions;
+    info->origin = header.origin;
+    info->spacing = header.spacing;
+    info->datatype = header.datatype;
+    info->binary = header.binary;
+    info->swapBytes = datatypeSizeInBytes(header.datatype) > 1 && isLittleEndian();
+    info->dataOffset = std::uint64_t(dataOffset);
     return true;
 }
 
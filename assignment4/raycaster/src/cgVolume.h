@@ -3,6 +3,8 @@
 #include <vector>
 #include <string>
 #include <cstdint>
+#include <cstddef>
+#include <utility>
 
 #define GLM_FORCE_RADIANS
 #include <glm/glm.hpp>
@@ -10,23 +12,69 @@
 
 namespace cg {
 
-// Base struct for volume images
+// Base struct for volume images. Volumes can be moved but not copied,
+// so that voxel data is never duplicated by accident; use volumeCopy()
+// where a copy is really needed.
 struct VolumeBase {
     glm::ivec3 dimensions;  // volume dimensions
     glm::vec3 origin;  // volume origin
     glm::vec3 spacing;  // voxel spacing
     std::string datatype;  // voxel data type string
     std::vector<std::uint8_t> data;  // voxel data
+
+    VolumeBase() {}
+    VolumeBase(VolumeBase &&other);
+    VolumeBase &operator=(VolumeBase &&other);
+
+private:
+    VolumeBase(const VolumeBase &);
+    VolumeBase &operator=(const VolumeBase &);
+};
+
+// Struct for the header information of a VTK file, used to read its
+// voxel data piecewise
+struct VTKFileInfo {
+    glm::ivec3 dimensions;  // volume dimensions
+    glm::vec3 origin;  // volume origin
+    glm::vec3 spacing;  // voxel spacing
+    std::string datatype;  // voxel data type string
+    bool binary;  // data section is binary (otherwise ASCII)
+    bool swapBytes;  // binary voxels must be byte swapped on this host
+    std::uint64_t dataOffset;  // file offset of the first voxel
+
+    VTKFileInfo() :
+        binary(true),
+        swapBytes(false),
+        dataOffset(0)
+    {}
 };
 
-// Template struct for typed volume images
+// Order of the voxels of a volume image in memory
+enum VoxelLayout {
+    LAYOUT_LINEAR = 0,  // x-fastest, then y, then z
+    LAYOUT_BRICKED = 1  // 8^3 bricks in x-fastest order, Z-order (Morton order)
+                        // within each brick; padded to whole bricks
+};
+
+// Edge length of the bricks of LAYOUT_BRICKED (a power of two)
+const int layoutBrickSize = 8;
+
+// Template struct for typed volume images. Voxels are accessed through
+// the layout; see cgVolumeLayout.h for converting between layouts,
+// iterating, and neighborhood access.
 template <typename VoxelType>
 struct Volume {
     VolumeBase base;
+    VoxelLayout layout;  // order of base.data (only LAYOUT_LINEAR is uploaded as is)
     typedef VoxelType voxel_type;
 
+    Volume() :
+        layout(LAYOUT_LINEAR)
+    {}
+
     // Overridden operator for element access (no bounds checking!)
     VoxelType &operator()(int x, int y, int z);
+    const VoxelType &operator()(int x, int y, int z) const;
 };
 
 // Typed volume images
@@ -38,13 +86,113 @@ typedef Volume<float> VolumeFloat32;
 
 
 
+inline VolumeBase::VolumeBase(VolumeBase &&other) :
+    dimensions(other.dimensions),
+    origin(other.origin),
+    spacing(other.spacing),
+    datatype(std::move(other.datatype)),
+    data(std::move(other.data))
+{}
+
+inline VolumeBase &VolumeBase::operator=(VolumeBase &&other)
+{
+    dimensions = other.dimensions;
+    origin = other.origin;
+    spacing = other.spacing;
+    datatype = std::move(other.datatype);
+    data = std::move(other.data);
+    return *this;
+}
+
+// Copies a volume image, header and voxels
+inline void volumeCopy(const VolumeBase &src, VolumeBase *dst)
+{
+    dst->dimensions = src.dimensions;
+    dst->origin = src.origin;
+    dst->spacing = src.spacing;
+    dst->datatype = src.datatype;
+    dst->data = src.data;
+}
+
+// Returns the number of voxels of the volume image
+inline std::size_t volumeNumVoxels(const VolumeBase &volume)
+{
+    return std::size_t(volume.dimensions.x) * std::size_t(volume.dimensions.y) *
+           std::size_t(volume.dimensions.z);
+}
+
+// Returns the linear index of voxel (x, y, z). Computed in 64 bits, so
+// that volumes with more than 2^31 voxels can be addressed.
+inline std::size_t volumeVoxelIndex(const VolumeBase &volume, int x, int y, int z)
+{
+    return (std::size_t(z) * std::size_t(volume.dimensions.y) + std::size_t(y)) *
+           std::size_t(volume.dimensions.x) + std::size_t(x);
+}
+
+// Spreads the three lowest bits of v to bits 0, 3 and 6
+inline std::size_t mortonSpread3(int v)
+{
+    return std::size_t((v & 1) | ((v & 2) << 2) | ((v & 4) << 4));
+}
+
+// Returns the number of voxels stored for a volume of the given
+// dimensions in the given layout (including padding)
+inline std::size_t volumeLayoutNumVoxels(const glm::ivec3 &dimensions, VoxelLayout layout)
+{
+    if (layout == LAYOUT_LINEAR) {
+        return std::size_t(dimensions.x) * std::size_t(dimensions.y) * std::size_t(dimensions.z);
+    }
+    glm::ivec3 numBricks = (dimensions + glm::ivec3(layoutBrickSize - 1)) / layoutBrickSize;
+    return std::size_t(numBricks.x) * std::size_t(numBricks.y) * std::size_t(numBricks.z) *
+           layoutBrickSize * layoutBrickSize * layoutBrickSize;
+}
+
+// Returns the index of voxel (x, y, z) in the given layout
+inline std::size_t volumeLayoutIndex(const glm::ivec3 &dimensions, VoxelLayout layout,
+                                     int x, int y, int z)
+{
+    if (layout == LAYOUT_LINEAR) {
+        return (std::size_t(z) * std::size_t(dimensions.y) + std::size_t(y)) *
+               std::size_t(dimensions.x) + std::size_t(x);
+    }
+    std::size_t numBricksX = std::size_t(dimensions.x + layoutBrickSize - 1) / layoutBrickSize;
+    std::size_t numBricksY = std::size_t(dimensions.y + layoutBrickSize - 1) / layoutBrickSize;
+    std::size_t brick = (std::size_t(z / layoutBrickSize) * numBricksY + std::size_t(y / layoutBrickSize)) *
+                        numBricksX + std::size_t(x / layoutBrickSize);
+    return brick * (layoutBrickSize * layoutBrickSize * layoutBrickSize) +
+           (mortonSpread3(x) | (mortonSpread3(y) << 1) | (mortonSpread3(z) << 2));
+}
+
 // Overridden operator for element access (no bounds checking!)
 template<typename VoxelType>
 inline VoxelType &Volume<VoxelType>::operator()(int x, int y, int z)
 {
-    int index = (base.dimensions.x * base.dimensions.y * z) +
-                (base.dimensions.x * y) + x;
-    return reinterpret_cast<VoxelType *>(&base.data[0])[index];
+    return reinterpret_cast<VoxelType *>(&base.data[0])[
+        volumeLayoutIndex(base.dimensions, layout, x, y, z)];
+}
+
+// Overridden operator for element access (no bounds checking!)
+template<typename VoxelType>
+inline const VoxelType &Volume<VoxelType>::operator()(int x, int y, int z) const
+{
+    return reinterpret_cast<const VoxelType *>(&base.data[0])[
+        volumeLayoutIndex(base.dimensions, layout, x, y, z)];
+}
+
+// Returns the size in bytes of one voxel of the given data type, or
+// zero if the data type is not supported
+inline std::size_t datatypeSizeInBytes(const std::string &datatype)
+{
+    if (datatype == "uint8") {
+        return 1;
+    }
+    else if (datatype == "uint16" || datatype == "int16") {
+        return 2;
+    }
+    else if (datatype == "uint32" || datatype == "float32") {
+        return 4;
+    }
+    return 0;
 }
 
 // Computes the extent (dimensions*spacing) of the volume image
@@ -81,6 +229,18 @@ inline glm::mat4 volumeComputeModelMatrix(const VolumeBase &volume)
 // SCALARS image_data unsigned_char\n
 // LOOKUP_TABLE default\n
 // raw data........\n
-bool volumeLoadVTK(VolumeBase *volume, const std::string &filename);
+//
+// The file is memory mapped and read in a single pass, converting the
+// data directly into volume->data. If datatype is not empty, voxels are
+// converted to that type ("uint8", "uint16", "float16", ...) in the
+// same pass; with normalize set, the value range of the file is mapped
+// to the full range of the target type ([0, 1] for floating point) when
+// the file's data type differs from it, otherwise values are clamped.
+bool volumeLoadVTK(VolumeBase *volume, const std::string &filename,
+                   const std::string &datatype = "", bool normalize = true);
+
+// Reads only the header of a VTK file (see volumeLoadVTK()) and
+// locates its data section. Returns true on success, false otherwise.
+bool volumeReadVTKInfo(VTKFileInfo *info, const std::string &filename);
 
 } // namespace cg
@@ -0,0 +1,427 @@
+#include "cgVolumeCache.h"
+#include "cgVolumeConvert.h"
+#include "cgParallel.h"
+
+#include <iostream>
+#include <fstream>
+#include <limits>
+#include <algorithm>
+#include <sstream>
+#include <thread>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+#include <sys/stat.h>
+
+namespace {
+
+// File layout (native byte order):
+//
+// CGVolFileHeader
+// CGVolLevelHeader[numLevels]
+// std::uint64_t histogram[numHistogramBins]
+// float brickMinMax[2 * numBricks] (for each level)
+// brick data (for each level, aligned to dataAlignment)
+
+const char cgvolMagic[8] = { 'C', 'G', 'V', 'O', 'L', '\r', '\n', '\x1a' };
+const std::uint32_t cgvolVersion = 1;
+const std::uint32_t byteOrderMark = 0x01020304;
+const std::uint64_t dataAlignment = 4096;
+const int maxNumLevels = 32;
+
+struct CGVolFileHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t byteOrderMark;
+    std::int32_t dimensions[3];
+    float origin[3];
+    float spacing[3];
+    char datatype[16];
+    std::int32_t brickSize;
+    std::int32_t numLevels;
+    std::int32_t numHistogramBins;
+    float minValue;
+    float maxValue;
+    std::uint64_t histogramOffset;
+    std::uint64_t levelsOffset;
+};
+
+struct CGVolLevelHeader {
+    std::int32_t dimensions[3];
+    std::int32_t numBricks[3];
+    std::uint64_t brickMinMaxOffset;
+    std::uint64_t brickDataOffset;
+};
+
+std::uint64_t alignOffset(std::uint64_t offset)
+{
+    return (offset + dataAlignment - 1) / dataAlignment * dataAlignment;
+}
+
+std::size_t numVoxels(const glm::ivec3 &dimensions)
+{
+    return std::size_t(dimensions.x) * std::size_t(dimensions.y) * std::size_t(dimensions.z);
+}
+
+// Downsample a volume by two along each axis by averaging 2x2x2 voxel
+// blocks (odd dimensions are rounded up and the last voxel repeated).
+// Output slices are computed in parallel.
+void downsampleLevel(const cg::VolumeBase &src, cg::VolumeBase *dst)
+{
+    glm::ivec3 srcDims = src.dimensions;
+    glm::ivec3 dstDims = (srcDims + glm::ivec3(1)) / 2;
+    std::size_t elementSize = cg::datatypeSizeInBytes(src.datatype);
+    dst->dimensions = dstDims;
+    dst->origin = src.origin;
+    dst->spacing = src.spacing * glm::vec3(srcDims) / glm::vec3(dstDims);
+    dst->datatype = src.datatype;
+    dst->data.resize(numVoxels(dstDims) * elementSize);
+
+    cg::VoxelConversion toDatatype;
+    toDatatype.srcDatatype = "float32";
+    toDatatype.dstDatatype = src.datatype;
+
+    std::size_t srcSliceSize = std::size_t(srcDims.x) * srcDims.y;
+    std::size_t dstSliceSize = std::size_t(dstDims.x) * dstDims.y;
+    cg::parallelFor(0, dstDims.z, [&](std::size_t first, std::size_t last) {
+        std::vector<float> slice0(srcSliceSize), slice1(srcSliceSize), out(dstSliceSize);
+        for (std::size_t z = first; z < last; z++) {
+            std::size_t z0 = 2 * z;
+            std::size_t z1 = std::min<std::size_t>(2 * z + 1, srcDims.z - 1);
+            cg::voxelsToFloat(src.datatype, &src.data[z0 * srcSliceSize * elementSize],
+                              srcSliceSize, &slice0[0]);
+            cg::voxelsToFloat(src.datatype, &src.data[z1 * srcSliceSize * elementSize],
+                              srcSliceSize, &slice1[0]);
+            for (int y = 0; y < dstDims.y; y++) {
+                std::size_t row0 = std::size_t(2 * y) * srcDims.x;
+                std::size_t row1 = std::size_t(std::min(2 * y + 1, srcDims.y - 1)) * srcDims.x;
+                for (int x = 0; x < dstDims.x; x++) {
+                    int x0 = 2 * x;
+                    int x1 = std::min(2 * x + 1, srcDims.x - 1);
+                    float sum = slice0[row0 + x0] + slice0[row0 + x1] +
+                                slice0[row1 + x0] + slice0[row1 + x1] +
+                                slice1[row0 + x0] + slice1[row0 + x1] +
+                                slice1[row1 + x0] + slice1[row1 + x1];
+                    out[std::size_t(y) * dstDims.x + x] = 0.125f * sum;
+                }
+            }
+            cg::convertVoxels(toDatatype, &dst->data[z * dstSliceSize * elementSize],
+                              reinterpret_cast<const std::uint8_t *>(&out[0]), dstSliceSize);
+        }
+    });
+}
+
+// Write the bricks of one level to the stream, one layer of bricks at a
+// time, and compute their min/max values
+bool writeLevelBricks(std::ofstream &os, const cg::VolumeBase &volume, const cg::BrickGrid &grid,
+                      std::vector<float> *brickMinMax)
+{
+    std::size_t brickVoxels = std::size_t(grid.brickSize) * grid.brickSize * grid.brickSize;
+    std::size_t brickBytes = brickVoxels * cg::datatypeSizeInBytes(volume.datatype);
+    std::size_t bricksPerLayer = std::size_t(grid.numBricks.x) * grid.numBricks.y;
+    brickMinMax->resize(2 * cg::brickGridNumBricks(grid));
+    std::vector<std::uint8_t> layer(bricksPerLayer * brickBytes);
+    for (int bz = 0; bz < grid.numBricks.z; bz++) {
+        cg::parallelFor(0, bricksPerLayer, [&](std::size_t first, std::size_t last) {
+            std::vector<float> values(brickVoxels);
+            for (std::size_t i = first; i < last; i++) {
+                glm::ivec3 brick(int(i % grid.numBricks.x), int(i / grid.numBricks.x), bz);
+                std::uint8_t *dst = &layer[i * brickBytes];
+                cg::volumeCopyBrick(volume, grid, brick, dst);
+                cg::voxelsToFloat(volume.datatype, dst, brickVoxels, &values[0]);
+                float mn = std::numeric_limits<float>::infinity();
+                float mx = -std::numeric_limits<float>::infinity();
+                for (std::size_t j = 0; j < brickVoxels; j++) {
+                    mn = values[j] < mn ? values[j] : mn;
+                    mx = values[j] > mx ? values[j] : mx;
+                }
+                std::size_t index = cg::brickGridIndex(grid, brick);
+                (*brickMinMax)[2 * index] = mn;
+                (*brickMinMax)[2 * index + 1] = mx;
+            }
+        });
+        os.write(reinterpret_cast<const char *>(&layer[0]), layer.size());
+    }
+    return bool(os);
+}
+
+} // namespace
+
+
+
+namespace cg {
+
+bool volumeSaveCGVol(const VolumeBase &volume, const std::string &filename,
+                     int brickSize, int numLevels, int numHistogramBins)
+{
+    std::size_t elementSize = datatypeSizeInBytes(volume.datatype);
+    if (elementSize == 0 || brickSize <= 0 || numHistogramBins <= 0 ||
+        volume.data.size() < numVoxels(volume.dimensions) * elementSize) {
+        return false;
+    }
+
+    // Determine the resolution levels
+    std::vector<BrickGrid> grids;
+    glm::ivec3 dims = volume.dimensions;
+    grids.push_back(brickGridCreate(dims, brickSize));
+    while (int(grids.size()) < (numLevels > 0 ? numLevels : maxNumLevels) &&
+           (numLevels > 0 || glm::max(glm::max(dims.x, dims.y), dims.z) > brickSize) &&
+           glm::max(glm::max(dims.x, dims.y), dims.z) > 1) {
+        dims = (dims + glm::ivec3(1)) / 2;
+        grids.push_back(brickGridCreate(dims, brickSize));
+    }
+
+    // Lay out the file
+    CGVolFileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, cgvolMagic, sizeof(header.magic));
+    header.version = cgvolVersion;
+    header.byteOrderMark = byteOrderMark;
+    for (int i = 0; i < 3; i++) {
+        header.dimensions[i] = volume.dimensions[i];
+        header.origin[i] = volume.origin[i];
+        header.spacing[i] = volume.spacing[i];
+    }
+    std::strncpy(header.datatype, volume.datatype.c_str(), sizeof(header.datatype) - 1);
+    header.brickSize = brickSize;
+    header.numLevels = int(grids.size());
+    header.numHistogramBins = numHistogramBins;
+    header.levelsOffset = sizeof(CGVolFileHeader);
+    header.histogramOffset = header.levelsOffset + grids.size() * sizeof(CGVolLevelHeader);
+
+    std::size_t brickBytes = std::size_t(brickSize) * brickSize * brickSize * elementSize;
+    std::vector<CGVolLevelHeader> levelHeaders(grids.size());
+    std::uint64_t offset = header.histogramOffset + numHistogramBins * sizeof(std::uint64_t);
+    for (std::size_t l = 0; l < grids.size(); l++) {
+        for (int i = 0; i < 3; i++) {
+            levelHeaders[l].dimensions[i] = grids[l].dimensions[i];
+            levelHeaders[l].numBricks[i] = grids[l].numBricks[i];
+        }
+        levelHeaders[l].brickMinMaxOffset = offset;
+        offset += 2 * brickGridNumBricks(grids[l]) * sizeof(float);
+    }
+    for (std::size_t l = 0; l < grids.size(); l++) {
+        offset = alignOffset(offset);
+        levelHeaders[l].brickDataOffset = offset;
+        offset += brickGridNumBricks(grids[l]) * brickBytes;
+    }
+
+    // The file is written under a temporary name unique to this thread
+    // and moment and renamed when complete, so that a crash or another
+    // process never leaves a partial file under the final name
+    std::ostringstream suffix;
+    suffix << ".tmp" << std::hash<std::thread::id>()(std::this_thread::get_id()) << "-"
+           << std::chrono::steady_clock::now().time_since_epoch().count();
+    std::string tempFilename = filename + suffix.str();
+    std::ofstream os(tempFilename.c_str(), std::ios::binary | std::ios::trunc);
+    if (!os.is_open()) {
+        std::cerr << "Could not open " << tempFilename << " for writing" << std::endl;
+        return false;
+    }
+
+    // Write brick data level by level, downsampling as we go
+    std::vector<std::vector<float> > brickMinMax(grids.size());
+    VolumeBase downsampled;
+    const VolumeBase *level = &volume;
+    for (std::size_t l = 0; l < grids.size(); l++) {
+        if (l > 0) {
+            VolumeBase next;
+            downsampleLevel(*level, &next);
+            downsampled.data.swap(next.data);
+            downsampled.dimensions = next.dimensions;
+            downsampled.origin = next.origin;
+            downsampled.spacing = next.spacing;
+            downsampled.datatype = next.datatype;
+            level = &downsampled;
+        }
+        os.seekp(levelHeaders[l].brickDataOffset);
+        if (!writeLevelBricks(os, *level, grids[l], &brickMinMax[l])) {
+            std::cerr << "Could not write " << tempFilename << std::endl;
+            os.close();
+            std::remove(tempFilename.c_str());
+            return false;
+        }
+    }
+
+    // Global range and histogram of the full resolution level
+    header.minValue = std::numeric_limits<float>::infinity();
+    header.maxValue = -std::numeric_limits<float>::infinity();
+    for (std::size_t i = 0; i < brickMinMax[0].size(); i += 2) {
+        header.minValue = std::min(header.minValue, brickMinMax[0][i]);
+        header.maxValue = std::max(header.maxValue, brickMinMax[0][i + 1]);
+    }
+    std::vector<std::uint64_t> histogram(numHistogramBins, 0);
+    voxelHistogram(volume.datatype, false, &volume.data[0], volumeNumVoxels(volume),
+                   header.minValue, header.maxValue, &histogram[0], histogram.size());
+
+    // Write metadata
+    os.seekp(0);
+    os.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    os.write(reinterpret_cast<const char *>(&levelHeaders[0]),
+             levelHeaders.size() * sizeof(CGVolLevelHeader));
+    os.write(reinterpret_cast<const char *>(&histogram[0]), histogram.size() * sizeof(std::uint64_t));
+    for (std::size_t l = 0; l < grids.size(); l++) {
+        os.write(reinterpret_cast<const char *>(&brickMinMax[l][0]),
+                 brickMinMax[l].size() * sizeof(float));
+    }
+    os.close();
+    if (!os) {
+        std::cerr << "Could not write " << tempFilename << std::endl;
+        std::remove(tempFilename.c_str());
+        return false;
+    }
+#ifdef _WIN32
+    std::remove(filename.c_str());  // rename does not replace files here
+#endif
+    if (std::rename(tempFilename.c_str(), filename.c_str()) != 0) {
+        std::cerr << "Could not rename " << tempFilename << " to " << filename << std::endl;
+        std::remove(tempFilename.c_str());
+        return false;
+    }
+    return true;
+}
+
+void volumeCopyBrick(const VolumeBase &volume, const BrickGrid &grid, const glm::ivec3 &brick,
+                     std::uint8_t *dst)
+{
+    std::size_t elementSize = datatypeSizeInBytes(volume.datatype);
+    int bs = grid.brickSize;
+    glm::ivec3 origin = brickGridBrickOrigin(grid, brick);
+    glm::ivec3 extent = brickGridBrickExtent(grid, brick);
+    for (int z = 0; z < bs; z++) {
+        std::size_t sz = origin.z + std::min(z, extent.z - 1);
+        for (int y = 0; y < bs; y++) {
+            std::size_t sy = origin.y + std::min(y, extent.y - 1);
+            const std::uint8_t *row = &volume.data[((sz * volume.dimensions.y + sy) *
+                                                    volume.dimensions.x + origin.x) * elementSize];
+            std::uint8_t *out = dst + (std::size_t(z) * bs + y) * bs * elementSize;
+            std::memcpy(out, row, extent.x * elementSize);
+            for (int x = extent.x; x < bs; x++) {
+                std::memcpy(out + x * elementSize, row + (extent.x - 1) * elementSize, elementSize);
+            }
+        }
+    }
+}
+
+bool volumeMapCGVol(BrickedVolume *volume, const std::string &filename)
+{
+    volume->levels.clear();
+    if (!mappedFileOpen(&volume->file, filename)) {
+        return false;
+    }
+
+    const std::uint8_t *base = volume->file.data;
+    std::uint64_t size = volume->file.size;
+    CGVolFileHeader header;
+    bool valid = size >= sizeof(header);
+    if (valid) {
+        std::memcpy(&header, base, sizeof(header));
+        header.datatype[sizeof(header.datatype) - 1] = '\0';
+        valid = std::memcmp(header.magic, cgvolMagic, sizeof(header.magic)) == 0 &&
+                header.version == cgvolVersion && header.byteOrderMark == byteOrderMark &&
+                datatypeSizeInBytes(header.datatype) > 0 && header.brickSize > 0 &&
+                header.numLevels > 0 && header.numLevels <= maxNumLevels &&
+                header.numHistogramBins > 0 &&
+                header.levelsOffset + header.numLevels * sizeof(CGVolLevelHeader) <= size &&
+                header.histogramOffset + header.numHistogramBins * sizeof(std::uint64_t) <= size;
+    }
+    if (!valid) {
+        std::cerr << filename << " is not a valid .cgvol file" << std::endl;
+        mappedFileClose(&volume->file);
+        return false;
+    }
+
+    volume->dimensions = glm::ivec3(header.dimensions[0], header.dimensions[1], header.dimensions[2]);
+    volume->origin = glm::vec3(header.origin[0], header.origin[1], header.origin[2]);
+    volume->spacing = glm::vec3(header.spacing[0], header.spacing[1], header.spacing[2]);
+    volume->datatype = header.datatype;
+    volume->brickSize = header.brickSize;
+    volume->minValue = header.minValue;
+    volume->maxValue = header.maxValue;
+    volume->numHistogramBins = header.numHistogramBins;
+    volume->histogram = reinterpret_cast<const std::uint64_t *>(base + header.histogramOffset);
+
+    std::size_t brickBytes = brickedVolumeBrickSizeInBytes(*volume);
+    for (int l = 0; l < header.numLevels; l++) {
+        CGVolLevelHeader levelHeader;
+        std::memcpy(&levelHeader, base + header.levelsOffset + l * sizeof(CGVolLevelHeader),
+                    sizeof(levelHeader));
+        BrickedLevel level;
+        level.grid = brickGridCreate(glm::ivec3(levelHeader.dimensions[0], levelHeader.dimensions[1],
+                                                levelHeader.dimensions[2]), header.brickSize);
+        std::size_t numBricks = brickGridNumBricks(level.grid);
+        if (level.grid.numBricks != glm::ivec3(levelHeader.numBricks[0], levelHeader.numBricks[1],
+                                               levelHeader.numBricks[2]) ||
+            levelHeader.brickMinMaxOffset + 2 * numBricks * sizeof(float) > size ||
+            levelHeader.brickDataOffset + numBricks * brickBytes > size) {
+            std::cerr << filename << " is truncated" << std::endl;
+            volume->levels.clear();
+            mappedFileClose(&volume->file);
+            return false;
+        }
+        level.brickMinMax = reinterpret_cast<const float *>(base + levelHeader.brickMinMaxOffset);
+        level.data = base + levelHeader.brickDataOffset;
+        volume->levels.push_back(level);
+    }
+
+    return true;
+}
+
+bool brickedVolumeToLinear(const BrickedVolume &bricked, int level, VolumeBase *volume)
+{
+    if (level < 0 || level >= int(bricked.levels.size())) {
+        return false;
+    }
+    const BrickGrid &grid = bricked.levels[level].grid;
+    std::size_t elementSize = datatypeSizeInBytes(bricked.datatype);
+    int bs = bricked.brickSize;
+    std::vector<std::uint8_t> data(numVoxels(grid.dimensions) * elementSize);
+    parallelFor(0, brickGridNumBricks(grid), [&](std::size_t first, std::size_t last) {
+        for (std::size_t i = first; i < last; i++) {
+            glm::ivec3 brick = brickGridCoord(grid, i);
+            glm::ivec3 origin = brickGridBrickOrigin(grid, brick);
+            glm::ivec3 extent = brickGridBrickExtent(grid, brick);
+            const std::uint8_t *src = brickedVolumeBrick(bricked, level, brick);
+            for (int z = 0; z < extent.z; z++) {
+                for (int y = 0; y < extent.y; y++) {
+                    std::size_t dstIndex = (std::size_t(origin.z + z) * grid.dimensions.y +
+                                            (origin.y + y)) * grid.dimensions.x + origin.x;
+                    std::size_t srcIndex = (std::size_t(z) * bs + y) * bs;
+                    std::memcpy(&data[dstIndex * elementSize], src + srcIndex * elementSize,
+                                extent.x * elementSize);
+                }
+            }
+        }
+    });
+
+    volume->dimensions = grid.dimensions;
+    volume->origin = bricked.origin;
+    volume->spacing = bricked.spacing * glm::vec3(bricked.dimensions) / glm::vec3(grid.dimensions);
+    volume->datatype = bricked.datatype;
+    volume->data.swap(data);
+    return true;
+}
+
+bool volumeLoadCGVol(VolumeBase *volume, const std::string &filename, int level)
+{
+    BrickedVolume bricked;
+    if (!volumeMapCGVol(&bricked, filename)) {
+        return false;
+    }
+    return brickedVolumeToLinear(bricked, level, volume);
+}
+
+bool volumeCGVolIsUpToDate(const std::string &cgvolFilename, const std::string &sourceFilename)
+{
+    struct stat cgvolStat, sourceStat;
+    if (stat(cgvolFilename.c_str(), &cgvolStat) != 0) {
+        return false;
+    }
+    if (stat(sourceFilename.c_str(), &sourceStat) != 0) {
+        return true;  // the source is gone, so the cache is all we have
+    }
+    return cgvolStat.st_mtime >= sourceStat.st_mtime;
+}
+
+} // namespace cg
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "cgVolume.h"
+#include "cgBrickGrid.h"
+#include "cgMappedFile.h"
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+namespace cg {
+
+// Struct for one resolution level of a bricked volume. Every brick is
+// stored as a full brickSize^3 block of voxels (x-fastest); border
+// bricks are padded by repeating the last voxel of the volume.
+struct BrickedLevel {
+    BrickGrid grid;  // dimensions and brick layout of the level
+    const float *brickMinMax;  // min and max value of each brick
+    const std::uint8_t *data;  // voxel data of the first brick
+};
+
+// Struct for a bricked volume image stored in a memory mapped native
+// volume cache (.cgvol) file. Level 0 has full resolution; each further
+// level is downsampled by two along every axis.
+struct BrickedVolume {
+    glm::ivec3 dimensions;  // volume dimensions (level 0)
+    glm::vec3 origin;  // volume origin
+    glm::vec3 spacing;  // voxel spacing (level 0)
+    std::string datatype;  // voxel data type string
+    int brickSize;  // brick edge length in voxels
+    float minValue;  // smallest value in the volume
+    float maxValue;  // largest value in the volume
+    int numHistogramBins;  // bins of the histogram over [minValue, maxValue]
+    const std::uint64_t *histogram;  // voxel counts per bin
+    std::vector<BrickedLevel> levels;  // resolution levels
+    MappedFile file;  // mapping that owns the data
+
+    BrickedVolume() :
+        brickSize(0),
+        minValue(0.0f),
+        maxValue(0.0f),
+        numHistogramBins(0),
+        histogram(nullptr)
+    {}
+};
+
+// Returns the size in bytes of one brick of the bricked volume
+inline std::size_t brickedVolumeBrickSizeInBytes(const BrickedVolume &volume)
+{
+    return std::size_t(volume.brickSize) * volume.brickSize * volume.brickSize *
+           datatypeSizeInBytes(volume.datatype);
+}
+
+// Returns a pointer to the voxels of a brick at the given level
+inline const std::uint8_t *brickedVolumeBrick(const BrickedVolume &volume, int level,
+                                              const glm::ivec3 &brick)
+{
+    const BrickedLevel &l = volume.levels[level];
+    return l.data + brickGridIndex(l.grid, brick) * brickedVolumeBrickSizeInBytes(volume);
+}
+
+// Copies a brick out of a linear volume image into dst (brickSize^3
+// voxels, x-fastest), padding border bricks by repeating the last voxel
+// along each axis
+void volumeCopyBrick(const VolumeBase &volume, const BrickGrid &grid, const glm::ivec3 &brick,
+                     std::uint8_t *dst);
+
+// Writes a volume image to a native volume cache (.cgvol) file. The
+// voxels are stored in bricks of brickSize^3 voxels together with the
+// min/max value of each brick, a histogram with numHistogramBins bins,
+// and downsampled levels. If numLevels is zero, levels are added until
+// the volume fits into a single brick. Returns true on success, false
+// otherwise.
+bool volumeSaveCGVol(const VolumeBase &volume, const std::string &filename,
+                     int brickSize = 32, int numLevels = 0, int numHistogramBins = 256);
+
+// Maps a .cgvol file into memory. Only the header is read; voxel data
+// and metadata are accessed through the mapping. Returns true on
+// success, false otherwise.
+bool volumeMapCGVol(BrickedVolume *volume, const std::string &filename);
+
+// Reads one level of a .cgvol file into a linear volume image, copying
+// bricks in parallel. Returns true on success, false otherwise.
+bool volumeLoadCGVol(VolumeBase *volume, const std::string &filename, int level = 0);
+
+// Copies one level of a mapped bricked volume into a linear volume image
+bool brickedVolumeToLinear(const BrickedVolume &bricked, int level, VolumeBase *volume);
+
+// Returns true if the .cgvol file exists and is at least as new as the
+// file it was converted from
+bool volumeCGVolIsUpToDate(const std::string &cgvolFilename, const std::string &sourceFilename);
+
+} // namespace cg
@@ -0,0 +1,347 @@
+#include "cgVolumeCompressed.h"
+#include "cgVolumeCache.h"
+#include "cgParallel.h"
+
+#include <iostream>
+#include <cstring>
+#include <mutex>
+
+namespace {
+
+const int lzHashBits = 12;
+const std::size_t lzMinMatch = 4;
+const std::size_t lzMaxOffset = 65535;
+
+std::uint32_t read32(const std::uint8_t *p)
+{
+    std::uint32_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+// Appends a length that did not fit into a token nibble (LZ4 style:
+// bytes of 255 followed by the remainder)
+void lzWriteLength(std::vector<std::uint8_t> *dst, std::size_t length)
+{
+    while (length >= 255) {
+        dst->push_back(255);
+        length -= 255;
+    }
+    dst->push_back(std::uint8_t(length));
+}
+
+// Appends one sequence of literals followed by a match. A match length
+// of zero marks the last sequence, which has no offset.
+void lzWriteSequence(std::vector<std::uint8_t> *dst, const std::uint8_t *literals,
+                     std::size_t numLiterals, std::size_t offset, std::size_t matchLength)
+{
+    std::size_t matchCode = matchLength > 0 ? matchLength - lzMinMatch : 0;
+    dst->push_back(std::uint8_t((std::min<std::size_t>(numLiterals, 15) << 4) |
+                                std::min<std::size_t>(matchCode, 15)));
+    if (numLiterals >= 15) {
+        lzWriteLength(dst, numLiterals - 15);
+    }
+    dst->insert(dst->end(), literals, literals + numLiterals);
+    if (matchLength > 0) {
+        dst->push_back(std::uint8_t(offset & 0xff));
+        dst->push_back(std::uint8_t(offset >> 8));
+        if (matchCode >= 15) {
+            lzWriteLength(dst, matchCode - 15);
+        }
+    }
+}
+
+// Compresses n bytes with a greedy LZ77 matcher (single-entry hash
+// table, 64 KB window)
+void lzCompress(const std::uint8_t *src, std::size_t n, std::vector<std::uint8_t> *dst)
+{
+    std::vector<std::uint32_t> table(std::size_t(1) << lzHashBits, 0);
+    std::size_t anchor = 0;
+    std::size_t i = 0;
+    while (i + lzMinMatch <= n) {
+        std::uint32_t sequence = read32(src + i);
+        std::uint32_t hash = (sequence * 2654435761u) >> (32 - lzHashBits);
+        std::size_t candidate = table[hash];  // position + 1, zero if empty
+        table[hash] = std::uint32_t(i + 1);
+        if (candidate > 0 && i - (candidate - 1) <= lzMaxOffset &&
+            read32(src + candidate - 1) == sequence) {
+            std::size_t match = candidate - 1;
+            std::size_t length = lzMinMatch;
+            while (i + length < n && src[match + length] == src[i + length]) {
+                length++;
+            }
+            lzWriteSequence(dst, src + anchor, i - anchor, i - match, length);
+            i += length;
+            anchor = i;
+        }
+        else {
+            i++;
+        }
+    }
+    lzWriteSequence(dst, src + anchor, n - anchor, 0, 0);
+}
+
+// Reads a length continuation; returns false on truncated input
+bool lzReadLength(const std::uint8_t **ip, const std::uint8_t *end, std::size_t *length)
+{
+    std::uint8_t byte;
+    do {
+        if (*ip >= end) {
+            return false;
+        }
+        byte = *(*ip)++;
+        *length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+// Decompresses exactly n bytes into dst; returns false on malformed
+// input
+bool lzDecompress(const std::uint8_t *src, std::size_t srcSize, std::uint8_t *dst, std::size_t n)
+{
+    const std::uint8_t *ip = src;
+    const std::uint8_t *end = src + srcSize;
+    std::size_t op = 0;
+    while (ip < end) {
+        std::uint8_t token = *ip++;
+        std::size_t numLiterals = token >> 4;
+        if (numLiterals == 15 && !lzReadLength(&ip, end, &numLiterals)) {
+            return false;
+        }
+        if (numLiterals > std::size_t(end - ip) || numLiterals > n - op) {
+            return false;
+        }
+        std::memcpy(dst + op, ip, numLiterals);
+        ip += numLiterals;
+        op += numLiterals;
+        if (ip == end) {
+            break;  // last sequence
+        }
+
+        if (end - ip < 2) {
+            return false;
+        }
+        std::size_t offset = ip[0] | (std::size_t(ip[1]) << 8);
+        ip += 2;
+        std::size_t matchLength = token & 15;
+        if (matchLength == 15 && !lzReadLength(&ip, end, &matchLength)) {
+            return false;
+        }
+        matchLength += lzMinMatch;
+        if (offset == 0 || offset > op || matchLength > n - op) {
+            return false;
+        }
+        // Byte by byte, since the match may overlap the output
+        for (std::size_t j = 0; j < matchLength; j++, op++) {
+            dst[op] = dst[op - offset];
+        }
+    }
+    return op == n;
+}
+
+// Splits elements into byte planes (all first bytes, then all second
+// bytes, ...), which makes multi-byte voxels compress much better
+void splitBytePlanes(const std::uint8_t *src, std::size_t numElements, std::size_t elementSize,
+                     std::uint8_t *dst)
+{
+    for (std::size_t i = 0; i < numElements; i++) {
+        for (std::size_t k = 0; k < elementSize; k++) {
+            dst[k * numElements + i] = src[i * elementSize + k];
+        }
+    }
+}
+
+void mergeBytePlanes(const std::uint8_t *src, std::size_t numElements, std::size_t elementSize,
+                     std::uint8_t *dst)
+{
+    for (std::size_t i = 0; i < numElements; i++) {
+        for (std::size_t k = 0; k < elementSize; k++) {
+            dst[i * elementSize + k] = src[k * numElements + i];
+        }
+    }
+}
+
+// Compresses one brick of brickVoxels voxels
+void compressBrick(const std::uint8_t *voxels, std::size_t brickVoxels, std::size_t elementSize,
+                   std::vector<std::uint8_t> *planes, cg::CompressedBrick *brick)
+{
+    std::size_t numBytes = brickVoxels * elementSize;
+    bool uniform = true;
+    for (std::size_t i = elementSize; i < numBytes && uniform; i += elementSize) {
+        uniform = std::memcmp(voxels, voxels + i, elementSize) == 0;
+    }
+    if (uniform) {
+        brick->encoding = cg::BRICK_ENCODING_UNIFORM;
+        brick->payload.assign(voxels, voxels + elementSize);
+        return;
+    }
+
+    const std::uint8_t *input = voxels;
+    if (elementSize > 1) {
+        splitBytePlanes(voxels, brickVoxels, elementSize, &(*planes)[0]);
+        input = &(*planes)[0];
+    }
+    brick->payload.clear();
+    lzCompress(input, numBytes, &brick->payload);
+    if (brick->payload.size() < numBytes) {
+        brick->encoding = cg::BRICK_ENCODING_LZ;
+    }
+    else {
+        brick->encoding = cg::BRICK_ENCODING_RAW;
+        brick->payload.assign(voxels, voxels + numBytes);
+    }
+    brick->payload.shrink_to_fit();
+}
+
+std::size_t brickSizeInBytes(const cg::CompressedVolume &compressed)
+{
+    return std::size_t(compressed.grid.brickSize) * compressed.grid.brickSize *
+           compressed.grid.brickSize * cg::datatypeSizeInBytes(compressed.datatype);
+}
+
+} // namespace
+
+
+
+namespace cg {
+
+bool volumeCompress(const VolumeBase &volume, CompressedVolume *compressed,
+                    int brickSize, std::size_t cacheSizeInBricks)
+{
+    std::size_t elementSize = datatypeSizeInBytes(volume.datatype);
+    if (elementSize == 0 || brickSize <= 0 ||
+        volume.data.size() < volumeNumVoxels(volume) * elementSize) {
+        return false;
+    }
+
+    compressed->dimensions = volume.dimensions;
+    compressed->origin = volume.origin;
+    compressed->spacing = volume.spacing;
+    compressed->datatype = volume.datatype;
+    compressed->grid = brickGridCreate(volume.dimensions, brickSize);
+    compressed->bricks.clear();
+    compressed->bricks.resize(brickGridNumBricks(compressed->grid));
+    brickCacheClear(&compressed->cache);
+    brickCacheSetCapacity(&compressed->cache, cacheSizeInBricks);
+
+    std::size_t brickVoxels = std::size_t(brickSize) * brickSize * brickSize;
+    parallelFor(0, compressed->bricks.size(), [&](std::size_t first, std::size_t last) {
+        std::vector<std::uint8_t> voxels(brickVoxels * elementSize), planes(voxels.size());
+        for (std::size_t i = first; i < last; i++) {
+            volumeCopyBrick(volume, compressed->grid, brickGridCoord(compressed->grid, i), &voxels[0]);
+            compressBrick(&voxels[0], brickVoxels, elementSize, &planes, &compressed->bricks[i]);
+        }
+    });
+
+    return true;
+}
+
+bool compressedVolumeDecodeBrick(const CompressedVolume &compressed, std::size_t index,
+                                 std::uint8_t *dst)
+{
+    const CompressedBrick &brick = compressed.bricks[index];
+    std::size_t elementSize = datatypeSizeInBytes(compressed.datatype);
+    std::size_t numBytes = brickSizeInBytes(compressed);
+    switch (brick.encoding) {
+    case BRICK_ENCODING_RAW:
+        if (brick.payload.size() != numBytes) {
+            return false;
+        }
+        std::memcpy(dst, &brick.payload[0], numBytes);
+        return true;
+    case BRICK_ENCODING_UNIFORM:
+        if (brick.payload.size() != elementSize) {
+            return false;
+        }
+        for (std::size_t i = 0; i < numBytes; i += elementSize) {
+            std::memcpy(dst + i, &brick.payload[0], elementSize);
+        }
+        return true;
+    case BRICK_ENCODING_LZ:
+        if (elementSize == 1) {
+            return lzDecompress(&brick.payload[0], brick.payload.size(), dst, numBytes);
+        }
+        else {
+            std::vector<std::uint8_t> planes(numBytes);
+            if (!lzDecompress(&brick.payload[0], brick.payload.size(), &planes[0], numBytes)) {
+                return false;
+            }
+            mergeBytePlanes(&planes[0], numBytes / elementSize, elementSize, dst);
+            return true;
+        }
+    }
+    return false;
+}
+
+BrickDataPtr compressedVolumeBrick(const CompressedVolume &compressed, std::size_t index)
+{
+    BrickDataPtr cached = brickCacheFind(&compressed.cache, index);
+    if (cached) {
+        return cached;
+    }
+
+    // Decompress outside the cache lock, so that other threads can keep
+    // reading cached bricks
+    std::shared_ptr<std::vector<std::uint8_t> > voxels =
+        std::make_shared<std::vector<std::uint8_t> >(brickSizeInBytes(compressed));
+    if (!compressedVolumeDecodeBrick(compressed, index, &(*voxels)[0])) {
+        std::cerr << "Corrupt compressed brick " << index << std::endl;
+        std::fill(voxels->begin(), voxels->end(), std::uint8_t(0));
+    }
+    return brickCacheInsert(&compressed.cache, index, voxels);
+}
+
+bool volumeDecompress(const CompressedVolume &compressed, VolumeBase *volume)
+{
+    const BrickGrid &grid = compressed.grid;
+    std::size_t elementSize = datatypeSizeInBytes(compressed.datatype);
+    std::size_t numBytes = std::size_t(grid.dimensions.x) * grid.dimensions.y *
+                           grid.dimensions.z * elementSize;
+    int bs = grid.brickSize;
+    std::vector<std::uint8_t> data(numBytes);
+    bool ok = true;
+    std::mutex okMutex;
+    parallelFor(0, compressed.bricks.size(), [&](std::size_t first, std::size_t last) {
+        std::vector<std::uint8_t> voxels(brickSizeInBytes(compressed));
+        for (std::size_t i = first; i < last; i++) {
+            if (!compressedVolumeDecodeBrick(compressed, i, &voxels[0])) {
+                std::lock_guard<std::mutex> lock(okMutex);
+                ok = false;
+                continue;
+            }
+            glm::ivec3 brick = brickGridCoord(grid, i);
+            glm::ivec3 origin = brickGridBrickOrigin(grid, brick);
+            glm::ivec3 extent = brickGridBrickExtent(grid, brick);
+            for (int z = 0; z < extent.z; z++) {
+                for (int y = 0; y < extent.y; y++) {
+                    std::size_t dstIndex = (std::size_t(origin.z + z) * grid.dimensions.y +
+                                            (origin.y + y)) * grid.dimensions.x + origin.x;
+                    std::size_t srcIndex = (std::size_t(z) * bs + y) * bs;
+                    std::memcpy(&data[dstIndex * elementSize], &voxels[srcIndex * elementSize],
+                                extent.x * elementSize);
+                }
+            }
+        }
+    });
+    if (!ok) {
+        return false;
+    }
+
+    volume->dimensions = compressed.dimensions;
+    volume->origin = compressed.origin;
+    volume->spacing = compressed.spacing;
+    volume->datatype = compressed.datatype;
+    volume->data.swap(data);
+    return true;
+}
+
+std::size_t compressedVolumeSizeInBytes(const CompressedVolume &compressed)
+{
+    std::size_t size = compressed.bricks.size() * sizeof(CompressedBrick);
+    for (std::size_t i = 0; i < compressed.bricks.size(); i++) {
+        size += compressed.bricks[i].payload.size();
+    }
+    return size;
+}
+
+} // namespace cg
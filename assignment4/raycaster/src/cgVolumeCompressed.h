@@ -0,0 +1,119 @@
+#pragma once
+
+#include "cgVolume.h"
+#include "cgBrickGrid.h"
+#include "cgBrickCache.h"
+
+#include <vector>
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+namespace cg {
+
+// Encodings of a compressed brick
+enum BrickEncoding {
+    BRICK_ENCODING_RAW = 0,  // voxels stored as-is
+    BRICK_ENCODING_UNIFORM,  // all voxels have the same value (stored once)
+    BRICK_ENCODING_LZ  // byte planes compressed with a fast LZ77 codec
+};
+
+// Struct for one compressed brick
+struct CompressedBrick {
+    BrickEncoding encoding;
+    std::vector<std::uint8_t> payload;
+
+    CompressedBrick() :
+        encoding(BRICK_ENCODING_RAW)
+    {}
+};
+
+// Struct for a volume image kept in memory as compressed bricks of
+// brickSize^3 voxels (border bricks are padded like in .cgvol files).
+// Bricks are decompressed on access and kept in a small LRU cache.
+struct CompressedVolume {
+    glm::ivec3 dimensions;  // volume dimensions
+    glm::vec3 origin;  // volume origin
+    glm::vec3 spacing;  // voxel spacing
+    std::string datatype;  // voxel data type string
+    BrickGrid grid;  // brick layout
+    std::vector<CompressedBrick> bricks;  // bricks in x-fastest order
+    mutable BrickLRUCache cache;  // recently used decompressed bricks
+};
+
+// Compresses a volume image brick by brick (in parallel). Uniform bricks
+// are stored as a single value; other bricks are split into byte planes
+// and LZ compressed, or stored raw if that does not save space.
+// cacheSizeInBricks sets the capacity of the decompressed brick cache.
+// Returns true on success, false otherwise.
+bool volumeCompress(const VolumeBase &volume, CompressedVolume *compressed,
+                    int brickSize = 32, std::size_t cacheSizeInBricks = 64);
+
+// Decompresses all bricks into a linear volume image (in parallel).
+// Returns true on success, false otherwise.
+bool volumeDecompress(const CompressedVolume &compressed, VolumeBase *volume);
+
+// Decompresses the brick with the given index into dst (brickSize^3
+// voxels) without going through the cache. Returns true on success,
+// false otherwise.
+bool compressedVolumeDecodeBrick(const CompressedVolume &compressed, std::size_t index,
+                                 std::uint8_t *dst);
+
+// Returns the decompressed voxels of the brick with the given index,
+// through the LRU cache. Safe to call from several threads.
+BrickDataPtr compressedVolumeBrick(const CompressedVolume &compressed, std::size_t index);
+
+// Returns the memory used by the compressed bricks in bytes (not
+// counting the cache)
+std::size_t compressedVolumeSizeInBytes(const CompressedVolume &compressed);
+
+// Calls fn(brick, voxels) for every brick, where brick is the brick
+// coordinate and voxels points to its brickSize^3 decompressed voxels
+// (only valid during the call). Bypasses the cache.
+template<typename Function>
+void compressedVolumeForEachBrick(const CompressedVolume &compressed, Function fn)
+{
+    std::vector<std::uint8_t> voxels(std::size_t(compressed.grid.brickSize) *
+                                     compressed.grid.brickSize * compressed.grid.brickSize *
+                                     datatypeSizeInBytes(compressed.datatype));
+    for (std::size_t i = 0; i < compressed.bricks.size(); i++) {
+        if (compressedVolumeDecodeBrick(compressed, i, &voxels[0])) {
+            fn(brickGridCoord(compressed.grid, i), static_cast<const std::uint8_t *>(&voxels[0]));
+        }
+    }
+}
+
+// Template struct for typed read access to a compressed volume image.
+// Holds on to the last brick used, so that neighbouring accesses do not
+// touch the cache.
+template <typename VoxelType>
+struct CompressedVolumeReader {
+    const CompressedVolume *volume;
+    std::size_t brickIndex;
+    BrickDataPtr brick;
+    typedef VoxelType voxel_type;
+
+    explicit CompressedVolumeReader(const CompressedVolume &volume) :
+        volume(&volume),
+        brickIndex(0)
+    {}
+
+    // Overridden operator for element access (no bounds checking!)
+    VoxelType operator()(int x, int y, int z);
+};
+
+// Overridden operator for element access (no bounds checking!)
+template<typename VoxelType>
+inline VoxelType CompressedVolumeReader<VoxelType>::operator()(int x, int y, int z)
+{
+    int bs = volume->grid.brickSize;
+    std::size_t index = brickGridIndex(volume->grid, glm::ivec3(x / bs, y / bs, z / bs));
+    if (!brick || index != brickIndex) {
+        brick = compressedVolumeBrick(*volume, index);
+        brickIndex = index;
+    }
+    std::size_t voxel = (std::size_t(z % bs) * bs + (y % bs)) * bs + (x % bs);
+    return reinterpret_cast<const VoxelType *>(&(*brick)[0])[voxel];
+}
+
+} // namespace cg
@@ -0,0 +1,712 @@
+#include "cgVolumeConvert.h"
+#include "cgParallel.h"
+
+#include <vector>
+#include <mutex>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CG_USE_SSE2
+#include <emmintrin.h>
+#endif
+#if defined(__SSSE3__)
+#define CG_USE_SSSE3
+#include <tmmintrin.h>
+#endif
+#if defined(__AVX2__)
+#define CG_USE_AVX2
+#include <immintrin.h>
+#endif
+#if defined(__F16C__)
+#define CG_USE_F16C
+#include <immintrin.h>
+#endif
+
+namespace {
+
+// Number of elements converted per block. A block of source elements
+// is swapped and widened to float in a small buffer that stays in the
+// L1 cache, and then written to the destination.
+const std::size_t blockSize = 256;
+
+// Swap byte order of 2-byte elements
+void swap16(std::uint8_t *dst, const std::uint8_t *src, std::size_t n)
+{
+    std::size_t i = 0;
+#ifdef CG_USE_AVX2
+    const __m256i mask = _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+                                          1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+    for (; i + 16 <= n; i += 16) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + 2 * i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + 2 * i), _mm256_shuffle_epi8(v, mask));
+    }
+#endif
+#ifdef CG_USE_SSE2
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 2 * i));
+        v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 2 * i), v);
+    }
+#endif
+    for (; i < n; i++) {
+        std::uint8_t b0 = src[2 * i];
+        std::uint8_t b1 = src[2 * i + 1];
+        dst[2 * i] = b1;
+        dst[2 * i + 1] = b0;
+    }
+}
+
+// Swap byte order of 4-byte elements
+void swap32(std::uint8_t *dst, const std::uint8_t *src, std::size_t n)
+{
+    std::size_t i = 0;
+#ifdef CG_USE_AVX2
+    const __m256i mask = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+                                          3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + 4 * i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + 4 * i), _mm256_shuffle_epi8(v, mask));
+    }
+#endif
+#if defined(CG_USE_SSSE3)
+    const __m128i mask128 = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    for (; i + 4 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 4 * i));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 4 * i), _mm_shuffle_epi8(v, mask128));
+    }
+#elif defined(CG_USE_SSE2)
+    for (; i + 4 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 4 * i));
+        // Swap the 16-bit halves of each element, then the bytes of each half
+        v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1)), _MM_SHUFFLE(2, 3, 0, 1));
+        v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 4 * i), v);
+    }
+#endif
+    for (; i < n; i++) {
+        std::uint8_t b0 = src[4 * i];
+        std::uint8_t b1 = src[4 * i + 1];
+        std::uint8_t b2 = src[4 * i + 2];
+        std::uint8_t b3 = src[4 * i + 3];
+        dst[4 * i] = b3;
+        dst[4 * i + 1] = b2;
+        dst[4 * i + 2] = b1;
+        dst[4 * i + 3] = b0;
+    }
+}
+
+// Widen n source elements to float. The source is in host byte order.
+typedef void (*LoadFunction)(const std::uint8_t *, std::size_t, float *);
+
+void loadUInt8(const std::uint8_t *src, std::size_t n, float *out)
+{
+    std::size_t i = 0;
+#ifdef CG_USE_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        __m128i lo = _mm_unpacklo_epi8(v, zero);
+        __m128i hi = _mm_unpackhi_epi8(v, zero);
+        _mm_storeu_ps(out + i, _mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)));
+        _mm_storeu_ps(out + i + 4, _mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)));
+        _mm_storeu_ps(out + i + 8, _mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)));
+        _mm_storeu_ps(out + i + 12, _mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero)));
+    }
+#endif
+    for (; i < n; i++) {
+        out[i] = float(src[i]);
+    }
+}
+
+void loadUInt16(const std::uint8_t *src, std::size_t n, float *out)
+{
+    const std::uint16_t *s = reinterpret_cast<const std::uint16_t *>(src);
+    std::size_t i = 0;
+#if defined(CG_USE_AVX2)
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + i));
+        _mm256_storeu_ps(out + i, _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(v)));
+    }
+#elif defined(CG_USE_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + i));
+        _mm_storeu_ps(out + i, _mm_cvtepi32_ps(_mm_unpacklo_epi16(v, zero)));
+        _mm_storeu_ps(out + i + 4, _mm_cvtepi32_ps(_mm_unpackhi_epi16(v, zero)));
+    }
+#endif
+    for (; i < n; i++) {
+        out[i] = float(s[i]);
+    }
+}
+
+void loadInt16(const std::uint8_t *src, std::size_t n, float *out)
+{
+    const std::int16_t *s = reinterpret_cast<const std::int16_t *>(src);
+    std::size_t i = 0;
+#if defined(CG_USE_AVX2)
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + i));
+        _mm256_storeu_ps(out + i, _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(v)));
+    }
+#elif defined(CG_USE_SSE2)
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + i));
+        // Sign-extend by placing each value in the upper half of a
+        // 32-bit lane and shifting it back down arithmetically
+        _mm_storeu_ps(out + i, _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16)));
+        _mm_storeu_ps(out + i + 4, _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16)));
+    }
+#endif
+    for (; i < n; i++) {
+        out[i] = float(s[i]);
+    }
+}
+
+void loadUInt32(const std::uint8_t *src, std::size_t n, float *out)
+{
+    const std::uint32_t *s = reinterpret_cast<const std::uint32_t *>(src);
+    for (std::size_t i = 0; i < n; i++) {
+        out[i] = float(s[i]);
+    }
+}
+
+void loadFloat32(const std::uint8_t *src, std::size_t n, float *out)
+{
+    std::memcpy(out, src, n * sizeof(float));
+}
+
+LoadFunction loadFunctionForDatatype(const std::string &datatype)
+{
+    if (datatype == "uint8") {
+        return loadUInt8;
+    }
+    else if (datatype == "uint16") {
+        return loadUInt16;
+    }
+    else if (datatype == "int16") {
+        return loadInt16;
+    }
+    else if (datatype == "uint32") {
+        return loadUInt32;
+    }
+    else if (datatype == "float32") {
+        return loadFloat32;
+    }
+    return nullptr;
+}
+
+// Clamp to [lo, hi] (NaN maps to lo) and round to nearest even
+template<typename T>
+T clampRound(float value, float lo, float hi)
+{
+    value = value > lo ? value : lo;
+    value = value < hi ? value : hi;
+    return static_cast<T>(std::llrint(value));
+}
+
+// Apply scale and offset to n floats and store them as the destination
+// type
+typedef void (*StoreFunction)(const float *, std::size_t, float, float, std::uint8_t *);
+
+void storeUInt8(const float *in, std::size_t n, float scale, float offset, std::uint8_t *dst)
+{
+    std::size_t i = 0;
+#ifdef CG_USE_SSE2
+    const __m128 s = _mm_set1_ps(scale);
+    const __m128 o = _mm_set1_ps(offset);
+    const __m128 lo = _mm_setzero_ps();
+    const __m128 hi = _mm_set1_ps(255.0f);
+    for (; i + 16 <= n; i += 16) {
+        __m128i v[4];
+        for (int j = 0; j < 4; j++) {
+            __m128 f = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(in + i + 4 * j), s), o);
+            f = _mm_min_ps(_mm_max_ps(f, lo), hi);
+            v[j] = _mm_cvtps_epi32(f);
+        }
+        __m128i packed = _mm_packus_epi16(_mm_packs_epi32(v[0], v[1]), _mm_packs_epi32(v[2], v[3]));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), packed);
+    }
+#endif
+    for (; i < n; i++) {
+        dst[i] = clampRound<std::uint8_t>(in[i] * scale + offset, 0.0f, 255.0f);
+    }
+}
+
+void storeUInt16(const float *in, std::size_t n, float scale, float offset, std::uint8_t *dst)
+{
+    std::uint16_t *d = reinterpret_cast<std::uint16_t *>(dst);
+    std::size_t i = 0;
+#ifdef CG_USE_SSE2
+    const __m128 s = _mm_set1_ps(scale);
+    const __m128 o = _mm_set1_ps(offset);
+    const __m128 lo = _mm_setzero_ps();
+    const __m128 hi = _mm_set1_ps(65535.0f);
+    const __m128i bias = _mm_set1_epi32(32768);
+    const __m128i flip = _mm_set1_epi16(-32768);
+    for (; i + 8 <= n; i += 8) {
+        __m128i v[2];
+        for (int j = 0; j < 2; j++) {
+            __m128 f = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(in + i + 4 * j), s), o);
+            f = _mm_min_ps(_mm_max_ps(f, lo), hi);
+            // SSE2 has no unsigned 32-to-16 bit pack, so pack signed values
+            // biased by -32768 and flip the sign bit back afterwards
+            v[j] = _mm_sub_epi32(_mm_cvtps_epi32(f), bias);
+        }
+        __m128i packed = _mm_xor_si128(_mm_packs_epi32(v[0], v[1]), flip);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(d + i), packed);
+    }
+#endif
+    for (; i < n; i++) {
+        d[i] = clampRound<std::uint16_t>(in[i] * scale + offset, 0.0f, 65535.0f);
+    }
+}
+
+void storeInt16(const float *in, std::size_t n, float scale, float offset, std::uint8_t *dst)
+{
+    std::int16_t *d = reinterpret_cast<std::int16_t *>(dst);
+    for (std::size_t i = 0; i < n; i++) {
+        d[i] = clampRound<std::int16_t>(in[i] * scale + offset, -32768.0f, 32767.0f);
+    }
+}
+
+void storeUInt32(const float *in, std::size_t n, float scale, float offset, std::uint8_t *dst)
+{
+    std::uint32_t *d = reinterpret_cast<std::uint32_t *>(dst);
+    for (std::size_t i = 0; i < n; i++) {
+        d[i] = clampRound<std::uint32_t>(in[i] * scale + offset, 0.0f, 4294967040.0f);
+    }
+}
+
+void storeFloat32(const float *in, std::size_t n, float scale, float offset, std::uint8_t *dst)
+{
+    float *d = reinterpret_cast<float *>(dst);
+    std::size_t i = 0;
+#ifdef CG_USE_SSE2
+    const __m128 s = _mm_set1_ps(scale);
+    const __m128 o = _mm_set1_ps(offset);
+    for (; i + 4 <= n; i += 4) {
+        _mm_storeu_ps(d + i, _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(in + i), s), o));
+    }
+#endif
+    for (; i < n; i++) {
+        d[i] = in[i] * scale + offset;
+    }
+}
+
+void storeFloat16(const float *in, std::size_t n, float scale, float offset, std::uint8_t *dst)
+{
+    std::uint16_t *d = reinterpret_cast<std::uint16_t *>(dst);
+    std::size_t i = 0;
+#ifdef CG_USE_F16C
+    const __m128 s = _mm_set1_ps(scale);
+    const __m128 o = _mm_set1_ps(offset);
+    for (; i + 4 <= n; i += 4) {
+        __m128 f = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(in + i), s), o);
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(d + i), _mm_cvtps_ph(f, 0));
+    }
+#endif
+    for (; i < n; i++) {
+        d[i] = cg::floatToHalf(in[i] * scale + offset);
+    }
+}
+
+StoreFunction storeFunctionForDatatype(const std::string &datatype)
+{
+    if (datatype == "uint8") {
+        return storeUInt8;
+    }
+    else if (datatype == "uint16") {
+        return storeUInt16;
+    }
+    else if (datatype == "int16") {
+        return storeInt16;
+    }
+    else if (datatype == "uint32") {
+        return storeUInt32;
+    }
+    else if (datatype == "float32") {
+        return storeFloat32;
+    }
+    else if (datatype == "float16") {
+        return storeFloat16;
+    }
+    return nullptr;
+}
+
+// Range of values representable by (or normalized to) a data type
+void datatypeRange(const std::string &datatype, float *lo, float *hi)
+{
+    *lo = 0.0f;
+    *hi = 1.0f;
+    if (datatype == "uint8") {
+        *hi = 255.0f;
+    }
+    else if (datatype == "uint16") {
+        *hi = 65535.0f;
+    }
+    else if (datatype == "int16") {
+        *lo = -32768.0f;
+        *hi = 32767.0f;
+    }
+    else if (datatype == "uint32") {
+        *hi = 4294967040.0f;
+    }
+}
+
+// Minimum and maximum of n floats, ignoring NaN
+void floatRange(const float *in, std::size_t n, float *minValue, float *maxValue)
+{
+    float mn = *minValue;
+    float mx = *maxValue;
+    std::size_t i = 0;
+#ifdef CG_USE_SSE2
+    __m128 vmin = _mm_set1_ps(mn);
+    __m128 vmax = _mm_set1_ps(mx);
+    for (; i + 4 <= n; i += 4) {
+        // The second operand is returned for NaN inputs
+        __m128 v = _mm_loadu_ps(in + i);
+        vmin = _mm_min_ps(v, vmin);
+        vmax = _mm_max_ps(v, vmax);
+    }
+    float lanes[4];
+    _mm_storeu_ps(lanes, vmin);
+    mn = std::min(std::min(lanes[0], lanes[1]), std::min(lanes[2], lanes[3]));
+    _mm_storeu_ps(lanes, vmax);
+    mx = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+#endif
+    for (; i < n; i++) {
+        mn = in[i] < mn ? in[i] : mn;
+        mx = in[i] > mx ? in[i] : mx;
+    }
+    *minValue = mn;
+    *maxValue = mx;
+}
+
+} // namespace
+
+
+
+namespace cg {
+
+std::size_t voxelSizeInBytes(const std::string &datatype)
+{
+    if (datatype == "float16") {
+        return 2;
+    }
+    return datatypeSizeInBytes(datatype);
+}
+
+void voxelConversionNormalize(VoxelConversion *conversion, float minValue, float maxValue)
+{
+    float lo, hi;
+    datatypeRange(conversion->dstDatatype, &lo, &hi);
+    if (maxValue > minValue) {
+        conversion->scale = (hi - lo) / (maxValue - minValue);
+    }
+    else {
+        conversion->scale = 0.0f;
+    }
+    conversion->offset = lo - minValue * conversion->scale;
+}
+
+void swapBytes(std::uint8_t *dst, const std::uint8_t *src, std::size_t numElements,
+               std::size_t elementSize)
+{
+    switch (elementSize) {
+    case 2: // uint16, int16, float16
+        swap16(dst, src, numElements);
+        break;
+    case 4: // uint32, float32
+        swap32(dst, src, numElements);
+        break;
+    default:
+        if (dst != src) {
+            std::memcpy(dst, src, numElements * elementSize);
+        }
+        break;
+    }
+}
+
+bool convertVoxels(const VoxelConversion &conversion, std::uint8_t *dst,
+                   const std::uint8_t *src, std::size_t numElements)
+{
+    std::size_t srcSize = voxelSizeInBytes(conversion.srcDatatype);
+    std::size_t dstSize = voxelSizeInBytes(conversion.dstDatatype);
+    if (srcSize == 0 || dstSize == 0) {
+        return false;
+    }
+
+    // Same type without scaling: only the byte order may change
+    if (conversion.srcDatatype == conversion.dstDatatype &&
+        conversion.scale == 1.0f && conversion.offset == 0.0f) {
+        if (conversion.swapBytes) {
+            swapBytes(dst, src, numElements, srcSize);
+        }
+        else if (dst != src) {
+            std::memcpy(dst, src, numElements * srcSize);
+        }
+        return true;
+    }
+
+    LoadFunction load = loadFunctionForDatatype(conversion.srcDatatype);
+    StoreFunction store = storeFunctionForDatatype(conversion.dstDatatype);
+    if (load == nullptr || store == nullptr) {
+        return false;
+    }
+
+    float values[blockSize];
+    std::uint32_t swapped[blockSize];  // 4-byte aligned scratch for swapped elements
+    for (std::size_t i = 0; i < numElements; i += blockSize) {
+        std::size_t count = std::min(blockSize, numElements - i);
+        const std::uint8_t *block = src + i * srcSize;
+        if (conversion.swapBytes && srcSize > 1) {
+            std::uint8_t *scratch = reinterpret_cast<std::uint8_t *>(swapped);
+            swapBytes(scratch, block, count, srcSize);
+            block = scratch;
+        }
+        load(block, count, values);
+        store(values, count, conversion.scale, conversion.offset, dst + i * dstSize);
+    }
+    return true;
+}
+
+bool voxelsToFloat(const std::string &datatype, const std::uint8_t *src,
+                   std::size_t numElements, float *dst)
+{
+    LoadFunction load = loadFunctionForDatatype(datatype);
+    if (load == nullptr) {
+        return false;
+    }
+    load(src, numElements, dst);
+    return true;
+}
+
+bool voxelValueRange(const std::string &datatype, bool swap, const std::uint8_t *src,
+                     std::size_t numElements, float *minValue, float *maxValue)
+{
+    std::size_t elementSize = voxelSizeInBytes(datatype);
+    LoadFunction load = loadFunctionForDatatype(datatype);
+    if (load == nullptr) {
+        return false;
+    }
+
+    std::size_t numBlocks = (numElements + blockSize - 1) / blockSize;
+    float rangeMin = std::numeric_limits<float>::infinity();
+    float rangeMax = -std::numeric_limits<float>::infinity();
+    std::mutex rangeMutex;
+    parallelFor(0, numBlocks, [&](std::size_t first, std::size_t last) {
+        float values[blockSize];
+        std::uint32_t swapped[blockSize];
+        float mn = std::numeric_limits<float>::infinity();
+        float mx = -std::numeric_limits<float>::infinity();
+        for (std::size_t b = first; b < last; b++) {
+            std::size_t count = std::min(blockSize, numElements - b * blockSize);
+            const std::uint8_t *block = src + b * blockSize * elementSize;
+            if (swap && elementSize > 1) {
+                std::uint8_t *scratch = reinterpret_cast<std::uint8_t *>(swapped);
+                swapBytes(scratch, block, count, elementSize);
+                block = scratch;
+            }
+            load(block, count, values);
+            floatRange(values, count, &mn, &mx);
+        }
+        std::lock_guard<std::mutex> lock(rangeMutex);
+        rangeMin = std::min(rangeMin, mn);
+        rangeMax = std::max(rangeMax, mx);
+    });
+
+    *minValue = rangeMin;
+    *maxValue = rangeMax;
+    if (*minValue > *maxValue) {  // empty or all NaN
+        *minValue = 0.0f;
+        *maxValue = 0.0f;
+    }
+    return true;
+}
+
+bool voxelHistogram(const std::string &datatype, bool swap, const std::uint8_t *src,
+                    std::size_t numElements, float minValue, float maxValue,
+                    std::uint64_t *bins, std::size_t numBins)
+{
+    std::size_t elementSize = voxelSizeInBytes(datatype);
+    LoadFunction load = loadFunctionForDatatype(datatype);
+    if (load == nullptr || numBins == 0) {
+        return false;
+    }
+
+    std::size_t numBlocks = (numElements + blockSize - 1) / blockSize;
+    float binScale = maxValue > minValue ? float(numBins) / (maxValue - minValue) : 0.0f;
+    std::mutex binsMutex;
+    parallelFor(0, numBlocks, [&](std::size_t first, std::size_t last) {
+        float values[blockSize];
+        std::uint32_t swapped[blockSize];
+        std::vector<std::uint64_t> partial(numBins, 0);
+        for (std::size_t b = first; b < last; b++) {
+            std::size_t count = std::min(blockSize, numElements - b * blockSize);
+            const std::uint8_t *block = src + b * blockSize * elementSize;
+            if (swap && elementSize > 1) {
+                std::uint8_t *scratch = reinterpret_cast<std::uint8_t *>(swapped);
+                swapBytes(scratch, block, count, elementSize);
+                block = scratch;
+            }
+            load(block, count, values);
+            for (std::size_t i = 0; i < count; i++) {
+                float bin = (values[i] - minValue) * binScale;
+                if (bin >= 0.0f && values[i] <= maxValue) {  // also skips NaN
+                    partial[std::min(std::size_t(bin), numBins - 1)]++;
+                }
+            }
+        }
+        std::lock_guard<std::mutex> lock(binsMutex);
+        for (std::size_t i = 0; i < numBins; i++) {
+            bins[i] += partial[i];
+        }
+    }, 64);
+    return true;
+}
+
+float histogramPercentile(const std::uint64_t *bins, std::size_t numBins, float minValue,
+                          float maxValue, float fraction)
+{
+    std::uint64_t total = 0;
+    for (std::size_t i = 0; i < numBins; i++) {
+        total += bins[i];
+    }
+    if (total == 0) {
+        return minValue;
+    }
+
+    // Interpolate linearly within the bin that contains the percentile
+    double target = double(std::min(std::max(fraction, 0.0f), 1.0f)) * double(total);
+    double binWidth = double(maxValue - minValue) / double(numBins);
+    std::uint64_t count = 0;
+    for (std::size_t i = 0; i < numBins; i++) {
+        if (bins[i] > 0 && double(count + bins[i]) >= target) {
+            double t = (target - double(count)) / double(bins[i]);
+            return float(minValue + (double(i) + t) * binWidth);
+        }
+        count += bins[i];
+    }
+    return maxValue;
+}
+
+bool convertVoxelsParallel(const VoxelConversion &conversion, std::uint8_t *dst,
+                           const std::uint8_t *src, std::size_t numElements,
+                           std::size_t rowLength)
+{
+    std::size_t srcSize = voxelSizeInBytes(conversion.srcDatatype);
+    std::size_t dstSize = voxelSizeInBytes(conversion.dstDatatype);
+    if (srcSize == 0 || dstSize == 0) {
+        return false;
+    }
+    rowLength = std::max<std::size_t>(rowLength, 1);
+    std::size_t numRows = (numElements + rowLength - 1) / rowLength;
+    bool ok = true;
+    parallelFor(0, numRows, [&](std::size_t first, std::size_t last) {
+        std::size_t begin = first * rowLength;
+        std::size_t end = std::min(last * rowLength, numElements);
+        if (!convertVoxels(conversion, dst + begin * dstSize, src + begin * srcSize, end - begin)) {
+            ok = false;
+        }
+    });
+    return ok;
+}
+
+bool volumeConvert(const VolumeBase &src, VolumeBase *dst, const std::string &datatype,
+                   bool normalize)
+{
+    std::size_t numElements = volumeNumVoxels(src);
+    std::size_t dstSize = voxelSizeInBytes(datatype);
+    if (dstSize == 0 || numElements * datatypeSizeInBytes(src.datatype) > src.data.size()) {
+        return false;
+    }
+
+    VoxelConversion conversion;
+    conversion.srcDatatype = src.datatype;
+    conversion.dstDatatype = datatype;
+    if (normalize) {
+        float minValue, maxValue;
+        if (!voxelValueRange(src.datatype, false, &src.data[0], numElements, &minValue, &maxValue)) {
+            return false;
+        }
+        voxelConversionNormalize(&conversion, minValue, maxValue);
+    }
+
+    // Convert into a new buffer, so that src and dst may be the same volume
+    std::vector<std::uint8_t> data(numElements * dstSize);
+    std::size_t sliceLength = std::size_t(src.dimensions.x) * std::size_t(src.dimensions.y);
+    if (!convertVoxelsParallel(conversion, &data[0], &src.data[0], numElements, sliceLength)) {
+        return false;
+    }
+
+    dst->dimensions = src.dimensions;
+    dst->origin = src.origin;
+    dst->spacing = src.spacing;
+    dst->datatype = datatype;
+    dst->data.swap(data);
+    return true;
+}
+
+std::uint16_t floatToHalf(float value)
+{
+    std::uint32_t f;
+    std::memcpy(&f, &value, sizeof(f));
+    std::uint32_t sign = (f >> 16) & 0x8000u;
+    std::uint32_t absf = f & 0x7fffffffu;
+
+    if (absf >= 0x7f800000u) {  // inf or nan
+        return std::uint16_t(sign | 0x7c00u | (absf > 0x7f800000u ? 0x200u : 0u));
+    }
+    if (absf >= 0x477ff000u) {  // rounds to a value above the largest half (65504)
+        return std::uint16_t(sign | 0x7c00u);
+    }
+    if (absf < 0x38800000u) {  // below 2^-14: subnormal half or zero
+        std::uint32_t exponent = absf >> 23;
+        std::uint32_t shift = 126 - exponent;
+        if (shift > 24) {
+            return std::uint16_t(sign);
+        }
+        std::uint32_t mantissa = (absf & 0x7fffffu) | 0x800000u;
+        std::uint32_t result = mantissa >> shift;
+        std::uint32_t remainder = mantissa & ((1u << shift) - 1);
+        std::uint32_t halfway = 1u << (shift - 1);
+        if (remainder > halfway || (remainder == halfway && (result & 1u))) {
+            result++;
+        }
+        return std::uint16_t(sign | result);
+    }
+
+    std::uint32_t result = (((absf >> 23) - 112) << 10) | ((absf & 0x7fffffu) >> 13);
+    std::uint32_t remainder = absf & 0x1fffu;
+    if (remainder > 0x1000u || (remainder == 0x1000u && (result & 1u))) {
+        result++;
+    }
+    return std::uint16_t(sign | result);
+}
+
+float halfToFloat(std::uint16_t value)
+{
+    std::uint32_t sign = std::uint32_t(value & 0x8000u) << 16;
+    std::uint32_t exponent = (value >> 10) & 0x1fu;
+    std::uint32_t mantissa = value & 0x3ffu;
+    std::uint32_t f;
+    if (exponent == 0) {
+        float result = std::ldexp(float(mantissa), -24);
+        return sign ? -result : result;
+    }
+    else if (exponent == 31) {
+        f = sign | 0x7f800000u | (mantissa << 13);
+    }
+    else {
+        f = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    }
+    float result;
+    std::memcpy(&result, &f, sizeof(result));
+    return result;
+}
+
+} // namespace cg
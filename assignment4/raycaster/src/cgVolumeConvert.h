@@ -0,0 +1,95 @@
+#pragma once
+
+#include "cgVolume.h"
+
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+namespace cg {
+
+// Struct describing a conversion of voxel values from one data type to
+// another. Besides the types supported by volumeLoadVTK(), "float16"
+// (IEEE half precision, stored as std::uint16_t) is a valid target.
+// Converted values are computed as value * scale + offset, rounded to
+// the nearest integer and clamped for integer targets.
+struct VoxelConversion {
+    std::string srcDatatype;  // data type of the source elements
+    std::string dstDatatype;  // data type of the destination elements
+    bool swapBytes;  // source elements are stored in the other byte order
+    float scale;
+    float offset;
+
+    VoxelConversion() :
+        swapBytes(false),
+        scale(1.0f),
+        offset(0.0f)
+    {}
+};
+
+// Returns the size in bytes of one element of the given data type,
+// including conversion-only types such as "float16"
+std::size_t voxelSizeInBytes(const std::string &datatype);
+
+// Sets up scale and offset of the conversion so that source values in
+// [minValue, maxValue] map to the full range of the destination type
+// ([0, 1] for floating point types)
+void voxelConversionNormalize(VoxelConversion *conversion, float minValue, float maxValue);
+
+// Swaps the byte order of numElements elements of elementSize bytes (1,
+// 2 or 4) from src into dst. src and dst may point to the same buffer.
+// Uses SSE/AVX2 when available.
+void swapBytes(std::uint8_t *dst, const std::uint8_t *src, std::size_t numElements,
+               std::size_t elementSize);
+
+// Converts numElements elements from src into dst in a single pass,
+// swapping the byte order of the source elements first if requested.
+// src and dst must not overlap. Uses SSE/AVX2 when available. Returns
+// false if a data type is not supported.
+bool convertVoxels(const VoxelConversion &conversion, std::uint8_t *dst,
+                   const std::uint8_t *src, std::size_t numElements);
+
+// Same as convertVoxels(), but processes rows of rowLength elements
+// (e.g., slices of a volume) in parallel. src and dst may be the same
+// buffer if only the byte order changes.
+bool convertVoxelsParallel(const VoxelConversion &conversion, std::uint8_t *dst,
+                           const std::uint8_t *src, std::size_t numElements,
+                           std::size_t rowLength);
+
+// Widens numElements elements of the given data type to float (on the
+// calling thread). Returns false if the data type is not supported.
+bool voxelsToFloat(const std::string &datatype, const std::uint8_t *src,
+                   std::size_t numElements, float *dst);
+
+// Computes the range of values of numElements elements in src (in
+// parallel). The source may be stored in the other byte order.
+bool voxelValueRange(const std::string &datatype, bool swapBytes, const std::uint8_t *src,
+                     std::size_t numElements, float *minValue, float *maxValue);
+
+// Adds the values of numElements elements in src to a histogram of
+// numBins bins over [minValue, maxValue] (in parallel). Values outside
+// the range are skipped. The source may be stored in the other byte
+// order.
+bool voxelHistogram(const std::string &datatype, bool swapBytes, const std::uint8_t *src,
+                    std::size_t numElements, float minValue, float maxValue,
+                    std::uint64_t *bins, std::size_t numBins);
+
+// Returns the value below which the given fraction (0 to 1) of the
+// values in a histogram over [minValue, maxValue] lies
+float histogramPercentile(const std::uint64_t *bins, std::size_t numBins, float minValue,
+                          float maxValue, float fraction);
+
+// Converts a volume image to the given data type, processing slices in
+// parallel. If normalize is true, the value range of the source is
+// mapped to the full range of the target type; otherwise values are
+// clamped. Returns true on success, false otherwise.
+bool volumeConvert(const VolumeBase &src, VolumeBase *dst, const std::string &datatype,
+                   bool normalize);
+
+// Converts a float to IEEE half precision (round to nearest even)
+std::uint16_t floatToHalf(float value);
+
+// Converts an IEEE half precision value to float
+float halfToFloat(std::uint16_t value);
+
+} // namespace cg
@@ -0,0 +1,148 @@
+#include "cgVolumeEdit.h"
+#include "cgVolumeConvert.h"
+#include "cgParallel.h"
+
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+
+namespace {
+
+// Brush slices are filled in parallel in ranges of at least this many
+// slices, so that small brushes stay on the calling thread
+const std::size_t brushMinSlices = 16;
+
+} // namespace
+
+
+
+namespace cg {
+
+void dirtyBricksInit(DirtyBricks *dirty, const glm::ivec3 &dimensions, int brickSize)
+{
+    dirty->grid = brickGridCreate(dimensions, brickSize);
+    dirty->flags.assign(brickGridNumBricks(dirty->grid), 0);
+    dirty->bricks.clear();
+}
+
+void dirtyBricksMark(DirtyBricks *dirty, const glm::ivec3 &origin, const glm::ivec3 &size)
+{
+    const BrickGrid &grid = dirty->grid;
+    glm::ivec3 lo = glm::max(origin, glm::ivec3(0));
+    glm::ivec3 hi = glm::min(origin + size, grid.dimensions);  // exclusive
+    if (glm::any(glm::lessThanEqual(hi, lo))) {
+        return;
+    }
+    glm::ivec3 first = lo / grid.brickSize;
+    glm::ivec3 last = (hi - 1) / grid.brickSize;
+    for (int z = first.z; z <= last.z; z++) {
+        for (int y = first.y; y <= last.y; y++) {
+            for (int x = first.x; x <= last.x; x++) {
+                std::size_t index = brickGridIndex(grid, glm::ivec3(x, y, z));
+                if (!dirty->flags[index]) {
+                    dirty->flags[index] = 1;
+                    dirty->bricks.push_back(index);
+                }
+            }
+        }
+    }
+}
+
+void dirtyBricksClear(DirtyBricks *dirty)
+{
+    for (std::size_t i = 0; i < dirty->bricks.size(); i++) {
+        dirty->flags[dirty->bricks[i]] = 0;
+    }
+    dirty->bricks.clear();
+}
+
+bool volumeApplyBrush(VolumeBase *volume, const VolumeBrush &brush, glm::ivec3 *origin,
+                      glm::ivec3 *size)
+{
+    const glm::ivec3 &dims = volume->dimensions;
+    std::size_t elementSize = datatypeSizeInBytes(volume->datatype);
+    *origin = glm::ivec3(0);
+    *size = glm::ivec3(0);
+    if (elementSize == 0 || volume->data.size() < volumeNumVoxels(*volume) * elementSize) {
+        std::cerr << "Cannot edit volume of data type " << volume->datatype << std::endl;
+        return false;
+    }
+    if (glm::any(glm::lessThanEqual(brush.radius, glm::vec3(0.0f)))) {
+        return true;
+    }
+
+    // The brush value is converted to the data type once, then copied
+    std::uint8_t value[8];
+    VoxelConversion conversion;
+    conversion.srcDatatype = "float32";
+    conversion.dstDatatype = volume->datatype;
+    const std::uint8_t *src = reinterpret_cast<const std::uint8_t *>(&brush.value);
+    if (!convertVoxels(conversion, value, src, 1)) {
+        return false;
+    }
+
+    glm::ivec3 lo = glm::max(glm::ivec3(glm::ceil(brush.center - brush.radius)), glm::ivec3(0));
+    glm::ivec3 hi = glm::min(glm::ivec3(glm::floor(brush.center + brush.radius)), dims - 1);
+    if (glm::any(glm::lessThan(hi, lo))) {
+        return true;
+    }
+    *origin = lo;
+    *size = hi - lo + 1;
+
+    std::uint8_t *voxels = &volume->data[0];
+    parallelFor(std::size_t(lo.z), std::size_t(hi.z) + 1, [&](std::size_t first, std::size_t last) {
+        for (std::size_t z = first; z < last; z++) {
+            float dz = (float(z) - brush.center.z) / brush.radius.z;
+            for (int y = lo.y; y <= hi.y; y++) {
+                float dy = (float(y) - brush.center.y) / brush.radius.y;
+                float remaining = 1.0f - dy * dy - dz * dz;
+                if (remaining < 0.0f) {
+                    continue;
+                }
+                // The span of the row within the ellipsoid
+                float halfWidth = brush.radius.x * std::sqrt(remaining);
+                int x0 = std::max(int(std::ceil(brush.center.x - halfWidth)), 0);
+                int x1 = std::min(int(std::floor(brush.center.x + halfWidth)), dims.x - 1);
+                std::uint8_t *row = voxels + (z * dims.y + y) * std::size_t(dims.x) * elementSize;
+                for (int x = x0; x <= x1; x++) {
+                    std::memcpy(row + x * elementSize, value, elementSize);
+                }
+            }
+        }
+    }, brushMinSlices);
+    return true;
+}
+
+bool volumeExtractRegion(const VolumeBase &volume, const glm::ivec3 &origin, const glm::ivec3 &size,
+                         VolumeBase *dst)
+{
+    const glm::ivec3 &dims = volume.dimensions;
+    std::size_t elementSize = datatypeSizeInBytes(volume.datatype);
+    if (elementSize == 0 || volume.data.size() < volumeNumVoxels(volume) * elementSize ||
+        glm::any(glm::lessThan(origin, glm::ivec3(0))) ||
+        glm::any(glm::lessThan(size, glm::ivec3(1))) ||
+        glm::any(glm::greaterThan(origin + size, dims))) {
+        std::cerr << "Cannot extract region of volume" << std::endl;
+        return false;
+    }
+    VolumeBase region;
+    region.dimensions = size;
+    region.origin = volume.origin + glm::vec3(origin) * volume.spacing;
+    region.spacing = volume.spacing;
+    region.datatype = volume.datatype;
+    region.data.resize(volumeNumVoxels(region) * elementSize);
+    std::size_t rowBytes = std::size_t(size.x) * elementSize;
+    for (int z = 0; z < size.z; z++) {
+        for (int y = 0; y < size.y; y++) {
+            std::size_t src = (std::size_t(origin.z + z) * dims.y + origin.y + y) * dims.x +
+                              origin.x;
+            std::size_t dstRow = std::size_t(z) * size.y + y;
+            std::memcpy(&region.data[dstRow * rowBytes], &volume.data[src * elementSize], rowBytes);
+        }
+    }
+    *dst = std::move(region);
+    return true;
+}
+
+} // namespace cg
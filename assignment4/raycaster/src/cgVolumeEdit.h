@@ -0,0 +1,59 @@
+#pragma once
+
+#include "cgVolume.h"
+#include "cgBrickGrid.h"
+
+#include <vector>
+#include <cstdint>
+
+namespace cg {
+
+// Struct for the bricks of a volume that have been edited since the data
+// derived from the volume (e.g., its texture) was last updated
+struct DirtyBricks {
+    BrickGrid grid;
+    std::vector<std::uint8_t> flags;  // one per brick
+    std::vector<std::size_t> bricks;  // indices of the dirty bricks, in the order they were marked
+};
+
+// Struct for a brush that sets the voxels within an ellipsoid to a value
+struct VolumeBrush {
+    glm::vec3 center;  // in voxel coordinates (voxel centers at integers)
+    glm::vec3 radius;  // in voxels, per axis (so that the brush can be round in world units)
+    float value;  // in the units of the voxels
+
+    VolumeBrush() :
+        center(glm::vec3(0.0f)),
+        radius(glm::vec3(1.0f)),
+        value(0.0f)
+    {}
+};
+
+// Sets up the dirty brick tracking for a volume of the given dimensions,
+// with no brick dirty
+void dirtyBricksInit(DirtyBricks *dirty, const glm::ivec3 &dimensions, int brickSize);
+
+// Marks the bricks that overlap the region [origin, origin + size) of the
+// volume as dirty. The region is clipped to the volume.
+void dirtyBricksMark(DirtyBricks *dirty, const glm::ivec3 &origin, const glm::ivec3 &size);
+
+// Marks all bricks as clean again
+void dirtyBricksClear(DirtyBricks *dirty);
+
+// Applies a brush to a volume image (in LAYOUT_LINEAR): every voxel whose
+// center lies within the ellipsoid is set to the brush value (rounded and
+// clamped to the data type). Only the rows that the ellipsoid covers are
+// touched, so the cost scales with the brush size. Returns the bounding
+// box of the ellipsoid within the volume in origin and size (size is 0
+// along some axis if it misses the volume). Returns false if the data type
+// is not supported.
+bool volumeApplyBrush(VolumeBase *volume, const VolumeBrush &brush, glm::ivec3 *origin,
+                      glm::ivec3 *size);
+
+// Copies the region [origin, origin + size) of a volume image (in
+// LAYOUT_LINEAR) into dst, as a volume image of that size. Returns false
+// if the region is not within the volume.
+bool volumeExtractRegion(const VolumeBase &volume, const glm::ivec3 &origin, const glm::ivec3 &size,
+                         VolumeBase *dst);
+
+} // namespace cg
@@ -0,0 +1,238 @@
+#include "cgVolumeFilter.h"
+#include "cgVolumeConvert.h"
+#include "cgParallel.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CG_USE_SSE2
+#include <emmintrin.h>
+#endif
+#if defined(__AVX__)
+#define CG_USE_AVX
+#include <immintrin.h>
+#endif
+
+namespace {
+
+// Adds weight * in[i] to out[i] for n floats. Every pass of the
+// convolution is made of these row updates.
+void accumulate(float *out, const float *in, float weight, std::size_t n)
+{
+    std::size_t i = 0;
+#ifdef CG_USE_AVX
+    const __m256 w8 = _mm256_set1_ps(weight);
+    for (; i + 8 <= n; i += 8) {
+        __m256 v = _mm256_add_ps(_mm256_loadu_ps(out + i), _mm256_mul_ps(w8, _mm256_loadu_ps(in + i)));
+        _mm256_storeu_ps(out + i, v);
+    }
+#endif
+#ifdef CG_USE_SSE2
+    const __m128 w4 = _mm_set1_ps(weight);
+    for (; i + 4 <= n; i += 4) {
+        _mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(out + i), _mm_mul_ps(w4, _mm_loadu_ps(in + i))));
+    }
+#endif
+    for (; i < n; i++) {
+        out[i] += weight * in[i];
+    }
+}
+
+// Returns true if the kernel leaves its input unchanged
+bool isIdentity(const std::vector<float> &kernel)
+{
+    return kernel.size() == 1 && kernel[0] == 1.0f;
+}
+
+// Convolves each of numRows rows of rowLength floats along the row.
+// padded is a buffer of rowLength + kernel.size() - 1 floats.
+void convolveAlongRows(const float *in, float *out, std::size_t numRows, std::size_t rowLength,
+                       const std::vector<float> &kernel, float *padded)
+{
+    std::size_t radius = kernel.size() / 2;
+    for (std::size_t row = 0; row < numRows; row++) {
+        const float *src = in + row * rowLength;
+        float *dst = out + row * rowLength;
+        std::fill(padded, padded + radius, src[0]);
+        std::copy(src, src + rowLength, padded + radius);
+        std::fill(padded + radius + rowLength, padded + 2 * radius + rowLength, src[rowLength - 1]);
+        std::fill(dst, dst + rowLength, 0.0f);
+        for (std::size_t k = 0; k < kernel.size(); k++) {
+            accumulate(dst, padded + k, kernel[k], rowLength);
+        }
+    }
+}
+
+// Convolves across rows: output row j (for j in [firstRow, lastRow)) is
+// the weighted sum of input rows j - radius to j + radius, clamped to
+// [0, numRows)
+void convolveAcrossRows(const float *in, float *out, int numRows, std::size_t rowLength,
+                        const std::vector<float> &kernel, int firstRow, int lastRow)
+{
+    int radius = int(kernel.size() / 2);
+    for (int row = firstRow; row < lastRow; row++) {
+        float *dst = out + row * rowLength;
+        std::fill(dst, dst + rowLength, 0.0f);
+        for (int k = 0; k < int(kernel.size()); k++) {
+            int src = std::min(std::max(row + k - radius, 0), numRows - 1);
+            accumulate(dst, in + src * rowLength, kernel[k], rowLength);
+        }
+    }
+}
+
+// Converts n floats back to the voxel data type (rounded and clamped;
+// the data type has been checked already)
+void storeVoxels(const cg::VoxelConversion &conversion, const float *src, std::size_t n,
+                 std::uint8_t *dst)
+{
+    cg::convertVoxels(conversion, dst, reinterpret_cast<const std::uint8_t *>(src), n);
+}
+
+} // namespace
+
+
+
+namespace cg {
+
+std::vector<float> convolutionKernelGaussian(float sigma)
+{
+    if (!(sigma > 0.0f)) {
+        return std::vector<float>(1, 1.0f);
+    }
+    int radius = std::max(int(std::ceil(3.0f * sigma)), 1);
+    std::vector<float> kernel(2 * radius + 1);
+    float sum = 0.0f;
+    for (int i = -radius; i <= radius; i++) {
+        kernel[i + radius] = std::exp(-0.5f * i * i / (sigma * sigma));
+        sum += kernel[i + radius];
+    }
+    for (auto it = kernel.begin(); it != kernel.end(); ++it) {
+        *it /= sum;
+    }
+    return kernel;
+}
+
+void convolutionAccumulate(float *out, const float *in, float weight, std::size_t n)
+{
+    accumulate(out, in, weight, n);
+}
+
+std::vector<float> convolutionKernelBox(int radius)
+{
+    radius = std::max(radius, 0);
+    return std::vector<float>(2 * radius + 1, 1.0f / (2 * radius + 1));
+}
+
+bool volumeConvolveSeparable(VolumeBase *volume, const std::vector<float> &kernelX,
+                             const std::vector<float> &kernelY, const std::vector<float> &kernelZ,
+                             ConvolutionMode mode)
+{
+    const std::vector<float> *kernels[3] = { &kernelX, &kernelY, &kernelZ };
+    for (int axis = 0; axis < 3; axis++) {
+        if (kernels[axis]->size() % 2 == 0) {
+            std::cerr << "Convolution kernels must have an odd number of taps" << std::endl;
+            return false;
+        }
+    }
+    std::size_t elementSize = datatypeSizeInBytes(volume->datatype);
+    std::size_t n = volumeNumVoxels(*volume);
+    if (elementSize == 0 || n == 0 || volume->data.size() < n * elementSize) {
+        std::cerr << "Cannot convolve volume of data type " << volume->datatype << std::endl;
+        return false;
+    }
+    bool filterXY = !isIdentity(kernelX) || !isIdentity(kernelY);
+    bool filterZ = !isIdentity(kernelZ);
+    if (!filterXY && !filterZ) {
+        return true;
+    }
+
+    const glm::ivec3 &dims = volume->dimensions;
+    std::size_t sliceVoxels = std::size_t(dims.x) * std::size_t(dims.y);
+    std::size_t maxTaps = std::max(kernelX.size(), std::max(kernelY.size(), kernelZ.size()));
+    std::uint8_t *voxels = &volume->data[0];
+    VoxelConversion conversion;
+    conversion.srcDatatype = "float32";
+    conversion.dstDatatype = volume->datatype;
+
+    // The x and y passes of a slice need only that slice, so slices are
+    // filtered independently: in float copies of the whole volume, or
+    // in a per-thread copy of the slice that is stored back right away
+    std::vector<float> ping, pong;
+    if (mode == CONVOLUTION_PING_PONG) {
+        ping.resize(n);
+        pong.resize(n);
+    }
+    parallelFor(0, std::size_t(mode == CONVOLUTION_PING_PONG || filterXY ? dims.z : 0),
+                [&](std::size_t first, std::size_t last) {
+        std::vector<float> slice, temp;
+        if (mode == CONVOLUTION_IN_PLACE) {
+            slice.resize(sliceVoxels);
+            temp.resize(sliceVoxels);
+        }
+        std::vector<float> padded(std::size_t(dims.x) + maxTaps);
+        for (std::size_t z = first; z < last; z++) {
+            float *a = mode == CONVOLUTION_PING_PONG ? &ping[z * sliceVoxels] : &slice[0];
+            float *b = mode == CONVOLUTION_PING_PONG ? &pong[z * sliceVoxels] : &temp[0];
+            std::uint8_t *src = voxels + z * sliceVoxels * elementSize;
+            voxelsToFloat(volume->datatype, src, sliceVoxels, a);
+            if (!isIdentity(kernelX)) {
+                convolveAlongRows(a, b, dims.y, dims.x, kernelX, &padded[0]);
+                std::swap(a, b);
+            }
+            if (!isIdentity(kernelY)) {
+                convolveAcrossRows(a, b, dims.y, dims.x, kernelY, 0, dims.y);
+                std::swap(a, b);
+            }
+            if (mode == CONVOLUTION_IN_PLACE) {
+                storeVoxels(conversion, a, sliceVoxels, src);
+            }
+            else if (a != &ping[z * sliceVoxels]) {
+                std::copy(a, a + sliceVoxels, &ping[z * sliceVoxels]);
+            }
+        }
+    }, 1);
+
+    // The z pass filters whole slices of the float copy, or in place,
+    // one xz-plane of the volume at a time (i.e., the rows of all
+    // slices at one y)
+    if (mode == CONVOLUTION_PING_PONG) {
+        if (filterZ) {
+            parallelFor(0, std::size_t(dims.z), [&](std::size_t first, std::size_t last) {
+                convolveAcrossRows(&ping[0], &pong[0], dims.z, sliceVoxels, kernelZ,
+                                   int(first), int(last));
+            }, 1);
+            ping.swap(pong);
+        }
+        parallelFor(0, std::size_t(dims.z), [&](std::size_t first, std::size_t last) {
+            storeVoxels(conversion, &ping[first * sliceVoxels], (last - first) * sliceVoxels,
+                        voxels + first * sliceVoxels * elementSize);
+        }, 1);
+    }
+    else if (filterZ) {
+        std::size_t rowBytes = std::size_t(dims.x) * elementSize;
+        parallelFor(0, std::size_t(dims.y), [&](std::size_t first, std::size_t last) {
+            std::vector<float> plane(std::size_t(dims.x) * dims.z), filtered(plane.size());
+            for (std::size_t y = first; y < last; y++) {
+                for (int z = 0; z < dims.z; z++) {
+                    voxelsToFloat(volume->datatype, voxels + (z * sliceVoxels + y * dims.x) * elementSize,
+                                  dims.x, &plane[z * dims.x]);
+                }
+                convolveAcrossRows(&plane[0], &filtered[0], dims.z, dims.x, kernelZ, 0, dims.z);
+                for (int z = 0; z < dims.z; z++) {
+                    storeVoxels(conversion, &filtered[z * dims.x], dims.x,
+                                voxels + z * sliceVoxels * elementSize + y * rowBytes);
+                }
+            }
+        }, 1);
+    }
+    return true;
+}
+
+bool volumeSmoothGaussian(VolumeBase *volume, float sigma, ConvolutionMode mode)
+{
+    std::vector<float> kernel = convolutionKernelGaussian(sigma);
+    return volumeConvolveSeparable(volume, kernel, kernel, kernel, mode);
+}
+
+} // namespace cg
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "cgVolume.h"
+
+#include <iostream>
+#include <vector>
+
+namespace cg {
+
+// How separable convolution buffers intermediate results
+enum ConvolutionMode {
+    // The volume is filtered in two float copies of it and rounded to
+    // its data type once at the end (most accurate, 8 bytes per voxel)
+    CONVOLUTION_PING_PONG = 0,
+    // The volume is filtered in place, slice by slice for the x and y
+    // passes and row by row for the z pass, so that only a few slices
+    // are held as float per thread. Results are rounded to the data type
+    // after the y and the z pass.
+    CONVOLUTION_IN_PLACE = 1
+};
+
+// Returns a normalized Gaussian kernel of the given standard deviation
+// (in voxels), truncated at three standard deviations. Returns the
+// identity kernel {1} if sigma is not positive.
+std::vector<float> convolutionKernelGaussian(float sigma);
+
+// Adds weight * in[i] to out[i] for n floats (with SSE/AVX where
+// available). Every pass of a convolution is made of these row updates,
+// here and in the smoothing stage of the volume pipeline.
+void convolutionAccumulate(float *out, const float *in, float weight, std::size_t n);
+
+// Returns a normalized box kernel of 2 * radius + 1 taps
+std::vector<float> convolutionKernelBox(int radius);
+
+// Convolves a volume image (in LAYOUT_LINEAR) with a separable kernel,
+// given as one 1D kernel of odd size per axis, centered on the middle
+// tap. Voxels outside the volume repeat the border voxels. Passes with
+// the identity kernel {1} are skipped. Slices (or rows) are processed
+// in parallel with SSE/AVX inner loops where available. Supports all
+// data types of VolumeBase; integer results are rounded and clamped.
+// Returns false if a kernel or the data type is not supported.
+bool volumeConvolveSeparable(VolumeBase *volume, const std::vector<float> &kernelX,
+                             const std::vector<float> &kernelY, const std::vector<float> &kernelZ,
+                             ConvolutionMode mode = CONVOLUTION_PING_PONG);
+
+// Smooths a volume image with a Gaussian of the given standard
+// deviation (in voxels) along every axis
+bool volumeSmoothGaussian(VolumeBase *volume, float sigma,
+                          ConvolutionMode mode = CONVOLUTION_PING_PONG);
+
+// Convolves a typed volume image with a separable kernel (see above).
+// Bricked volumes must be converted to LAYOUT_LINEAR first.
+template<typename VoxelType>
+inline bool volumeConvolveSeparable(Volume<VoxelType> *volume, const std::vector<float> &kernelX,
+                                    const std::vector<float> &kernelY,
+                                    const std::vector<float> &kernelZ,
+                                    ConvolutionMode mode = CONVOLUTION_PING_PONG)
+{
+    if (volume->layout != LAYOUT_LINEAR) {
+        std::cerr << "Convolution needs a volume in linear layout" << std::endl;
+        return false;
+    }
+    return volumeConvolveSeparable(&volume->base, kernelX, kernelY, kernelZ, mode);
+}
+
+// Smooths a typed volume image with a Gaussian (see above)
+template<typename VoxelType>
+inline bool volumeSmoothGaussian(Volume<VoxelType> *volume, float sigma,
+                                 ConvolutionMode mode = CONVOLUTION_PING_PONG)
+{
+    std::vector<float> kernel = convolutionKernelGaussian(sigma);
+    return volumeConvolveSeparable(volume, kernel, kernel, kernel, mode);
+}
+
+} // namespace cg
@@ -0,0 +1,300 @@
+#include "cgVolumeGradient.h"
+#include "cgVolumeConvert.h"
+#include "cgVolumeEdit.h"
+#include "cgParallel.h"
+
+#include <iostream>
+#include <algorithm>
+#include <mutex>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CG_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// Slices per slab of cg::volumeComputeGradientTexelsSlices()
+const int gradientSlabSlices = 32;
+
+// Calls fn(row, gx, gy, gz) for every row of the slices [first, last) of
+// a volume, with the gradient components of the row's voxels (row is
+// the index of the row in the volume). Slices are converted to float
+// padded by one voxel on each side, and each slice is converted once.
+template<typename Function>
+void forEachGradientRow(const cg::VolumeBase &volume, cg::GradientOperator op,
+                        std::size_t first, std::size_t last, Function fn)
+{
+    const glm::ivec3 &dims = volume.dimensions;
+    std::size_t sliceVoxels = std::size_t(dims.x) * std::size_t(dims.y);
+    std::size_t elementSize = cg::datatypeSizeInBytes(volume.datatype);
+    std::size_t w = std::size_t(dims.x) + 2;  // padded row length
+    std::size_t paddedSlice = w * (std::size_t(dims.y) + 2);
+    glm::vec3 h;  // 1 / (2 * spacing), and 1 / 16 for the smoothing of the Sobel operator
+    for (int axis = 0; axis < 3; axis++) {
+        h[axis] = 0.5f / (volume.spacing[axis] > 0.0f ? volume.spacing[axis] : 1.0f);
+    }
+    if (op == cg::GRADIENT_SOBEL) {
+        h /= 16.0f;
+    }
+
+    // Slice s is kept in slot s % 3
+    std::vector<float> slices(3 * paddedSlice);
+    int loaded[3] = { -1, -1, -1 };
+    auto slice = [&](int s) {
+        float *dst = &slices[(s % 3) * paddedSlice];
+        if (loaded[s % 3] != s) {
+            for (int y = 0; y < dims.y; y++) {
+                float *row = dst + (y + 1) * w;
+                cg::voxelsToFloat(volume.datatype,
+                                  &volume.data[(s * sliceVoxels + std::size_t(y) * dims.x) * elementSize],
+                                  dims.x, row + 1);
+                row[0] = row[1];
+                row[w - 1] = row[w - 2];
+            }
+            std::copy(dst + w, dst + 2 * w, dst);
+            std::copy(dst + dims.y * w, dst + (dims.y + 1) * w, dst + (dims.y + 1) * w);
+            loaded[s % 3] = s;
+        }
+        return dst;
+    };
+
+    std::vector<float> gx(dims.x), gy(dims.x), gz(dims.x);
+    std::vector<float> syz(w), dy(w), dz(w);  // partial sums over the padded row (Sobel)
+    for (int z = int(first); z < int(last); z++) {
+        const float *below = slice(std::max(z - 1, 0));
+        const float *above = slice(std::min(z + 1, dims.z - 1));
+        const float *center = slice(z);
+        for (int y = 0; y < dims.y; y++) {
+            std::size_t offset = (y + 1) * w;
+            const float *c = center + offset;
+            const float *b = below + offset;
+            const float *a = above + offset;
+            const float *c0 = c - w, *c1 = c + w;  // the rows before and after
+            if (op == cg::GRADIENT_CENTRAL_DIFFERENCES) {
+                for (int x = 0; x < dims.x; x++) {
+                    gx[x] = (c[x + 2] - c[x]) * h.x;
+                    gy[x] = (c1[x + 1] - c0[x + 1]) * h.y;
+                    gz[x] = (a[x + 1] - b[x + 1]) * h.z;
+                }
+            }
+            else {
+                // Smooth (1 2 1) across the derivative axis in the 3x3
+                // neighborhood of each padded column first, then
+                // differentiate or smooth along the row
+                const float *b0 = b - w, *b1 = b + w;
+                const float *a0 = a - w, *a1 = a + w;
+                for (std::size_t i = 0; i < w; i++) {
+                    float cy = c0[i] + 2.0f * c[i] + c1[i];
+                    float by = b0[i] + 2.0f * b[i] + b1[i];
+                    float ay = a0[i] + 2.0f * a[i] + a1[i];
+                    syz[i] = by + 2.0f * cy + ay;
+                    dy[i] = (b1[i] - b0[i]) + 2.0f * (c1[i] - c0[i]) + (a1[i] - a0[i]);
+                    dz[i] = ay - by;
+                }
+                for (int x = 0; x < dims.x; x++) {
+                    gx[x] = (syz[x + 2] - syz[x]) * h.x;
+                    gy[x] = (dy[x] + 2.0f * dy[x + 1] + dy[x + 2]) * h.y;
+                    gz[x] = (dz[x] + 2.0f * dz[x + 1] + dz[x + 2]) * h.z;
+                }
+            }
+            fn(std::size_t(z) * dims.y + y, &gx[0], &gy[0], &gz[0]);
+        }
+    }
+}
+
+// Calls fn(slab, first, last) for the slabs of a volume read with
+// readSlices: slab holds the slices [first - 1, last + 1) of the volume
+// as float (clamped to the volume), so that the gradients of its slices
+// [first, last) are those of the whole volume
+template<typename Function>
+bool forEachGradientSlab(const cg::VolumeBase &header, const cg::SliceReader &readSlices,
+                         Function fn)
+{
+    const glm::ivec3 &dims = header.dimensions;
+    std::size_t sliceVoxels = std::size_t(dims.x) * std::size_t(dims.y);
+    cg::VolumeBase slab;
+    slab.origin = header.origin;
+    slab.spacing = header.spacing;
+    slab.datatype = "float32";
+    for (int first = 0; first < dims.z; first += gradientSlabSlices) {
+        int last = std::min(first + gradientSlabSlices, dims.z);
+        int z0 = std::max(first - 1, 0), z1 = std::min(last + 1, dims.z);
+        slab.dimensions = glm::ivec3(dims.x, dims.y, z1 - z0);
+        slab.data.resize(std::size_t(z1 - z0) * sliceVoxels * sizeof(float));
+        if (!readSlices(z0, z1 - z0, reinterpret_cast<float *>(&slab.data[0]))) {
+            return false;
+        }
+        fn(slab, first - z0, last - z0, first);
+    }
+    return true;
+}
+
+// Packs n gradients as RGBA8 texels (see cg::volumeComputeGradientTexels())
+void packGradients(const float *gx, const float *gy, const float *gz, std::size_t n,
+                   float magnitudeScale, std::uint8_t *dst)
+{
+    std::size_t i = 0;
+#ifdef CG_USE_SSE2
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 half = _mm_set1_ps(127.5f);
+    const __m128 scale = _mm_set1_ps(magnitudeScale);
+    const __m128 full = _mm_set1_ps(255.0f);
+    for (; i + 4 <= n; i += 4) {
+        __m128 x = _mm_loadu_ps(gx + i), y = _mm_loadu_ps(gy + i), z = _mm_loadu_ps(gz + i);
+        __m128 magnitude = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(x, x),
+                                                  _mm_add_ps(_mm_mul_ps(y, y), _mm_mul_ps(z, z))));
+        __m128 inverse = _mm_and_ps(_mm_div_ps(one, magnitude), _mm_cmpgt_ps(magnitude, zero));
+        // Clamping to [0, 1] also maps NaN to 0 (max returns its second
+        // operand then)
+        __m128 alpha = _mm_min_ps(_mm_max_ps(_mm_mul_ps(magnitude, scale), zero), one);
+        __m128i r = _mm_cvtps_epi32(_mm_add_ps(_mm_mul_ps(_mm_mul_ps(x, inverse), half), half));
+        __m128i g = _mm_cvtps_epi32(_mm_add_ps(_mm_mul_ps(_mm_mul_ps(y, inverse), half), half));
+        __m128i b = _mm_cvtps_epi32(_mm_add_ps(_mm_mul_ps(_mm_mul_ps(z, inverse), half), half));
+        __m128i a = _mm_cvtps_epi32(_mm_mul_ps(alpha, full));
+        __m128i rgba = _mm_or_si128(_mm_or_si128(r, _mm_slli_epi32(g, 8)),
+                                    _mm_or_si128(_mm_slli_epi32(b, 16), _mm_slli_epi32(a, 24)));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 4 * i), rgba);
+    }
+#endif
+    for (; i < n; i++) {
+        float magnitude = std::sqrt(gx[i] * gx[i] + gy[i] * gy[i] + gz[i] * gz[i]);
+        float inverse = magnitude > 0.0f ? 1.0f / magnitude : 0.0f;
+        float alpha = magnitude * magnitudeScale;
+        alpha = alpha > 0.0f ? std::min(alpha, 1.0f) : 0.0f;
+        dst[4 * i + 0] = std::uint8_t(std::lrint(gx[i] * inverse * 127.5f + 127.5f));
+        dst[4 * i + 1] = std::uint8_t(std::lrint(gy[i] * inverse * 127.5f + 127.5f));
+        dst[4 * i + 2] = std::uint8_t(std::lrint(gz[i] * inverse * 127.5f + 127.5f));
+        dst[4 * i + 3] = std::uint8_t(std::lrint(alpha * 255.0f));
+    }
+}
+
+} // namespace
+
+
+
+namespace cg {
+
+bool volumeComputeGradientTexels(const VolumeBase &volume, GradientOperator op,
+                                 std::vector<std::uint8_t> *texels, float *maxMagnitude)
+{
+    std::size_t elementSize = datatypeSizeInBytes(volume.datatype);
+    std::size_t n = volumeNumVoxels(volume);
+    if (elementSize == 0 || volume.data.size() < n * elementSize) {
+        std::cerr << "Cannot compute gradients of volume of data type " << volume.datatype
+                  << std::endl;
+        return false;
+    }
+    std::size_t numSlices = std::size_t(volume.dimensions.z);
+    std::size_t rowLength = std::size_t(volume.dimensions.x);
+
+    if (!(*maxMagnitude > 0.0f)) {
+        float largest = 0.0f;
+        std::mutex largestMutex;
+        parallelFor(0, numSlices, [&](std::size_t first, std::size_t last) {
+            float partial = 0.0f;
+            forEachGradientRow(volume, op, first, last, [&](std::size_t, const float *gx,
+                                                            const float *gy, const float *gz) {
+                for (std::size_t i = 0; i < rowLength; i++) {
+                    float squared = gx[i] * gx[i] + gy[i] * gy[i] + gz[i] * gz[i];
+                    partial = squared > partial ? squared : partial;  // skips NaN
+                }
+            });
+            std::lock_guard<std::mutex> lock(largestMutex);
+            largest = std::max(largest, partial);
+        });
+        *maxMagnitude = std::sqrt(largest);
+    }
+
+    float magnitudeScale = *maxMagnitude > 0.0f ? 1.0f / *maxMagnitude : 0.0f;
+    texels->resize(4 * n);
+    std::uint8_t *dst = &(*texels)[0];
+    parallelFor(0, numSlices, [&](std::size_t first, std::size_t last) {
+        forEachGradientRow(volume, op, first, last, [&](std::size_t row, const float *gx,
+                                                        const float *gy, const float *gz) {
+            packGradients(gx, gy, gz, rowLength, magnitudeScale, dst + 4 * row * rowLength);
+        });
+    });
+    return true;
+}
+
+bool volumeComputeGradientTexelsSlices(const VolumeBase &header, const SliceReader &readSlices,
+                                       GradientOperator op, std::vector<std::uint8_t> *texels,
+                                       float *maxMagnitude)
+{
+    std::size_t rowLength = std::size_t(header.dimensions.x);
+    std::size_t sliceTexels = rowLength * std::size_t(header.dimensions.y);
+    if (!(*maxMagnitude > 0.0f)) {
+        float largest = 0.0f;
+        std::mutex largestMutex;
+        bool ok = forEachGradientSlab(header, readSlices, [&](const VolumeBase &slab, int first,
+                                                              int last, int) {
+            parallelFor(std::size_t(first), std::size_t(last), [&](std::size_t f, std::size_t l) {
+                float partial = 0.0f;
+                forEachGradientRow(slab, op, f, l, [&](std::size_t, const float *gx,
+                                                       const float *gy, const float *gz) {
+                    for (std::size_t i = 0; i < rowLength; i++) {
+                        float squared = gx[i] * gx[i] + gy[i] * gy[i] + gz[i] * gz[i];
+                        partial = squared > partial ? squared : partial;  // skips NaN
+                    }
+                });
+                std::lock_guard<std::mutex> lock(largestMutex);
+                largest = std::max(largest, partial);
+            });
+        });
+        if (!ok) {
+            return false;
+        }
+        *maxMagnitude = std::sqrt(largest);
+    }
+
+    float magnitudeScale = *maxMagnitude > 0.0f ? 1.0f / *maxMagnitude : 0.0f;
+    texels->resize(4 * sliceTexels * std::size_t(header.dimensions.z));
+    std::uint8_t *dst = &(*texels)[0];
+    return forEachGradientSlab(header, readSlices, [&](const VolumeBase &slab, int first,
+                                                       int last, int firstSlice) {
+        // Rows are numbered within the slab
+        std::uint8_t *slabDst = dst + 4 * (std::size_t(firstSlice - first) * sliceTexels);
+        parallelFor(std::size_t(first), std::size_t(last), [&](std::size_t f, std::size_t l) {
+            forEachGradientRow(slab, op, f, l, [&](std::size_t row, const float *gx,
+                                                   const float *gy, const float *gz) {
+                packGradients(gx, gy, gz, rowLength, magnitudeScale,
+                              slabDst + 4 * row * rowLength);
+            });
+        });
+    });
+}
+
+bool volumeComputeGradientTexelsRegion(const VolumeBase &volume, GradientOperator op,
+                                       const glm::ivec3 &origin, const glm::ivec3 &size,
+                                       float maxMagnitude, std::vector<std::uint8_t> *texels)
+{
+    // The region is extracted with a margin of one voxel (the reach of
+    // the operators) where the volume has one. At the borders of the
+    // volume, the border voxels are repeated just like for the whole
+    // volume, so the texels of the region come out the same.
+    glm::ivec3 lo = glm::max(origin - 1, glm::ivec3(0));
+    glm::ivec3 hi = glm::min(origin + size + 1, volume.dimensions);
+    VolumeBase padded;
+    std::vector<std::uint8_t> paddedTexels;
+    if (!(maxMagnitude > 0.0f) || !volumeExtractRegion(volume, lo, hi - lo, &padded) ||
+        !volumeComputeGradientTexels(padded, op, &paddedTexels, &maxMagnitude)) {
+        return false;
+    }
+    glm::ivec3 offset = origin - lo;
+    const glm::ivec3 &dims = padded.dimensions;
+    texels->resize(4 * std::size_t(size.x) * size.y * size.z);
+    for (int z = 0; z < size.z; z++) {
+        for (int y = 0; y < size.y; y++) {
+            const std::uint8_t *src = &paddedTexels[4 * ((std::size_t(offset.z + z) * dims.y +
+                                                          offset.y + y) * dims.x + offset.x)];
+            std::size_t dst = (std::size_t(z) * size.y + y) * size.x;
+            std::copy(src, src + 4 * size.x, &(*texels)[4 * dst]);
+        }
+    }
+    return true;
+}
+
+} // namespace cg
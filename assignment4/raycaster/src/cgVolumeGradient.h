@@ -0,0 +1,50 @@
+#pragma once
+
+#include "cgVolume.h"
+#include "cgVolumeResample.h"
+
+#include <vector>
+#include <cstdint>
+
+namespace cg {
+
+// How gradients are estimated from the voxels around a voxel
+enum GradientOperator {
+    GRADIENT_CENTRAL_DIFFERENCES = 0,  // the 6 face neighbors
+    GRADIENT_SOBEL = 1  // the 26 neighbors, smoothing across each derivative (less noise)
+};
+
+// Computes the gradient of a volume image (in LAYOUT_LINEAR) in world
+// units (i.e., taking the voxel spacing into account). Voxels outside
+// the volume repeat the border voxels. Returns the gradients packed as
+// RGBA8 texels, one per voxel: the unit normal (the direction of the
+// gradient) mapped from [-1, 1] to [0, 255] in RGB, and the magnitude
+// mapped from [0, maxMagnitude] to [0, 255] in A. If maxMagnitude is
+// not positive, the largest magnitude of the volume is used (which takes
+// an extra pass) and returned in it. Slices are processed in parallel
+// with SSE2 inner loops where available. Returns false if the data type
+// is not supported.
+bool volumeComputeGradientTexels(const VolumeBase &volume, GradientOperator op,
+                                 std::vector<std::uint8_t> *texels, float *maxMagnitude);
+
+// Same as volumeComputeGradientTexels(), but reads the volume with
+// readSlices, a slab (and the slices around it) at a time, so that it
+// never needs to be in memory at once. header describes the volume (its
+// data is not used). Without a given maxMagnitude, the volume is read
+// twice.
+bool volumeComputeGradientTexelsSlices(const VolumeBase &header, const SliceReader &readSlices,
+                                       GradientOperator op, std::vector<std::uint8_t> *texels,
+                                       float *maxMagnitude);
+
+// Computes the gradient texels of the region [origin, origin + size) of a
+// volume image, the same as volumeComputeGradientTexels() computes them
+// for the voxels of the region (maxMagnitude must be given). Only the
+// region and the voxels around it are read, for updating the gradients
+// of edited parts of a volume. texels receives the texels of the region
+// in LAYOUT_LINEAR. Returns false if the data type is not supported or
+// the region is not within the volume.
+bool volumeComputeGradientTexelsRegion(const VolumeBase &volume, GradientOperator op,
+                                       const glm::ivec3 &origin, const glm::ivec3 &size,
+                                       float maxMagnitude, std::vector<std::uint8_t> *texels);
+
+} // namespace cg
@@ -0,0 +1,39 @@
+#include "cgVolumeLayout.h"
+
+#include <vector>
+#include <cstring>
+
+namespace cg {
+
+bool volumeConvertLayout(VolumeBase *volume, VoxelLayout from, VoxelLayout to)
+{
+    std::size_t elementSize = datatypeSizeInBytes(volume->datatype);
+    const glm::ivec3 &dims = volume->dimensions;
+    if (elementSize == 0 || volume->data.size() != volumeLayoutNumVoxels(dims, from) * elementSize) {
+        return false;
+    }
+    if (from == to) {
+        return true;
+    }
+
+    // Every voxel of the target layout (padding included) is copied from
+    // the nearest voxel of the volume, in parallel over units of the
+    // target layout: bricks or slices
+    std::vector<std::uint8_t> data(volumeLayoutNumVoxels(dims, to) * elementSize);
+    const std::uint8_t *src = &volume->data[0];
+    std::uint8_t *dst = &data[0];
+    std::size_t unitSize = to == LAYOUT_LINEAR
+        ? std::size_t(dims.x) * std::size_t(dims.y)
+        : std::size_t(layoutBrickSize * layoutBrickSize * layoutBrickSize);
+    parallelFor(0, data.size() / elementSize / unitSize, [&](std::size_t first, std::size_t last) {
+        for (std::size_t i = first * unitSize; i < last * unitSize; i++) {
+            glm::ivec3 p = glm::min(volumeLayoutPosition(dims, to, i), dims - glm::ivec3(1));
+            std::size_t j = volumeLayoutIndex(dims, from, p.x, p.y, p.z);
+            std::memcpy(dst + i * elementSize, src + j * elementSize, elementSize);
+        }
+    });
+    volume->data.swap(data);
+    return true;
+}
+
+} // namespace cg
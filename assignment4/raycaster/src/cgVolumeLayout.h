@@ -0,0 +1,218 @@
+#pragma once
+
+#include "cgVolume.h"
+#include "cgParallel.h"
+
+#include <algorithm>
+#include <cstddef>
+
+namespace cg {
+
+// Reorders the voxels of a volume image from one layout to another (see
+// VoxelLayout). Padding voxels of LAYOUT_BRICKED repeat the nearest
+// voxel of the volume. Bricks or slices are reordered in parallel.
+// Returns false if the data type is not supported or the data does not
+// match the source layout.
+bool volumeConvertLayout(VolumeBase *volume, VoxelLayout from, VoxelLayout to);
+
+// Reorders the voxels of a typed volume image to the given layout
+template<typename VoxelType>
+inline bool volumeSetLayout(Volume<VoxelType> *volume, VoxelLayout layout)
+{
+    if (volume->layout == layout) {
+        return true;
+    }
+    if (!volumeConvertLayout(&volume->base, volume->layout, layout)) {
+        return false;
+    }
+    volume->layout = layout;
+    return true;
+}
+
+// Gathers the bits at positions 0, 3 and 6 of v (the inverse of
+// mortonSpread3())
+inline int mortonCompact3(std::size_t v)
+{
+    return int((v & 1) | ((v >> 2) & 2) | ((v >> 4) & 4));
+}
+
+// Iterator over the voxels of a volume image in memory order, so that
+// loops over all voxels touch memory sequentially whatever the layout.
+// Padding voxels are skipped; position holds the coordinates of the
+// current voxel. Advancing updates the position incrementally: within a
+// brick of LAYOUT_BRICKED from the Morton index of the voxel in the
+// brick, and only at the end of a brick by moving to the next brick.
+template<typename VoxelType>
+struct VolumeIterator {
+    VoxelType *voxels;
+    glm::ivec3 dimensions;
+    VoxelLayout layout;
+    std::size_t index;  // memory index of the current voxel
+    std::size_t endIndex;  // memory index the iteration stops at
+    glm::ivec3 position;  // coordinates of the current voxel
+    glm::ivec3 brickOrigin;  // of the brick of the current voxel (LAYOUT_BRICKED)
+
+    VoxelType &operator*() const
+    {
+        return voxels[index];
+    }
+
+    bool operator==(const VolumeIterator &other) const
+    {
+        return index == other.index;
+    }
+
+    bool operator!=(const VolumeIterator &other) const
+    {
+        return index != other.index;
+    }
+
+    VolumeIterator &operator++();
+};
+
+// Returns the coordinates of the voxel at a memory index of the given
+// layout (which may be a padding voxel, outside the volume)
+inline glm::ivec3 volumeLayoutPosition(const glm::ivec3 &dimensions, VoxelLayout layout,
+                                       std::size_t index)
+{
+    if (layout == LAYOUT_LINEAR) {
+        std::size_t sliceSize = std::size_t(dimensions.x) * std::size_t(dimensions.y);
+        std::size_t inSlice = index % sliceSize;
+        return glm::ivec3(int(inSlice % dimensions.x), int(inSlice / dimensions.x),
+                          int(index / sliceSize));
+    }
+    const std::size_t brickVoxels = layoutBrickSize * layoutBrickSize * layoutBrickSize;
+    std::size_t brick = index / brickVoxels;
+    std::size_t local = index % brickVoxels;
+    std::size_t numBricksX = std::size_t(dimensions.x + layoutBrickSize - 1) / layoutBrickSize;
+    std::size_t numBricksY = std::size_t(dimensions.y + layoutBrickSize - 1) / layoutBrickSize;
+    glm::ivec3 brickOrigin(int(brick % numBricksX), int(brick / numBricksX % numBricksY),
+                           int(brick / (numBricksX * numBricksY)));
+    return brickOrigin * layoutBrickSize +
+           glm::ivec3(mortonCompact3(local), mortonCompact3(local >> 1), mortonCompact3(local >> 2));
+}
+
+template<typename VoxelType>
+inline VolumeIterator<VoxelType> &VolumeIterator<VoxelType>::operator++()
+{
+    if (layout == LAYOUT_LINEAR) {
+        index++;
+        if (++position.x == dimensions.x) {
+            position.x = 0;
+            if (++position.y == dimensions.y) {
+                position.y = 0;
+                position.z++;
+            }
+        }
+        return *this;
+    }
+    const std::size_t brickVoxels = layoutBrickSize * layoutBrickSize * layoutBrickSize;
+    while (++index < endIndex) {
+        std::size_t local = index % brickVoxels;
+        if (local == 0) {
+            brickOrigin.x += layoutBrickSize;
+            if (brickOrigin.x >= dimensions.x) {
+                brickOrigin.x = 0;
+                brickOrigin.y += layoutBrickSize;
+                if (brickOrigin.y >= dimensions.y) {
+                    brickOrigin.y = 0;
+                    brickOrigin.z += layoutBrickSize;
+                }
+            }
+        }
+        position = brickOrigin + glm::ivec3(mortonCompact3(local), mortonCompact3(local >> 1),
+                                            mortonCompact3(local >> 2));
+        if (position.x < dimensions.x && position.y < dimensions.y && position.z < dimensions.z) {
+            break;
+        }
+    }
+    return *this;
+}
+
+// Returns an iterator over the voxels from memory index first (which
+// must be the index of a voxel inside the volume) up to memory index last
+template<typename VoxelType>
+inline VolumeIterator<VoxelType> volumeIterator(VoxelType *voxels, const glm::ivec3 &dimensions,
+                                                VoxelLayout layout, std::size_t first,
+                                                std::size_t last)
+{
+    VolumeIterator<VoxelType> it;
+    it.voxels = voxels;
+    it.dimensions = dimensions;
+    it.layout = layout;
+    it.index = first;
+    it.endIndex = last;
+    it.position = volumeLayoutPosition(dimensions, layout, first);
+    it.brickOrigin = it.position / layoutBrickSize * layoutBrickSize;
+    return it;
+}
+
+// Returns an iterator to the first voxel of a volume image
+template<typename VoxelType>
+inline VolumeIterator<VoxelType> volumeBegin(Volume<VoxelType> &volume)
+{
+    std::size_t n = volumeLayoutNumVoxels(volume.base.dimensions, volume.layout);
+    VoxelType *voxels = volume.base.data.empty() ? nullptr
+                                                 : reinterpret_cast<VoxelType *>(&volume.base.data[0]);
+    return volumeIterator(voxels, volume.base.dimensions, volume.layout, 0, n);
+}
+
+// Returns the iterator past the last voxel of a volume image
+template<typename VoxelType>
+inline VolumeIterator<VoxelType> volumeEnd(Volume<VoxelType> &volume)
+{
+    VolumeIterator<VoxelType> it = volumeBegin(volume);
+    it.index = it.endIndex;
+    return it;
+}
+
+// Calls fn(x, y, z, voxel) for every voxel of a volume image, in memory
+// order within parallel ranges of whole bricks (or slices, for the
+// linear layout)
+template<typename VoxelType, typename Function>
+void volumeForEachVoxel(Volume<VoxelType> &volume, Function fn)
+{
+    const glm::ivec3 &dims = volume.base.dimensions;
+    std::size_t unitSize = volume.layout == LAYOUT_LINEAR
+        ? std::size_t(dims.x) * std::size_t(dims.y)
+        : std::size_t(layoutBrickSize * layoutBrickSize * layoutBrickSize);
+    if (volume.base.data.empty() || unitSize == 0) {
+        return;
+    }
+    std::size_t numUnits = volumeLayoutNumVoxels(dims, volume.layout) / unitSize;
+    VoxelType *voxels = reinterpret_cast<VoxelType *>(&volume.base.data[0]);
+    parallelFor(0, numUnits, [&](std::size_t first, std::size_t last) {
+        VolumeIterator<VoxelType> it = volumeIterator(voxels, dims, volume.layout,
+                                                      first * unitSize, last * unitSize);
+        for (; it.index < it.endIndex; ++it) {
+            fn(it.position.x, it.position.y, it.position.z, *it);
+        }
+    });
+}
+
+// Returns voxel (x, y, z) with the coordinates clamped to the volume
+template<typename VoxelType>
+inline const VoxelType &volumeAtClamped(const Volume<VoxelType> &volume, int x, int y, int z)
+{
+    const glm::ivec3 &dims = volume.base.dimensions;
+    return volume(std::min(std::max(x, 0), dims.x - 1), std::min(std::max(y, 0), dims.y - 1),
+                  std::min(std::max(z, 0), dims.z - 1));
+}
+
+// Gathers the 3x3x3 neighborhood of voxel (x, y, z) into out (x-fastest,
+// out[13] is the voxel itself), repeating border voxels outside the
+// volume
+template<typename VoxelType>
+inline void volumeNeighborhood(const Volume<VoxelType> &volume, int x, int y, int z,
+                               VoxelType out[27])
+{
+    for (int dz = -1; dz <= 1; dz++) {
+        for (int dy = -1; dy <= 1; dy++) {
+            for (int dx = -1; dx <= 1; dx++) {
+                *out++ = volumeAtClamped(volume, x + dx, y + dy, z + dz);
+            }
+        }
+    }
+}
+
+} // namespace cg
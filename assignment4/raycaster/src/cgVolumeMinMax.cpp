@@ -0,0 +1,264 @@
+#include "cgVolumeMinMax.h"
+#include "cgVolumeConvert.h"
+#include "cgVolumeLayout.h"
+#include "cgParallel.h"
+
+#include <iostream>
+#include <algorithm>
+#include <limits>
+#include <mutex>
+#include <cmath>
+
+namespace {
+
+// Extends [*minValue, *maxValue] by n floats, skipping NaN
+inline void extendRange(const float *values, std::size_t n, float *minValue, float *maxValue)
+{
+    float mn = *minValue, mx = *maxValue;
+    for (std::size_t i = 0; i < n; i++) {
+        float v = values[i];
+        mn = v < mn ? v : mn;
+        mx = v > mx ? v : mx;
+    }
+    *minValue = mn;
+    *maxValue = mx;
+}
+
+// Returns the voxels [lo, hi) covered by a brick and its margin
+void brickBox(const cg::MinMaxGrid &grid, const glm::ivec3 &brick, glm::ivec3 *lo, glm::ivec3 *hi)
+{
+    glm::ivec3 origin = cg::brickGridBrickOrigin(grid.grid, brick);
+    glm::ivec3 extent = cg::brickGridBrickExtent(grid.grid, brick);
+    *lo = glm::max(origin - grid.margin, glm::ivec3(0));
+    *hi = glm::min(origin + extent + grid.margin, grid.grid.dimensions);
+}
+
+// Sets up an empty min/max grid for a volume
+bool initGrid(const cg::VolumeBase &volume, int brickSize, int margin, cg::MinMaxGrid *grid)
+{
+    if (cg::datatypeSizeInBytes(volume.datatype) == 0 || brickSize < 1 ||
+        glm::any(glm::lessThan(volume.dimensions, glm::ivec3(1)))) {
+        std::cerr << "Cannot compute min/max grid of volume of data type " << volume.datatype
+                  << std::endl;
+        return false;
+    }
+    grid->grid = cg::brickGridCreate(volume.dimensions, brickSize);
+    grid->margin = std::max(margin, 0);
+    std::size_t numBricks = cg::brickGridNumBricks(grid->grid);
+    grid->minValues.assign(numBricks, std::numeric_limits<float>::infinity());
+    grid->maxValues.assign(numBricks, -std::numeric_limits<float>::infinity());
+    return true;
+}
+
+// Extends the ranges of the bricks of an empty min/max grid by the
+// voxels of a volume in LAYOUT_BRICKED. Each voxel extends the bricks
+// whose margins it lies in.
+template<typename VoxelType>
+void extendBrickedGrid(const cg::VolumeBase &volume, cg::MinMaxGrid *grid)
+{
+    const glm::ivec3 &dims = volume.dimensions;
+    const std::size_t unitSize = cg::layoutBrickSize * cg::layoutBrickSize * cg::layoutBrickSize;
+    std::size_t numUnits = cg::volumeLayoutNumVoxels(dims, cg::LAYOUT_BRICKED) / unitSize;
+    const VoxelType *voxels = reinterpret_cast<const VoxelType *>(&volume.data[0]);
+    int bs = grid->grid.brickSize;
+    glm::ivec3 lastBrick = grid->grid.numBricks - 1;
+    std::mutex resultMutex;
+    cg::parallelFor(0, numUnits, [&](std::size_t first, std::size_t last) {
+        std::vector<float> minValues(grid->minValues), maxValues(grid->maxValues);
+        cg::VolumeIterator<const VoxelType> it = cg::volumeIterator(
+            voxels, dims, cg::LAYOUT_BRICKED, first * unitSize, last * unitSize);
+        for (; it.index < it.endIndex; ++it) {
+            float v = float(*it);
+            glm::ivec3 lo = glm::max(it.position - grid->margin, glm::ivec3(0)) / bs;
+            glm::ivec3 hi = glm::min((it.position + grid->margin) / bs, lastBrick);
+            for (int bz = lo.z; bz <= hi.z; bz++) {
+                for (int by = lo.y; by <= hi.y; by++) {
+                    for (int bx = lo.x; bx <= hi.x; bx++) {
+                        std::size_t index = cg::brickGridIndex(grid->grid, glm::ivec3(bx, by, bz));
+                        minValues[index] = v < minValues[index] ? v : minValues[index];
+                        maxValues[index] = v > maxValues[index] ? v : maxValues[index];
+                    }
+                }
+            }
+        }
+        std::lock_guard<std::mutex> lock(resultMutex);
+        for (std::size_t i = 0; i < minValues.size(); i++) {
+            grid->minValues[i] = std::min(grid->minValues[i], minValues[i]);
+            grid->maxValues[i] = std::max(grid->maxValues[i], maxValues[i]);
+        }
+    });
+}
+
+} // namespace
+
+
+
+namespace cg {
+
+bool volumeComputeMinMaxGrid(const VolumeBase &volume, int brickSize, int margin,
+                             MinMaxGrid *grid)
+{
+    std::size_t elementSize = datatypeSizeInBytes(volume.datatype);
+    if (elementSize == 0 || volume.data.size() < volumeNumVoxels(volume) * elementSize) {
+        std::cerr << "Cannot compute min/max grid of volume of data type " << volume.datatype
+                  << std::endl;
+        return false;
+    }
+    std::size_t sliceVoxels = std::size_t(volume.dimensions.x) * std::size_t(volume.dimensions.y);
+    VoxelConversion conversion;
+    conversion.srcDatatype = volume.datatype;
+    conversion.dstDatatype = "float32";
+    const std::uint8_t *voxels = &volume.data[0];
+    SliceReader readSlices = [&](int firstSlice, int numSlices, float *values) {
+        return convertVoxelsParallel(conversion, reinterpret_cast<std::uint8_t *>(values),
+                                     voxels + firstSlice * sliceVoxels * elementSize,
+                                     numSlices * sliceVoxels, sliceVoxels);
+    };
+    return volumeComputeMinMaxGridSlices(volume, readSlices, brickSize, margin, grid);
+}
+
+bool volumeComputeMinMaxGrid(const VolumeBase &volume, VoxelLayout layout, int brickSize,
+                             int margin, MinMaxGrid *grid)
+{
+    if (layout == LAYOUT_LINEAR) {
+        return volumeComputeMinMaxGrid(volume, brickSize, margin, grid);
+    }
+    std::size_t elementSize = datatypeSizeInBytes(volume.datatype);
+    MinMaxGrid result;
+    if (elementSize == 0 ||
+        volume.data.size() != volumeLayoutNumVoxels(volume.dimensions, layout) * elementSize ||
+        !initGrid(volume, brickSize, margin, &result)) {
+        std::cerr << "Cannot compute min/max grid of volume of data type " << volume.datatype
+                  << std::endl;
+        return false;
+    }
+    if (volume.datatype == "uint8") {
+        extendBrickedGrid<std::uint8_t>(volume, &result);
+    }
+    else if (volume.datatype == "uint16") {
+        extendBrickedGrid<std::uint16_t>(volume, &result);
+    }
+    else if (volume.datatype == "int16") {
+        extendBrickedGrid<std::int16_t>(volume, &result);
+    }
+    else if (volume.datatype == "uint32") {
+        extendBrickedGrid<std::uint32_t>(volume, &result);
+    }
+    else {
+        extendBrickedGrid<float>(volume, &result);
+    }
+    *grid = std::move(result);
+    return true;
+}
+
+bool volumeComputeMinMaxGridSlices(const VolumeBase &header, const SliceReader &readSlices,
+                                   int brickSize, int margin, MinMaxGrid *grid)
+{
+    MinMaxGrid result;
+    if (!initGrid(header, brickSize, margin, &result)) {
+        return false;
+    }
+    const glm::ivec3 &dims = header.dimensions;
+    const glm::ivec3 &numBricks = result.grid.numBricks;
+    std::size_t sliceVoxels = std::size_t(dims.x) * std::size_t(dims.y);
+    int slabSlices = std::min(brickSize + 2 * result.margin, dims.z);
+    std::vector<float> slab(std::size_t(slabSlices) * sliceVoxels);
+
+    // The slices of a layer of bricks are read at once, then the rows of
+    // bricks of the layer are processed in parallel
+    for (int bz = 0; bz < numBricks.z; bz++) {
+        int z0 = std::max(bz * brickSize - result.margin, 0);
+        int z1 = std::min((bz + 1) * brickSize + result.margin, dims.z);
+        if (!readSlices(z0, z1 - z0, &slab[0])) {
+            return false;
+        }
+        parallelFor(0, std::size_t(numBricks.y), [&](std::size_t first, std::size_t last) {
+            for (std::size_t by = first; by < last; by++) {
+                for (int bx = 0; bx < numBricks.x; bx++) {
+                    glm::ivec3 brick(bx, int(by), bz);
+                    glm::ivec3 lo, hi;
+                    brickBox(result, brick, &lo, &hi);
+                    std::size_t index = brickGridIndex(result.grid, brick);
+                    for (int z = lo.z; z < hi.z; z++) {
+                        for (int y = lo.y; y < hi.y; y++) {
+                            const float *row = &slab[std::size_t(z - z0) * sliceVoxels +
+                                                     std::size_t(y) * dims.x];
+                            extendRange(row + lo.x, std::size_t(hi.x - lo.x),
+                                        &result.minValues[index], &result.maxValues[index]);
+                        }
+                    }
+                }
+            }
+        });
+    }
+    *grid = std::move(result);
+    return true;
+}
+
+bool volumeUpdateMinMaxGrid(const VolumeBase &volume, const glm::ivec3 &origin,
+                            const glm::ivec3 &size, MinMaxGrid *grid)
+{
+    const glm::ivec3 &dims = volume.dimensions;
+    std::size_t elementSize = datatypeSizeInBytes(volume.datatype);
+    if (elementSize == 0 || volume.data.size() < volumeNumVoxels(volume) * elementSize ||
+        dims != grid->grid.dimensions) {
+        std::cerr << "Cannot update min/max grid of volume" << std::endl;
+        return false;
+    }
+    // The bricks whose margins reach into the region
+    int bs = grid->grid.brickSize;
+    glm::ivec3 lo = glm::max(origin - grid->margin, glm::ivec3(0));
+    glm::ivec3 hi = glm::min(origin + size + grid->margin, dims);
+    if (glm::any(glm::lessThanEqual(hi, lo))) {
+        return true;
+    }
+    glm::ivec3 first = lo / bs, last = (hi - 1) / bs;
+    std::vector<float> row(dims.x);
+    for (int bz = first.z; bz <= last.z; bz++) {
+        for (int by = first.y; by <= last.y; by++) {
+            for (int bx = first.x; bx <= last.x; bx++) {
+                glm::ivec3 brick(bx, by, bz);
+                glm::ivec3 boxLo, boxHi;
+                brickBox(*grid, brick, &boxLo, &boxHi);
+                float mn = std::numeric_limits<float>::infinity();
+                float mx = -std::numeric_limits<float>::infinity();
+                std::size_t n = std::size_t(boxHi.x - boxLo.x);
+                for (int z = boxLo.z; z < boxHi.z; z++) {
+                    for (int y = boxLo.y; y < boxHi.y; y++) {
+                        std::size_t offset = (std::size_t(z) * dims.y + y) * dims.x + boxLo.x;
+                        voxelsToFloat(volume.datatype, &volume.data[offset * elementSize], n,
+                                      &row[0]);
+                        extendRange(&row[0], n, &mn, &mx);
+                    }
+                }
+                std::size_t index = brickGridIndex(grid->grid, brick);
+                grid->minValues[index] = mn;
+                grid->maxValues[index] = mx;
+            }
+        }
+    }
+    return true;
+}
+
+void minMaxGridOccupancy(const MinMaxGrid &grid, const std::uint8_t *visible, int numEntries,
+                         float windowMin, float windowMax, std::vector<std::uint8_t> *occupancy)
+{
+    // Counting the visible entries up to each entry answers whether a
+    // range of entries has a visible one in constant time
+    std::vector<int> count(numEntries + 1, 0);
+    for (int i = 0; i < numEntries; i++) {
+        count[i + 1] = count[i] + (visible[i] ? 1 : 0);
+    }
+    float scale = windowMax > windowMin ? float(numEntries) / (windowMax - windowMin) : 0.0f;
+    auto entry = [&](float value) {
+        float e = std::floor((value - windowMin) * scale);
+        return int(std::min(std::max(e, 0.0f), float(numEntries - 1)));
+    };
+    occupancy->resize(grid.minValues.size());
+    for (std::size_t i = 0; i < grid.minValues.size(); i++) {
+        float mn = grid.minValues[i], mx = grid.maxValues[i];
+        (*occupancy)[i] = mn <= mx && count[entry(mx) + 1] - count[entry(mn)] > 0 ? 1 : 0;
+    }
+}
+
+} // namespace cg
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "cgVolume.h"
+#include "cgBrickGrid.h"
+#include "cgVolumeResample.h"
+
+#include <vector>
+#include <cstdint>
+
+namespace cg {
+
+// Struct for the value range of each brick of a volume, for skipping the
+// bricks that cannot contribute to an image. The range of a brick covers
+// its voxels and a margin of voxels around them (at least the one voxel
+// that trilinear interpolation reaches into the neighboring bricks).
+struct MinMaxGrid {
+    BrickGrid grid;
+    int margin;  // in voxels
+    std::vector<float> minValues;  // one per brick (+infinity if all voxels are NaN)
+    std::vector<float> maxValues;  // one per brick (-infinity if all voxels are NaN)
+
+    MinMaxGrid() :
+        margin(0)
+    {}
+};
+
+// Computes the min/max grid of a volume image (in LAYOUT_LINEAR) with the
+// given brick size and margin. Bricks are processed in parallel, one layer
+// of bricks at a time. Returns false if the data type is not supported.
+bool volumeComputeMinMaxGrid(const VolumeBase &volume, int brickSize, int margin,
+                             MinMaxGrid *grid);
+
+// Same as volumeComputeMinMaxGrid(), for a volume image in the given
+// layout (see cgVolumeLayout.h). Bricked volumes are visited in memory
+// order with VolumeIterator, in parallel ranges of layout bricks with
+// per-thread partial grids. Returns false if the data type is not
+// supported or the data does not match the layout.
+bool volumeComputeMinMaxGrid(const VolumeBase &volume, VoxelLayout layout, int brickSize,
+                             int margin, MinMaxGrid *grid);
+
+// Computes the min/max grid of a typed volume image in its layout
+template<typename VoxelType>
+inline bool volumeComputeMinMaxGrid(const Volume<VoxelType> &volume, int brickSize, int margin,
+                                    MinMaxGrid *grid)
+{
+    return volumeComputeMinMaxGrid(volume.base, volume.layout, brickSize, margin, grid);
+}
+
+// Same as volumeComputeMinMaxGrid(), but reads the volume with
+// readSlices, one layer of bricks (and its margin) at a time, so that it
+// never needs to be in memory at once. header describes the volume (its
+// data is not used).
+bool volumeComputeMinMaxGridSlices(const VolumeBase &header, const SliceReader &readSlices,
+                                   int brickSize, int margin, MinMaxGrid *grid);
+
+// Recomputes the ranges of the bricks whose voxels or margins overlap the
+// region [origin, origin + size) of a volume image, after the region has
+// been edited. Returns false if the data type is not supported.
+bool volumeUpdateMinMaxGrid(const VolumeBase &volume, const glm::ivec3 &origin,
+                            const glm::ivec3 &size, MinMaxGrid *grid);
+
+// Computes which bricks of a min/max grid can contribute to an image
+// under a transfer function with numEntries entries. visible tells for
+// each entry whether it contributes anything (e.g., has nonzero color or
+// opacity). Values are mapped to entries like texture coordinates of a
+// texture with nearest filtering: [windowMin, windowMax] to [0, 1],
+// clamped. A brick is occupied if any entry its range maps to is
+// visible. occupancy receives 1 for occupied bricks, 0 otherwise.
+void minMaxGridOccupancy(const MinMaxGrid &grid, const std::uint8_t *visible, int numEntries,
+                         float windowMin, float windowMax, std::vector<std::uint8_t> *occupancy);
+
+} // namespace cg
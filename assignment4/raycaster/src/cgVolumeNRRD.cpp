@@ -0,0 +1,518 @@
+#include "cgVolumeNRRD.h"
+#include "cgMappedFile.h"
+#include "cgVolumeConvert.h"
+#include "cgParseASCII.h"
+#include "cgInflate.h"
+
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <locale>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+
+namespace {
+
+// Struct for the header of a raw data file (NRRD or MetaImage), in the
+// terms both formats share
+struct RawDataHeader {
+    glm::ivec3 dimensions;
+    glm::vec3 origin;
+    glm::vec3 spacing;
+    std::string datatype;
+    std::string encoding;  // "raw", "gzip", "zlib" or "ascii"
+    bool bigEndian;
+    std::string dataFile;  // empty if the data follows the header
+    long long byteSkip;  // -1: the data is at the end of the file
+    int lineSkip;
+    std::size_t headerSize;  // size of an attached header in bytes
+
+    RawDataHeader() :
+        dimensions(glm::ivec3(0, 0, 0)),
+        origin(glm::vec3(0.0f, 0.0f, 0.0f)),
+        spacing(glm::vec3(1.0f, 1.0f, 1.0f)),
+        encoding("raw"),
+        bigEndian(false),
+        byteSkip(0),
+        lineSkip(0),
+        headerSize(0)
+    {}
+};
+
+// Check endianness of target architecture
+bool isLittleEndian()
+{
+    std::uint16_t one = 1;
+    return *reinterpret_cast<std::uint8_t *>(&one) == 1;
+}
+
+std::string trim(const std::string &s)
+{
+    std::size_t begin = s.find_first_not_of(" \t\r");
+    if (begin == std::string::npos) {
+        return "";
+    }
+    return s.substr(begin, s.find_last_not_of(" \t\r") - begin + 1);
+}
+
+std::string toLower(std::string s)
+{
+    for (std::size_t i = 0; i < s.size(); i++) {
+        s[i] = char(std::tolower((unsigned char)s[i]));
+    }
+    return s;
+}
+
+// Read the next line of a memory buffer (without the line break).
+// Returns false at the end of the buffer.
+bool nextLine(const std::uint8_t *buffer, std::size_t size, std::size_t *pos, std::string *line)
+{
+    if (*pos >= size) {
+        return false;
+    }
+    const void *lineEnd = std::memchr(buffer + *pos, '\n', size - *pos);
+    std::size_t length = lineEnd != nullptr
+        ? static_cast<const std::uint8_t *>(lineEnd) - (buffer + *pos) : size - *pos;
+    line->assign(reinterpret_cast<const char *>(buffer + *pos), length);
+    if (!line->empty() && (*line)[line->size() - 1] == '\r') {
+        line->erase(line->size() - 1);
+    }
+    *pos += length + 1;
+    return true;
+}
+
+// Map NRRD type names to data type strings
+std::string nrrdDatatype(const std::string &type)
+{
+    if (type == "uchar" || type == "unsigned char" || type == "uint8" || type == "uint8_t") {
+        return "uint8";
+    }
+    else if (type == "ushort" || type == "unsigned short" || type == "unsigned short int" ||
+             type == "uint16" || type == "uint16_t") {
+        return "uint16";
+    }
+    else if (type == "short" || type == "short int" || type == "signed short" ||
+             type == "signed short int" || type == "int16" || type == "int16_t") {
+        return "int16";
+    }
+    else if (type == "uint" || type == "unsigned int" || type == "uint32" || type == "uint32_t") {
+        return "uint32";
+    }
+    else if (type == "float") {
+        return "float32";
+    }
+    return "";
+}
+
+// Map MetaImage element types to data type strings
+std::string metaImageDatatype(const std::string &type)
+{
+    if (type == "MET_UCHAR") {
+        return "uint8";
+    }
+    else if (type == "MET_USHORT") {
+        return "uint16";
+    }
+    else if (type == "MET_SHORT") {
+        return "int16";
+    }
+    else if (type == "MET_UINT") {
+        return "uint32";
+    }
+    else if (type == "MET_FLOAT") {
+        return "float32";
+    }
+    return "";
+}
+
+// Read the sizes of a 2D or 3D image (z is one for 2D images)
+bool parseDimensions(const std::string &value, int numDims, glm::ivec3 *dimensions)
+{
+    std::istringstream ss(value);
+    *dimensions = glm::ivec3(1, 1, 1);
+    for (int i = 0; i < numDims; i++) {
+        if (!(ss >> (*dimensions)[i]) || (*dimensions)[i] <= 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Read up to three numbers separated by whitespace, commas or
+// parentheses (as in NRRD vectors)
+int parseNumbers(const std::string &value, float *numbers, int maxNumbers)
+{
+    std::string s = value;
+    for (std::size_t i = 0; i < s.size(); i++) {
+        if (s[i] == ',' || s[i] == '(' || s[i] == ')') {
+            s[i] = ' ';
+        }
+    }
+    std::istringstream ss(s);
+    ss.imbue(std::locale::classic());
+    int n = 0;
+    while (n < maxNumbers && ss >> numbers[n]) {
+        n++;
+    }
+    return n;
+}
+
+// Parse a NRRD header: a magic line, "field: value" lines, and a blank
+// line before attached data
+bool parseNRRDHeader(const std::uint8_t *buffer, std::size_t size, RawDataHeader *header,
+                     const std::string &filename)
+{
+    std::size_t pos = 0;
+    std::string line;
+    if (!nextLine(buffer, size, &pos, &line) || line.compare(0, 7, "NRRD000") != 0) {
+        std::cerr << filename << " is not a NRRD file" << std::endl;
+        return false;
+    }
+
+    int numDims = 0;
+    std::string sizes;
+    while (nextLine(buffer, size, &pos, &line) && !line.empty()) {
+        if (line[0] == '#' || line.find(":=") != std::string::npos) {
+            continue;  // comment or key/value pair
+        }
+        std::size_t colon = line.find(": ");
+        if (colon == std::string::npos) {
+            std::cerr << "Invalid header line in " << filename << ": " << line << std::endl;
+            return false;
+        }
+        std::string field = toLower(trim(line.substr(0, colon)));
+        std::string value = trim(line.substr(colon + 2));
+        if (field == "type") {
+            header->datatype = nrrdDatatype(toLower(value));
+            if (header->datatype.empty()) {
+                std::cerr << "Unsupported NRRD type " << value << " in " << filename << std::endl;
+                return false;
+            }
+        }
+        else if (field == "dimension") {
+            numDims = std::atoi(value.c_str());
+        }
+        else if (field == "sizes") {
+            sizes = value;
+        }
+        else if (field == "endian") {
+            header->bigEndian = toLower(value) == "big";
+        }
+        else if (field == "encoding") {
+            std::string encoding = toLower(value);
+            if (encoding == "gzip" || encoding == "gz") {
+                header->encoding = "gzip";
+            }
+            else if (encoding == "ascii" || encoding == "text" || encoding == "txt") {
+                header->encoding = "ascii";
+            }
+            else if (encoding == "raw") {
+                header->encoding = "raw";
+            }
+            else {
+                std::cerr << "Unsupported NRRD encoding " << value << " in " << filename
+                          << std::endl;
+                return false;
+            }
+        }
+        else if (field == "spacings") {
+            float numbers[3];
+            for (int i = 0, n = parseNumbers(value, numbers, 3); i < n; i++) {
+                header->spacing[i] = numbers[i];
+            }
+        }
+        else if (field == "space directions") {
+            // One vector per axis; the spacing is its length
+            std::size_t begin = value.find('(');
+            for (int i = 0; i < 3 && begin != std::string::npos; i++) {
+                std::size_t end = value.find(')', begin);
+                float numbers[3];
+                if (parseNumbers(value.substr(begin, end - begin), numbers, 3) == 3) {
+                    header->spacing[i] = glm::length(glm::vec3(numbers[0], numbers[1], numbers[2]));
+                }
+                begin = value.find('(', end);
+            }
+        }
+        else if (field == "space origin") {
+            float numbers[3];
+            for (int i = 0, n = parseNumbers(value, numbers, 3); i < n; i++) {
+                header->origin[i] = numbers[i];
+            }
+        }
+        else if (field == "data file" || field == "datafile") {
+            header->dataFile = value;
+        }
+        else if (field == "byte skip" || field == "byteskip") {
+            header->byteSkip = std::atoll(value.c_str());
+        }
+        else if (field == "line skip" || field == "lineskip") {
+            header->lineSkip = std::atoi(value.c_str());
+        }
+    }
+    header->headerSize = std::min(pos, size);
+
+    if (numDims < 2 || numDims > 3 || !parseDimensions(sizes, numDims, &header->dimensions)) {
+        std::cerr << "Only 2D and 3D images are supported (" << filename << ")" << std::endl;
+        return false;
+    }
+    if (header->datatype.empty()) {
+        std::cerr << "Missing type in " << filename << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Parse a MetaImage header: "Key = Value" lines up to ElementDataFile,
+// which must be the last one
+bool parseMetaImageHeader(const std::uint8_t *buffer, std::size_t size, RawDataHeader *header,
+                          const std::string &filename)
+{
+    std::size_t pos = 0;
+    std::string line;
+    int numDims = 0;
+    std::string dimSize;
+    bool hasSpacing = false;
+    while (nextLine(buffer, size, &pos, &line)) {
+        std::size_t equals = line.find('=');
+        if (equals == std::string::npos) {
+            continue;
+        }
+        std::string key = trim(line.substr(0, equals));
+        std::string value = trim(line.substr(equals + 1));
+        float numbers[3];
+        if (key == "NDims") {
+            numDims = std::atoi(value.c_str());
+        }
+        else if (key == "DimSize") {
+            dimSize = value;
+        }
+        else if (key == "ElementType") {
+            header->datatype = metaImageDatatype(value);
+            if (header->datatype.empty()) {
+                std::cerr << "Unsupported element type " << value << " in " << filename
+                          << std::endl;
+                return false;
+            }
+        }
+        else if (key == "ElementNumberOfChannels" && std::atoi(value.c_str()) != 1) {
+            std::cerr << "Only single-channel images are supported (" << filename << ")"
+                      << std::endl;
+            return false;
+        }
+        else if (key == "ElementSpacing" || (key == "ElementSize" && !hasSpacing)) {
+            for (int i = 0, n = parseNumbers(value, numbers, 3); i < n; i++) {
+                header->spacing[i] = numbers[i];
+            }
+            hasSpacing = hasSpacing || key == "ElementSpacing";
+        }
+        else if (key == "Offset" || key == "Position" || key == "Origin") {
+            for (int i = 0, n = parseNumbers(value, numbers, 3); i < n; i++) {
+                header->origin[i] = numbers[i];
+            }
+        }
+        else if (key == "BinaryDataByteOrderMSB" || key == "ElementByteOrderMSB") {
+            header->bigEndian = toLower(value) == "true";
+        }
+        else if (key == "CompressedData") {
+            header->encoding = toLower(value) == "true" ? "zlib" : "raw";
+        }
+        else if (key == "HeaderSize") {
+            header->byteSkip = std::atoll(value.c_str());
+        }
+        else if (key == "ElementDataFile") {
+            if (value != "LOCAL") {
+                header->dataFile = value;
+            }
+            header->headerSize = std::min(pos, size);
+            break;
+        }
+    }
+
+    if (numDims < 2 || numDims > 3 || !parseDimensions(dimSize, numDims, &header->dimensions)) {
+        std::cerr << "Only 2D and 3D images are supported (" << filename << ")" << std::endl;
+        return false;
+    }
+    if (header->datatype.empty() || header->headerSize == 0) {
+        std::cerr << "Missing ElementType or ElementDataFile in " << filename << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Inflate compressed voxels straight into dst. When the voxels must be
+// byte swapped, a second thread swaps the part of the buffer the
+// decoder is done with while decoding goes on.
+bool inflateVoxels(const std::uint8_t *src, std::size_t srcSize, const std::string &encoding,
+                   std::uint8_t *dst, std::size_t numElements, std::size_t elementSize,
+                   bool swap, std::string *errorMessage)
+{
+    std::size_t numBytes = numElements * elementSize;
+    if (!swap) {
+        return encoding == "gzip" ? cg::inflateGzip(src, srcSize, dst, numBytes, errorMessage)
+                                  : cg::inflateZlib(src, srcSize, dst, numBytes, errorMessage);
+    }
+
+    std::mutex mutex;
+    std::condition_variable finalBytesChanged;
+    std::size_t finalBytes = 0;
+    bool done = false;
+    std::thread swapper([&]() {
+        std::size_t swapped = 0;
+        for (;;) {
+            std::unique_lock<std::mutex> lock(mutex);
+            finalBytesChanged.wait(lock, [&]() { return done || finalBytes > swapped; });
+            std::size_t end = finalBytes - finalBytes % elementSize;
+            bool finished = done;
+            lock.unlock();
+            cg::swapBytes(dst + swapped, dst + swapped, (end - swapped) / elementSize, elementSize);
+            swapped = end;
+            if (finished) {
+                break;
+            }
+        }
+    });
+
+    cg::InflateProgress progress = [&](std::size_t numFinalBytes) {
+        std::lock_guard<std::mutex> lock(mutex);
+        finalBytes = numFinalBytes;
+        finalBytesChanged.notify_one();
+    };
+    bool ok = encoding == "gzip"
+        ? cg::inflateGzip(src, srcSize, dst, numBytes, errorMessage, progress)
+        : cg::inflateZlib(src, srcSize, dst, numBytes, errorMessage, progress);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        done = true;
+        finalBytesChanged.notify_one();
+    }
+    swapper.join();
+    return ok;
+}
+
+// Read the voxel data described by the header into the volume
+bool loadData(const RawDataHeader &header, const std::string &filename, cg::VolumeBase *volume)
+{
+    // A separate data file is relative to the header file
+    std::string dataFilename = filename;
+    std::size_t offset = header.headerSize;
+    if (!header.dataFile.empty()) {
+        dataFilename = header.dataFile;
+        std::size_t slash = filename.find_last_of("/\\");
+        bool absolute = dataFilename[0] == '/' || dataFilename[0] == '\\' ||
+                        (dataFilename.size() > 1 && dataFilename[1] == ':');
+        if (!absolute && slash != std::string::npos) {
+            dataFilename = filename.substr(0, slash + 1) + dataFilename;
+        }
+        offset = 0;
+    }
+    cg::MappedFile file;
+    if (!cg::mappedFileOpen(&file, dataFilename)) {  // reported by mappedFileOpen()
+        return false;
+    }
+
+    std::size_t n = std::size_t(header.dimensions.x) * std::size_t(header.dimensions.y) *
+                    std::size_t(header.dimensions.z);
+    std::size_t elementSize = cg::datatypeSizeInBytes(header.datatype);
+    std::size_t nBytes = n * elementSize;
+    for (int i = 0; i < header.lineSkip && offset < file.size; i++) {
+        const void *lineEnd = std::memchr(file.data + offset, '\n', file.size - offset);
+        offset = lineEnd != nullptr ? static_cast<const std::uint8_t *>(lineEnd) - file.data + 1
+                                    : file.size;
+    }
+    if (header.byteSkip == -1 && header.encoding == "raw") {
+        offset = file.size >= nBytes ? file.size - nBytes : file.size;
+    }
+    else if (header.byteSkip > 0 && header.encoding == "raw") {
+        offset += std::size_t(header.byteSkip);
+    }
+    else if (header.byteSkip != 0) {
+        std::cerr << "Byte skip is only supported for raw data (" << filename << ")" << std::endl;
+        return false;
+    }
+    if (offset > file.size) {
+        std::cerr << "Unexpected end of data in " << dataFilename << std::endl;
+        return false;
+    }
+
+    const std::uint8_t *src = file.data + offset;
+    std::size_t srcSize = file.size - offset;
+    bool swap = elementSize > 1 && header.bigEndian == isLittleEndian();
+    std::vector<std::uint8_t> data(nBytes);
+    std::string errorMessage;
+    bool ok = true;
+    if (header.encoding == "raw") {
+        if (srcSize < nBytes) {
+            errorMessage = "unexpected end of data";
+            ok = false;
+        }
+        else {
+            cg::VoxelConversion conversion;
+            conversion.srcDatatype = header.datatype;
+            conversion.dstDatatype = header.datatype;
+            conversion.swapBytes = swap;
+            ok = cg::convertVoxelsParallel(conversion, &data[0], src, n,
+                                           std::size_t(header.dimensions.x) * header.dimensions.y);
+        }
+    }
+    else if (header.encoding == "ascii") {
+        const char *text = reinterpret_cast<const char *>(src);
+        ok = cg::parseASCIIVoxels(text, text + srcSize, header.datatype, &data[0], n, offset,
+                                  &errorMessage);
+    }
+    else {
+        ok = inflateVoxels(src, srcSize, header.encoding, &data[0], n, elementSize, swap,
+                           &errorMessage);
+    }
+    if (!ok) {
+        std::cerr << "Could not read " << dataFilename << ": " << errorMessage << std::endl;
+        return false;
+    }
+
+    volume->dimensions = header.dimensions;
+    volume->origin = header.origin;
+    volume->spacing = header.spacing;
+    volume->datatype = header.datatype;
+    volume->data.swap(data);
+    return true;
+}
+
+} // namespace
+
+
+
+namespace cg {
+
+bool volumeLoadNRRD(VolumeBase *volume, const std::string &filename)
+{
+    MappedFile file;
+    if (!mappedFileOpen(&file, filename)) {  // reported by mappedFileOpen()
+        return false;
+    }
+    RawDataHeader header;
+    if (!parseNRRDHeader(file.data, file.size, &header, filename)) {
+        return false;
+    }
+    mappedFileClose(&file);
+    return loadData(header, filename, volume);
+}
+
+bool volumeLoadMetaImage(VolumeBase *volume, const std::string &filename)
+{
+    MappedFile file;
+    if (!mappedFileOpen(&file, filename)) {  // reported by mappedFileOpen()
+        return false;
+    }
+    RawDataHeader header;
+    if (!parseMetaImageHeader(file.data, file.size, &header, filename)) {
+        return false;
+    }
+    mappedFileClose(&file);
+    return loadData(header, filename, volume);
+}
+
+} // namespace cg
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "cgVolume.h"
+
+#include <string>
+
+namespace cg {
+
+// Reads a volume image from a NRRD file, either with the data attached
+// (.nrrd) or in a separate data file named by a detached header
+// (.nhdr). Supported are 2D and 3D images of the types "uint8",
+// "uint16", "int16", "uint32" and "float32" (under any of their NRRD
+// names) in raw, gzip, or ASCII encoding. Spacing is taken from the
+// "spacings" or "space directions" field, the origin from "space
+// origin". Voxels are kept in their own data type in host byte order.
+//
+// Compressed data is decompressed straight from the memory mapped file
+// into volume->data; byte swapping, if needed, runs on a second thread
+// right behind the decoder. Returns true on success, false otherwise.
+bool volumeLoadNRRD(VolumeBase *volume, const std::string &filename);
+
+// Reads a volume image from a MetaImage file, i.e., a text header with
+// the data attached (.mha) or in a separate raw file (.mhd). Supported
+// are single-channel 2D and 3D images of the element types MET_UCHAR,
+// MET_USHORT, MET_SHORT, MET_UINT and MET_FLOAT, raw or zlib compressed
+// (CompressedData = True), read like in volumeLoadNRRD(). Returns true
+// on success, false otherwise.
+bool volumeLoadMetaImage(VolumeBase *volume, const std::string &filename);
+
+} // namespace cg
@@ -0,0 +1,463 @@
+#include "cgVolumePipeline.h"
+#include "cgVolumeConvert.h"
+#include "cgVolumeFilter.h"
+#include "cgParallel.h"
+
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+// Default size of the bricks cached by each stage
+const std::size_t defaultMemoryBudget = 256u << 20;
+
+// Returns v with every coordinate clamped to [0, dimensions - 1]
+glm::ivec3 clampToVolume(const glm::ivec3 &v, const glm::ivec3 &dimensions)
+{
+    return glm::clamp(v, glm::ivec3(0), dimensions - glm::ivec3(1));
+}
+
+// Reads a box of voxels of a source, clamping coordinates to the volume
+// (see cg::volumeSourceReadRegion()). The bricks involved are fetched
+// in parallel only if parallel is set; stages reading the halo of a
+// brick are already running on a worker thread.
+bool readRegion(cg::VolumeSource *source, const glm::ivec3 &origin, const glm::ivec3 &size,
+                std::uint8_t *dst, bool parallel)
+{
+    const glm::ivec3 &dims = source->info.dimensions;
+    if (dims.x <= 0 || dims.y <= 0 || dims.z <= 0) {
+        return false;
+    }
+    if (size.x <= 0 || size.y <= 0 || size.z <= 0) {
+        return true;
+    }
+    int bs = source->grid.brickSize;
+    glm::ivec3 firstBrick = clampToVolume(origin, dims) / bs;
+    glm::ivec3 numBricks = clampToVolume(origin + size - glm::ivec3(1), dims) / bs -
+                           firstBrick + glm::ivec3(1);
+
+    // Holding on to the bricks keeps them valid while they are copied,
+    // even if the cache evicts them
+    std::vector<cg::BrickDataPtr> bricks(std::size_t(numBricks.x) * numBricks.y * numBricks.z);
+    auto fetch = [&](std::size_t first, std::size_t last) {
+        for (std::size_t i = first; i < last; i++) {
+            glm::ivec3 brick = firstBrick + glm::ivec3(int(i % numBricks.x),
+                                                       int(i / numBricks.x % numBricks.y),
+                                                       int(i / (std::size_t(numBricks.x) * numBricks.y)));
+            bricks[i] = cg::volumeSourceBrick(source, brick);
+        }
+    };
+    if (parallel) {
+        cg::parallelFor(0, bricks.size(), fetch);
+    }
+    else {
+        fetch(0, bricks.size());
+    }
+    for (auto it = bricks.begin(); it != bricks.end(); ++it) {
+        if (!*it) {
+            return false;
+        }
+    }
+
+    // Rows are copied in runs of voxels within one brick; voxels outside
+    // the volume are copied one at a time from the border
+    std::size_t voxelSize = cg::volumeSourceVoxelSizeInBytes(*source);
+    for (int z = 0; z < size.z; z++) {
+        int sz = std::min(std::max(origin.z + z, 0), dims.z - 1);
+        for (int y = 0; y < size.y; y++) {
+            int sy = std::min(std::max(origin.y + y, 0), dims.y - 1);
+            std::uint8_t *row = dst + (std::size_t(z) * size.y + y) * size.x * voxelSize;
+            int x = 0;
+            while (x < size.x) {
+                int gx = origin.x + x;
+                int sx = std::min(std::max(gx, 0), dims.x - 1);
+                int run = 1;
+                if (gx == sx) {
+                    run = std::min(std::min(bs - sx % bs, dims.x - sx), size.x - x);
+                }
+                glm::ivec3 brick = glm::ivec3(sx, sy, sz) / bs - firstBrick;
+                const cg::BrickDataPtr &data = bricks[(std::size_t(brick.z) * numBricks.y +
+                                                       brick.y) * numBricks.x + brick.x];
+                std::size_t local = (std::size_t(sz % bs) * bs + sy % bs) * bs + sx % bs;
+                std::memcpy(row + std::size_t(x) * voxelSize, &(*data)[local * voxelSize],
+                            run * voxelSize);
+                x += run;
+            }
+        }
+    }
+    return true;
+}
+
+// Same as readRegion(), but widens the voxels to float
+bool readRegionFloat(cg::VolumeSource *source, const glm::ivec3 &origin, const glm::ivec3 &size,
+                     float *dst, bool parallel)
+{
+    std::size_t numElements = std::size_t(size.x) * size.y * size.z * source->info.numComponents;
+    if (source->info.datatype == "float32") {
+        return readRegion(source, origin, size, reinterpret_cast<std::uint8_t *>(dst), parallel);
+    }
+    std::vector<std::uint8_t> raw(numElements * cg::datatypeSizeInBytes(source->info.datatype));
+    return readRegion(source, origin, size, raw.empty() ? nullptr : &raw[0], parallel) &&
+           (raw.empty() || cg::voxelsToFloat(source->info.datatype, &raw[0], numElements, dst));
+}
+
+// Returns the geometry of input with another data type
+cg::VolumeSourceInfo sourceInfo(const cg::VolumeSource &input, const std::string &datatype,
+                                int numComponents)
+{
+    cg::VolumeSourceInfo info = input.info;
+    info.datatype = datatype;
+    info.numComponents = numComponents;
+    return info;
+}
+
+} // namespace
+
+
+
+namespace cg {
+
+VolumeSourcePtr volumeSourceCreate(const VolumeSourceInfo &info, int brickSize,
+                                   const BrickCompute &compute,
+                                   const std::vector<VolumeSourcePtr> &inputs)
+{
+    VolumeSourcePtr source = std::make_shared<VolumeSource>();
+    source->info = info;
+    source->grid = brickGridCreate(info.dimensions, std::max(brickSize, 1));
+    source->compute = compute;
+    source->inputs = inputs;
+    volumeSourceSetMemoryBudget(source.get(), defaultMemoryBudget);
+    return source;
+}
+
+std::size_t volumeSourceVoxelSizeInBytes(const VolumeSource &source)
+{
+    return datatypeSizeInBytes(source.info.datatype) * std::size_t(source.info.numComponents);
+}
+
+std::size_t volumeSourceBrickSizeInBytes(const VolumeSource &source)
+{
+    std::size_t bs = source.grid.brickSize;
+    return bs * bs * bs * volumeSourceVoxelSizeInBytes(source);
+}
+
+void volumeSourceSetMemoryBudget(VolumeSource *source, std::size_t memoryBudget)
+{
+    std::size_t brickBytes = std::max<std::size_t>(volumeSourceBrickSizeInBytes(*source), 1);
+    brickCacheSetCapacity(&source->cache, std::max<std::size_t>(memoryBudget / brickBytes, 1));
+}
+
+BrickDataPtr volumeSourceBrick(VolumeSource *source, const glm::ivec3 &brick)
+{
+    std::size_t index = brickGridIndex(source->grid, brick);
+    BrickDataPtr cached = brickCacheFind(&source->cache, index);
+    if (cached) {
+        return cached;
+    }
+    // Two threads may compute the same brick; the first one to finish
+    // is kept
+    std::shared_ptr<std::vector<std::uint8_t> > voxels =
+        std::make_shared<std::vector<std::uint8_t> >(volumeSourceBrickSizeInBytes(*source));
+    if (voxels->empty() || !source->compute(brick, &(*voxels)[0])) {
+        return BrickDataPtr();
+    }
+    return brickCacheInsert(&source->cache, index, voxels);
+}
+
+bool volumeSourceReadRegion(VolumeSource *source, const glm::ivec3 &origin,
+                            const glm::ivec3 &size, std::uint8_t *dst)
+{
+    return readRegion(source, origin, size, dst, true);
+}
+
+bool volumeSourceReadRegionFloat(VolumeSource *source, const glm::ivec3 &origin,
+                                 const glm::ivec3 &size, float *dst)
+{
+    return readRegionFloat(source, origin, size, dst, true);
+}
+
+bool volumeSourceMaterialize(VolumeSource *source, VolumeBase *volume)
+{
+    const glm::ivec3 &dims = source->info.dimensions;
+    std::size_t sliceBytes = std::size_t(dims.x) * dims.y * volumeSourceVoxelSizeInBytes(*source);
+    VolumeBase result;
+    result.dimensions = dims;
+    result.origin = source->info.origin;
+    result.spacing = source->info.spacing;
+    result.datatype = source->info.datatype;
+    result.data.resize(sliceBytes * std::max(dims.z, 0));
+    if (result.data.empty()) {
+        std::cerr << "Cannot materialize an empty volume source" << std::endl;
+        return false;
+    }
+
+    // One layer of bricks at a time, so that only that layer is pinned
+    // besides the result
+    int bs = source->grid.brickSize;
+    for (int z = 0; z < dims.z; z += bs) {
+        int numSlices = std::min(bs, dims.z - z);
+        if (!readRegion(source, glm::ivec3(0, 0, z), glm::ivec3(dims.x, dims.y, numSlices),
+                        &result.data[z * sliceBytes], true)) {
+            std::cerr << "Failed to compute bricks of volume source" << std::endl;
+            return false;
+        }
+    }
+    *volume = std::move(result);
+    return true;
+}
+
+VolumeSourcePtr volumeSourceFromVoxels(const glm::ivec3 &dimensions, const glm::vec3 &origin,
+                                       const glm::vec3 &spacing, const std::string &datatype,
+                                       const std::uint8_t *voxels, int brickSize)
+{
+    VolumeSourceInfo info;
+    info.dimensions = dimensions;
+    info.origin = origin;
+    info.spacing = spacing;
+    info.datatype = datatype;
+    BrickGrid grid = brickGridCreate(dimensions, brickSize);
+    std::size_t elementSize = datatypeSizeInBytes(datatype);
+    return volumeSourceCreate(info, brickSize, [=](const glm::ivec3 &brick, std::uint8_t *dst) {
+        glm::ivec3 first = brickGridBrickOrigin(grid, brick);
+        glm::ivec3 extent = brickGridBrickExtent(grid, brick);
+        std::size_t rowBytes = extent.x * elementSize;
+        for (int z = 0; z < extent.z; z++) {
+            for (int y = 0; y < extent.y; y++) {
+                std::size_t offset = ((std::size_t(first.z + z) * dimensions.y + first.y + y) *
+                                      dimensions.x + first.x) * elementSize;
+                std::memcpy(dst + (std::size_t(z) * brickSize + y) * brickSize * elementSize,
+                            voxels + offset, rowBytes);
+            }
+        }
+        return true;
+    });
+}
+
+VolumeSourcePtr volumeSourceFromVolume(const VolumeBase *volume, int brickSize)
+{
+    if (volume->data.empty() ||
+        volume->data.size() < volumeNumVoxels(*volume) * datatypeSizeInBytes(volume->datatype)) {
+        std::cerr << "Cannot create a volume source from an empty volume" << std::endl;
+        return VolumeSourcePtr();
+    }
+    return volumeSourceFromVoxels(volume->dimensions, volume->origin, volume->spacing,
+                                  volume->datatype, &volume->data[0], brickSize);
+}
+
+VolumeSourcePtr volumeSourceFromBrickSource(const std::shared_ptr<VTKBrickSource> &source)
+{
+    VolumeSourceInfo info;
+    info.dimensions = source->info.dimensions;
+    info.origin = source->info.origin;
+    info.spacing = source->info.spacing;
+    info.datatype = source->info.datatype;
+    std::size_t brickBytes = brickSourceBrickSizeInBytes(*source);
+    VolumeSourcePtr leaf = volumeSourceCreate(info, source->grid.brickSize,
+                                              [=](const glm::ivec3 &brick, std::uint8_t *dst) {
+        BrickDataPtr data = brickSourceBrick(source.get(), brickGridIndex(source->grid, brick));
+        if (!data) {
+            return false;
+        }
+        std::memcpy(dst, &(*data)[0], brickBytes);
+        return true;
+    });
+    brickCacheSetCapacity(&leaf->cache, 0);
+    return leaf;
+}
+
+VolumeSourcePtr volumeSourceFromBricked(const std::shared_ptr<BrickedVolume> &volume)
+{
+    VolumeSourceInfo info;
+    info.dimensions = volume->dimensions;
+    info.origin = volume->origin;
+    info.spacing = volume->spacing;
+    info.datatype = volume->datatype;
+    std::size_t brickBytes = brickedVolumeBrickSizeInBytes(*volume);
+    VolumeSourcePtr leaf = volumeSourceCreate(info, volume->brickSize,
+                                              [=](const glm::ivec3 &brick, std::uint8_t *dst) {
+        std::memcpy(dst, brickedVolumeBrick(*volume, 0, brick), brickBytes);
+        return true;
+    });
+    brickCacheSetCapacity(&leaf->cache, 0);
+    return leaf;
+}
+
+VolumeSourcePtr volumeSourceResample(const VolumeSourcePtr &input, const glm::ivec3 &dimensions)
+{
+    if (glm::any(glm::lessThanEqual(dimensions, glm::ivec3(0)))) {
+        std::cerr << "Invalid dimensions for resampling" << std::endl;
+        return VolumeSourcePtr();
+    }
+
+    // Voxel centers of the output cover the same extent as those of the
+    // input: output voxel i samples the input at (i + 0.5) * ratio - 0.5
+    VolumeSourceInfo info = sourceInfo(*input, "float32", input->info.numComponents);
+    glm::vec3 ratio = glm::vec3(input->info.dimensions) / glm::vec3(dimensions);
+    info.dimensions = dimensions;
+    info.spacing = input->info.spacing * ratio;
+    info.origin = input->info.origin + input->info.spacing * (0.5f * ratio - 0.5f);
+    int bs = input->grid.brickSize;
+    VolumeSource *in = input.get();
+    return volumeSourceCreate(info, bs, [=](const glm::ivec3 &brick, std::uint8_t *dst) {
+        glm::ivec3 first = brick * bs;
+        glm::vec3 lo = glm::max((glm::vec3(first) + 0.5f) * ratio - 0.5f, glm::vec3(0.0f));
+        glm::vec3 hi = glm::max((glm::vec3(first + glm::ivec3(bs - 1)) + 0.5f) * ratio - 0.5f,
+                                glm::vec3(0.0f));
+        glm::ivec3 regionOrigin = glm::ivec3(glm::floor(lo));
+        glm::ivec3 regionSize = glm::ivec3(glm::floor(hi)) - regionOrigin + glm::ivec3(2);
+        int nc = in->info.numComponents;
+        std::vector<float> region(std::size_t(regionSize.x) * regionSize.y * regionSize.z * nc);
+        if (!readRegionFloat(in, regionOrigin, regionSize, &region[0], false)) {
+            return false;
+        }
+
+        float *out = reinterpret_cast<float *>(dst);
+        for (int z = 0; z < bs; z++) {
+            float pz = std::max((first.z + z + 0.5f) * ratio.z - 0.5f, 0.0f) - regionOrigin.z;
+            int z0 = std::min(int(pz), regionSize.z - 2);
+            float fz = std::min(pz - z0, 1.0f);
+            for (int y = 0; y < bs; y++) {
+                float py = std::max((first.y + y + 0.5f) * ratio.y - 0.5f, 0.0f) - regionOrigin.y;
+                int y0 = std::min(int(py), regionSize.y - 2);
+                float fy = std::min(py - y0, 1.0f);
+                for (int x = 0; x < bs; x++) {
+                    float px = std::max((first.x + x + 0.5f) * ratio.x - 0.5f, 0.0f) - regionOrigin.x;
+                    int x0 = std::min(int(px), regionSize.x - 2);
+                    float fx = std::min(px - x0, 1.0f);
+                    const float *v = &region[((std::size_t(z0) * regionSize.y + y0) *
+                                              regionSize.x + x0) * nc];
+                    std::size_t dy = std::size_t(regionSize.x) * nc;
+                    std::size_t dz = dy * regionSize.y;
+                    for (int c = 0; c < nc; c++) {
+                        float c00 = v[c] + fx * (v[nc + c] - v[c]);
+                        float c10 = v[dy + c] + fx * (v[dy + nc + c] - v[dy + c]);
+                        float c01 = v[dz + c] + fx * (v[dz + nc + c] - v[dz + c]);
+                        float c11 = v[dz + dy + c] + fx * (v[dz + dy + nc + c] - v[dz + dy + c]);
+                        float c0 = c00 + fy * (c10 - c00);
+                        float c1 = c01 + fy * (c11 - c01);
+                        *out++ = c0 + fz * (c1 - c0);
+                    }
+                }
+            }
+        }
+        return true;
+    }, std::vector<VolumeSourcePtr>(1, input));
+}
+
+VolumeSourcePtr volumeSourceSmooth(const VolumeSourcePtr &input, float sigma)
+{
+    if (!(sigma > 0.0f)) {
+        std::cerr << "Invalid standard deviation for smoothing: " << sigma << std::endl;
+        return VolumeSourcePtr();
+    }
+
+    std::vector<float> kernel = convolutionKernelGaussian(sigma);
+    int radius = int(kernel.size() / 2);
+
+    VolumeSourceInfo info = sourceInfo(*input, "float32", input->info.numComponents);
+    int bs = input->grid.brickSize;
+    VolumeSource *in = input.get();
+    return volumeSourceCreate(info, bs, [=](const glm::ivec3 &brick, std::uint8_t *dst) {
+        // The brick and its halo are filtered along x, then y, then z,
+        // each pass dropping the halo along its axis
+        int nc = in->info.numComponents;
+        int n = bs + 2 * radius;
+        std::vector<float> region(std::size_t(n) * n * n * nc);
+        if (!readRegionFloat(in, brick * bs - glm::ivec3(radius), glm::ivec3(n), &region[0], false)) {
+            return false;
+        }
+        std::vector<float> passX(std::size_t(bs) * n * n * nc, 0.0f);
+        for (int z = 0; z < n; z++) {
+            for (int y = 0; y < n; y++) {
+                const float *src = &region[(std::size_t(z) * n + y) * n * nc];
+                float *out = &passX[(std::size_t(z) * n + y) * bs * nc];
+                for (int k = 0; k <= 2 * radius; k++) {
+                    convolutionAccumulate(out, src + k * nc, kernel[k], std::size_t(bs) * nc);
+                }
+            }
+        }
+        std::vector<float> passY(std::size_t(bs) * bs * n * nc, 0.0f);
+        for (int z = 0; z < n; z++) {
+            for (int y = 0; y < bs; y++) {
+                float *out = &passY[(std::size_t(z) * bs + y) * bs * nc];
+                for (int k = 0; k <= 2 * radius; k++) {
+                    const float *src = &passX[(std::size_t(z) * n + y + k) * bs * nc];
+                    convolutionAccumulate(out, src, kernel[k], std::size_t(bs) * nc);
+                }
+            }
+        }
+        float *out = reinterpret_cast<float *>(dst);
+        std::size_t sliceElements = std::size_t(bs) * bs * nc;
+        std::fill(out, out + sliceElements * bs, 0.0f);
+        for (int z = 0; z < bs; z++) {
+            for (int k = 0; k <= 2 * radius; k++) {
+                const float *src = &passY[(z + k) * sliceElements];
+                convolutionAccumulate(out + z * sliceElements, src, kernel[k], sliceElements);
+            }
+        }
+        return true;
+    }, std::vector<VolumeSourcePtr>(1, input));
+}
+
+VolumeSourcePtr volumeSourceGradient(const VolumeSourcePtr &input)
+{
+    if (input->info.numComponents != 1) {
+        std::cerr << "Gradients need a single-component volume source" << std::endl;
+        return VolumeSourcePtr();
+    }
+    VolumeSourceInfo info = sourceInfo(*input, "float32", 3);
+    int bs = input->grid.brickSize;
+    VolumeSource *in = input.get();
+    return volumeSourceCreate(info, bs, [=](const glm::ivec3 &brick, std::uint8_t *dst) {
+        int n = bs + 2;
+        glm::ivec3 regionOrigin = brick * bs - glm::ivec3(1);
+        std::vector<float> region(std::size_t(n) * n * n);
+        if (!readRegionFloat(in, regionOrigin, glm::ivec3(n), &region[0], false)) {
+            return false;
+        }
+
+        // Differences are taken between the neighbors inside the volume,
+        // i.e., one-sided at the border
+        const glm::ivec3 &dims = in->info.dimensions;
+        float *out = reinterpret_cast<float *>(dst);
+        for (int z = 0; z < bs; z++) {
+            for (int y = 0; y < bs; y++) {
+                for (int x = 0; x < bs; x++) {
+                    glm::ivec3 p = brick * bs + glm::ivec3(x, y, z);
+                    glm::ivec3 lo = clampToVolume(p - glm::ivec3(1), dims);
+                    glm::ivec3 hi = clampToVolume(p + glm::ivec3(1), dims);
+                    for (int axis = 0; axis < 3; axis++) {
+                        glm::ivec3 a = clampToVolume(p, dims) - regionOrigin;
+                        glm::ivec3 b = a;
+                        a[axis] = lo[axis] - regionOrigin[axis];
+                        b[axis] = hi[axis] - regionOrigin[axis];
+                        float va = region[(std::size_t(a.z) * n + a.y) * n + a.x];
+                        float vb = region[(std::size_t(b.z) * n + b.y) * n + b.x];
+                        float distance = (hi[axis] - lo[axis]) * in->info.spacing[axis];
+                        *out++ = distance > 0.0f ? (vb - va) / distance : 0.0f;
+                    }
+                }
+            }
+        }
+        return true;
+    }, std::vector<VolumeSourcePtr>(1, input));
+}
+
+VolumeSourcePtr volumeSourceQuantize(const VolumeSourcePtr &input, float minValue, float maxValue)
+{
+    VolumeSourceInfo info = sourceInfo(*input, "uint8", input->info.numComponents);
+    VoxelConversion conversion;
+    conversion.srcDatatype = input->info.datatype;
+    conversion.dstDatatype = "uint8";
+    voxelConversionNormalize(&conversion, minValue, maxValue);
+    int bs = input->grid.brickSize;
+    std::size_t numElements = std::size_t(bs) * bs * bs * input->info.numComponents;
+    VolumeSource *in = input.get();
+    return volumeSourceCreate(info, bs, [=](const glm::ivec3 &brick, std::uint8_t *dst) {
+        BrickDataPtr data = volumeSourceBrick(in, brick);
+        return data && convertVoxels(conversion, dst, &(*data)[0], numElements);
+    }, std::vector<VolumeSourcePtr>(1, input));
+}
+
+} // namespace cg
@@ -0,0 +1,131 @@
+#pragma once
+
+#include "cgVolume.h"
+#include "cgBrickGrid.h"
+#include "cgBrickCache.h"
+#include "cgBrickSource.h"
+#include "cgVolumeCache.h"
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <functional>
+#include <cstddef>
+#include <cstdint>
+
+namespace cg {
+
+// Function that computes one brick of a volume source into dst
+// (brickSize^3 voxels of numComponents interleaved components,
+// x-fastest). Voxels of border bricks outside the volume are
+// unspecified. Returns true on success.
+typedef std::function<bool(const glm::ivec3 &brick, std::uint8_t *dst)> BrickCompute;
+
+// Struct for the geometry and data type of a volume source
+struct VolumeSourceInfo {
+    glm::ivec3 dimensions;  // volume dimensions
+    glm::vec3 origin;  // volume origin
+    glm::vec3 spacing;  // voxel spacing
+    std::string datatype;  // data type of each component
+    int numComponents;  // components per voxel
+
+    VolumeSourceInfo() :
+        dimensions(glm::ivec3(0, 0, 0)),
+        origin(glm::vec3(0.0f, 0.0f, 0.0f)),
+        spacing(glm::vec3(1.0f, 1.0f, 1.0f)),
+        numComponents(1)
+    {}
+};
+
+// Struct for a stage of a lazy volume pipeline. A source is either a
+// leaf that reads bricks from a volume, or a filter computed from the
+// bricks of its inputs. Bricks are only computed when they are pulled
+// (see volumeSourceBrick()) and are kept in a bounded cache, so that
+// no stage ever holds a full-size copy of the volume. All functions
+// below are thread-safe; sources are shared through VolumeSourcePtr and
+// keep their inputs alive.
+struct VolumeSource {
+    VolumeSourceInfo info;  // geometry and data type of the output
+    BrickGrid grid;  // brick layout
+    BrickCompute compute;
+    std::vector<std::shared_ptr<VolumeSource> > inputs;
+    BrickLRUCache cache;
+};
+
+typedef std::shared_ptr<VolumeSource> VolumeSourcePtr;
+
+// Creates a source with the given geometry and data type that computes
+// its bricks with compute. This is the extension point for new stages.
+VolumeSourcePtr volumeSourceCreate(const VolumeSourceInfo &info, int brickSize,
+                                   const BrickCompute &compute,
+                                   const std::vector<VolumeSourcePtr> &inputs =
+                                       std::vector<VolumeSourcePtr>());
+
+// Returns the size in bytes of one voxel of the source
+std::size_t volumeSourceVoxelSizeInBytes(const VolumeSource &source);
+
+// Returns the size in bytes of one brick of the source
+std::size_t volumeSourceBrickSizeInBytes(const VolumeSource &source);
+
+// Limits the bricks cached by the source to about the given number of
+// bytes (at least one brick)
+void volumeSourceSetMemoryBudget(VolumeSource *source, std::size_t memoryBudget);
+
+// Returns a brick of the source, computing it (and the input bricks it
+// needs) if it is not cached. Returns an empty pointer if the brick
+// cannot be computed.
+BrickDataPtr volumeSourceBrick(VolumeSource *source, const glm::ivec3 &brick);
+
+// Reads the box of voxels starting at origin into dst (x-fastest, with
+// interleaved components). Coordinates outside the volume are clamped
+// to the border, so the box may extend past the volume (e.g., for the
+// halo of a filter). The bricks involved are computed in parallel.
+// Returns false if a brick cannot be computed.
+bool volumeSourceReadRegion(VolumeSource *source, const glm::ivec3 &origin,
+                            const glm::ivec3 &size, std::uint8_t *dst);
+
+// Same as volumeSourceReadRegion(), but widens the voxels to float
+bool volumeSourceReadRegionFloat(VolumeSource *source, const glm::ivec3 &origin,
+                                 const glm::ivec3 &size, float *dst);
+
+// Computes the whole source into a linear volume image (for tools that
+// need all voxels at once). Returns true on success, false otherwise.
+bool volumeSourceMaterialize(VolumeSource *source, VolumeBase *volume);
+
+// Creates a leaf source reading bricks from linear voxels in memory,
+// e.g., the data of a volume image or a mapping. The voxels must
+// outlive the source.
+VolumeSourcePtr volumeSourceFromVoxels(const glm::ivec3 &dimensions, const glm::vec3 &origin,
+                                       const glm::vec3 &spacing, const std::string &datatype,
+                                       const std::uint8_t *voxels, int brickSize = 32);
+
+// Creates a leaf source reading bricks from a volume image, which must
+// outlive the source
+VolumeSourcePtr volumeSourceFromVolume(const VolumeBase *volume, int brickSize = 32);
+
+// Creates a leaf source reading bricks from a streamed VTK file. The
+// bricks are cached by the brick source, not by the leaf.
+VolumeSourcePtr volumeSourceFromBrickSource(const std::shared_ptr<VTKBrickSource> &source);
+
+// Creates a leaf source reading bricks from the full-resolution level of
+// a mapped bricked volume. Bricks are read from the mapping, not cached.
+VolumeSourcePtr volumeSourceFromBricked(const std::shared_ptr<BrickedVolume> &volume);
+
+// Creates a stage resampling its input to the given dimensions
+// (trilinear, covering the same extent). The output is float32.
+VolumeSourcePtr volumeSourceResample(const VolumeSourcePtr &input, const glm::ivec3 &dimensions);
+
+// Creates a stage smoothing its input with a separable Gaussian of the
+// given standard deviation (in voxels). The output is float32.
+VolumeSourcePtr volumeSourceSmooth(const VolumeSourcePtr &input, float sigma);
+
+// Creates a stage computing the gradient of its (single-component)
+// input by central differences, in value units per unit of length. The
+// output is float32 with three components.
+VolumeSourcePtr volumeSourceGradient(const VolumeSourcePtr &input);
+
+// Creates a stage quantizing its input to uint8 so that values in
+// [minValue, maxValue] map to [0, 255]
+VolumeSourcePtr volumeSourceQuantize(const VolumeSourcePtr &input, float minValue, float maxValue);
+
+} // namespace cg
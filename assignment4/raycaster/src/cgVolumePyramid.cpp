@@ -0,0 +1,282 @@
+#include "cgVolumePyramid.h"
+#include "cgParallel.h"
+
+#include <iostream>
+#include <algorithm>
+#include <limits>
+#include <cstring>
+#include <cmath>
+
+namespace {
+
+// Input slices read at once by cg::volumeReduceSlices() (at least)
+const int reduceSlabSlices = 32;
+
+// Returns the first input voxel of the block covered by output voxel i,
+// when an axis of n input voxels is reduced to m output voxels
+inline int blockBegin(int i, int n, int m)
+{
+    return int(std::int64_t(i) * n / m);
+}
+
+// Rounds an average back to the voxel type
+template<typename VoxelType>
+inline VoxelType fromAverage(double value)
+{
+    return static_cast<VoxelType>(std::llrint(value));
+}
+
+template<>
+inline float fromAverage<float>(double value)
+{
+    return float(value);
+}
+
+// Reduces the output voxels [begin, end) of a volume of the given voxel
+// type (see cg::volumeReduce())
+template<typename VoxelType>
+void reduceBox(const cg::VolumeBase &src, cg::VolumeBase *dst, cg::PyramidReduction reduction,
+               const glm::ivec3 &begin, const glm::ivec3 &end)
+{
+    const glm::ivec3 &n = src.dimensions;
+    const glm::ivec3 &m = dst->dimensions;
+    const VoxelType *in = reinterpret_cast<const VoxelType *>(&src.data[0]);
+    VoxelType *out = reinterpret_cast<VoxelType *>(&dst->data[0]);
+    std::size_t inSlice = std::size_t(n.x) * n.y;
+    std::vector<double> sum(m.x);
+    std::vector<VoxelType> largest(m.x);
+    std::vector<int> x0(m.x + 1);
+    for (int x = begin.x; x <= end.x; x++) {
+        x0[x] = blockBegin(x, n.x, m.x);
+    }
+
+    for (int z = begin.z; z < end.z; z++) {
+        int z0 = blockBegin(z, n.z, m.z), z1 = blockBegin(z + 1, n.z, m.z);
+        for (int y = begin.y; y < end.y; y++) {
+            int y0 = blockBegin(y, n.y, m.y), y1 = blockBegin(y + 1, n.y, m.y);
+            std::fill(sum.begin(), sum.end(), 0.0);
+            std::fill(largest.begin(), largest.end(), std::numeric_limits<VoxelType>::lowest());
+            // Input rows are read sequentially, each adding to the whole
+            // output row
+            for (int iz = z0; iz < z1; iz++) {
+                for (int iy = y0; iy < y1; iy++) {
+                    const VoxelType *row = in + iz * inSlice + std::size_t(iy) * n.x;
+                    for (int x = begin.x; x < end.x; x++) {
+                        for (int ix = x0[x]; ix < x0[x + 1]; ix++) {
+                            sum[x] += row[ix];
+                            largest[x] = std::max(largest[x], row[ix]);
+                        }
+                    }
+                }
+            }
+            VoxelType *dstRow = out + (std::size_t(z) * m.y + y) * std::size_t(m.x);
+            for (int x = begin.x; x < end.x; x++) {
+                if (reduction == cg::PYRAMID_MAX) {
+                    dstRow[x] = largest[x];
+                }
+                else {
+                    int count = (x0[x + 1] - x0[x]) * (y1 - y0) * (z1 - z0);
+                    dstRow[x] = fromAverage<VoxelType>(sum[x] / count);
+                }
+            }
+        }
+    }
+}
+
+// Calls reduceBox() for the voxel type of the volume
+void reduceBoxOfDatatype(const cg::VolumeBase &src, cg::VolumeBase *dst,
+                         cg::PyramidReduction reduction, const glm::ivec3 &begin,
+                         const glm::ivec3 &end)
+{
+    if (src.datatype == "uint8") {
+        reduceBox<std::uint8_t>(src, dst, reduction, begin, end);
+    }
+    else if (src.datatype == "uint16") {
+        reduceBox<std::uint16_t>(src, dst, reduction, begin, end);
+    }
+    else if (src.datatype == "int16") {
+        reduceBox<std::int16_t>(src, dst, reduction, begin, end);
+    }
+    else if (src.datatype == "uint32") {
+        reduceBox<std::uint32_t>(src, dst, reduction, begin, end);
+    }
+    else {
+        reduceBox<float>(src, dst, reduction, begin, end);
+    }
+}
+
+} // namespace
+
+
+
+namespace cg {
+
+glm::ivec3 pyramidReducedDimensions(const glm::ivec3 &dimensions, const glm::vec3 &spacing,
+                                    bool anisotropic)
+{
+    // Axes that cannot be halved any more do not count as finest
+    float finest = std::numeric_limits<float>::max();
+    for (int axis = 0; axis < 3; axis++) {
+        if (dimensions[axis] > 1) {
+            finest = std::min(finest, spacing[axis]);
+        }
+    }
+    glm::ivec3 reduced = dimensions;
+    for (int axis = 0; axis < 3; axis++) {
+        if (!anisotropic || spacing[axis] < 2.0f * finest) {
+            reduced[axis] = std::max(dimensions[axis] / 2, 1);
+        }
+    }
+    return reduced;
+}
+
+bool volumeReduce(const VolumeBase &src, VolumeBase *dst, const glm::ivec3 &dimensions,
+                  PyramidReduction reduction)
+{
+    std::size_t elementSize = datatypeSizeInBytes(src.datatype);
+    if (elementSize == 0 || src.data.size() < volumeNumVoxels(src) * elementSize ||
+        glm::any(glm::lessThan(dimensions, glm::ivec3(1))) ||
+        glm::any(glm::greaterThan(dimensions, src.dimensions))) {
+        std::cerr << "Cannot reduce volume of data type " << src.datatype << " to "
+                  << dimensions.x << "x" << dimensions.y << "x" << dimensions.z << std::endl;
+        return false;
+    }
+    VolumeBase result;
+    result.dimensions = dimensions;
+    result.origin = src.origin;
+    result.spacing = src.spacing * glm::vec3(src.dimensions) / glm::vec3(dimensions);
+    result.datatype = src.datatype;
+    result.data.resize(volumeNumVoxels(result) * elementSize);
+
+    parallelFor(0, std::size_t(dimensions.z), [&](std::size_t first, std::size_t last) {
+        reduceBoxOfDatatype(src, &result, reduction, glm::ivec3(0, 0, int(first)),
+                            glm::ivec3(dimensions.x, dimensions.y, int(last)));
+    });
+    *dst = std::move(result);
+    return true;
+}
+
+bool volumeReduceSlices(const VolumeBase &header, const SliceReader &readSlices,
+                        VolumeBase *dst, const glm::ivec3 &dimensions,
+                        PyramidReduction reduction)
+{
+    const glm::ivec3 &n = header.dimensions;
+    const glm::ivec3 &m = dimensions;
+    if (glm::any(glm::lessThan(m, glm::ivec3(1))) || glm::any(glm::greaterThan(m, n))) {
+        std::cerr << "Cannot reduce volume to " << m.x << "x" << m.y << "x" << m.z << std::endl;
+        return false;
+    }
+    VolumeBase result;
+    result.dimensions = m;
+    result.origin = header.origin;
+    result.spacing = header.spacing * glm::vec3(n) / glm::vec3(m);
+    result.datatype = "float32";
+    result.data.resize(volumeNumVoxels(result) * sizeof(float));
+
+    // Output slices are reduced one at a time from a copy of the input
+    // slices of their block, so that the blocks are the same as for the
+    // whole volume
+    std::size_t sliceVoxels = std::size_t(n.x) * std::size_t(n.y);
+    std::size_t outSliceBytes = std::size_t(m.x) * std::size_t(m.y) * sizeof(float);
+    std::vector<float> slab;
+    VolumeBase block, reduced;
+    block.dimensions = glm::ivec3(n.x, n.y, 0);
+    block.datatype = "float32";
+    reduced.dimensions = glm::ivec3(m.x, m.y, 1);
+    reduced.datatype = "float32";
+    reduced.data.resize(outSliceBytes);
+    for (int first = 0; first < m.z; ) {
+        int last = first + 1;
+        while (last < m.z && blockBegin(last, n.z, m.z) - blockBegin(first, n.z, m.z) <
+                             reduceSlabSlices) {
+            last++;
+        }
+        int z0 = blockBegin(first, n.z, m.z), z1 = blockBegin(last, n.z, m.z);
+        slab.resize(std::size_t(z1 - z0) * sliceVoxels);
+        if (!readSlices(z0, z1 - z0, &slab[0])) {
+            return false;
+        }
+        for (int z = first; z < last; z++) {
+            int b0 = blockBegin(z, n.z, m.z), b1 = blockBegin(z + 1, n.z, m.z);
+            block.dimensions.z = b1 - b0;
+            block.data.resize(std::size_t(b1 - b0) * sliceVoxels * sizeof(float));
+            std::memcpy(&block.data[0], &slab[std::size_t(b0 - z0) * sliceVoxels],
+                        block.data.size());
+            parallelFor(0, std::size_t(m.y), [&](std::size_t y0, std::size_t y1) {
+                reduceBox<float>(block, &reduced, reduction, glm::ivec3(0, int(y0), 0),
+                                 glm::ivec3(m.x, int(y1), 1));
+            });
+            std::memcpy(&result.data[std::size_t(z) * outSliceBytes], &reduced.data[0],
+                        outSliceBytes);
+        }
+        first = last;
+    }
+    *dst = std::move(result);
+    return true;
+}
+
+void pyramidReducedRegion(const glm::ivec3 &dimensions, const glm::ivec3 &reducedDimensions,
+                          const glm::ivec3 &origin, const glm::ivec3 &size,
+                          glm::ivec3 *reducedOrigin, glm::ivec3 *reducedSize)
+{
+    for (int axis = 0; axis < 3; axis++) {
+        // Output voxel i covers [blockBegin(i), blockBegin(i + 1)): the
+        // first one covering the region starts at or before its origin,
+        // the last one starts before its end
+        std::int64_t n = dimensions[axis], m = reducedDimensions[axis];
+        std::int64_t a = origin[axis], b = std::int64_t(origin[axis]) + size[axis];
+        std::int64_t first = std::max<std::int64_t>(((a + 1) * m - 1) / n, 0);
+        std::int64_t last = std::min<std::int64_t>((b * m + n - 1) / n, m);  // exclusive
+        (*reducedOrigin)[axis] = int(first);
+        (*reducedSize)[axis] = int(std::max<std::int64_t>(last - first, 0));
+    }
+}
+
+bool volumeReduceRegion(const VolumeBase &src, VolumeBase *dst, const glm::ivec3 &origin,
+                        const glm::ivec3 &size, PyramidReduction reduction)
+{
+    std::size_t elementSize = datatypeSizeInBytes(src.datatype);
+    if (elementSize == 0 || src.datatype != dst->datatype ||
+        src.data.size() < volumeNumVoxels(src) * elementSize ||
+        dst->data.size() < volumeNumVoxels(*dst) * elementSize ||
+        glm::any(glm::greaterThan(dst->dimensions, src.dimensions)) ||
+        glm::any(glm::lessThan(origin, glm::ivec3(0))) ||
+        glm::any(glm::greaterThan(origin + size, dst->dimensions))) {
+        std::cerr << "Cannot reduce region of volume of data type " << src.datatype << std::endl;
+        return false;
+    }
+    if (glm::any(glm::lessThan(size, glm::ivec3(1)))) {
+        return true;
+    }
+    reduceBoxOfDatatype(src, dst, reduction, origin, origin + size);
+    return true;
+}
+
+bool volumeBuildPyramid(const VolumeBase &volume, std::vector<VolumeBase> *levels,
+                        PyramidReduction reduction, bool anisotropic, int maxLevels)
+{
+    levels->clear();
+    const VolumeBase *level = &volume;
+    while (maxLevels <= 0 || int(levels->size()) < maxLevels) {
+        glm::ivec3 dims = pyramidReducedDimensions(level->dimensions, level->spacing, anisotropic);
+        if (dims == level->dimensions) {
+            break;
+        }
+        VolumeBase next;
+        if (!volumeReduce(*level, &next, dims, reduction)) {
+            levels->clear();
+            return false;
+        }
+        levels->push_back(std::move(next));
+        level = &levels->back();
+    }
+    return true;
+}
+
+float pyramidLevelForFootprint(float voxelPixels, int numLevels, float bias)
+{
+    float level = voxelPixels > 0.0f ? std::log2(1.0f / voxelPixels) + bias : 0.0f;
+    return std::min(std::max(level, 0.0f), float(std::max(numLevels - 1, 0)));
+}
+
+} // namespace cg
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "cgVolume.h"
+#include "cgVolumeResample.h"
+
+#include <vector>
+
+namespace cg {
+
+// How the voxels of a block are combined into one voxel of the next
+// (coarser) level of a pyramid
+enum PyramidReduction {
+    PYRAMID_AVERAGE = 0,  // mean of the block
+    PYRAMID_MAX = 1  // largest value of the block (keeps thin bright structures)
+};
+
+// Returns the dimensions of the level below a level of the given
+// dimensions and voxel spacing. Without anisotropic set, every axis is
+// halved, rounding down to at least one voxel, like the mip levels of a
+// texture. With anisotropic set, only the axes whose spacing is less
+// than twice the finest spacing (of the axes longer than one voxel) are
+// halved, so that anisotropic voxels become more isotropic from level to
+// level.
+glm::ivec3 pyramidReducedDimensions(const glm::ivec3 &dimensions, const glm::vec3 &spacing,
+                                    bool anisotropic);
+
+// Reduces a volume image (in LAYOUT_LINEAR) to smaller dimensions. Each
+// output voxel combines the block of input voxels it covers along each
+// axis (2 voxels when halving even dimensions, 2 or 3 for odd ones, 1 on
+// axes that keep their size). The spacing grows accordingly; origin and
+// data type are kept. Output slices are computed in parallel. Returns
+// false if the data type is not supported or dimensions grow.
+bool volumeReduce(const VolumeBase &src, VolumeBase *dst, const glm::ivec3 &dimensions,
+                  PyramidReduction reduction);
+
+// Same as volumeReduce(), but reads the input with readSlices, a slab
+// at a time, so that it never needs to be in memory at once. header
+// describes the input (its data is not used); dst is "float32".
+bool volumeReduceSlices(const VolumeBase &header, const SliceReader &readSlices,
+                        VolumeBase *dst, const glm::ivec3 &dimensions,
+                        PyramidReduction reduction);
+
+// Returns the region of a reduced level of a volume (of dimensions
+// reducedDimensions) whose voxels cover any of the region [origin, origin
+// + size) of the level above it (of dimensions dimensions), i.e., the
+// voxels of the reduced level that change when that region changes
+void pyramidReducedRegion(const glm::ivec3 &dimensions, const glm::ivec3 &reducedDimensions,
+                          const glm::ivec3 &origin, const glm::ivec3 &size,
+                          glm::ivec3 *reducedOrigin, glm::ivec3 *reducedSize);
+
+// Recomputes the region [origin, origin + size) of dst, a reduced level
+// of src built with volumeReduce(), from src. Only the voxels of src that
+// the region covers are read, for updating the levels of edited parts of
+// a volume. Returns false if the data types differ or the region is not
+// within dst.
+bool volumeReduceRegion(const VolumeBase &src, VolumeBase *dst, const glm::ivec3 &origin,
+                        const glm::ivec3 &size, PyramidReduction reduction);
+
+// Builds the coarser levels of a volume image, each reduced from the
+// previous one (see pyramidReducedDimensions()), until the volume is a
+// single voxel or maxLevels levels have been built (0 = no limit).
+// levels[0] is the first reduced level; the full resolution level is
+// not copied. Returns true on success, false otherwise.
+bool volumeBuildPyramid(const VolumeBase &volume, std::vector<VolumeBase> *levels,
+                        PyramidReduction reduction, bool anisotropic = false, int maxLevels = 0);
+
+// Returns the level of a pyramid to sample when one voxel of the full
+// resolution level covers the given number of pixels on screen: the
+// level whose voxels cover about one pixel, offset by bias and clamped
+// to [0, numLevels - 1]
+float pyramidLevelForFootprint(float voxelPixels, int numLevels, float bias = 0.0f);
+
+} // namespace cg
@@ -0,0 +1,270 @@
+#include "cgVolumeResample.h"
+#include "cgVolumeConvert.h"
+#include "cgParallel.h"
+
+#include <iostream>
+#include <algorithm>
+#include <vector>
+#include <cmath>
+
+namespace {
+
+const double pi = 3.14159265358979323846;
+
+// Slabs of input slices are read up to this many voxels at a time
+const std::size_t slabVoxels = std::size_t(1) << 24;
+
+// Struct for the taps of a 1D resampling filter: output voxel i is the
+// sum of weights[k] * input[indices[k]] over k in [offsets[i],
+// offsets[i + 1])
+struct FilterTaps {
+    std::vector<std::size_t> offsets;
+    std::vector<int> indices;
+    std::vector<float> weights;
+};
+
+// Evaluates the (unwidened) filter kernel at distance t
+double filterKernel(cg::ResampleFilter filter, double t)
+{
+    t = std::fabs(t);
+    if (filter == cg::RESAMPLE_LANCZOS) {
+        if (t < 1e-9) {
+            return 1.0;
+        }
+        if (t >= 3.0) {
+            return 0.0;
+        }
+        return 3.0 * std::sin(pi * t) * std::sin(pi * t / 3.0) / (pi * pi * t * t);
+    }
+    return std::max(1.0 - t, 0.0);
+}
+
+// Computes the taps that resample an axis of n voxels to m voxels.
+// Input voxels outside the axis repeat the border voxels.
+FilterTaps computeTaps(int n, int m, cg::ResampleFilter filter)
+{
+    FilterTaps taps;
+    double scale = double(m) / double(n);
+    double stretch = std::min(scale, 1.0);  // kernels widen when downsampling
+    double radius = (filter == cg::RESAMPLE_LANCZOS ? 3.0 : 1.0) / stretch;
+    taps.offsets.push_back(0);
+    for (int i = 0; i < m; i++) {
+        double center = (i + 0.5) / scale - 0.5;
+        std::size_t begin = taps.weights.size();
+        double sum = 0.0;
+        for (int j = int(std::ceil(center - radius)); j <= int(std::floor(center + radius)); j++) {
+            double w = filterKernel(filter, (j - center) * stretch);
+            if (std::fabs(w) > 1e-6) {
+                taps.indices.push_back(std::min(std::max(j, 0), n - 1));
+                taps.weights.push_back(float(w));
+                sum += w;
+            }
+        }
+        if (taps.weights.size() == begin || sum == 0.0) {
+            taps.weights.resize(begin);
+            taps.indices.resize(begin);
+            taps.indices.push_back(std::min(std::max(int(std::floor(center + 0.5)), 0), n - 1));
+            taps.weights.push_back(1.0f);
+            sum = 1.0;
+        }
+        for (std::size_t k = begin; k < taps.weights.size(); k++) {
+            taps.weights[k] = float(taps.weights[k] / sum);
+        }
+        taps.offsets.push_back(taps.weights.size());
+    }
+    return taps;
+}
+
+// Resamples each of numRows rows of n floats (at stride n) to m floats
+void resampleAlongRows(const float *in, float *out, std::size_t numRows, int n, int m,
+                       const FilterTaps &taps)
+{
+    for (std::size_t row = 0; row < numRows; row++) {
+        const float *src = in + row * n;
+        float *dst = out + row * m;
+        for (int i = 0; i < m; i++) {
+            float sum = 0.0f;
+            for (std::size_t k = taps.offsets[i]; k < taps.offsets[i + 1]; k++) {
+                sum += taps.weights[k] * src[taps.indices[k]];
+            }
+            dst[i] = sum;
+        }
+    }
+}
+
+// Resamples across rows of rowLength floats: output row i is the
+// weighted sum of the input rows given by the taps of row i. Input row
+// j is stored at row j % numRows of in, so that in can be a ring.
+void resampleAcrossRows(const float *in, float *out, std::size_t rowLength, int i,
+                        const FilterTaps &taps, int numRows)
+{
+    std::fill(out, out + rowLength, 0.0f);
+    for (std::size_t k = taps.offsets[i]; k < taps.offsets[i + 1]; k++) {
+        const float *src = in + std::size_t(taps.indices[k] % numRows) * rowLength;
+        float w = taps.weights[k];
+        for (std::size_t j = 0; j < rowLength; j++) {
+            out[j] += w * src[j];
+        }
+    }
+}
+
+} // namespace
+
+
+
+namespace cg {
+
+glm::ivec3 resampleDimensionsForSpacing(const VolumeBase &volume, const glm::vec3 &spacing)
+{
+    glm::ivec3 dims;
+    glm::vec3 extent = volumeComputeExtent(volume);
+    for (int axis = 0; axis < 3; axis++) {
+        float s = spacing[axis] > 0.0f ? spacing[axis] : volume.spacing[axis];
+        dims[axis] = s > 0.0f ? int(std::floor(extent[axis] / s + 0.5f)) : volume.dimensions[axis];
+        dims[axis] = std::max(dims[axis], 1);
+    }
+    return dims;
+}
+
+glm::ivec3 resampleDimensionsForBudget(const VolumeBase &volume, std::uint64_t maxVoxels)
+{
+    glm::vec3 spacing = volume.spacing;
+    for (int axis = 0; axis < 3; axis++) {
+        spacing[axis] = spacing[axis] > 0.0f ? spacing[axis] : 1.0f;
+    }
+    glm::dvec3 extent = glm::dvec3(volume.dimensions) * glm::dvec3(spacing);
+    double finest = std::min(spacing.x, std::min(spacing.y, spacing.z));
+    double s = std::max(finest, std::cbrt(extent.x * extent.y * extent.z /
+                                          double(std::max<std::uint64_t>(maxVoxels, 1))));
+    // Rounding may overshoot the budget slightly; coarsen until it fits
+    for (;;) {
+        glm::ivec3 dims;
+        for (int axis = 0; axis < 3; axis++) {
+            dims[axis] = std::max(int(std::floor(extent[axis] / s + 0.5)), 1);
+        }
+        std::uint64_t n = std::uint64_t(dims.x) * std::uint64_t(dims.y) * std::uint64_t(dims.z);
+        if (n <= maxVoxels || n == 1) {
+            return dims;
+        }
+        s *= 1.01;
+    }
+}
+
+bool volumeResample(const VolumeBase &src, VolumeBase *dst, const glm::ivec3 &dimensions,
+                    ResampleFilter filter)
+{
+    std::size_t elementSize = datatypeSizeInBytes(src.datatype);
+    if (elementSize == 0 || src.data.size() < volumeNumVoxels(src) * elementSize) {
+        std::cerr << "Cannot resample volume of data type " << src.datatype << std::endl;
+        return false;
+    }
+    std::size_t sliceVoxels = std::size_t(src.dimensions.x) * std::size_t(src.dimensions.y);
+    VoxelConversion conversion;
+    conversion.srcDatatype = src.datatype;
+    conversion.dstDatatype = "float32";
+    const std::uint8_t *voxels = &src.data[0];
+    SliceReader readSlices = [&](int firstSlice, int numSlices, float *values) {
+        return convertVoxelsParallel(conversion, reinterpret_cast<std::uint8_t *>(values),
+                                     voxels + firstSlice * sliceVoxels * elementSize,
+                                     numSlices * sliceVoxels, sliceVoxels);
+    };
+    return volumeResampleSlices(src, readSlices, dst, dimensions, filter);
+}
+
+bool volumeResampleSlices(const VolumeBase &header, const SliceReader &readSlices,
+                          VolumeBase *dst, const glm::ivec3 &dimensions, ResampleFilter filter)
+{
+    const glm::ivec3 &n = header.dimensions;
+    const glm::ivec3 &m = dimensions;
+    std::size_t elementSize = datatypeSizeInBytes(header.datatype);
+    if (elementSize == 0 || glm::any(glm::lessThan(n, glm::ivec3(1))) ||
+        glm::any(glm::lessThan(m, glm::ivec3(1)))) {
+        std::cerr << "Cannot resample volume of data type " << header.datatype << " to "
+                  << m.x << "x" << m.y << "x" << m.z << std::endl;
+        return false;
+    }
+    FilterTaps tx = computeTaps(n.x, m.x, filter);
+    FilterTaps ty = computeTaps(n.y, m.y, filter);
+    FilterTaps tz = computeTaps(n.z, m.z, filter);
+
+    // The input slices that the output slices need, made monotonic, and
+    // the largest number of them any output slice needs
+    std::vector<int> firstInput(m.z), lastInput(m.z);
+    for (int z = 0; z < m.z; z++) {
+        firstInput[z] = n.z - 1;
+        lastInput[z] = z > 0 ? lastInput[z - 1] : 0;
+        for (std::size_t k = tz.offsets[z]; k < tz.offsets[z + 1]; k++) {
+            firstInput[z] = std::min(firstInput[z], tz.indices[k]);
+            lastInput[z] = std::max(lastInput[z], tz.indices[k]);
+        }
+    }
+    int window = 1;
+    for (int z = m.z - 1; z >= 0; z--) {
+        if (z + 1 < m.z) {
+            firstInput[z] = std::min(firstInput[z], firstInput[z + 1]);
+        }
+        window = std::max(window, lastInput[z] - firstInput[z] + 1);
+    }
+
+    // Input slices are read slab by slab and resampled along x and y in
+    // parallel into planes of the output size. Planes are kept in a ring
+    // that holds the planes of one slab and of one window of them, so
+    // that memory does not grow with the input depth.
+    std::size_t inSlice = std::size_t(n.x) * std::size_t(n.y);
+    std::size_t outSlice = std::size_t(m.x) * std::size_t(m.y);
+    int slabSlices = int(std::min<std::size_t>(std::max<std::size_t>(slabVoxels / inSlice, 1), n.z));
+    int ringSize = std::min(n.z, window + slabSlices);
+    std::vector<float> slab(slabSlices * inSlice);
+    std::vector<float> planes(outSlice * ringSize);
+
+    // Output slices are resampled along z in parallel as soon as their
+    // input slices have been read, and stored in the data type of the
+    // input
+    VolumeBase result;
+    result.dimensions = m;
+    glm::vec3 ratio = glm::vec3(n) / glm::vec3(m);
+    result.spacing = header.spacing * ratio;
+    result.origin = header.origin + header.spacing * (0.5f * ratio - 0.5f);
+    result.datatype = header.datatype;
+    result.data.resize(volumeNumVoxels(result) * elementSize);
+    VoxelConversion conversion;
+    conversion.srcDatatype = "float32";
+    conversion.dstDatatype = header.datatype;
+    std::uint8_t *out = &result.data[0];
+    int nextOutput = 0;
+    for (int z0 = 0; z0 < n.z; z0 += slabSlices) {
+        int numSlices = std::min(slabSlices, n.z - z0);
+        if (!readSlices(z0, numSlices, &slab[0])) {
+            return false;
+        }
+        parallelFor(0, std::size_t(numSlices), [&](std::size_t first, std::size_t last) {
+            std::vector<float> rows(std::size_t(m.x) * n.y);
+            for (std::size_t s = first; s < last; s++) {
+                resampleAlongRows(&slab[s * inSlice], &rows[0], n.y, n.x, m.x, tx);
+                float *plane = &planes[((z0 + s) % ringSize) * outSlice];
+                for (int y = 0; y < m.y; y++) {
+                    resampleAcrossRows(&rows[0], plane + std::size_t(y) * m.x, m.x, y, ty, n.y);
+                }
+            }
+        }, 1);
+
+        int endOutput = nextOutput;
+        while (endOutput < m.z && lastInput[endOutput] < z0 + numSlices) {
+            endOutput++;
+        }
+        parallelFor(std::size_t(nextOutput), std::size_t(endOutput),
+                    [&](std::size_t first, std::size_t last) {
+            std::vector<float> slice(outSlice);
+            for (std::size_t z = first; z < last; z++) {
+                resampleAcrossRows(&planes[0], &slice[0], outSlice, int(z), tz, ringSize);
+                convertVoxels(conversion, out + z * outSlice * elementSize,
+                              reinterpret_cast<const std::uint8_t *>(&slice[0]), outSlice);
+            }
+        }, 1);
+        nextOutput = endOutput;
+    }
+    *dst = std::move(result);
+    return true;
+}
+
+} // namespace cg
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "cgVolume.h"
+
+#include <functional>
+#include <cstdint>
+
+namespace cg {
+
+// Reconstruction filter used for resampling. When an axis is
+// downsampled, the filter is widened by the reduction factor so that
+// every input voxel contributes (i.e., it also prefilters).
+enum ResampleFilter {
+    RESAMPLE_TRILINEAR = 0,  // tent filter, i.e., trilinear interpolation when upsampling
+    RESAMPLE_LANCZOS = 1  // windowed sinc (Lanczos, 3 lobes): sharper, may ring at edges
+};
+
+// Function that reads the slices [firstSlice, firstSlice + numSlices) of
+// a volume as float into dst. Returns true on success.
+typedef std::function<bool(int firstSlice, int numSlices, float *dst)> SliceReader;
+
+// Returns the dimensions of a volume resampled to the given voxel
+// spacing, covering the same extent (at least one voxel per axis)
+glm::ivec3 resampleDimensionsForSpacing(const VolumeBase &volume, const glm::vec3 &spacing);
+
+// Returns the dimensions of a volume resampled to isotropic voxels, as
+// fine as possible with at most maxVoxels voxels, but not finer than the
+// finest spacing of the volume
+glm::ivec3 resampleDimensionsForBudget(const VolumeBase &volume, std::uint64_t maxVoxels);
+
+// Resamples a volume image (in LAYOUT_LINEAR) to the given dimensions,
+// covering the same extent: the voxel centers of dst span those of src.
+// The filter is applied separably; input slices are filtered along x and
+// y in parallel, then output slices along z. The data type is kept
+// (integer results are rounded and clamped). src and dst may be the same
+// volume. Returns false if the data type is not supported.
+bool volumeResample(const VolumeBase &src, VolumeBase *dst, const glm::ivec3 &dimensions,
+                    ResampleFilter filter);
+
+// Same as volumeResample(), but reads the input with readSlices, slab by
+// slab, so that it never needs to be in memory at once. header describes
+// the input (its data is not used); dst gets the data type of the header.
+bool volumeResampleSlices(const VolumeBase &header, const SliceReader &readSlices,
+                          VolumeBase *dst, const glm::ivec3 &dimensions, ResampleFilter filter);
+
+} // namespace cg
@@ -0,0 +1,387 @@
+#include "cgVolumeSample.h"
+#include "cgParallel.h"
+
+#include <iostream>
+#include <vector>
+#include <limits>
+#include <algorithm>
+
+#if defined(__SSE4_1__)
+#define CG_USE_SSE41
+#include <smmintrin.h>
+#endif
+#if defined(__AVX2__)
+#define CG_USE_AVX2
+#include <immintrin.h>
+#endif
+
+namespace {
+
+// Positions are sampled in parallel ranges of at least this many
+const std::size_t minPositionsPerThread = 4096;
+
+// Gradients are computed in batches of this many positions, whose
+// shifted positions and samples fit in the L1 cache
+const std::size_t gradientBatchSize = 256;
+
+// Returns true if the volume holds voxels of the expected size
+template<typename VoxelType>
+bool hasVoxels(const cg::VolumeBase &base, cg::VoxelLayout layout)
+{
+    std::size_t n = cg::volumeLayoutNumVoxels(base.dimensions, layout);
+    return n > 0 && glm::all(glm::greaterThan(base.dimensions, glm::ivec3(0))) &&
+           cg::datatypeSizeInBytes(base.datatype) == sizeof(VoxelType) &&
+           base.data.size() >= n * sizeof(VoxelType);
+}
+
+// Returns true if the voxels of the volume can be addressed with 32-bit
+// indices, as done by the SIMD code paths
+bool hasSmallLinearLayout(const cg::VolumeBase &base, cg::VoxelLayout layout)
+{
+    return layout == cg::LAYOUT_LINEAR &&
+           cg::volumeNumVoxels(base) < std::size_t(std::numeric_limits<std::int32_t>::max());
+}
+
+// Samples positions one at a time (any layout)
+template<typename VoxelType>
+void sampleScalar(const cg::VolumeBase &base, cg::VoxelLayout layout, const glm::vec3 *positions,
+                  std::size_t numPositions, float *values)
+{
+    for (std::size_t i = 0; i < numPositions; i++) {
+        values[i] = cg::volumeSampleTrilinear<VoxelType>(base, layout, positions[i]);
+    }
+}
+
+#ifdef CG_USE_AVX2
+// Gathers the voxels at 8 indices and widens them to float. Voxels
+// narrower than 32 bits are gathered as 32-bit words and masked, so the
+// indices must leave room for the extra bytes (see gatherLimit()).
+template<typename VoxelType>
+__m256 gather8(const VoxelType *voxels, __m256i indices);
+
+template<>
+__m256 gather8<std::uint8_t>(const std::uint8_t *voxels, __m256i indices)
+{
+    __m256i v = _mm256_i32gather_epi32(reinterpret_cast<const int *>(voxels), indices, 1);
+    return _mm256_cvtepi32_ps(_mm256_and_si256(v, _mm256_set1_epi32(0xff)));
+}
+
+template<>
+__m256 gather8<std::uint16_t>(const std::uint16_t *voxels, __m256i indices)
+{
+    __m256i v = _mm256_i32gather_epi32(reinterpret_cast<const int *>(voxels), indices, 2);
+    return _mm256_cvtepi32_ps(_mm256_and_si256(v, _mm256_set1_epi32(0xffff)));
+}
+
+template<>
+__m256 gather8<std::int16_t>(const std::int16_t *voxels, __m256i indices)
+{
+    __m256i v = _mm256_i32gather_epi32(reinterpret_cast<const int *>(voxels), indices, 2);
+    return _mm256_cvtepi32_ps(_mm256_srai_epi32(_mm256_slli_epi32(v, 16), 16));
+}
+
+template<>
+__m256 gather8<std::uint32_t>(const std::uint32_t *voxels, __m256i indices)
+{
+    // There is no unsigned conversion, so the 16-bit halves are converted
+    // separately
+    __m256i v = _mm256_i32gather_epi32(reinterpret_cast<const int *>(voxels), indices, 4);
+    __m256 hi = _mm256_cvtepi32_ps(_mm256_srli_epi32(v, 16));
+    __m256 lo = _mm256_cvtepi32_ps(_mm256_and_si256(v, _mm256_set1_epi32(0xffff)));
+    return _mm256_add_ps(_mm256_mul_ps(hi, _mm256_set1_ps(65536.0f)), lo);
+}
+
+template<>
+__m256 gather8<float>(const float *voxels, __m256i indices)
+{
+    return _mm256_i32gather_ps(voxels, indices, 4);
+}
+
+// Returns the number of leading voxels whose index can be gathered
+// without reading past the end of the voxel data
+template<typename VoxelType>
+std::int32_t gatherLimit(std::size_t numVoxels)
+{
+    return std::int32_t(numVoxels) - std::int32_t(4 / sizeof(VoxelType)) + 1;
+}
+
+// Splits 8 clamped coordinates into the lower voxel index, the offset
+// to the upper voxel (0 at the border) and the fraction between them
+inline void splitCoordinates(__m256 p, __m256 maxCoord, __m256i *p0, __m256i *step, __m256 *f)
+{
+    p = _mm256_min_ps(_mm256_max_ps(p, _mm256_setzero_ps()), maxCoord);
+    __m256 fl = _mm256_floor_ps(p);
+    *f = _mm256_sub_ps(p, fl);
+    *p0 = _mm256_cvttps_epi32(fl);
+    *step = _mm256_and_si256(_mm256_cmpgt_epi32(_mm256_cvttps_epi32(maxCoord), *p0),
+                             _mm256_set1_epi32(1));
+}
+
+inline __m256 lerp8(__m256 a, __m256 b, __m256 t)
+{
+    return _mm256_add_ps(a, _mm256_mul_ps(t, _mm256_sub_ps(b, a)));
+}
+
+// Samples 8 positions at a time with AVX2 gathers (linear layout)
+template<typename VoxelType>
+void sampleAVX2(const cg::VolumeBase &base, cg::VoxelLayout layout, const glm::vec3 *positions,
+                std::size_t numPositions, float *values)
+{
+    const glm::ivec3 &dims = base.dimensions;
+    const VoxelType *voxels = reinterpret_cast<const VoxelType *>(&base.data[0]);
+    const __m256i strideY = _mm256_set1_epi32(dims.x);
+    const __m256i strideZ = _mm256_set1_epi32(dims.x * dims.y);
+    const __m256 maxX = _mm256_set1_ps(float(dims.x - 1));
+    const __m256 maxY = _mm256_set1_ps(float(dims.y - 1));
+    const __m256 maxZ = _mm256_set1_ps(float(dims.z - 1));
+    const __m256i limit = _mm256_set1_epi32(gatherLimit<VoxelType>(cg::volumeNumVoxels(base)));
+    const __m256i xyz = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21);
+
+    std::size_t i = 0;
+    for (; i + 8 <= numPositions; i += 8) {
+        const float *p = &positions[i].x;
+        __m256i x0, y0, z0, dx, dy, dz;
+        __m256 fx, fy, fz;
+        splitCoordinates(_mm256_i32gather_ps(p, xyz, 4), maxX, &x0, &dx, &fx);
+        splitCoordinates(_mm256_i32gather_ps(p + 1, xyz, 4), maxY, &y0, &dy, &fy);
+        splitCoordinates(_mm256_i32gather_ps(p + 2, xyz, 4), maxZ, &z0, &dz, &fz);
+        __m256i b0 = _mm256_add_epi32(_mm256_add_epi32(_mm256_mullo_epi32(z0, strideZ),
+                                                       _mm256_mullo_epi32(y0, strideY)), x0);
+        dy = _mm256_mullo_epi32(dy, strideY);
+        dz = _mm256_mullo_epi32(dz, strideZ);
+
+        // The last corner has the largest index; near the end of narrow
+        // voxel data, the batch is sampled with scalar code instead
+        __m256i last = _mm256_add_epi32(_mm256_add_epi32(b0, dx), _mm256_add_epi32(dy, dz));
+        if (_mm256_movemask_epi8(_mm256_cmpgt_epi32(limit, last)) != -1) {
+            sampleScalar<VoxelType>(base, layout, positions + i, 8, values + i);
+            continue;
+        }
+        __m256i b1 = _mm256_add_epi32(b0, dy);
+        __m256i b2 = _mm256_add_epi32(b0, dz);
+        __m256i b3 = _mm256_add_epi32(b1, dz);
+        __m256 c00 = lerp8(gather8(voxels, b0), gather8(voxels, _mm256_add_epi32(b0, dx)), fx);
+        __m256 c10 = lerp8(gather8(voxels, b1), gather8(voxels, _mm256_add_epi32(b1, dx)), fx);
+        __m256 c01 = lerp8(gather8(voxels, b2), gather8(voxels, _mm256_add_epi32(b2, dx)), fx);
+        __m256 c11 = lerp8(gather8(voxels, b3), gather8(voxels, _mm256_add_epi32(b3, dx)), fx);
+        _mm256_storeu_ps(values + i, lerp8(lerp8(c00, c10, fy), lerp8(c01, c11, fy), fz));
+    }
+    sampleScalar<VoxelType>(base, layout, positions + i, numPositions - i, values + i);
+}
+#endif
+
+#ifdef CG_USE_SSE41
+inline __m128 lerp4(__m128 a, __m128 b, __m128 t)
+{
+    return _mm_add_ps(a, _mm_mul_ps(t, _mm_sub_ps(b, a)));
+}
+
+// Samples 4 positions at a time with SSE4.1 (linear layout). Corner
+// indices and weights are computed with SIMD; there are no gathers, so
+// the voxels are loaded one by one.
+template<typename VoxelType>
+void sampleSSE41(const cg::VolumeBase &base, cg::VoxelLayout layout, const glm::vec3 *positions,
+                 std::size_t numPositions, float *values)
+{
+    const glm::ivec3 &dims = base.dimensions;
+    const VoxelType *voxels = reinterpret_cast<const VoxelType *>(&base.data[0]);
+    const __m128i strideY = _mm_set1_epi32(dims.x);
+    const __m128i strideZ = _mm_set1_epi32(dims.x * dims.y);
+    const __m128 maxCoord[3] = { _mm_set1_ps(float(dims.x - 1)), _mm_set1_ps(float(dims.y - 1)),
+                                 _mm_set1_ps(float(dims.z - 1)) };
+    const __m128i one = _mm_set1_epi32(1);
+
+    std::size_t i = 0;
+    for (; i + 4 <= numPositions; i += 4) {
+        __m128i p0[3], step[3];
+        __m128 f[3];
+        for (int axis = 0; axis < 3; axis++) {
+            __m128 p = _mm_setr_ps(positions[i][axis], positions[i + 1][axis],
+                                   positions[i + 2][axis], positions[i + 3][axis]);
+            p = _mm_min_ps(_mm_max_ps(p, _mm_setzero_ps()), maxCoord[axis]);
+            __m128 fl = _mm_floor_ps(p);
+            f[axis] = _mm_sub_ps(p, fl);
+            p0[axis] = _mm_cvttps_epi32(fl);
+            step[axis] = _mm_and_si128(_mm_cmpgt_epi32(_mm_cvttps_epi32(maxCoord[axis]), p0[axis]),
+                                       one);
+        }
+        __m128i base = _mm_add_epi32(_mm_add_epi32(_mm_mullo_epi32(p0[2], strideZ),
+                                                   _mm_mullo_epi32(p0[1], strideY)), p0[0]);
+        std::int32_t b[4], dx[4], dy[4], dz[4];
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(b), base);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dx), step[0]);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dy), _mm_mullo_epi32(step[1], strideY));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dz), _mm_mullo_epi32(step[2], strideZ));
+
+        float corners[8][4];
+        for (int j = 0; j < 4; j++) {
+            const VoxelType *v = voxels + b[j];
+            corners[0][j] = float(v[0]);
+            corners[1][j] = float(v[dx[j]]);
+            corners[2][j] = float(v[dy[j]]);
+            corners[3][j] = float(v[dy[j] + dx[j]]);
+            corners[4][j] = float(v[dz[j]]);
+            corners[5][j] = float(v[dz[j] + dx[j]]);
+            corners[6][j] = float(v[dz[j] + dy[j]]);
+            corners[7][j] = float(v[dz[j] + dy[j] + dx[j]]);
+        }
+        __m128 c00 = lerp4(_mm_loadu_ps(corners[0]), _mm_loadu_ps(corners[1]), f[0]);
+        __m128 c10 = lerp4(_mm_loadu_ps(corners[2]), _mm_loadu_ps(corners[3]), f[0]);
+        __m128 c01 = lerp4(_mm_loadu_ps(corners[4]), _mm_loadu_ps(corners[5]), f[0]);
+        __m128 c11 = lerp4(_mm_loadu_ps(corners[6]), _mm_loadu_ps(corners[7]), f[0]);
+        _mm_storeu_ps(values + i, lerp4(lerp4(c00, c10, f[1]), lerp4(c01, c11, f[1]), f[2]));
+    }
+    sampleScalar<VoxelType>(base, layout, positions + i, numPositions - i, values + i);
+}
+#endif
+
+// Samples positions on the calling thread with the fastest code path
+// available for the volume
+template<typename VoxelType>
+void sampleBatch(const cg::VolumeBase &base, cg::VoxelLayout layout, const glm::vec3 *positions,
+                 std::size_t numPositions, float *values)
+{
+    if (!hasSmallLinearLayout(base, layout)) {
+        sampleScalar<VoxelType>(base, layout, positions, numPositions, values);
+        return;
+    }
+#if defined(CG_USE_AVX2)
+    sampleAVX2<VoxelType>(base, layout, positions, numPositions, values);
+#elif defined(CG_USE_SSE41)
+    sampleSSE41<VoxelType>(base, layout, positions, numPositions, values);
+#else
+    sampleScalar<VoxelType>(base, layout, positions, numPositions, values);
+#endif
+}
+
+// Computes gradients on the calling thread, in batches: the positions
+// one voxel before and after each position along each axis are sampled
+// together, then differenced
+template<typename VoxelType>
+void gradientBatch(const cg::VolumeBase &base, cg::VoxelLayout layout, const glm::vec3 *positions,
+                   std::size_t numPositions, glm::vec3 *gradients)
+{
+    const glm::vec3 maxCoord = glm::vec3(base.dimensions - glm::ivec3(1));
+    std::vector<glm::vec3> shifted(6 * gradientBatchSize);
+    std::vector<float> samples(6 * gradientBatchSize);
+    std::vector<glm::vec3> distance(gradientBatchSize);
+    for (std::size_t first = 0; first < numPositions; first += gradientBatchSize) {
+        std::size_t n = std::min(gradientBatchSize, numPositions - first);
+        for (std::size_t i = 0; i < n; i++) {
+            glm::vec3 p;
+            for (int axis = 0; axis < 3; axis++) {
+                float v = positions[first + i][axis];
+                p[axis] = v > 0.0f ? std::min(v, maxCoord[axis]) : 0.0f;
+            }
+            for (int axis = 0; axis < 3; axis++) {
+                glm::vec3 lo = p, hi = p;
+                lo[axis] = std::max(p[axis] - 1.0f, 0.0f);
+                hi[axis] = std::min(p[axis] + 1.0f, maxCoord[axis]);
+                shifted[(2 * axis) * n + i] = lo;
+                shifted[(2 * axis + 1) * n + i] = hi;
+                distance[i][axis] = (hi[axis] - lo[axis]) * base.spacing[axis];
+            }
+        }
+        sampleBatch<VoxelType>(base, layout, &shifted[0], 6 * n, &samples[0]);
+        for (std::size_t i = 0; i < n; i++) {
+            glm::vec3 &g = gradients[first + i];
+            for (int axis = 0; axis < 3; axis++) {
+                float d = samples[(2 * axis + 1) * n + i] - samples[(2 * axis) * n + i];
+                g[axis] = distance[i][axis] > 0.0f ? d / distance[i][axis] : 0.0f;
+            }
+        }
+    }
+}
+
+} // namespace
+
+
+
+namespace cg {
+
+template<typename VoxelType>
+bool volumeSampleTrilinear(const VolumeBase &volume, VoxelLayout layout,
+                           const glm::vec3 *positions, std::size_t numPositions, float *values)
+{
+    if (!hasVoxels<VoxelType>(volume, layout)) {
+        std::cerr << "Cannot sample a volume without voxels" << std::endl;
+        return false;
+    }
+    parallelFor(0, numPositions, [&](std::size_t first, std::size_t last) {
+        sampleBatch<VoxelType>(volume, layout, positions + first, last - first, values + first);
+    }, minPositionsPerThread);
+    return true;
+}
+
+template<typename VoxelType>
+bool volumeSampleGradient(const VolumeBase &volume, VoxelLayout layout,
+                          const glm::vec3 *positions, std::size_t numPositions,
+                          glm::vec3 *gradients)
+{
+    if (!hasVoxels<VoxelType>(volume, layout)) {
+        std::cerr << "Cannot sample a volume without voxels" << std::endl;
+        return false;
+    }
+    parallelFor(0, numPositions, [&](std::size_t first, std::size_t last) {
+        gradientBatch<VoxelType>(volume, layout, positions + first, last - first,
+                                 gradients + first);
+    }, minPositionsPerThread / 6);
+    return true;
+}
+
+bool volumeSampleTrilinear(const VolumeBase &volume, const glm::vec3 *positions,
+                           std::size_t numPositions, float *values)
+{
+    if (volume.datatype == "uint8") {
+        return volumeSampleTrilinear<std::uint8_t>(volume, LAYOUT_LINEAR, positions,
+                                                   numPositions, values);
+    }
+    else if (volume.datatype == "uint16") {
+        return volumeSampleTrilinear<std::uint16_t>(volume, LAYOUT_LINEAR, positions,
+                                                    numPositions, values);
+    }
+    else if (volume.datatype == "int16") {
+        return volumeSampleTrilinear<std::int16_t>(volume, LAYOUT_LINEAR, positions,
+                                                   numPositions, values);
+    }
+    else if (volume.datatype == "uint32") {
+        return volumeSampleTrilinear<std::uint32_t>(volume, LAYOUT_LINEAR, positions,
+                                                    numPositions, values);
+    }
+    else if (volume.datatype == "float32") {
+        return volumeSampleTrilinear<float>(volume, LAYOUT_LINEAR, positions, numPositions,
+                                            values);
+    }
+    std::cerr << "Cannot sample a volume of data type " << volume.datatype << std::endl;
+    return false;
+}
+
+template<typename VoxelType>
+bool volumeSampleTrilinear(const Volume<VoxelType> &volume, const glm::vec3 *positions,
+                           std::size_t numPositions, float *values)
+{
+    return volumeSampleTrilinear<VoxelType>(volume.base, volume.layout, positions, numPositions,
+                                            values);
+}
+
+template<typename VoxelType>
+bool volumeSampleGradient(const Volume<VoxelType> &volume, const glm::vec3 *positions,
+                          std::size_t numPositions, glm::vec3 *gradients)
+{
+    return volumeSampleGradient<VoxelType>(volume.base, volume.layout, positions, numPositions,
+                                           gradients);
+}
+
+template bool volumeSampleTrilinear(const VolumeUInt8 &, const glm::vec3 *, std::size_t, float *);
+template bool volumeSampleTrilinear(const VolumeUInt16 &, const glm::vec3 *, std::size_t, float *);
+template bool volumeSampleTrilinear(const VolumeInt16 &, const glm::vec3 *, std::size_t, float *);
+template bool volumeSampleTrilinear(const VolumeUInt32 &, const glm::vec3 *, std::size_t, float *);
+template bool volumeSampleTrilinear(const VolumeFloat32 &, const glm::vec3 *, std::size_t, float *);
+
+template bool volumeSampleGradient(const VolumeUInt8 &, const glm::vec3 *, std::size_t, glm::vec3 *);
+template bool volumeSampleGradient(const VolumeUInt16 &, const glm::vec3 *, std::size_t, glm::vec3 *);
+template bool volumeSampleGradient(const VolumeInt16 &, const glm::vec3 *, std::size_t, glm::vec3 *);
+template bool volumeSampleGradient(const VolumeUInt32 &, const glm::vec3 *, std::size_t, glm::vec3 *);
+template bool volumeSampleGradient(const VolumeFloat32 &, const glm::vec3 *, std::size_t, glm::vec3 *);
+
+} // namespace cg
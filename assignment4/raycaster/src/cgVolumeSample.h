@@ -0,0 +1,74 @@
+#pragma once
+
+#include "cgVolume.h"
+
+#include <algorithm>
+#include <cstddef>
+
+namespace cg {
+
+// Batched sampling of typed volume images on the CPU (for picking,
+// probing, resampling and offline rendering). Positions are given in
+// voxel coordinates, i.e., voxel (x, y, z) is centered at (x, y, z),
+// and are clamped to the volume. Batches are split across worker
+// threads; volumes in LAYOUT_LINEAR with fewer than 2^31 voxels are
+// sampled with AVX2 (gathers) or SSE4.1 if the build targets them (e.g.,
+// with RAYCASTER_NATIVE_ARCH), other volumes and default builds use
+// scalar code. Implemented for the typed volumes declared in cgVolume.h.
+
+// Samples the volume at numPositions positions with trilinear
+// interpolation and writes the values to values. Returns false if the
+// volume holds no voxels of the expected size.
+template<typename VoxelType>
+bool volumeSampleTrilinear(const Volume<VoxelType> &volume, const glm::vec3 *positions,
+                           std::size_t numPositions, float *values);
+
+// Same as above for a volume image in LAYOUT_LINEAR of any data type
+// supported by datatypeSizeInBytes()
+bool volumeSampleTrilinear(const VolumeBase &volume, const glm::vec3 *positions,
+                           std::size_t numPositions, float *values);
+
+// Computes the gradient of the trilinearly interpolated volume at
+// numPositions positions by central differences of one voxel along each
+// axis (one-sided at the border), in value units per unit of length
+// (i.e., taking the voxel spacing into account). Returns false if the
+// volume holds no voxels of the expected size.
+template<typename VoxelType>
+bool volumeSampleGradient(const Volume<VoxelType> &volume, const glm::vec3 *positions,
+                          std::size_t numPositions, glm::vec3 *gradients);
+
+// Samples one position of a volume image of voxels of the given type in
+// the given layout with trilinear interpolation (scalar code, no checks;
+// for occasional queries)
+template<typename VoxelType>
+inline float volumeSampleTrilinear(const VolumeBase &volume, VoxelLayout layout,
+                                   const glm::vec3 &position)
+{
+    const glm::ivec3 &dims = volume.dimensions;
+    const VoxelType *voxels = reinterpret_cast<const VoxelType *>(&volume.data[0]);
+    auto voxel = [&](int x, int y, int z) {
+        return float(voxels[volumeLayoutIndex(dims, layout, x, y, z)]);
+    };
+    glm::vec3 p;
+    for (int i = 0; i < 3; i++) {
+        // NaN maps to zero
+        p[i] = position[i] > 0.0f ? std::min(position[i], float(dims[i] - 1)) : 0.0f;
+    }
+    glm::ivec3 p0 = glm::ivec3(glm::floor(p));
+    glm::ivec3 p1 = glm::min(p0 + glm::ivec3(1), dims - glm::ivec3(1));
+    glm::vec3 f = p - glm::vec3(p0);
+    float c00 = glm::mix(voxel(p0.x, p0.y, p0.z), voxel(p1.x, p0.y, p0.z), f.x);
+    float c10 = glm::mix(voxel(p0.x, p1.y, p0.z), voxel(p1.x, p1.y, p0.z), f.x);
+    float c01 = glm::mix(voxel(p0.x, p0.y, p1.z), voxel(p1.x, p0.y, p1.z), f.x);
+    float c11 = glm::mix(voxel(p0.x, p1.y, p1.z), voxel(p1.x, p1.y, p1.z), f.x);
+    return glm::mix(glm::mix(c00, c10, f.y), glm::mix(c01, c11, f.y), f.z);
+}
+
+// Samples one position of a typed volume image (see above)
+template<typename VoxelType>
+inline float volumeSampleTrilinear(const Volume<VoxelType> &volume, const glm::vec3 &position)
+{
+    return volumeSampleTrilinear<VoxelType>(volume.base, volume.layout, position);
+}
+
+} // namespace cg
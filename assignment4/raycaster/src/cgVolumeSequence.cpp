@@ -0,0 +1,153 @@
+#include "cgVolumeSequence.h"
+
+#include <algorithm>
+#include <utility>
+
+namespace {
+
+// Returns true if the timestep is within the prefetch window, i.e., one
+// of the next slots.size() timesteps from nextFrame on (wrapping
+// around at the end of the sequence)
+bool inPrefetchWindow(const cg::VolumeSequence &sequence, int frame)
+{
+    int numFrames = int(sequence.filenames.size());
+    int window = std::min(int(sequence.slots.size()), numFrames);
+    return (frame - sequence.nextFrame + numFrames) % numFrames < window;
+}
+
+// Frees the decoded slots that have fallen out of the prefetch window.
+// Slots still being decoded are freed by their worker.
+void dropStaleSlots(cg::VolumeSequence *sequence)
+{
+    for (auto it = sequence->slots.begin(); it != sequence->slots.end(); ++it) {
+        if (it->frame >= 0 && it->ready && !inPrefetchWindow(*sequence, it->frame)) {
+            *it = cg::SequenceSlot();
+        }
+    }
+}
+
+// Decodes the first timestep of the prefetch window that is neither
+// decoded nor being decoded, into a free slot, until the sequence is
+// closed
+void prefetchWorker(cg::VolumeSequence *sequence)
+{
+    int numFrames = int(sequence->filenames.size());
+    int window = std::min(int(sequence->slots.size()), numFrames);
+    std::unique_lock<std::mutex> lock(sequence->mutex);
+    while (!sequence->stopping) {
+        int frame = -1;
+        for (int i = 0; i < window && frame < 0; i++) {
+            int candidate = (sequence->nextFrame + i) % numFrames;
+            bool taken = false;
+            for (auto it = sequence->slots.begin(); it != sequence->slots.end(); ++it) {
+                taken = taken || it->frame == candidate;
+            }
+            if (!taken) {
+                frame = candidate;
+            }
+        }
+        std::size_t slot = 0;
+        while (slot < sequence->slots.size() && sequence->slots[slot].frame >= 0) {
+            slot++;
+        }
+        if (frame < 0 || slot == sequence->slots.size()) {
+            sequence->changed.wait(lock);
+            continue;
+        }
+
+        sequence->slots[slot].frame = frame;
+        lock.unlock();
+        cg::VolumeBase volume;
+        bool ok = sequence->decoder(sequence->filenames[frame], &volume);
+        lock.lock();
+
+        if (inPrefetchWindow(*sequence, frame)) {
+            sequence->slots[slot].volume = std::move(volume);
+            sequence->slots[slot].ready = true;
+            sequence->slots[slot].failed = !ok;
+        }
+        else {
+            sequence->slots[slot] = cg::SequenceSlot();
+        }
+        sequence->changed.notify_all();
+    }
+}
+
+} // namespace
+
+
+
+namespace cg {
+
+void volumeSequenceOpen(VolumeSequence *sequence, const std::vector<std::string> &filenames,
+                        const SequenceDecoder &decoder, int firstFrame, int ringSize,
+                        int numWorkers)
+{
+    volumeSequenceClose(sequence);
+    sequence->filenames = filenames;
+    sequence->decoder = decoder;
+    sequence->slots.clear();
+    sequence->slots.resize(std::max(ringSize, 1));
+    sequence->nextFrame = filenames.empty() ? 0 : firstFrame % int(filenames.size());
+    sequence->stopping = false;
+    if (filenames.empty()) {
+        return;
+    }
+    for (int i = 0; i < std::max(numWorkers, 1); i++) {
+        sequence->workers.push_back(std::thread(prefetchWorker, sequence));
+    }
+}
+
+bool volumeSequenceTake(VolumeSequence *sequence, int frame, VolumeBase *volume)
+{
+    std::lock_guard<std::mutex> lock(sequence->mutex);
+    int numFrames = int(sequence->filenames.size());
+    if (numFrames == 0) {
+        return false;
+    }
+    for (auto it = sequence->slots.begin(); it != sequence->slots.end(); ++it) {
+        if (it->frame == frame && it->ready) {
+            *volume = std::move(it->volume);
+            if (it->failed) {
+                *volume = VolumeBase();
+            }
+            *it = SequenceSlot();
+            sequence->nextFrame = (frame + 1) % numFrames;
+            dropStaleSlots(sequence);
+            sequence->changed.notify_all();
+            return true;
+        }
+    }
+    if (sequence->nextFrame != frame) {
+        sequence->nextFrame = frame % numFrames;
+        dropStaleSlots(sequence);
+        sequence->changed.notify_all();
+    }
+    return false;
+}
+
+int volumeSequencePrefetched(VolumeSequence *sequence)
+{
+    std::lock_guard<std::mutex> lock(sequence->mutex);
+    int count = 0;
+    for (auto it = sequence->slots.begin(); it != sequence->slots.end(); ++it) {
+        count += it->ready ? 1 : 0;
+    }
+    return count;
+}
+
+void volumeSequenceClose(VolumeSequence *sequence)
+{
+    {
+        std::lock_guard<std::mutex> lock(sequence->mutex);
+        sequence->stopping = true;
+        sequence->changed.notify_all();
+    }
+    for (auto it = sequence->workers.begin(); it != sequence->workers.end(); ++it) {
+        it->join();
+    }
+    sequence->workers.clear();
+    sequence->slots.clear();
+}
+
+} // namespace cg
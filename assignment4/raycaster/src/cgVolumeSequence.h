@@ -0,0 +1,74 @@
+#pragma once
+
+#include "cgVolume.h"
+
+#include <vector>
+#include <string>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace cg {
+
+// Function that reads one timestep of a sequence into a volume. Called
+// on the worker threads of the sequence. Returns true on success.
+typedef std::function<bool(const std::string &filename, VolumeBase *volume)> SequenceDecoder;
+
+// Struct for one place in the prefetch ring of a sequence
+struct SequenceSlot {
+    int frame;  // timestep held or being decoded, -1 if the slot is free
+    bool ready;  // decoding has finished
+    bool failed;  // decoding has failed
+    VolumeBase volume;
+
+    SequenceSlot() :
+        frame(-1),
+        ready(false),
+        failed(false)
+    {}
+};
+
+// Struct for a time-varying (4D) volume, i.e., an ordered list of
+// volume files played back in a loop. Worker threads decode the
+// timesteps following the playback position into a bounded ring of
+// slots, so that the next timesteps are usually in memory when they are
+// needed. All functions below are called from one thread; the struct
+// must not be copied or moved while it is open.
+struct VolumeSequence {
+    std::vector<std::string> filenames;  // timesteps in playback order
+    SequenceDecoder decoder;
+    std::vector<SequenceSlot> slots;  // the prefetch ring
+    int nextFrame;  // next timestep to be taken (start of the prefetch window)
+    bool stopping;
+    std::vector<std::thread> workers;
+    std::mutex mutex;  // guards slots, nextFrame and stopping
+    std::condition_variable changed;
+
+    VolumeSequence() :
+        nextFrame(0),
+        stopping(false)
+    {}
+};
+
+// Starts prefetching a sequence from the given timestep on, decoding up
+// to ringSize timesteps ahead on numWorkers threads
+void volumeSequenceOpen(VolumeSequence *sequence, const std::vector<std::string> &filenames,
+                        const SequenceDecoder &decoder, int firstFrame = 0, int ringSize = 8,
+                        int numWorkers = 2);
+
+// Takes a decoded timestep out of the ring without waiting. Returns
+// true if the timestep was ready; volume is then set to it (or left
+// empty if it could not be decoded) and prefetching continues after
+// it. Returns false if it is not ready yet; prefetching then moves on
+// to start at this timestep, dropping decoded timesteps before it.
+bool volumeSequenceTake(VolumeSequence *sequence, int frame, VolumeBase *volume);
+
+// Returns the number of decoded timesteps waiting in the ring
+int volumeSequencePrefetched(VolumeSequence *sequence);
+
+// Stops the worker threads (waiting for timesteps being decoded) and
+// frees the ring
+void volumeSequenceClose(VolumeSequence *sequence);
+
+} // namespace cg
@@ -0,0 +1,417 @@
+#include "cgVolumeSlices.h"
+#include "cgVolumeConvert.h"
+#include "cgMappedFile.h"
+#include "cgParallel.h"
+
+#include <lodepng.h>
+
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <mutex>
+#include <cstring>
+#include <cctype>
+#include <string>
+
+#include <sys/stat.h>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <dirent.h>
+#endif
+
+namespace {
+
+// Highest first number tried for printf patterns
+const int maxFirstSliceNumber = 1;
+
+// A printf pattern with a single number conversion, split into the
+// text before and after the number
+struct NumberPattern {
+    std::string prefix;
+    std::string suffix;
+    int width;
+    bool zeroPad;
+};
+
+// Parse a printf pattern with exactly one "%d" conversion, optionally
+// with a width ("%3d") and zero padding ("%03d"); "%%" stands for a
+// literal '%'. Returns false for any other pattern.
+bool parseNumberPattern(const std::string &path, NumberPattern *pattern)
+{
+    pattern->prefix.clear();
+    pattern->suffix.clear();
+    pattern->width = 0;
+    pattern->zeroPad = false;
+    bool found = false;
+    for (std::size_t i = 0; i < path.size(); i++) {
+        std::string &text = found ? pattern->suffix : pattern->prefix;
+        if (path[i] != '%') {
+            text += path[i];
+            continue;
+        }
+        if (++i < path.size() && path[i] == '%') {
+            text += '%';
+            continue;
+        }
+        if (found) {
+            return false;
+        }
+        if (i < path.size() && path[i] == '0') {
+            pattern->zeroPad = true;
+            i++;
+        }
+        for (; i < path.size() && std::isdigit(static_cast<unsigned char>(path[i])); i++) {
+            pattern->width = pattern->width * 10 + (path[i] - '0');
+            if (pattern->width > 32) {
+                return false;
+            }
+        }
+        if (i >= path.size() || path[i] != 'd') {
+            return false;
+        }
+        found = true;
+    }
+    return found;
+}
+
+// Format a number of a printf pattern
+std::string formatNumberPattern(const NumberPattern &pattern, int number)
+{
+    std::string digits = std::to_string(number);
+    if (int(digits.size()) < pattern.width) {
+        digits.insert(0, pattern.width - digits.size(), pattern.zeroPad ? '0' : ' ');
+    }
+    return pattern.prefix + digits + pattern.suffix;
+}
+
+bool isDirectory(const std::string &path)
+{
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && (st.st_mode & S_IFMT) == S_IFDIR;
+}
+
+bool fileExists(const std::string &path)
+{
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && (st.st_mode & S_IFMT) == S_IFREG;
+}
+
+// List the names of the regular files in a directory
+bool listDirectory(const std::string &directory, std::vector<std::string> *names)
+{
+#ifdef _WIN32
+    WIN32_FIND_DATAA data;
+    HANDLE handle = FindFirstFileA((directory + "\\*").c_str(), &data);
+    if (handle == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    do {
+        if (!(data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+            names->push_back(data.cFileName);
+        }
+    } while (FindNextFileA(handle, &data));
+    FindClose(handle);
+#else
+    DIR *dir = opendir(directory.c_str());
+    if (dir == nullptr) {
+        return false;
+    }
+    while (struct dirent *entry = readdir(dir)) {
+        std::string name = entry->d_name;
+        if (fileExists(directory + "/" + name)) {
+            names->push_back(name);
+        }
+    }
+    closedir(dir);
+#endif
+    return true;
+}
+
+// Match a file name against a pattern with '*' and '?' wildcards
+bool matchWildcard(const char *pattern, const char *name)
+{
+    if (*pattern == '\0') {
+        return *name == '\0';
+    }
+    if (*pattern == '*') {
+        return matchWildcard(pattern + 1, name) || (*name != '\0' && matchWildcard(pattern, name + 1));
+    }
+    return *name != '\0' && (*pattern == '?' || *pattern == *name) &&
+           matchWildcard(pattern + 1, name + 1);
+}
+
+// Compare file names with embedded numbers compared by value
+bool naturalLess(const std::string &a, const std::string &b)
+{
+    std::size_t i = 0, j = 0;
+    while (i < a.size() && j < b.size()) {
+        if (std::isdigit((unsigned char)a[i]) && std::isdigit((unsigned char)b[j])) {
+            std::size_t iEnd = i, jEnd = j;
+            while (iEnd < a.size() && std::isdigit((unsigned char)a[iEnd])) iEnd++;
+            while (jEnd < b.size() && std::isdigit((unsigned char)b[jEnd])) jEnd++;
+            // Compare without leading zeros: longer numbers are larger
+            std::size_t i0 = i, j0 = j;
+            while (i0 + 1 < iEnd && a[i0] == '0') i0++;
+            while (j0 + 1 < jEnd && b[j0] == '0') j0++;
+            if (iEnd - i0 != jEnd - j0) {
+                return iEnd - i0 < jEnd - j0;
+            }
+            int c = a.compare(i0, iEnd - i0, b, j0, jEnd - j0);
+            if (c != 0) {
+                return c < 0;
+            }
+            i = iEnd;
+            j = jEnd;
+        }
+        else {
+            if (a[i] != b[j]) {
+                return a[i] < b[j];
+            }
+            i++;
+            j++;
+        }
+    }
+    return a.size() - i < b.size() - j;
+}
+
+bool hasExtension(const std::string &name, const std::string &extension)
+{
+    if (name.size() < extension.size()) {
+        return false;
+    }
+    for (std::size_t i = 0; i < extension.size(); i++) {
+        if (std::tolower((unsigned char)name[name.size() - extension.size() + i]) != extension[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Decode a PNG slice into dst (width * height voxels of the volume's
+// data type)
+bool decodePNGSlice(const std::string &filename, const glm::ivec2 &dimensions, bool sixteenBit,
+                    std::uint8_t *dst, std::string *error)
+{
+    cg::MappedFile file;
+    if (!cg::mappedFileOpen(&file, filename)) {
+        *error = "could not open file";
+        return false;
+    }
+
+    LodePNGState state;
+    lodepng_state_init(&state);
+    unsigned width = 0, height = 0;
+    unsigned result = lodepng_inspect(&width, &height, &state, file.data, file.size);
+    LodePNGColorType colorType = state.info_png.color.colortype;
+    lodepng_state_cleanup(&state);
+    if (result != 0) {
+        *error = lodepng_error_text(result);
+        return false;
+    }
+    if (int(width) != dimensions.x || int(height) != dimensions.y) {
+        *error = "slice size differs from the first slice";
+        return false;
+    }
+
+    bool grey = colorType == LCT_GREY || colorType == LCT_GREY_ALPHA;
+    unsigned bitDepth = sixteenBit ? 16 : 8;
+    std::vector<unsigned char> pixels;
+    result = lodepng::decode(pixels, width, height, file.data, file.size,
+                             grey ? LCT_GREY : LCT_RGB, bitDepth);
+    if (result != 0) {
+        *error = lodepng_error_text(result);
+        return false;
+    }
+
+    // Samples are big-endian in PNG; color is converted to luminance
+    std::size_t n = std::size_t(width) * height;
+    if (grey && !sixteenBit) {
+        std::memcpy(dst, &pixels[0], n);
+    }
+    else if (grey) {
+        for (std::size_t i = 0; i < n; i++) {
+            std::uint16_t value = std::uint16_t((pixels[2 * i] << 8) | pixels[2 * i + 1]);
+            std::memcpy(dst + 2 * i, &value, 2);
+        }
+    }
+    else {
+        std::size_t sampleSize = sixteenBit ? 2 : 1;
+        for (std::size_t i = 0; i < n; i++) {
+            unsigned sum = 0;
+            for (std::size_t c = 0; c < 3; c++) {
+                const unsigned char *sample = &pixels[(3 * i + c) * sampleSize];
+                sum += sixteenBit ? (sample[0] << 8) | sample[1] : sample[0];
+            }
+            if (sixteenBit) {
+                std::uint16_t value = std::uint16_t((sum + 1) / 3);
+                std::memcpy(dst + 2 * i, &value, 2);
+            }
+            else {
+                dst[i] = std::uint8_t((sum + 1) / 3);
+            }
+        }
+    }
+    return true;
+}
+
+// Read a raw slice straight into dst
+bool readRawSlice(const std::string &filename, const cg::RawSliceFormat &format,
+                  std::uint8_t *dst, std::string *error)
+{
+    std::ifstream is(filename.c_str(), std::ios::binary);
+    if (!is.is_open()) {
+        *error = "could not open file";
+        return false;
+    }
+    std::size_t elementSize = cg::datatypeSizeInBytes(format.datatype);
+    std::size_t n = std::size_t(format.dimensions.x) * format.dimensions.y;
+    is.seekg(std::streamoff(format.headerSize));
+    is.read(reinterpret_cast<char *>(dst), std::streamsize(n * elementSize));
+    if (!is) {
+        *error = "unexpected end of data";
+        return false;
+    }
+
+    std::uint16_t one = 1;
+    bool littleEndian = *reinterpret_cast<std::uint8_t *>(&one) == 1;
+    if (elementSize > 1 && format.bigEndian == littleEndian) {
+        cg::swapBytes(dst, dst, n, elementSize);
+    }
+    return true;
+}
+
+} // namespace
+
+
+
+namespace cg {
+
+bool volumeListSlices(const std::string &path, std::vector<std::string> *filenames, bool raw)
+{
+    filenames->clear();
+    if (path.find('%') != std::string::npos) {
+        NumberPattern pattern;
+        if (!parseNumberPattern(path, &pattern)) {
+            std::cerr << "Invalid slice pattern " << path << " (expected one %d, %3d or %03d)"
+                      << std::endl;
+            return false;
+        }
+        for (int first = 0; first <= maxFirstSliceNumber && filenames->empty(); first++) {
+            for (int i = first; ; i++) {
+                std::string filename = formatNumberPattern(pattern, i);
+                if (!fileExists(filename)) {
+                    break;
+                }
+                filenames->push_back(filename);
+            }
+        }
+        return !filenames->empty();
+    }
+
+    std::string directory = path;
+    std::string pattern = raw ? "*" : "*.png";
+    if (!isDirectory(path)) {
+        std::size_t slash = path.find_last_of("/\\");
+        directory = slash == std::string::npos ? "." : path.substr(0, slash);
+        pattern = path.substr(slash == std::string::npos ? 0 : slash + 1);
+    }
+    std::vector<std::string> names;
+    if (!listDirectory(directory, &names)) {
+        std::cerr << "Could not list " << directory << std::endl;
+        return false;
+    }
+    std::sort(names.begin(), names.end(), naturalLess);
+    for (std::size_t i = 0; i < names.size(); i++) {
+        bool match = pattern == "*.png" ? hasExtension(names[i], ".png")
+                                        : matchWildcard(pattern.c_str(), names[i].c_str());
+        if (match && names[i][0] != '.') {
+            filenames->push_back(directory + "/" + names[i]);
+        }
+    }
+    return !filenames->empty();
+}
+
+bool volumeLoadSlices(VolumeBase *volume, const std::vector<std::string> &filenames,
+                      const RawSliceFormat *rawFormat)
+{
+    if (filenames.empty()) {
+        return false;
+    }
+
+    // The first slice determines size and data type of the volume
+    glm::ivec2 dimensions;
+    std::string datatype;
+    if (rawFormat != nullptr) {
+        dimensions = rawFormat->dimensions;
+        datatype = rawFormat->datatype;
+        if (dimensions.x <= 0 || dimensions.y <= 0 || datatypeSizeInBytes(datatype) == 0) {
+            std::cerr << "Invalid raw slice format" << std::endl;
+            return false;
+        }
+    }
+    else {
+        MappedFile file;
+        if (!mappedFileOpen(&file, filenames[0])) {
+            return false;
+        }
+        LodePNGState state;
+        lodepng_state_init(&state);
+        unsigned width = 0, height = 0;
+        unsigned result = lodepng_inspect(&width, &height, &state, file.data, file.size);
+        unsigned bitDepth = state.info_png.color.bitdepth;
+        lodepng_state_cleanup(&state);
+        if (result != 0 || width == 0 || height == 0) {
+            std::cerr << "Could not read " << filenames[0] << ": "
+                      << lodepng_error_text(result) << std::endl;
+            return false;
+        }
+        dimensions = glm::ivec2(int(width), int(height));
+        datatype = bitDepth == 16 ? "uint16" : "uint8";
+    }
+
+    std::size_t sliceBytes = std::size_t(dimensions.x) * dimensions.y * datatypeSizeInBytes(datatype);
+    std::vector<std::uint8_t> data(sliceBytes * filenames.size());
+    bool ok = true;
+    std::mutex errorMutex;
+    parallelFor(0, filenames.size(), [&](std::size_t first, std::size_t last) {
+        for (std::size_t z = first; z < last; z++) {
+            std::string error;
+            bool sliceOk = rawFormat != nullptr
+                ? readRawSlice(filenames[z], *rawFormat, &data[z * sliceBytes], &error)
+                : decodePNGSlice(filenames[z], dimensions, datatype == "uint16",
+                                 &data[z * sliceBytes], &error);
+            if (!sliceOk) {
+                std::lock_guard<std::mutex> lock(errorMutex);
+                std::cerr << "Could not read " << filenames[z] << ": " << error << std::endl;
+                ok = false;
+                return;
+            }
+        }
+    });
+    if (!ok) {
+        return false;
+    }
+
+    volume->dimensions = glm::ivec3(dimensions.x, dimensions.y, int(filenames.size()));
+    volume->origin = glm::vec3(0.0f);
+    volume->spacing = glm::vec3(1.0f);
+    volume->datatype = datatype;
+    volume->data.swap(data);
+    return true;
+}
+
+bool volumeLoadSliceStack(VolumeBase *volume, const std::string &path,
+                          const RawSliceFormat *rawFormat)
+{
+    std::vector<std::string> filenames;
+    if (!volumeListSlices(path, &filenames, rawFormat != nullptr)) {
+        std::cerr << "No slices found for " << path << std::endl;
+        return false;
+    }
+    return volumeLoadSlices(volume, filenames, rawFormat);
+}
+
+} // namespace cg
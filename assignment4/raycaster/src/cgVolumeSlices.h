@@ -0,0 +1,58 @@
+#pragma once
+
+#include "cgVolume.h"
+
+#include <vector>
+#include <string>
+#include <cstddef>
+
+namespace cg {
+
+// Struct describing slices stored as headerless raw image files
+struct RawSliceFormat {
+    glm::ivec2 dimensions;  // slice width and height
+    std::string datatype;  // voxel data type string
+    bool bigEndian;  // byte order of multi-byte voxels
+    std::size_t headerSize;  // bytes to skip at the start of each file
+
+    RawSliceFormat() :
+        dimensions(glm::ivec2(0, 0)),
+        datatype("uint8"),
+        bigEndian(false),
+        headerSize(0)
+    {}
+};
+
+// Lists the slice files of a slice stack in slice order. path may be
+//
+// - a directory: all PNG files in it (all files if raw is true),
+// - a printf pattern such as "ct/slice%03d.png": numbered files,
+//   starting at 0 or 1 and ending at the first missing number. The
+//   pattern must have exactly one %d conversion (with an optional width
+//   and zero padding); "%%" is a literal '%'. Other patterns are an
+//   error. Or
+// - a wildcard pattern such as "ct/slice*.png" ('*' and '?' in the
+//   file name part only).
+//
+// Files are sorted by name, with numbers compared by value (so that
+// "slice2" comes before "slice10"). Returns true if at least one file
+// was found, false otherwise.
+bool volumeListSlices(const std::string &path, std::vector<std::string> *filenames,
+                      bool raw = false);
+
+// Reads a volume image from a stack of 2D slices, one file per slice
+// (slice z = filenames[z]), decoding the slices in parallel straight
+// into their place in volume->data. PNG slices are read as "uint8", or
+// "uint16" if they have 16 bits per sample; color images are converted
+// to luminance. If rawFormat is given, the files are read as raw
+// images of that format instead. The origin is set to zero and the
+// spacing to one. Returns true on success, false otherwise.
+bool volumeLoadSlices(VolumeBase *volume, const std::vector<std::string> &filenames,
+                      const RawSliceFormat *rawFormat = nullptr);
+
+// Lists the slices of a slice stack (see volumeListSlices()) and reads
+// them (see volumeLoadSlices())
+bool volumeLoadSliceStack(VolumeBase *volume, const std::string &path,
+                          const RawSliceFormat *rawFormat = nullptr);
+
+} // namespace cg
@@ -0,0 +1,702 @@
+#include "cgVolumeStatistics.h"
+#include "cgVolumeConvert.h"
+#include "cgParallel.h"
+
+#include <iostream>
+#include <algorithm>
+#include <limits>
+#include <mutex>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CG_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// Voxels are processed in blocks of this many elements
+const std::size_t blockSize = 4096;
+
+// Partial counts of a thread are moved to 64-bit totals before any of
+// its 32-bit counters can overflow
+const std::size_t flushInterval = std::size_t(1) << 30;
+
+// Volumes read with a slice reader are read in slabs of about this many
+// voxels
+const std::size_t slabVoxels = std::size_t(16) << 20;
+
+// Adds the values of n voxels (offset to be non-negative) to four
+// interleaved tables of numValues counters each, so that runs of equal
+// values do not all wait on the same counter
+template<typename VoxelType>
+void countValues(const VoxelType *src, std::size_t n, int offset, std::uint32_t *counts,
+                 std::size_t numValues)
+{
+    std::uint32_t *c0 = counts;
+    std::uint32_t *c1 = counts + numValues;
+    std::uint32_t *c2 = counts + 2 * numValues;
+    std::uint32_t *c3 = counts + 3 * numValues;
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        c0[src[i] + offset]++;
+        c1[src[i + 1] + offset]++;
+        c2[src[i + 2] + offset]++;
+        c3[src[i + 3] + offset]++;
+    }
+    for (; i < n; i++) {
+        c0[src[i] + offset]++;
+    }
+}
+
+// Counts every value of an 8- or 16-bit volume exactly (in parallel);
+// counts[value + offset] is the number of voxels of that value
+template<typename VoxelType>
+void countAllValues(const VoxelType *src, std::size_t n, std::vector<std::uint64_t> *counts)
+{
+    std::size_t numValues = std::size_t(1) << (8 * sizeof(VoxelType));
+    int offset = -int(std::numeric_limits<VoxelType>::min());
+    counts->assign(numValues, 0);
+    std::mutex countsMutex;
+    std::size_t numBlocks = (n + blockSize - 1) / blockSize;
+    cg::parallelFor(0, numBlocks, [&](std::size_t first, std::size_t last) {
+        std::vector<std::uint32_t> partial(4 * numValues, 0);
+        std::vector<std::uint64_t> total(numValues, 0);
+        std::size_t pending = 0;
+        for (std::size_t b = first; b < last; b++) {
+            std::size_t count = std::min(blockSize, n - b * blockSize);
+            countValues(src + b * blockSize, count, offset, &partial[0], numValues);
+            pending += count;
+            if (pending >= flushInterval || b + 1 == last) {
+                for (std::size_t i = 0; i < numValues; i++) {
+                    total[i] += std::uint64_t(partial[i]) + partial[i + numValues] +
+                                partial[i + 2 * numValues] + partial[i + 3 * numValues];
+                }
+                std::fill(partial.begin(), partial.end(), 0u);
+                pending = 0;
+            }
+        }
+        std::lock_guard<std::mutex> lock(countsMutex);
+        for (std::size_t i = 0; i < numValues; i++) {
+            (*counts)[i] += total[i];
+        }
+    }, 16);
+}
+
+// Derives the statistics of a volume from the exact counts of its
+// values (see countAllValues())
+void statisticsFromCounts(const std::vector<std::uint64_t> &counts, int offset,
+                          std::size_t numBins, cg::VolumeStatistics *stats)
+{
+    std::size_t lowest = counts.size(), highest = 0;
+    std::uint64_t total = 0;
+    double sum = 0.0;
+    for (std::size_t i = 0; i < counts.size(); i++) {
+        if (counts[i] > 0) {
+            lowest = std::min(lowest, i);
+            highest = i;
+            total += counts[i];
+            sum += double(counts[i]) * (double(i) - offset);
+        }
+    }
+    stats->numValues = total;
+    stats->histogram.assign(numBins, 0);
+    if (total == 0) {
+        return;
+    }
+    stats->minValue = float(int(lowest) - offset);
+    stats->maxValue = float(int(highest) - offset);
+    stats->mean = sum / double(total);
+    double squares = 0.0;
+    float binScale = stats->maxValue > stats->minValue ?
+                     float(numBins) / (stats->maxValue - stats->minValue) : 0.0f;
+    for (std::size_t i = lowest; i <= highest; i++) {
+        double deviation = double(i) - offset - stats->mean;
+        squares += double(counts[i]) * deviation * deviation;
+        // Same binning as cg::voxelHistogram()
+        float bin = (float(int(i) - offset) - stats->minValue) * binScale;
+        stats->histogram[std::min(std::size_t(bin), numBins - 1)] += counts[i];
+    }
+    stats->standardDeviation = std::sqrt(squares / double(total));
+}
+
+// Struct for the range and moments of the finite values seen so far
+struct Moments {
+    std::uint64_t count;
+    double sum;
+    double sumSquares;
+    float minValue;
+    float maxValue;
+
+    Moments() :
+        count(0),
+        sum(0.0),
+        sumSquares(0.0),
+        minValue(std::numeric_limits<float>::infinity()),
+        maxValue(-std::numeric_limits<float>::infinity())
+    {}
+};
+
+// Adds n floats (at most blockSize) to the moments, skipping NaN and
+// infinities
+void accumulateMoments(const float *values, std::size_t n, Moments *moments)
+{
+    std::size_t i = 0;
+#ifdef CG_USE_SSE2
+    const float infinity = std::numeric_limits<float>::infinity();
+    const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    const __m128 posInf = _mm_set1_ps(infinity);
+    const __m128 negInf = _mm_set1_ps(-infinity);
+    __m128 mn = posInf, mx = negInf;
+    __m128d sumLo = _mm_setzero_pd(), sumHi = _mm_setzero_pd();
+    __m128d squaresLo = _mm_setzero_pd(), squaresHi = _mm_setzero_pd();
+    __m128i count = _mm_setzero_si128();
+    for (; i + 4 <= n; i += 4) {
+        __m128 v = _mm_loadu_ps(values + i);
+        __m128 finite = _mm_cmplt_ps(_mm_and_ps(v, absMask), posInf);  // false for NaN
+        __m128 x = _mm_and_ps(v, finite);
+        mn = _mm_min_ps(mn, _mm_or_ps(x, _mm_andnot_ps(finite, posInf)));
+        mx = _mm_max_ps(mx, _mm_or_ps(x, _mm_andnot_ps(finite, negInf)));
+        __m128d lo = _mm_cvtps_pd(x);
+        __m128d hi = _mm_cvtps_pd(_mm_movehl_ps(x, x));
+        sumLo = _mm_add_pd(sumLo, lo);
+        sumHi = _mm_add_pd(sumHi, hi);
+        squaresLo = _mm_add_pd(squaresLo, _mm_mul_pd(lo, lo));
+        squaresHi = _mm_add_pd(squaresHi, _mm_mul_pd(hi, hi));
+        count = _mm_sub_epi32(count, _mm_castps_si128(finite));
+    }
+    float mnLanes[4], mxLanes[4];
+    double sums[2], squares[2];
+    std::int32_t counts[4];
+    _mm_storeu_ps(mnLanes, mn);
+    _mm_storeu_ps(mxLanes, mx);
+    _mm_storeu_pd(sums, _mm_add_pd(sumLo, sumHi));
+    _mm_storeu_pd(squares, _mm_add_pd(squaresLo, squaresHi));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(counts), count);
+    for (int lane = 0; lane < 4; lane++) {
+        moments->minValue = std::min(moments->minValue, mnLanes[lane]);
+        moments->maxValue = std::max(moments->maxValue, mxLanes[lane]);
+        moments->count += std::uint64_t(counts[lane]);
+    }
+    moments->sum += sums[0] + sums[1];
+    moments->sumSquares += squares[0] + squares[1];
+#endif
+    for (; i < n; i++) {
+        float v = values[i];
+        if (std::fabs(v) < std::numeric_limits<float>::infinity()) {
+            moments->minValue = std::min(moments->minValue, v);
+            moments->maxValue = std::max(moments->maxValue, v);
+            moments->sum += v;
+            moments->sumSquares += double(v) * v;
+            moments->count++;
+        }
+    }
+}
+
+// Adds the range and moments of other to those of moments
+void mergeMoments(const Moments &other, Moments *moments)
+{
+    moments->count += other.count;
+    moments->sum += other.sum;
+    moments->sumSquares += other.sumSquares;
+    moments->minValue = std::min(moments->minValue, other.minValue);
+    moments->maxValue = std::max(moments->maxValue, other.maxValue);
+}
+
+// Computes the range and moments of a volume of any data type (in
+// parallel)
+Moments computeMoments(const cg::VolumeBase &volume)
+{
+    std::size_t n = cg::volumeNumVoxels(volume);
+    std::size_t elementSize = cg::datatypeSizeInBytes(volume.datatype);
+    std::size_t numBlocks = (n + blockSize - 1) / blockSize;
+    bool isFloat = volume.datatype == "float32";
+    Moments result;
+    std::mutex resultMutex;
+    cg::parallelFor(0, numBlocks, [&](std::size_t first, std::size_t last) {
+        float values[blockSize];
+        Moments moments;
+        for (std::size_t b = first; b < last; b++) {
+            std::size_t count = std::min(blockSize, n - b * blockSize);
+            const std::uint8_t *block = &volume.data[b * blockSize * elementSize];
+            if (isFloat) {
+                accumulateMoments(reinterpret_cast<const float *>(block), count, &moments);
+            }
+            else {
+                cg::voxelsToFloat(volume.datatype, block, count, values);
+                accumulateMoments(values, count, &moments);
+            }
+        }
+        std::lock_guard<std::mutex> lock(resultMutex);
+        mergeMoments(moments, &result);
+    }, 16);
+    return result;
+}
+
+// Sets the statistics (but not the histogram) from the range and moments
+// of a volume
+void statisticsFromMoments(const Moments &moments, cg::VolumeStatistics *stats)
+{
+    stats->numValues = moments.count;
+    if (moments.count == 0) {
+        return;
+    }
+    stats->minValue = moments.minValue;
+    stats->maxValue = moments.maxValue;
+    stats->mean = moments.sum / double(moments.count);
+    double variance = moments.sumSquares / double(moments.count) - stats->mean * stats->mean;
+    stats->standardDeviation = std::sqrt(std::max(variance, 0.0));
+}
+
+// Reads a volume slab by slab with readSlices and calls fn(slab, first,
+// last) for each slab, given as a float32 volume image that holds the
+// slices [first, last) of the slab and up to halo slices of the volume
+// on either side of them. Returns false if a slab cannot be read.
+template<typename Function>
+bool forEachSlab(const cg::VolumeBase &header, const cg::SliceReader &readSlices, int halo,
+                 Function fn)
+{
+    const glm::ivec3 &dims = header.dimensions;
+    std::size_t sliceVoxels = std::max<std::size_t>(std::size_t(dims.x) * std::size_t(dims.y), 1);
+    int slabSlices = int(std::min<std::size_t>(std::max<std::size_t>(slabVoxels / sliceVoxels, 1),
+                                               std::size_t(std::max(dims.z, 1))));
+    cg::VolumeBase slab;
+    slab.spacing = header.spacing;
+    slab.datatype = "float32";
+    for (int z0 = 0; z0 < dims.z; z0 += slabSlices) {
+        int z1 = std::min(z0 + slabSlices, dims.z);
+        int lo = std::max(z0 - halo, 0), hi = std::min(z1 + halo, dims.z);
+        slab.dimensions = glm::ivec3(dims.x, dims.y, hi - lo);
+        slab.data.resize(cg::volumeNumVoxels(slab) * sizeof(float));
+        if (!readSlices(lo, hi - lo, reinterpret_cast<float *>(&slab.data[0]))) {
+            return false;
+        }
+        fn(static_cast<const cg::VolumeBase &>(slab), std::size_t(z0 - lo), std::size_t(z1 - lo));
+    }
+    return true;
+}
+
+// Calls fn(values, magnitudes, n) for every row of the slices [first,
+// last) of a volume, with the gradient magnitudes (central differences
+// in world units, one-sided at the border) of the row's voxels
+template<typename Function>
+void forEachGradientRow(const cg::VolumeBase &volume, std::size_t first, std::size_t last,
+                        Function fn)
+{
+    const glm::ivec3 &dims = volume.dimensions;
+    std::size_t sliceVoxels = std::size_t(dims.x) * std::size_t(dims.y);
+    std::size_t elementSize = cg::datatypeSizeInBytes(volume.datatype);
+    glm::vec3 scale;
+    for (int axis = 0; axis < 3; axis++) {
+        scale[axis] = volume.spacing[axis] > 0.0f ? 1.0f / volume.spacing[axis] : 1.0f;
+    }
+
+    // Slice s is kept in slot s % 3, so that each slice is converted
+    // once per range
+    std::vector<float> slices(3 * sliceVoxels), magnitudes(dims.x);
+    int loaded[3] = { -1, -1, -1 };
+    auto slice = [&](int s) {
+        float *dst = &slices[(s % 3) * sliceVoxels];
+        if (loaded[s % 3] != s) {
+            cg::voxelsToFloat(volume.datatype, &volume.data[s * sliceVoxels * elementSize],
+                              sliceVoxels, dst);
+            loaded[s % 3] = s;
+        }
+        return dst;
+    };
+
+    for (int z = int(first); z < int(last); z++) {
+        int za = std::max(z - 1, 0), zb = std::min(z + 1, dims.z - 1);
+        const float *center = slice(z);
+        const float *below = slice(za);
+        const float *above = slice(zb);
+        float hz = zb > za ? scale.z / float(zb - za) : 0.0f;
+        for (int y = 0; y < dims.y; y++) {
+            int ya = std::max(y - 1, 0), yb = std::min(y + 1, dims.y - 1);
+            float hy = yb > ya ? scale.y / float(yb - ya) : 0.0f;
+            const float *row = center + std::size_t(y) * dims.x;
+            const float *prevRow = center + std::size_t(ya) * dims.x;
+            const float *nextRow = center + std::size_t(yb) * dims.x;
+            const float *belowRow = below + std::size_t(y) * dims.x;
+            const float *aboveRow = above + std::size_t(y) * dims.x;
+            float hx = 0.5f * scale.x;
+            int x = 1;
+#ifdef CG_USE_SSE2
+            const __m128 hx4 = _mm_set1_ps(hx), hy4 = _mm_set1_ps(hy), hz4 = _mm_set1_ps(hz);
+            for (; x + 4 < dims.x; x += 4) {
+                __m128 gx = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(row + x + 1), _mm_loadu_ps(row + x - 1)), hx4);
+                __m128 gy = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(nextRow + x), _mm_loadu_ps(prevRow + x)), hy4);
+                __m128 gz = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(aboveRow + x), _mm_loadu_ps(belowRow + x)), hz4);
+                __m128 sq = _mm_add_ps(_mm_mul_ps(gx, gx), _mm_add_ps(_mm_mul_ps(gy, gy), _mm_mul_ps(gz, gz)));
+                _mm_storeu_ps(&magnitudes[x], _mm_sqrt_ps(sq));
+            }
+#endif
+            for (; x < dims.x; x++) {
+                int xa = std::max(x - 1, 0), xb = std::min(x + 1, dims.x - 1);
+                float gx = xb > xa ? (row[xb] - row[xa]) * scale.x / float(xb - xa) : 0.0f;
+                float gy = (nextRow[x] - prevRow[x]) * hy;
+                float gz = (aboveRow[x] - belowRow[x]) * hz;
+                magnitudes[x] = std::sqrt(gx * gx + gy * gy + gz * gz);
+            }
+            {
+                int xb = std::min(1, dims.x - 1);
+                float gx = xb > 0 ? (row[xb] - row[0]) * scale.x : 0.0f;
+                float gy = (nextRow[0] - prevRow[0]) * hy;
+                float gz = (aboveRow[0] - belowRow[0]) * hz;
+                magnitudes[0] = std::sqrt(gx * gx + gy * gy + gz * gz);
+            }
+            fn(row, &magnitudes[0], std::size_t(dims.x));
+        }
+    }
+}
+
+// Returns true if the volume holds all voxels of a supported data type
+// (or, with header set, if the volume is of a supported data type)
+bool checkVolume(const cg::VolumeBase &volume, const char *what, bool header = false)
+{
+    std::size_t elementSize = cg::datatypeSizeInBytes(volume.datatype);
+    if (elementSize == 0 ||
+        (!header && volume.data.size() < cg::volumeNumVoxels(volume) * elementSize)) {
+        std::cerr << "Cannot compute " << what << " of volume of data type " << volume.datatype
+                  << std::endl;
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+
+
+namespace cg {
+
+bool volumeComputeStatistics(const VolumeBase &volume, VolumeStatistics *stats,
+                             std::size_t numBins)
+{
+    if (!checkVolume(volume, "statistics")) {
+        return false;
+    }
+    numBins = std::max<std::size_t>(numBins, 1);
+    *stats = VolumeStatistics();
+    std::size_t n = volumeNumVoxels(volume);
+    if (n == 0) {
+        stats->histogram.assign(numBins, 0);
+        return true;
+    }
+
+    std::vector<std::uint64_t> counts;
+    if (volume.datatype == "uint8") {
+        countAllValues(&volume.data[0], n, &counts);
+        statisticsFromCounts(counts, 0, numBins, stats);
+        return true;
+    }
+    if (volume.datatype == "uint16") {
+        countAllValues(reinterpret_cast<const std::uint16_t *>(&volume.data[0]), n, &counts);
+        statisticsFromCounts(counts, 0, numBins, stats);
+        return true;
+    }
+    if (volume.datatype == "int16") {
+        countAllValues(reinterpret_cast<const std::int16_t *>(&volume.data[0]), n, &counts);
+        statisticsFromCounts(counts, 32768, numBins, stats);
+        return true;
+    }
+
+    Moments moments = computeMoments(volume);
+    stats->histogram.assign(numBins, 0);
+    statisticsFromMoments(moments, stats);
+    if (moments.count == 0) {
+        return true;
+    }
+    return voxelHistogram(volume.datatype, false, &volume.data[0], n, stats->minValue,
+                          stats->maxValue, &stats->histogram[0], numBins);
+}
+
+bool volumeComputeStatisticsSlices(const VolumeBase &header, const SliceReader &readSlices,
+                                   VolumeStatistics *stats, std::size_t numBins)
+{
+    if (!checkVolume(header, "statistics", true)) {
+        return false;
+    }
+    numBins = std::max<std::size_t>(numBins, 1);
+    VolumeStatistics result;
+
+    // 8- and 16-bit values are counted exactly in a single pass, like
+    // those of volumes in memory
+    if (header.datatype == "uint8" || header.datatype == "uint16" || header.datatype == "int16") {
+        int offset = header.datatype == "int16" ? 32768 : 0;
+        std::size_t numValues = header.datatype == "uint8" ? 256 : 65536;
+        std::vector<std::uint64_t> counts(numValues, 0);
+        std::mutex countsMutex;
+        bool ok = forEachSlab(header, readSlices, 0, [&](const VolumeBase &slab, std::size_t,
+                                                         std::size_t) {
+            const float *values = reinterpret_cast<const float *>(&slab.data[0]);
+            std::size_t n = volumeNumVoxels(slab);
+            parallelFor(0, (n + blockSize - 1) / blockSize, [&](std::size_t first,
+                                                                std::size_t last) {
+                std::vector<std::uint64_t> partial(numValues, 0);
+                for (std::size_t i = first * blockSize; i < std::min(last * blockSize, n); i++) {
+                    partial[std::size_t(int(values[i]) + offset)]++;
+                }
+                std::lock_guard<std::mutex> lock(countsMutex);
+                for (std::size_t i = 0; i < numValues; i++) {
+                    counts[i] += partial[i];
+                }
+            }, 16);
+        });
+        if (!ok) {
+            return false;
+        }
+        statisticsFromCounts(counts, offset, numBins, &result);
+        *stats = std::move(result);
+        return true;
+    }
+
+    // Other data types take one pass for range and moments and one for
+    // the histogram
+    Moments moments;
+    bool ok = forEachSlab(header, readSlices, 0, [&](const VolumeBase &slab, std::size_t,
+                                                     std::size_t) {
+        mergeMoments(computeMoments(slab), &moments);
+    });
+    result.histogram.assign(numBins, 0);
+    statisticsFromMoments(moments, &result);
+    if (ok && moments.count > 0) {
+        ok = forEachSlab(header, readSlices, 0, [&](const VolumeBase &slab, std::size_t,
+                                                    std::size_t) {
+            voxelHistogram(slab.datatype, false, &slab.data[0], volumeNumVoxels(slab),
+                           result.minValue, result.maxValue, &result.histogram[0], numBins);
+        });
+    }
+    if (!ok) {
+        return false;
+    }
+    *stats = std::move(result);
+    return true;
+}
+
+float volumeStatisticsPercentile(const VolumeStatistics &stats, float fraction)
+{
+    if (stats.histogram.empty()) {
+        return stats.minValue;
+    }
+    return histogramPercentile(&stats.histogram[0], stats.histogram.size(), stats.minValue,
+                               stats.maxValue, fraction);
+}
+
+void volumeStatisticsSerialize(const VolumeStatistics &stats, std::vector<std::uint8_t> *data)
+{
+    std::uint64_t numBins = stats.histogram.size();
+    std::size_t headerSize = 2 * sizeof(std::uint64_t) + 2 * sizeof(float) + 2 * sizeof(double);
+    data->resize(headerSize + numBins * sizeof(std::uint64_t));
+    std::uint8_t *dst = &(*data)[0];
+    std::memcpy(dst, &stats.numValues, sizeof(std::uint64_t));
+    std::memcpy(dst + 8, &stats.minValue, sizeof(float));
+    std::memcpy(dst + 12, &stats.maxValue, sizeof(float));
+    std::memcpy(dst + 16, &stats.mean, sizeof(double));
+    std::memcpy(dst + 24, &stats.standardDeviation, sizeof(double));
+    std::memcpy(dst + 32, &numBins, sizeof(std::uint64_t));
+    if (numBins > 0) {
+        std::memcpy(dst + headerSize, &stats.histogram[0], numBins * sizeof(std::uint64_t));
+    }
+}
+
+bool volumeStatisticsDeserialize(VolumeStatistics *stats, const std::uint8_t *data,
+                                 std::size_t size)
+{
+    std::size_t headerSize = 2 * sizeof(std::uint64_t) + 2 * sizeof(float) + 2 * sizeof(double);
+    std::uint64_t numBins = 0;
+    if (size < headerSize) {
+        return false;
+    }
+    std::memcpy(&numBins, data + 32, sizeof(std::uint64_t));
+    if (size != headerSize + numBins * sizeof(std::uint64_t)) {
+        return false;
+    }
+    std::memcpy(&stats->numValues, data, sizeof(std::uint64_t));
+    std::memcpy(&stats->minValue, data + 8, sizeof(float));
+    std::memcpy(&stats->maxValue, data + 12, sizeof(float));
+    std::memcpy(&stats->mean, data + 16, sizeof(double));
+    std::memcpy(&stats->standardDeviation, data + 24, sizeof(double));
+    stats->histogram.resize(std::size_t(numBins));
+    if (numBins > 0) {
+        std::memcpy(&stats->histogram[0], data + headerSize, numBins * sizeof(std::uint64_t));
+    }
+    return true;
+}
+
+bool volumeComputeJointHistogram(const VolumeBase &volume, JointHistogram *histogram,
+                                 int numValueBins, int numGradientBins)
+{
+    if (!checkVolume(volume, "joint histogram")) {
+        return false;
+    }
+    std::size_t sliceVoxels = std::size_t(volume.dimensions.x) * std::size_t(volume.dimensions.y);
+    std::size_t elementSize = datatypeSizeInBytes(volume.datatype);
+    SliceReader readSlices = [&](int firstSlice, int numSlices, float *dst) {
+        voxelsToFloat(volume.datatype, &volume.data[firstSlice * sliceVoxels * elementSize],
+                      numSlices * sliceVoxels, dst);
+        return true;
+    };
+    return volumeComputeJointHistogramSlices(volume, readSlices, histogram, numValueBins,
+                                             numGradientBins);
+}
+
+bool volumeComputeJointHistogramSlices(const VolumeBase &header, const SliceReader &readSlices,
+                                       JointHistogram *histogram, int numValueBins,
+                                       int numGradientBins)
+{
+    if (!checkVolume(header, "joint histogram", true)) {
+        return false;
+    }
+    JointHistogram result;
+    result.numValueBins = std::max(numValueBins, 1);
+    result.numGradientBins = std::max(numGradientBins, 1);
+
+    // The first pass finds the range of the finite values and the largest
+    // gradient magnitude, the second one bins values and magnitudes.
+    // Slabs are read with one slice around them for the gradients, and
+    // their slices are processed in parallel.
+    float minValue = std::numeric_limits<float>::infinity();
+    float maxValue = -std::numeric_limits<float>::infinity();
+    float maxGradient = 0.0f;
+    std::mutex resultMutex;
+    bool ok = forEachSlab(header, readSlices, 1, [&](const VolumeBase &slab, std::size_t begin,
+                                                     std::size_t end) {
+        parallelFor(begin, end, [&](std::size_t first, std::size_t last) {
+            float lowest = std::numeric_limits<float>::infinity();
+            float highest = -std::numeric_limits<float>::infinity();
+            float largest = 0.0f;
+            forEachGradientRow(slab, first, last, [&](const float *values,
+                                                      const float *magnitudes, std::size_t n) {
+                for (std::size_t i = 0; i < n; i++) {
+                    if (std::fabs(values[i]) < std::numeric_limits<float>::infinity()) {
+                        lowest = std::min(lowest, values[i]);
+                        highest = std::max(highest, values[i]);
+                    }
+                    largest = magnitudes[i] > largest ? magnitudes[i] : largest;  // skips NaN
+                }
+            });
+            std::lock_guard<std::mutex> lock(resultMutex);
+            minValue = std::min(minValue, lowest);
+            maxValue = std::max(maxValue, highest);
+            maxGradient = std::max(maxGradient, largest);
+        });
+    });
+    if (!ok) {
+        return false;
+    }
+    if (minValue > maxValue) {  // no finite values
+        minValue = maxValue = 0.0f;
+    }
+    if (!(maxGradient < std::numeric_limits<float>::infinity())) {
+        maxGradient = std::numeric_limits<float>::max();
+    }
+    result.minValue = minValue;
+    result.maxValue = maxValue;
+    result.maxGradient = maxGradient;
+    result.bins.assign(std::size_t(result.numValueBins) * result.numGradientBins, 0);
+
+    std::size_t nv = std::size_t(result.numValueBins);
+    std::size_t ng = std::size_t(result.numGradientBins);
+    float valueScale = maxValue > minValue ? float(nv) / (maxValue - minValue) : 0.0f;
+    float gradientScale = maxGradient > 0.0f ? float(ng) / maxGradient : 0.0f;
+    ok = forEachSlab(header, readSlices, 1, [&](const VolumeBase &slab, std::size_t begin,
+                                                std::size_t end) {
+        parallelFor(begin, end, [&](std::size_t first, std::size_t last) {
+            std::vector<std::uint64_t> partial(nv * ng, 0);
+            forEachGradientRow(slab, first, last, [&](const float *values,
+                                                      const float *magnitudes, std::size_t n) {
+                for (std::size_t i = 0; i < n; i++) {
+                    float valueBin = (values[i] - minValue) * valueScale;
+                    float gradientBin = magnitudes[i] * gradientScale;
+                    // Also skips NaN and infinite values or magnitudes
+                    if (valueBin >= 0.0f && values[i] <= maxValue &&
+                        gradientBin >= 0.0f && magnitudes[i] <= maxGradient) {
+                        std::size_t v = std::min(std::size_t(valueBin), nv - 1);
+                        std::size_t g = std::min(std::size_t(gradientBin), ng - 1);
+                        partial[g * nv + v]++;
+                    }
+                }
+            });
+            std::lock_guard<std::mutex> lock(resultMutex);
+            for (std::size_t i = 0; i < partial.size(); i++) {
+                result.bins[i] += partial[i];
+            }
+        });
+    });
+    if (!ok) {
+        return false;
+    }
+    *histogram = std::move(result);
+    return true;
+}
+
+void volumeJointHistogramSerialize(const JointHistogram &histogram,
+                                   std::vector<std::uint8_t> *data)
+{
+    std::size_t headerSize = 2 * sizeof(std::int32_t) + 3 * sizeof(float);
+    std::int32_t numBins[2] = { histogram.numValueBins, histogram.numGradientBins };
+    float ranges[3] = { histogram.minValue, histogram.maxValue, histogram.maxGradient };
+    data->resize(headerSize + histogram.bins.size() * sizeof(std::uint64_t));
+    std::uint8_t *dst = &(*data)[0];
+    std::memcpy(dst, numBins, sizeof(numBins));
+    std::memcpy(dst + sizeof(numBins), ranges, sizeof(ranges));
+    if (!histogram.bins.empty()) {
+        std::memcpy(dst + headerSize, &histogram.bins[0],
+                    histogram.bins.size() * sizeof(std::uint64_t));
+    }
+}
+
+bool volumeJointHistogramDeserialize(JointHistogram *histogram, const std::uint8_t *data,
+                                     std::size_t size)
+{
+    std::size_t headerSize = 2 * sizeof(std::int32_t) + 3 * sizeof(float);
+    std::int32_t numBins[2];
+    float ranges[3];
+    if (size < headerSize) {
+        return false;
+    }
+    std::memcpy(numBins, data, sizeof(numBins));
+    std::memcpy(ranges, data + sizeof(numBins), sizeof(ranges));
+    if (numBins[0] < 0 || numBins[1] < 0 ||
+        size != headerSize + std::size_t(numBins[0]) * std::size_t(numBins[1]) *
+                             sizeof(std::uint64_t)) {
+        return false;
+    }
+    histogram->numValueBins = numBins[0];
+    histogram->numGradientBins = numBins[1];
+    histogram->minValue = ranges[0];
+    histogram->maxValue = ranges[1];
+    histogram->maxGradient = ranges[2];
+    histogram->bins.resize(std::size_t(numBins[0]) * std::size_t(numBins[1]));
+    if (!histogram->bins.empty()) {
+        std::memcpy(&histogram->bins[0], data + headerSize,
+                    histogram->bins.size() * sizeof(std::uint64_t));
+    }
+    return true;
+}
+
+std::vector<float> jointHistogramMeanGradients(const JointHistogram &histogram)
+{
+    std::size_t nv = std::size_t(std::max(histogram.numValueBins, 0));
+    std::size_t ng = std::size_t(std::max(histogram.numGradientBins, 0));
+    std::vector<float> means(nv, 0.0f);
+    if (histogram.bins.size() != nv * ng || ng == 0) {
+        return means;
+    }
+    // Magnitudes are taken at the centers of the gradient bins
+    float binWidth = histogram.maxGradient / float(ng);
+    for (std::size_t v = 0; v < nv; v++) {
+        double count = 0.0, sum = 0.0;
+        for (std::size_t g = 0; g < ng; g++) {
+            double n = double(histogram.bins[g * nv + v]);
+            count += n;
+            sum += n * (double(g) + 0.5) * binWidth;
+        }
+        means[v] = count > 0.0 ? float(sum / count) : 0.0f;
+    }
+    return means;
+}
+
+} // namespace cg
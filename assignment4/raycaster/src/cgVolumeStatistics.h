@@ -0,0 +1,110 @@
+#pragma once
+
+#include "cgVolume.h"
+#include "cgVolumeResample.h"
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+namespace cg {
+
+// Struct for summary statistics of the values of a volume image. Only
+// finite values count; NaN and infinities are skipped.
+struct VolumeStatistics {
+    std::uint64_t numValues;  // finite values
+    float minValue;
+    float maxValue;
+    double mean;
+    double standardDeviation;
+    std::vector<std::uint64_t> histogram;  // equal bins over [minValue, maxValue]
+
+    VolumeStatistics() :
+        numValues(0),
+        minValue(0.0f),
+        maxValue(0.0f),
+        mean(0.0),
+        standardDeviation(0.0)
+    {}
+};
+
+// Struct for a joint histogram of the values and gradient magnitudes of
+// a volume image, e.g., for 2D transfer functions
+struct JointHistogram {
+    int numValueBins;
+    int numGradientBins;
+    float minValue;  // the value axis spans [minValue, maxValue]
+    float maxValue;
+    float maxGradient;  // the gradient axis spans [0, maxGradient]
+    std::vector<std::uint64_t> bins;  // value bins vary fastest
+
+    JointHistogram() :
+        numValueBins(0),
+        numGradientBins(0),
+        minValue(0.0f),
+        maxValue(0.0f),
+        maxGradient(0.0f)
+    {}
+};
+
+// Computes the statistics of a volume image (in LAYOUT_LINEAR), with a
+// histogram of numBins bins over its value range. Voxels are processed
+// in parallel with per-thread partial results. 8- and 16-bit volumes
+// take a single pass that counts every value exactly; other data types
+// take a SIMD pass for range and moments and one for the histogram.
+// Returns false if the data type is not supported.
+bool volumeComputeStatistics(const VolumeBase &volume, VolumeStatistics *stats,
+                             std::size_t numBins = 4096);
+
+// Same as volumeComputeStatistics(), but reads the volume with
+// readSlices, slab by slab, so that it never needs to be in memory at
+// once (e.g., a streamed or mapped volume). header describes the volume
+// (its data is not used). 8- and 16-bit volumes take a single pass,
+// other data types two.
+bool volumeComputeStatisticsSlices(const VolumeBase &header, const SliceReader &readSlices,
+                                   VolumeStatistics *stats, std::size_t numBins = 4096);
+
+// Returns the value below which the given fraction (0 to 1) of the
+// values lies, interpolated within the histogram bins
+float volumeStatisticsPercentile(const VolumeStatistics &stats, float fraction);
+
+// Serializes statistics into a buffer (e.g., for the derived data cache)
+void volumeStatisticsSerialize(const VolumeStatistics &stats, std::vector<std::uint8_t> *data);
+
+// Reads statistics back from a buffer written by
+// volumeStatisticsSerialize(). Returns false if the buffer is invalid.
+bool volumeStatisticsDeserialize(VolumeStatistics *stats, const std::uint8_t *data,
+                                 std::size_t size);
+
+// Computes the joint histogram of the values and the gradient
+// magnitudes (central differences in world units, one-sided at the
+// border) of a volume image (in LAYOUT_LINEAR). The gradient axis spans
+// up to the largest magnitude. Slices are processed in parallel with
+// per-thread partial histograms. Returns false if the data type is not
+// supported.
+bool volumeComputeJointHistogram(const VolumeBase &volume, JointHistogram *histogram,
+                                 int numValueBins = 256, int numGradientBins = 256);
+
+// Same as volumeComputeJointHistogram(), but reads the volume with
+// readSlices, slab by slab (see volumeComputeStatisticsSlices())
+bool volumeComputeJointHistogramSlices(const VolumeBase &header, const SliceReader &readSlices,
+                                       JointHistogram *histogram, int numValueBins = 256,
+                                       int numGradientBins = 256);
+
+// Serializes a joint histogram into a buffer (e.g., for the derived data
+// cache)
+void volumeJointHistogramSerialize(const JointHistogram &histogram,
+                                   std::vector<std::uint8_t> *data);
+
+// Reads a joint histogram back from a buffer written by
+// volumeJointHistogramSerialize(). Returns false if the buffer is
+// invalid.
+bool volumeJointHistogramDeserialize(JointHistogram *histogram, const std::uint8_t *data,
+                                     std::size_t size);
+
+// Returns the mean gradient magnitude of the values in each value bin of
+// a joint histogram (zero for empty bins). Boundaries between materials
+// show up as values with large mean gradient magnitudes.
+std::vector<float> jointHistogramMeanGradients(const JointHistogram &histogram);
+
+} // namespace cg
@@ -2,6 +2,23 @@
 #include "utils.h"
 #include "utils2.h"
 #include "cgVolume.h"
+#include "cgVolumeCache.h"
+#include "cgVolumeCompressed.h"
+#include "cgVolumeConvert.h"
+#include "cgVolumeSlices.h"
+#include "cgVolumeNRRD.h"
+#include "cgVolumeSequence.h"
+#include "cgBrickSource.h"
+#include "cgDerivedCache.h"
+#include "cgVolumePipeline.h"
+#include "cgVolumePyramid.h"
+#include "cgVolumeStatistics.h"
+#include "cgVolumeGradient.h"
+#include "cgVolumeResample.h"
+#include "cgVolumeSample.h"
+#include "cgVolumeFilter.h"
+#include "cgVolumeEdit.h"
+#include "cgVolumeMinMax.h"
 
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
@@ -17,6 +34,48 @@
 #include <iostream>
 #include <cstdlib>
 #include <algorithm>
+#include <functional>
+#include <memory>
+#include <list>
+#include <future>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <iomanip>
+#include <cmath>
+#include <limits>
+
+// VTK files with more voxel data than this (in bytes) are streamed
+// brick by brick instead of being read into memory
+const std::uint64_t streamingThreshold = std::uint64_t(1) << 30;
+
+// Max size in bytes of the slabs a volume is uploaded in (one pixel
+// buffer object each)
+const std::size_t uploadSlabSize = 16u << 20;
+
+// Number of pixel buffer objects in the upload ring
+const int uploadRingSize = 3;
+
+// Number of 3D textures the timesteps of a sequence are streamed into
+const int sequenceTexturePoolSize = 3;
+
+// Number of timesteps of a sequence decoded ahead on the CPU, and the
+// number of threads decoding them
+const int sequencePrefetchFrames = 8;
+const int sequenceDecodeThreads = 2;
+
+// Edge length in voxels of the bricks that edits of a volume are tracked
+// and uploaded in
+const int editBrickSize = 32;
+
+// Seconds that editing has to pause before the statistics of an edited
+// volume are computed anew
+const double editStatisticsDelay = 0.5;
+
+// Edge length in voxels of the bricks of the min/max grid that rays skip
+// empty space with
+const int minMaxBrickSize = 16;
 
 // The attribute locations we will use in the vertex shader
 enum AttributeLocation {
@@ -53,17 +112,208 @@ struct MeshVAO {
     int numIndices;
 };
 
+// Precision of volume textures
+enum VolumePrecision {
+    PRECISION_FULL = 0,  // own data type (R8, R16, R16_SNORM or R32F)
+    PRECISION_HALF = 1,  // like PRECISION_FULL, but 32-bit types as R16F
+    PRECISION_8BIT = 2  // quantized to R8 within a value window
+};
+
+// What happens to the CPU copy of a volume read into memory once its
+// texture is resident
+enum CpuCopyPolicy {
+    CPU_COPY_KEEP = 0,  // kept until the CPU budget of the dataset cache is exceeded
+    CPU_COPY_PAGE_OUT = 1,  // moved to the derived data cache and mapped from there
+    CPU_COPY_DROP = 2,  // freed
+    CPU_COPY_COMPRESS = 3  // kept as compressed bricks (see cg::CompressedVolume)
+};
+
+// Which coarser levels of a volume are uploaded as mip levels of its
+// texture, for sampling at a level of detail that matches the screen
+enum LodPyramidMode {
+    LOD_PYRAMID_OFF = 0,
+    LOD_PYRAMID_AVERAGE = 1,  // levels average their blocks of voxels
+    LOD_PYRAMID_MAX = 2  // levels keep the largest voxel of each block
+};
+
+// Whether gradients are precomputed into a second texture for the
+// shaded modes, and with which operator. Without it, the shader
+// estimates gradients with six extra samples.
+enum GradientPrecompute {
+    GRADIENTS_OFF = 0,
+    GRADIENTS_CENTRAL_DIFFERENCES = 1,
+    GRADIENTS_SOBEL = 2
+};
+
+// Whether volumes are resampled before upload
+enum VolumeResampling {
+    RESAMPLING_OFF = 0,
+    RESAMPLING_ISOTROPIC = 1,  // to cubic voxels of the finest spacing
+    RESAMPLING_BUDGET = 2  // to cubic voxels, as fine as the GPU budget for the texture allows
+};
+
+// Struct for settings of how volumes are stored on the GPU (and the CPU)
+struct VolumeUploadSettings {
+    VolumePrecision precision;
+    CpuCopyPolicy cpuCopy;
+    float lowPercentile;  // 8-bit window from histogram percentiles (in %)
+    float highPercentile;
+    float windowLevel;  // explicit 8-bit window, used if windowWidth > 0
+    float windowWidth;
+    float smoothing;  // Gaussian smoothing while uploading (sigma in voxels, 0 = off)
+    LodPyramidMode lodPyramid;
+    GradientPrecompute gradients;
+    VolumeResampling resampling;
+    cg::ResampleFilter resampleFilter;
+    float resampleBudgetMB;  // texture size with RESAMPLING_BUDGET
+    float maxTextureMB;  // largest texture, or zero for the GPU's limits only
+
+    VolumeUploadSettings() :
+        precision(PRECISION_FULL),
+        cpuCopy(CPU_COPY_KEEP),
+        lowPercentile(0.5f),
+        highPercentile(99.5f),
+        windowLevel(0.0f),
+        windowWidth(0.0f),
+        smoothing(0.0f),
+        lodPyramid(LOD_PYRAMID_OFF),
+        gradients(GRADIENTS_OFF),
+        resampling(RESAMPLING_OFF),
+        resampleFilter(cg::RESAMPLE_TRILINEAR),
+        resampleBudgetMB(1024.0f),
+        maxTextureMB(0.0f)
+    {}
+};
+
+// Struct for the limits on the size of a volume texture (see
+// getTextureLimits())
+struct TextureLimits {
+    int maxSize;  // largest dimension of a 3D texture
+    std::uint64_t maxBytes;  // largest texture
+
+    TextureLimits() :
+        maxSize(std::numeric_limits<int>::max()),
+        maxBytes(std::numeric_limits<std::uint64_t>::max())
+    {}
+};
+
+// Struct describing how a volume is stored in its 3D texture
+struct VolumeTextureFormat {
+    GLint internalFormat;
+    GLenum type;
+    bool convert;  // voxels are converted on the CPU before upload
+    cg::VoxelConversion conversion;
+    float valueScale;  // maps texture values to [0, 1] for the transfer function
+    float valueOffset;
+    float windowMin;  // the voxel values mapped to 0 and 1
+    float windowMax;
+
+    VolumeTextureFormat() :
+        internalFormat(GL_R8),
+        type(GL_UNSIGNED_BYTE),
+        convert(false),
+        valueScale(1.0f),
+        valueOffset(0.0f),
+        windowMin(0.0f),
+        windowMax(1.0f)
+    {}
+};
+
+// Struct for the edits of a dataset (see editRayCastVolume()). Editing
+// needs a writable CPU copy of the voxels and, if the texture has levels
+// of detail, the levels in the voxel data type; both are set up on the
+// first edit. Edited bricks are marked dirty and uploaded once per frame
+// (see uploadVolumeEdits()), together with the parts of the levels and
+// the gradients that depend on them.
+struct VolumeEdits {
+    bool active;  // the dataset is set up for editing
+    std::vector<cg::VolumeBase> levels;  // coarser levels (mip levels 1, 2, ...)
+    cg::DirtyBricks dirty;
+
+    VolumeEdits() :
+        active(false)
+    {}
+};
+
+// Struct for a volume that is resident for rendering: its texture and,
+// unless it has been dropped to save memory, its CPU copy (in
+// volume.data, paged out to the derived data cache (see
+// datasetVoxels()), or compressed)
+struct VolumeDataset {
+    cg::VolumeBase volume;
+    std::shared_ptr<cg::DerivedArtifact> pagedOut;
+    std::shared_ptr<cg::CompressedVolume> compressed;
+    cg::VolumeSourcePtr source;  // the voxels of a streamed or mapped volume, for reading them back
+    bool streamed;  // the volume is too large for memory (see streamingThreshold)
+    bool edited;  // volume.data has been edited, so it is the only copy of the voxels
+    VolumeUploadSettings settings;  // the settings the texture was made with
+    VolumeTextureFormat format;
+    std::string filename;
+    float valueScale;  // maps texture values to [0, 1]
+    float valueOffset;
+    cg::VolumeStatistics statistics;  // empty (no values) if they could not be computed
+    cg::JointHistogram jointHistogram;  // empty (no bins) if streamed or not computed
+    double statisticsEditTime;  // time of the last edit not in the statistics, or negative
+    GLuint texture;
+    int numLevels;  // levels of detail in the texture (1 = full resolution only)
+    GLuint gradientTexture;  // packed normals and gradient magnitudes (RGBA8), or 0
+    float gradientMaxMagnitude;  // gradient magnitude mapped to 1
+    std::size_t textureBytes;  // GPU memory used by the textures
+    VolumeEdits edits;
+    cg::MinMaxGrid minMax;  // value ranges of the bricks, empty if not computed
+    GLuint brickTexture;  // occupancy and normalized maximum of each brick (RG32F), or 0
+    int brickTextureVersion;  // transfer function version it was made for (-1 = stale)
+
+    VolumeDataset() :
+        streamed(false),
+        edited(false),
+        valueScale(1.0f),
+        valueOffset(0.0f),
+        statisticsEditTime(-1.0),
+        texture(0),
+        numLevels(1),
+        gradientTexture(0),
+        gradientMaxMagnitude(0.0f),
+        textureBytes(0),
+        brickTexture(0),
+        brickTextureVersion(-1)
+    {}
+};
+
+// Struct for the datasets kept resident, most recently used first.
+// Switching to a resident dataset only changes RayCastVolume::dataset.
+// Above the CPU budget, the CPU copies of the least recently used
+// datasets are dropped; above the GPU budget, the least recently used
+// datasets are evicted altogether. The current dataset and edited ones
+// are never touched.
+struct DatasetCache {
+    std::list<VolumeDataset> datasets;
+    std::string selected;  // filename of the dataset to show
+    float cpuBudgetMB;
+    float gpuBudgetMB;
+    float cpuResidentMB;  // statistics shown in the tweak bar
+    float gpuResidentMB;
+    int numResident;
+
+    DatasetCache() :
+        cpuBudgetMB(4096.0f),
+        gpuBudgetMB(2048.0f),
+        cpuResidentMB(0.0f),
+        gpuResidentMB(0.0f),
+        numResident(0)
+    {}
+};
+
 // Struct for representing a volume used for ray-casting.
 struct RayCastVolume {
-    cg::VolumeBase volume;
-    GLuint volumeTexture;
+    VolumeDataset *dataset;  // current volume (owned by the dataset cache)
     GLuint frontFaceFBO;
     GLuint backFaceFBO;
     GLuint frontFaceTexture;
     GLuint backFaceTexture;
 
     RayCastVolume() :
-        volumeTexture(0),
+        dataset(nullptr),
         frontFaceFBO(0),
         backFaceFBO(0),
         frontFaceTexture(0),
@@ -71,6 +321,128 @@ struct RayCastVolume {
     {}
 };
 
+// Struct for a volume that has been read and is ready to be uploaded
+struct PreparedVolume {
+    cg::VolumeBase volume;  // header, and the voxels if they are in memory
+    std::shared_ptr<cg::DerivedArtifact> pagedOut;  // the voxels, if paged out
+    std::shared_ptr<cg::CompressedVolume> compressed;  // the voxels, if compressed
+    cg::VolumeSourcePtr source;  // the voxels, if streamed or mapped
+    bool streamed;
+    VolumeUploadSettings settings;
+    VolumeTextureFormat format;
+    std::function<bool(int, int, std::uint8_t *)> readSlab;  // (firstSlice, numSlices, dst)
+    std::vector<cg::VolumeBase> levels;  // coarser levels as texels, if any (mip levels 1, 2, ...)
+    cg::VolumeStatistics statistics;
+    cg::JointHistogram jointHistogram;  // unless streamed or a timestep of a sequence
+    std::vector<std::uint8_t> gradientTexels;  // RGBA8, if precomputed
+    float gradientMaxMagnitude;
+    cg::MinMaxGrid minMax;  // unless the volume is a timestep of a sequence
+    std::future<bool> cgvolWrite;  // writes the .cgvol cache file of a VTK file, if started
+
+    PreparedVolume() :
+        streamed(false),
+        gradientMaxMagnitude(0.0f)
+    {}
+};
+
+// Struct for one pixel buffer object of the upload ring
+struct UploadSlot {
+    GLuint pbo;
+    int firstSlice;
+    int numSlices;  // 0 if the buffer is free
+    std::future<bool> pending;  // worker thread filling the mapped buffer
+
+    UploadSlot() :
+        pbo(0),
+        firstSlice(0),
+        numSlices(0)
+    {}
+};
+
+// Struct for a volume that is loaded in the background, so that the
+// current volume keeps rendering. The volume is read on a worker thread;
+// then worker threads fill a ring of mapped pixel buffer objects slab by
+// slab, and the render loop uploads the filled buffers into a new
+// texture over several frames. The new texture replaces the current one
+// once it is complete.
+struct VolumeLoad {
+    bool active;
+    bool failed;
+    std::string filename;
+    std::future<std::shared_ptr<PreparedVolume> > preparing;
+    std::shared_ptr<PreparedVolume> prepared;
+    GLuint texture;
+    UploadSlot slots[uploadRingSize];
+    int slabSlices;
+    int nextSlice;  // first slice not yet handed to a buffer
+    int uploadedSlices;
+    std::string queuedFilename;  // loaded next (if not empty)
+    std::vector<std::future<bool> > cgvolWrites;  // cache files still being written
+    float progress;  // upload progress in percent
+    char status[128];  // shown in the tweak bar
+
+    VolumeLoad() :
+        active(false),
+        failed(false),
+        texture(0),
+        slabSlices(0),
+        nextSlice(0),
+        uploadedSlices(0),
+        progress(0.0f)
+    {
+        status[0] = '\0';
+    }
+};
+
+// Struct for playing back a time-varying (4D) volume, i.e., an ordered
+// list of volume files with one timestep each. Upcoming timesteps are
+// decoded on worker threads into a prefetch ring (see
+// cg::VolumeSequence), and the render loop streams them into a small
+// pool of textures ahead of their turn. The shown timestep follows the
+// target frame rate; a timestep that is not on the GPU when its turn
+// has passed is dropped, and the last one stays on screen.
+struct SequencePlayback {
+    bool active;
+    std::string pattern;  // dataset name of the sequence
+    std::vector<std::string> filenames;  // one per timestep
+    std::future<std::shared_ptr<PreparedVolume> > preparing;  // first timestep
+    std::unique_ptr<cg::VolumeSequence> sequence;
+    VolumeTextureFormat format;  // chosen for the first timestep, used for all
+    GLuint textures[sequenceTexturePoolSize];
+    int textureFrames[sequenceTexturePoolSize];  // timestep in each texture, -1 if none
+    std::vector<bool> brokenFrames;  // timesteps that could not be decoded
+    VolumeDataset dataset;  // shown timestep (header only; texture from the pool)
+    bool playing;
+    float frameRate;  // target rate in timesteps per second
+    double position;  // playback position in timesteps since the start
+    double lastUpdate;  // time of the last update in seconds
+    std::int64_t step;  // whole timesteps played (position rounded down)
+    std::int64_t shownStep;  // last step whose timestep was shown
+    int frame;  // shown timestep
+    int droppedFrames;
+    int prefetchDepth;  // timesteps decoded ahead on the CPU
+    int residentFrames;  // upcoming timesteps on the GPU
+
+    SequencePlayback() :
+        active(false),
+        playing(true),
+        frameRate(10.0f),
+        position(0.0),
+        lastUpdate(0.0),
+        step(0),
+        shownStep(0),
+        frame(0),
+        droppedFrames(0),
+        prefetchDepth(0),
+        residentFrames(0)
+    {
+        for (int i = 0; i < sequenceTexturePoolSize; i++) {
+            textures[i] = 0;
+            textureFrames[i] = -1;
+        }
+    }
+};
+
 #define BSPLINE_MAX_NUM_COLORS 16
 #define BSPLINE_MAX_DEGREE 1
 
@@ -90,12 +462,17 @@ struct TransferFunction {
 	GLuint texture;
 	GLuint fbo;
 	GLuint ubo;
+	BSpline bakedSpline;  // spline the texture was last read back for
+	std::vector<std::uint8_t> visible;  // per texel: nonzero color or opacity
+	int version;  // incremented whenever visible changes
 
 	TransferFunction() : 
 		texture(0),
 		fbo(0),
 		ubo(0),
-		bSpline()
+		bSpline(),
+		bakedSpline(),
+		version(0)
 	{}
 };
 
@@ -118,6 +495,49 @@ struct RayCastSettings {
 	GLfloat density;
 	GLint use_gamma_correction;
 	GLint use_color_inversion;
+	GLint use_lod;
+	GLfloat lod_bias;
+	GLfloat iso_value;
+	GLint use_empty_space_skipping;
+};
+
+// Struct for the statistics of the current dataset shown in the tweak
+// bar, updated when another texture is shown or the dataset has been
+// edited (see updateStatisticsView())
+struct StatisticsView {
+    GLuint texture;  // texture of the dataset the values were taken from
+    float minValue;
+    float maxValue;
+    float mean;
+    float standardDeviation;
+    float lowPercentile;  // 1st percentile
+    float median;
+    float highPercentile;  // 99th percentile
+
+    StatisticsView() :
+        texture(0),
+        minValue(0.0f),
+        maxValue(0.0f),
+        mean(0.0f),
+        standardDeviation(0.0f),
+        lowPercentile(0.0f),
+        median(0.0f),
+        highPercentile(0.0f)
+    {}
+};
+
+// Struct for the brush that edits the current volume: shift + drag
+// applies it where the rays under the cursor reach the iso value
+struct BrushSettings {
+    float radius;  // in voxels of the finest spacing
+    float value;  // voxels are set to this fraction of the value window (0 erases)
+    bool stroking;  // shift + drag in progress
+
+    BrushSettings() :
+        radius(8.0f),
+        value(0.0f),
+        stroking(false)
+    {}
 };
 
 // Struct for resources and state
@@ -135,6 +555,9 @@ struct Context {
     MeshVAO quadVAO;
     GLuint defaultVAO;
     RayCastVolume rayCastVolume;
+    DatasetCache datasetCache;
+    std::vector<std::string> datasetFilenames;  // datasets offered in the tweak bar
+    int datasetIndex;
 	
     GLuint boundingGeometryProgram;
 	GLuint transferFunctionProgram;
@@ -142,7 +565,12 @@ struct Context {
 
 	glm::vec4 backgroundColor;
 	RayCastSettings rayCasterSettings;
+	VolumeUploadSettings volumeUploadSettings;
+	VolumeLoad volumeLoad;
+	SequencePlayback sequencePlayback;
 	TransferFunction transferFunction;
+	StatisticsView statisticsView;
+	BrushSettings brush;
     float elapsed_time;
 };
 
@@ -211,25 +639,708 @@ void loadMesh(const std::string &filename, Mesh *mesh)
     mesh->indices = obj_mesh.indices;
 }
 
-void loadRayCastVolume(Context &ctx, const std::string &filename, RayCastVolume *rayCastVolume)
+// Chooses how a volume of the given data type and value range is stored
+// in its 3D texture. [windowMin, windowMax] is the value window used for
+// 8-bit quantization.
+VolumeTextureFormat chooseVolumeTextureFormat(const std::string &datatype, float minValue,
+                                              float maxValue, VolumePrecision precision,
+                                              float windowMin, float windowMax)
 {
-    cg::VolumeBase volume;
-    cg::volumeLoadVTK(&volume, filename);
-    rayCastVolume->volume = volume;
+    VolumeTextureFormat format;
+    format.conversion.srcDatatype = datatype;
+    format.conversion.dstDatatype = datatype;
+    float range = maxValue > minValue ? maxValue - minValue : 1.0f;
+    format.windowMin = minValue;
+    format.windowMax = minValue + range;
+    if (datatype == "uint8") {
+        format.internalFormat = GL_R8;
+        format.type = GL_UNSIGNED_BYTE;
+        format.windowMin = 0.0f;
+        format.windowMax = 255.0f;
+    }
+    else if (precision == PRECISION_8BIT) {
+        format.internalFormat = GL_R8;
+        format.type = GL_UNSIGNED_BYTE;
+        format.conversion.dstDatatype = "uint8";
+        cg::voxelConversionNormalize(&format.conversion, windowMin, windowMax);
+        format.windowMin = windowMin;
+        format.windowMax = windowMax;
+    }
+    else if (datatype == "uint16") {
+        format.internalFormat = GL_R16;
+        format.type = GL_UNSIGNED_SHORT;
+        format.valueScale = 65535.0f / range;
+        format.valueOffset = -minValue / range;
+    }
+    else if (datatype == "int16") {
+        format.internalFormat = GL_R16_SNORM;
+        format.type = GL_SHORT;
+        format.valueScale = 32767.0f / range;
+        format.valueOffset = -minValue / range;
+    }
+    else if (precision == PRECISION_HALF) {
+        format.internalFormat = GL_R16F;
+        format.type = GL_HALF_FLOAT;
+        format.conversion.dstDatatype = "float16";
+        cg::voxelConversionNormalize(&format.conversion, minValue, maxValue);
+    }
+    else {
+        format.internalFormat = GL_R32F;
+        format.type = GL_FLOAT;
+        format.conversion.dstDatatype = "float32";
+        format.valueScale = 1.0f / range;
+        format.valueOffset = -minValue / range;
+    }
+    format.convert = format.conversion.dstDatatype != datatype;
+    return format;
+}
 
-    glDeleteTextures(1, &rayCastVolume->volumeTexture);
-    glGenTextures(1, &rayCastVolume->volumeTexture);
-    glBindTexture(GL_TEXTURE_3D, rayCastVolume->volumeTexture);
-    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexImage3D(GL_TEXTURE_3D, 0, GL_R8, volume.dimensions.x,
-                 volume.dimensions.y, volume.dimensions.z,
-                 0, GL_RED, GL_UNSIGNED_BYTE, &volume.data[0]);
-    glBindTexture(GL_TEXTURE_3D, 0);
+// Returns the size in bytes of one texel of the volume texture
+std::size_t volumeTextureTexelSize(const VolumeTextureFormat &format)
+{
+    return cg::voxelSizeInBytes(format.conversion.dstDatatype);
+}
+
+// Copies the slices [firstSlice, firstSlice + numSlices) of the full
+// resolution level of a bricked volume into dst as texels, row by row
+// straight from the file mapping
+bool readBrickedSlab(const cg::BrickedVolume &bricked, const VolumeTextureFormat &format,
+                     int firstSlice, int numSlices, std::uint8_t *dst)
+{
+    const cg::BrickGrid &grid = bricked.levels[0].grid;
+    const glm::ivec3 &dims = grid.dimensions;
+    int bs = bricked.brickSize;
+    std::size_t elementSize = cg::datatypeSizeInBytes(bricked.datatype);
+    std::size_t texelSize = volumeTextureTexelSize(format);
+    for (int z = firstSlice; z < firstSlice + numSlices; z++) {
+        for (int by = 0; by < grid.numBricks.y; by++) {
+            for (int bx = 0; bx < grid.numBricks.x; bx++) {
+                glm::ivec3 brick(bx, by, z / bs);
+                glm::ivec3 origin = cg::brickGridBrickOrigin(grid, brick);
+                glm::ivec3 extent = cg::brickGridBrickExtent(grid, brick);
+                const std::uint8_t *voxels = cg::brickedVolumeBrick(bricked, 0, brick);
+                for (int y = 0; y < extent.y; y++) {
+                    const std::uint8_t *src = voxels + (std::size_t(z % bs) * bs + y) * bs * elementSize;
+                    std::uint8_t *row = dst + ((std::size_t(z - firstSlice) * dims.y + origin.y + y) *
+                                               dims.x + origin.x) * texelSize;
+                    if (!cg::convertVoxels(format.conversion, row, src, extent.x)) {
+                        return false;
+                    }
+                }
+            }
+        }
+    }
+    return true;
+}
+
+// Returns the number of slices per slab for uploading a volume
+int volumeSlabSlices(const glm::ivec3 &dimensions, std::size_t texelSize)
+{
+    std::size_t sliceBytes = std::size_t(dimensions.x) * std::size_t(dimensions.y) * texelSize;
+    return int(std::max<std::size_t>(1, std::min<std::size_t>(uploadSlabSize / sliceBytes,
+                                                               dimensions.z)));
+}
+
+// Returns the filename without its directory
+std::string baseName(const std::string &filename)
+{
+    return filename.substr(filename.find_last_of("/\\") + 1);
+}
+
+// Returns true if the filename ends with the given extension
+bool hasExtension(const std::string &filename, const std::string &extension)
+{
+    return filename.size() >= extension.size() &&
+           filename.compare(filename.size() - extension.size(), extension.size(), extension) == 0;
+}
+
+// Returns true if the filename has the extension of a volume file
+// format (as opposed to a slice of a slice stack)
+bool isVolumeFile(const std::string &filename)
+{
+    return hasExtension(filename, ".vtk") || hasExtension(filename, ".nrrd") ||
+           hasExtension(filename, ".nhdr") || hasExtension(filename, ".mha") ||
+           hasExtension(filename, ".mhd");
+}
+
+// Returns true if a texture of the given dimensions and texel size is
+// within the limits
+bool textureFits(const TextureLimits &limits, const glm::ivec3 &dims, std::size_t texelSize)
+{
+    std::uint64_t numVoxels = std::uint64_t(dims.x) * std::uint64_t(dims.y) *
+                              std::uint64_t(dims.z);
+    return glm::all(glm::lessThanEqual(dims, glm::ivec3(limits.maxSize))) &&
+           numVoxels <= limits.maxBytes / texelSize;
+}
+
+// Returns the dimensions a volume is resampled to before upload (its own
+// dimensions if it is not resampled). Volumes whose texture would not be
+// within the limits are resampled to fit, whatever the settings.
+glm::ivec3 uploadDimensions(const VolumeUploadSettings &settings, const cg::VolumeBase &volume,
+                            const TextureLimits &limits)
+{
+    VolumeTextureFormat format = chooseVolumeTextureFormat(volume.datatype, 0.0f, 1.0f,
+                                                           settings.precision, 0.0f, 1.0f);
+    std::size_t texelSize = volumeTextureTexelSize(format);
+    float finest = std::numeric_limits<float>::max();
+    for (int axis = 0; axis < 3; axis++) {
+        if (volume.spacing[axis] > 0.0f) {
+            finest = std::min(finest, volume.spacing[axis]);
+        }
+    }
+    glm::ivec3 dims = volume.dimensions;
+    if (settings.resampling == RESAMPLING_ISOTROPIC && finest < std::numeric_limits<float>::max()) {
+        dims = cg::resampleDimensionsForSpacing(volume, glm::vec3(finest));
+    }
+    else if (settings.resampling == RESAMPLING_BUDGET) {
+        std::uint64_t budget = std::uint64_t(double(settings.resampleBudgetMB) * (1 << 20));
+        dims = cg::resampleDimensionsForBudget(volume, budget / texelSize);
+    }
+
+    // The voxel budget shrinks until the longest axis fits too
+    std::uint64_t maxVoxels = limits.maxBytes / texelSize;
+    while (!textureFits(limits, dims, texelSize)) {
+        std::uint64_t numVoxels = std::uint64_t(dims.x) * std::uint64_t(dims.y) *
+                                  std::uint64_t(dims.z);
+        if (numVoxels <= 1) {
+            break;
+        }
+        double scale = double(limits.maxSize) / double(std::max(dims.x, std::max(dims.y, dims.z)));
+        if (scale < 1.0) {
+            maxVoxels = std::min(maxVoxels, std::uint64_t(double(numVoxels) * scale * scale * scale));
+        }
+        else {
+            maxVoxels = std::min(maxVoxels, numVoxels - 1);
+        }
+        dims = cg::resampleDimensionsForBudget(volume, std::max<std::uint64_t>(maxVoxels, 1));
+    }
+    return dims;
+}
+
+// Reads a volume into memory with the reader for its file format.
+// Paths that are not volume files are read as a stack of PNG slices (a
+// directory, or a printf or wildcard pattern).
+bool loadVolumeFile(cg::VolumeBase *volume, const std::string &filename)
+{
+    if (hasExtension(filename, ".vtk")) {
+        return cg::volumeLoadVTK(volume, filename);
+    }
+    else if (hasExtension(filename, ".nrrd") || hasExtension(filename, ".nhdr")) {
+        return cg::volumeLoadNRRD(volume, filename);
+    }
+    else if (hasExtension(filename, ".mha") || hasExtension(filename, ".mhd")) {
+        return cg::volumeLoadMetaImage(volume, filename);
+    }
+    return cg::volumeLoadSliceStack(volume, filename);
+}
+
+// Returns the statistics (with a histogram of numBins bins) of the data
+// with the given content key from the derived data cache, computing them
+// with compute and caching them if needed
+bool cachedStatistics(std::uint64_t key, std::size_t numBins,
+                      const std::function<bool(cg::VolumeStatistics *)> &compute,
+                      cg::VolumeStatistics *stats)
+{
+    std::ostringstream parameters;
+    parameters << "bins=" << numBins;
+    cg::DerivedArtifact artifact;
+    bool ok = cg::derivedCacheGet(&artifact, cg::derivedCacheDirectory(), key, "statistics",
+                                  parameters.str(), [&](std::vector<std::uint8_t> *data) {
+        cg::VolumeStatistics computed;
+        if (!compute(&computed)) {
+            return false;
+        }
+        cg::volumeStatisticsSerialize(computed, data);
+        return true;
+    });
+    return ok && cg::volumeStatisticsDeserialize(stats, artifact.data, artifact.size) &&
+           stats->histogram.size() == numBins;
+}
+
+// Returns the joint histogram of values and gradient magnitudes of the
+// data with the given content key from the derived data cache, computing
+// it with compute and caching it if needed
+bool cachedJointHistogram(std::uint64_t key, int numValueBins, int numGradientBins,
+                          const std::function<bool(cg::JointHistogram *)> &compute,
+                          cg::JointHistogram *histogram)
+{
+    std::ostringstream parameters;
+    parameters << "bins=" << numValueBins << "x" << numGradientBins;
+    cg::DerivedArtifact artifact;
+    bool ok = cg::derivedCacheGet(&artifact, cg::derivedCacheDirectory(), key, "joint-histogram",
+                                  parameters.str(), [&](std::vector<std::uint8_t> *data) {
+        cg::JointHistogram computed;
+        if (!compute(&computed)) {
+            return false;
+        }
+        cg::volumeJointHistogramSerialize(computed, data);
+        return true;
+    });
+    return ok && cg::volumeJointHistogramDeserialize(histogram, artifact.data, artifact.size) &&
+           histogram->numValueBins == numValueBins && histogram->numGradientBins == numGradientBins;
+}
 
+// Returns the min/max grid of a volume with the given content key from
+// the derived data cache, computing and caching it if needed. header
+// describes the volume; the grid is stored as the minima followed by the
+// maxima of its bricks.
+bool cachedMinMaxGrid(std::uint64_t key, const cg::VolumeBase &header, int brickSize, int margin,
+                      const std::function<bool(cg::MinMaxGrid *)> &compute,
+                      cg::MinMaxGrid *grid)
+{
+    std::ostringstream parameters;
+    parameters << "brick=" << brickSize << ";margin=" << margin;
+    cg::DerivedArtifact artifact;
+    bool ok = cg::derivedCacheGet(&artifact, cg::derivedCacheDirectory(), key, "min-max-grid",
+                                  parameters.str(), [&](std::vector<std::uint8_t> *data) {
+        cg::MinMaxGrid computed;
+        if (!compute(&computed)) {
+            return false;
+        }
+        std::size_t bytes = computed.minValues.size() * sizeof(float);
+        data->resize(2 * bytes);
+        std::memcpy(&(*data)[0], &computed.minValues[0], bytes);
+        std::memcpy(&(*data)[bytes], &computed.maxValues[0], bytes);
+        return true;
+    });
+    cg::MinMaxGrid result;
+    result.grid = cg::brickGridCreate(header.dimensions, brickSize);
+    result.margin = margin;
+    std::size_t numBricks = cg::brickGridNumBricks(result.grid);
+    if (!ok || artifact.size != 2 * numBricks * sizeof(float)) {
+        return false;
+    }
+    result.minValues.resize(numBricks);
+    result.maxValues.resize(numBricks);
+    std::memcpy(&result.minValues[0], artifact.data, numBricks * sizeof(float));
+    std::memcpy(&result.maxValues[0], artifact.data + numBricks * sizeof(float),
+                numBricks * sizeof(float));
+    *grid = std::move(result);
+    return true;
+}
+
+// Moves the voxels of a volume to the derived data cache (reusing them
+// if they are cached already) and frees them. Returns the mapped voxels,
+// or an empty pointer (keeping the voxels) if they cannot be stored.
+std::shared_ptr<cg::DerivedArtifact> pageOutVoxels(std::uint64_t contentKey,
+                                                   cg::VolumeBase *volume)
+{
+    std::string directory = cg::derivedCacheDirectory();
+    std::shared_ptr<cg::DerivedArtifact> artifact = std::make_shared<cg::DerivedArtifact>();
+    bool cached = cg::derivedCacheLoad(artifact.get(), directory, contentKey, "voxels", "") &&
+                  artifact->size == volume->data.size();
+    if (!cached && !(cg::derivedCacheStore(directory, contentKey, "voxels", "", &volume->data[0],
+                                           volume->data.size()) &&
+                     cg::derivedCacheLoad(artifact.get(), directory, contentKey, "voxels", ""))) {
+        return std::shared_ptr<cg::DerivedArtifact>();
+    }
+    std::vector<std::uint8_t>().swap(volume->data);
+    return artifact;
+}
+
+// Converts a level of detail to texels the same way as the full
+// resolution level. Returns true on success.
+bool convertTextureLevel(const cg::VolumeBase &level, const cg::VoxelConversion &conversion,
+                         cg::VolumeBase *texels)
+{
+    texels->dimensions = level.dimensions;
+    texels->origin = level.origin;
+    texels->spacing = level.spacing;
+    texels->datatype = conversion.dstDatatype;
+    std::size_t n = cg::volumeNumVoxels(level);
+    std::size_t sliceVoxels = std::size_t(level.dimensions.x) * std::size_t(level.dimensions.y);
+    texels->data.resize(n * cg::voxelSizeInBytes(conversion.dstDatatype));
+    return cg::convertVoxelsParallel(conversion, &texels->data[0], &level.data[0], n, sliceVoxels);
+}
+
+// Builds the coarser levels of detail of a volume and converts them to
+// texels the same way as the full resolution level, for the mip levels
+// of its texture. Returns false (and no levels) on failure.
+bool buildTextureLevels(const cg::VolumeBase &volume, const cg::VoxelConversion &conversion,
+                        cg::PyramidReduction reduction, std::vector<cg::VolumeBase> *levels)
+{
+    levels->clear();
+    std::vector<cg::VolumeBase> reduced;
+    if (!cg::volumeBuildPyramid(volume, &reduced, reduction)) {
+        return false;
+    }
+    for (auto it = reduced.begin(); it != reduced.end(); ++it) {
+        cg::VolumeBase texels;
+        if (!convertTextureLevel(*it, conversion, &texels)) {
+            levels->clear();
+            return false;
+        }
+        levels->push_back(std::move(texels));
+    }
+    return true;
+}
+
+// Returns the voxels of a dataset on the CPU, mapped from the derived
+// data cache if they have been paged out, or null if there is no linear
+// CPU copy (it has been dropped, or the volume is streamed or bricked)
+const std::uint8_t *datasetVoxels(const VolumeDataset &dataset)
+{
+    if (!dataset.volume.data.empty()) {
+        return &dataset.volume.data[0];
+    }
+    return dataset.pagedOut ? dataset.pagedOut->data : nullptr;
+}
+
+// Reads a volume and works out how to store it in its texture. Runs on
+// a worker thread, so it only touches its arguments. With inMemory set,
+// the volume is always read into memory, i.e., neither streamed nor
+// converted to a cache file. Volumes too large for a texture within the
+// limits are resampled to fit. Returns an empty pointer if the volume
+// cannot be read.
+std::shared_ptr<PreparedVolume> prepareVolume(const std::string &filename,
+                                              const VolumeUploadSettings &settings,
+                                              const TextureLimits &limits,
+                                              bool inMemory = false)
+{
+    std::string cgvolFilename = filename;
+    bool isVTK = hasExtension(filename, ".vtk") && !inMemory;
+
+    // Binary VTK files too large to read into memory are streamed to the
+    // texture instead
+    std::shared_ptr<cg::VTKBrickSource> source = std::make_shared<cg::VTKBrickSource>();
+    cg::VTKFileInfo info;
+    bool streamed = isVTK && cg::volumeReadVTKInfo(&info, filename) && info.binary &&
+                    std::uint64_t(info.dimensions.x) * std::uint64_t(info.dimensions.y) *
+                    std::uint64_t(info.dimensions.z) * cg::datatypeSizeInBytes(info.datatype) >
+                    streamingThreshold &&
+                    cg::brickSourceOpenVTK(source.get(), filename);
+
+    // Other VTK files are converted to a native bricked cache file in
+    // the derived data cache on first use, so that later starts only
+    // need to map it. The first start reads the VTK file into memory and
+    // writes the cache file from it in the background.
+    bool writeCGVol = false;
+    if (isVTK && !streamed) {
+        cgvolFilename = cg::derivedCacheConvertedPath(cg::derivedCacheDirectory(), filename,
+                                                      ".cgvol");
+        if (cgvolFilename.empty()) {
+            cgvolFilename = filename;
+        }
+        else {
+            writeCGVol = !cg::volumeCGVolIsUpToDate(cgvolFilename, filename);
+        }
+    }
+    std::shared_ptr<cg::BrickedVolume> bricked = std::make_shared<cg::BrickedVolume>();
+    bool mapped = !streamed && hasExtension(cgvolFilename, ".cgvol") &&
+                  cg::volumeCGVolIsUpToDate(cgvolFilename, filename) &&
+                  cg::volumeMapCGVol(bricked.get(), cgvolFilename);
+
+    // Voxels are kept in their own data type; the value range is needed
+    // to map texture values to the transfer function. Mapped files know
+    // their range and histogram; the statistics of all volumes are taken
+    // from the derived data cache, keyed by content (or by the file, for
+    // streamed and mapped files).
+    std::shared_ptr<PreparedVolume> prepared = std::make_shared<PreparedVolume>();
+    prepared->settings = settings;
+    cg::VolumeBase &volume = prepared->volume;
+    std::uint64_t contentKey = 0;
+    if (streamed) {
+        volume.dimensions = info.dimensions;
+        volume.origin = info.origin;
+        volume.spacing = info.spacing;
+        volume.datatype = info.datatype;
+        contentKey = cg::derivedCacheFileKey(filename);
+    }
+    else if (mapped) {
+        volume.dimensions = bricked->dimensions;
+        volume.origin = bricked->origin;
+        volume.spacing = bricked->spacing;
+        volume.datatype = bricked->datatype;
+        contentKey = cg::derivedCacheFileKey(cgvolFilename);
+    }
+    else {
+        if (!loadVolumeFile(&volume, filename) || volume.data.empty()) {
+            return std::shared_ptr<PreparedVolume>();
+        }
+        contentKey = cg::derivedCacheSourceHash(cg::derivedCacheDirectory(), filename, volume);
+        if (writeCGVol) {
+            std::shared_ptr<cg::VolumeBase> copy = std::make_shared<cg::VolumeBase>();
+            cg::volumeCopy(volume, copy.get());
+            prepared->cgvolWrite = std::async(std::launch::async, [copy, cgvolFilename]() {
+                return cg::volumeSaveCGVol(*copy, cgvolFilename);
+            });
+        }
+    }
+
+    // Resampling reads the volume slab by slab from wherever it is. The
+    // result is kept in memory and handled like a volume read into
+    // memory, keyed by the source and the resampling. Timesteps of a
+    // sequence are not resampled.
+    glm::ivec3 resampled = uploadDimensions(settings, volume, limits);
+    if (resampled != uploadDimensions(settings, volume, TextureLimits()) && !inMemory) {
+        std::cerr << "Warning: " << filename << " is too large for a texture, resampling it to "
+                  << resampled.x << "x" << resampled.y << "x" << resampled.z << std::endl;
+    }
+    if (resampled != volume.dimensions && !inMemory) {
+        bool ok;
+        if (streamed || mapped) {
+            cg::VolumeSourcePtr input = streamed ? cg::volumeSourceFromBrickSource(source)
+                                                 : cg::volumeSourceFromBricked(bricked);
+            glm::ivec3 sliceSize(volume.dimensions.x, volume.dimensions.y, 0);
+            ok = cg::volumeResampleSlices(volume, [&](int firstSlice, int numSlices, float *dst) {
+                return cg::volumeSourceReadRegionFloat(input.get(), glm::ivec3(0, 0, firstSlice),
+                                                       sliceSize + glm::ivec3(0, 0, numSlices), dst);
+            }, &volume, resampled, settings.resampleFilter);
+        }
+        else {
+            ok = cg::volumeResample(volume, &volume, resampled, settings.resampleFilter);
+        }
+        if (!ok) {
+            return std::shared_ptr<PreparedVolume>();
+        }
+        std::ostringstream parameters;
+        parameters << "resampled=" << resampled.x << "x" << resampled.y << "x" << resampled.z
+                   << ";filter=" << settings.resampleFilter;
+        contentKey = cg::hashBytes(parameters.str().data(), parameters.str().size(), contentKey);
+        streamed = false;
+        mapped = false;
+    }
+
+    // Streamed and mapped volumes are read slab by slab for their
+    // statistics and joint histogram
+    cg::VolumeSourcePtr sourceVoxels;
+    if (streamed || mapped) {
+        sourceVoxels = streamed ? cg::volumeSourceFromBrickSource(source)
+                                : cg::volumeSourceFromBricked(bricked);
+    }
+    cg::SliceReader readSourceSlices = [&](int firstSlice, int numSlices, float *dst) {
+        return cg::volumeSourceReadRegionFloat(sourceVoxels.get(), glm::ivec3(0, 0, firstSlice),
+                                               glm::ivec3(volume.dimensions.x, volume.dimensions.y,
+                                                          numSlices), dst);
+    };
+    bool hasStatistics = cachedStatistics(contentKey, 4096, [&](cg::VolumeStatistics *stats) {
+        if (sourceVoxels) {
+            return cg::volumeComputeStatisticsSlices(volume, readSourceSlices, stats, 4096);
+        }
+        return cg::volumeComputeStatistics(volume, stats, 4096);
+    }, &prepared->statistics);
+    if (!hasStatistics) {
+        prepared->statistics = cg::VolumeStatistics();
+    }
+    float minValue = 0.0f, maxValue = 0.0f;
+    if (mapped) {
+        minValue = bricked->minValue;
+        maxValue = bricked->maxValue;
+    }
+    else if (hasStatistics) {
+        minValue = prepared->statistics.minValue;
+        maxValue = prepared->statistics.maxValue;
+    }
+    if (!streamed && !inMemory) {
+        bool ok = cachedJointHistogram(contentKey, 256, 256, [&](cg::JointHistogram *histogram) {
+            if (sourceVoxels) {
+                return cg::volumeComputeJointHistogramSlices(volume, readSourceSlices, histogram,
+                                                             256, 256);
+            }
+            return cg::volumeComputeJointHistogram(volume, histogram, 256, 256);
+        }, &prepared->jointHistogram);
+        if (!ok) {
+            prepared->jointHistogram = cg::JointHistogram();
+        }
+    }
+
+    // The window for 8-bit quantization is either given explicitly or
+    // taken from percentiles of the histogram
+    float windowMin = minValue, windowMax = maxValue;
+    if (settings.precision == PRECISION_8BIT && volume.datatype != "uint8") {
+        if (settings.windowWidth > 0.0f) {
+            windowMin = settings.windowLevel - 0.5f * settings.windowWidth;
+            windowMax = settings.windowLevel + 0.5f * settings.windowWidth;
+        }
+        else {
+            std::vector<std::uint64_t> histogram;
+            if (mapped) {
+                histogram.assign(bricked->histogram, bricked->histogram + bricked->numHistogramBins);
+            }
+            else {
+                histogram = prepared->statistics.histogram;
+                histogram.resize(4096, 0);
+            }
+            windowMin = cg::histogramPercentile(&histogram[0], histogram.size(), minValue, maxValue,
+                                                0.01f * settings.lowPercentile);
+            windowMax = cg::histogramPercentile(&histogram[0], histogram.size(), minValue, maxValue,
+                                                0.01f * settings.highPercentile);
+        }
+    }
+    VolumeTextureFormat format = chooseVolumeTextureFormat(volume.datatype, minValue, maxValue,
+                                                           settings.precision, windowMin, windowMax);
+    prepared->format = format;
+
+    // The coarser levels of detail and the gradients are computed from
+    // the whole volume as it is uploaded, i.e., after smoothing. Mapped
+    // and smoothed volumes are read slab by slab for this (the first
+    // level is reduced from the slabs, the others from it); streamed
+    // volumes and sequence frames get neither.
+    bool buildLevels = settings.lodPyramid != LOD_PYRAMID_OFF;
+    bool buildGradients = settings.gradients != GRADIENTS_OFF;
+    if ((buildLevels || buildGradients) && !streamed && !inMemory) {
+        cg::PyramidReduction reduction = settings.lodPyramid == LOD_PYRAMID_MAX ?
+                                         cg::PYRAMID_MAX : cg::PYRAMID_AVERAGE;
+        cg::GradientOperator op = settings.gradients == GRADIENTS_SOBEL ?
+                                  cg::GRADIENT_SOBEL : cg::GRADIENT_CENTRAL_DIFFERENCES;
+        bool levelsOk = true, gradientsOk = true;
+        if (mapped || settings.smoothing > 0.0f) {
+            cg::VolumeSourcePtr input = mapped ? cg::volumeSourceFromBricked(bricked)
+                                      : cg::volumeSourceFromVoxels(volume.dimensions, volume.origin,
+                                                                   volume.spacing, volume.datatype,
+                                                                   &volume.data[0]);
+            if (settings.smoothing > 0.0f) {
+                input = cg::volumeSourceSmooth(input, settings.smoothing);
+            }
+            glm::ivec3 sliceSize(volume.dimensions.x, volume.dimensions.y, 0);
+            cg::SliceReader readSlices = [&](int firstSlice, int numSlices, float *dst) {
+                return cg::volumeSourceReadRegionFloat(input.get(), glm::ivec3(0, 0, firstSlice),
+                                                       sliceSize + glm::ivec3(0, 0, numSlices), dst);
+            };
+            glm::ivec3 dims = cg::pyramidReducedDimensions(volume.dimensions, volume.spacing, false);
+            if (buildLevels && dims != volume.dimensions) {
+                cg::VoxelConversion conversion = format.conversion;
+                conversion.srcDatatype = "float32";
+                cg::VolumeBase first, texels;
+                levelsOk = cg::volumeReduceSlices(volume, readSlices, &first, dims, reduction) &&
+                           convertTextureLevel(first, conversion, &texels) &&
+                           buildTextureLevels(first, conversion, reduction, &prepared->levels);
+                if (levelsOk) {
+                    prepared->levels.insert(prepared->levels.begin(), std::move(texels));
+                }
+            }
+            if (buildGradients) {
+                gradientsOk = cg::volumeComputeGradientTexelsSlices(volume, readSlices, op,
+                                                                    &prepared->gradientTexels,
+                                                                    &prepared->gradientMaxMagnitude);
+            }
+        }
+        else {
+            levelsOk = !buildLevels || buildTextureLevels(volume, format.conversion, reduction,
+                                                          &prepared->levels);
+            gradientsOk = !buildGradients ||
+                          cg::volumeComputeGradientTexels(volume, op, &prepared->gradientTexels,
+                                                          &prepared->gradientMaxMagnitude);
+        }
+        if (!levelsOk) {
+            prepared->levels.clear();
+            std::cerr << "Warning: No levels of detail for " << filename << std::endl;
+        }
+        if (!gradientsOk) {
+            prepared->gradientTexels.clear();
+            std::cerr << "Warning: No gradients for " << filename << std::endl;
+        }
+    }
+
+    // The min/max grid for empty space skipping is computed from the
+    // voxels before smoothing, with a margin that covers the reach of
+    // the smoothing kernel and of trilinear interpolation
+    if (!inMemory) {
+        int margin = 1;
+        if (settings.smoothing > 0.0f) {
+            margin += int(cg::convolutionKernelGaussian(settings.smoothing).size() / 2);
+        }
+        bool ok = cachedMinMaxGrid(contentKey, volume, minMaxBrickSize, margin,
+                                   [&](cg::MinMaxGrid *grid) {
+            if (!streamed && !mapped) {
+                return cg::volumeComputeMinMaxGrid(volume, minMaxBrickSize, margin, grid);
+            }
+            cg::VolumeSourcePtr input = streamed ? cg::volumeSourceFromBrickSource(source)
+                                                 : cg::volumeSourceFromBricked(bricked);
+            glm::ivec3 sliceSize(volume.dimensions.x, volume.dimensions.y, 0);
+            return cg::volumeComputeMinMaxGridSlices(volume, [&](int firstSlice, int numSlices,
+                                                                 float *dst) {
+                return cg::volumeSourceReadRegionFloat(input.get(), glm::ivec3(0, 0, firstSlice),
+                                                       sliceSize + glm::ivec3(0, 0, numSlices), dst);
+            }, minMaxBrickSize, margin, grid);
+        }, &prepared->minMax);
+        if (!ok) {
+            std::cerr << "Warning: No empty space skipping for " << filename << std::endl;
+        }
+    }
+
+    // Slabs are read from wherever the voxels are: the streamed file, the
+    // mapped cache file, or memory
+    std::size_t sliceVoxels = std::size_t(volume.dimensions.x) * std::size_t(volume.dimensions.y);
+    std::size_t elementSize = cg::datatypeSizeInBytes(volume.datatype);
+    const std::uint8_t *voxels = nullptr;
+    if (streamed || mapped) {
+        prepared->source = streamed ? cg::volumeSourceFromBrickSource(source)
+                                    : cg::volumeSourceFromBricked(bricked);
+    }
+    prepared->streamed = streamed;
+    if (streamed) {
+        prepared->readSlab = [=](int firstSlice, int numSlices, std::uint8_t *dst) {
+            if (!format.convert) {
+                return cg::brickSourceReadSlab(source.get(), firstSlice, numSlices, dst);
+            }
+            std::vector<std::uint8_t> raw(numSlices * sliceVoxels * elementSize);
+            return cg::brickSourceReadSlab(source.get(), firstSlice, numSlices, &raw[0]) &&
+                   cg::convertVoxelsParallel(format.conversion, dst, &raw[0],
+                                             numSlices * sliceVoxels, sliceVoxels);
+        };
+    }
+    else if (mapped) {
+        prepared->readSlab = [=](int firstSlice, int numSlices, std::uint8_t *dst) {
+            return readBrickedSlab(*bricked, format, firstSlice, numSlices, dst);
+        };
+    }
+    else {
+        // The voxels stay in the prepared volume until the upload is
+        // done, unless they are paged out; then they are uploaded from
+        // the mapping. Compressed voxels replace them once uploaded.
+        voxels = &volume.data[0];
+        if (settings.cpuCopy == CPU_COPY_PAGE_OUT && !inMemory) {
+            prepared->pagedOut = pageOutVoxels(contentKey, &volume);
+            if (prepared->pagedOut) {
+                voxels = prepared->pagedOut->data;
+            }
+        }
+        else if (settings.cpuCopy == CPU_COPY_COMPRESS && !inMemory) {
+            prepared->compressed = std::make_shared<cg::CompressedVolume>();
+            if (!cg::volumeCompress(volume, prepared->compressed.get())) {
+                std::cerr << "Warning: Could not compress " << filename << std::endl;
+                prepared->compressed.reset();
+            }
+        }
+        prepared->readSlab = [=](int firstSlice, int numSlices, std::uint8_t *dst) {
+            return cg::convertVoxelsParallel(format.conversion, dst,
+                                             voxels + firstSlice * sliceVoxels * elementSize,
+                                             numSlices * sliceVoxels, sliceVoxels);
+        };
+    }
+
+    // Smoothing pulls each slab through a lazy brick pipeline over the
+    // same voxels, so no smoothed copy of the whole volume is made.
+    // Smoothed values stay within the value range, so the texture format
+    // is kept; only the source type of the conversion changes.
+    if (settings.smoothing > 0.0f) {
+        cg::VolumeSourcePtr input = streamed ? cg::volumeSourceFromBrickSource(source)
+                                  : mapped ? cg::volumeSourceFromBricked(bricked)
+                                  : cg::volumeSourceFromVoxels(volume.dimensions, volume.origin,
+                                                               volume.spacing, volume.datatype,
+                                                               voxels);
+        cg::VolumeSourcePtr smoothed = cg::volumeSourceSmooth(input, settings.smoothing);
+        cg::VoxelConversion conversion = format.conversion;
+        conversion.srcDatatype = "float32";
+        glm::ivec3 dims = volume.dimensions;
+        prepared->readSlab = [=](int firstSlice, int numSlices, std::uint8_t *dst) {
+            std::vector<float> filtered(numSlices * sliceVoxels);
+            return cg::volumeSourceReadRegionFloat(smoothed.get(), glm::ivec3(0, 0, firstSlice),
+                                                   glm::ivec3(dims.x, dims.y, numSlices),
+                                                   &filtered[0]) &&
+                   cg::convertVoxelsParallel(conversion, dst,
+                                             reinterpret_cast<const std::uint8_t *>(&filtered[0]),
+                                             numSlices * sliceVoxels, sliceVoxels);
+        };
+    }
+    return prepared;
+}
+
+// Creates the textures and framebuffers the bounding geometry is
+// rendered to (sized to the window)
+void createRayCastFBOs(Context &ctx, RayCastVolume *rayCastVolume)
+{
     glDeleteTextures(1, &rayCastVolume->backFaceTexture);
     glGenTextures(1, &rayCastVolume->backFaceTexture);
     glBindTexture(GL_TEXTURE_2D, rayCastVolume->backFaceTexture);
@@ -273,6 +1384,875 @@ void loadRayCastVolume(Context &ctx, const std::string &filename, RayCastVolume
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
+// Returns the limits on the size of a volume texture: the largest 3D
+// texture the GPU supports and, if set, the largest texture of the
+// upload settings. The GPU budget of the dataset cache is not a limit
+// here, it only decides which datasets stay resident.
+TextureLimits getTextureLimits(Context &ctx)
+{
+    TextureLimits limits;
+    GLint maxSize = 0;
+    glGetIntegerv(GL_MAX_3D_TEXTURE_SIZE, &maxSize);
+    if (maxSize > 0) {
+        limits.maxSize = maxSize;
+    }
+    if (ctx.volumeUploadSettings.maxTextureMB > 0.0f) {
+        limits.maxBytes = std::uint64_t(double(ctx.volumeUploadSettings.maxTextureMB) * (1 << 20));
+    }
+    return limits;
+}
+
+// Sets the status line of a volume load shown in the tweak bar
+void setVolumeLoadStatus(VolumeLoad *load, const std::string &status)
+{
+    std::snprintf(load->status, sizeof(load->status), "%s", status.c_str());
+}
+
+// Drops the prepared volume of a load, but keeps its cache file write
+// (see prepareVolume()) running; writes that are done are forgotten
+void dropPreparedVolume(VolumeLoad *load)
+{
+    if (load->prepared && load->prepared->cgvolWrite.valid()) {
+        load->cgvolWrites.push_back(std::move(load->prepared->cgvolWrite));
+    }
+    load->prepared.reset();
+    for (auto it = load->cgvolWrites.begin(); it != load->cgvolWrites.end();) {
+        if (it->wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+            it = load->cgvolWrites.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+}
+
+// Starts loading a volume in the background (see VolumeLoad). If a
+// volume is already being loaded, the new one is loaded after it.
+void startVolumeLoad(Context &ctx, const std::string &filename)
+{
+    VolumeLoad &load = ctx.volumeLoad;
+    if (load.active) {
+        load.queuedFilename = filename;
+        return;
+    }
+    load.active = true;
+    load.failed = false;
+    load.filename = filename;
+    dropPreparedVolume(&load);
+    load.nextSlice = 0;
+    load.uploadedSlices = 0;
+    load.progress = 0.0f;
+    setVolumeLoadStatus(&load, "Reading " + baseName(filename));
+    load.preparing = std::async(std::launch::async, prepareVolume, filename,
+                                ctx.volumeUploadSettings, getTextureLimits(ctx), false);
+}
+
+// Creates the new texture and sizes the pixel buffer ring for the
+// prepared volume
+bool beginVolumeUpload(Context &ctx, VolumeLoad *load)
+{
+    const glm::ivec3 &dims = load->prepared->volume.dimensions;
+    const VolumeTextureFormat &format = load->prepared->format;
+    std::size_t sliceBytes = std::size_t(dims.x) * std::size_t(dims.y) * volumeTextureTexelSize(format);
+    load->slabSlices = volumeSlabSlices(dims, volumeTextureTexelSize(format));
+    if (!textureFits(getTextureLimits(ctx), dims, volumeTextureTexelSize(format))) {
+        std::cerr << "Error: A texture of " << dims.x << "x" << dims.y << "x" << dims.z
+                  << " voxels is too large for the GPU" << std::endl;
+        return false;
+    }
+
+    while (glGetError() != GL_NO_ERROR) {}  // errors of earlier calls
+    glGenTextures(1, &load->texture);
+    glBindTexture(GL_TEXTURE_3D, load->texture);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexImage3D(GL_TEXTURE_3D, 0, format.internalFormat, dims.x, dims.y, dims.z,
+                 0, GL_RED, format.type, nullptr);
+    glBindTexture(GL_TEXTURE_3D, 0);
+
+    for (int i = 0; i < uploadRingSize; i++) {
+        glGenBuffers(1, &load->slots[i].pbo);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, load->slots[i].pbo);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, load->slabSlices * sliceBytes, nullptr, GL_STREAM_DRAW);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    GLenum error = glGetError();
+    if (error != GL_NO_ERROR) {
+        std::cerr << "Error: Could not allocate a texture of " << dims.x << "x" << dims.y << "x"
+                  << dims.z << " voxels (" << (error == GL_OUT_OF_MEMORY ? "out of memory" :
+                                               "OpenGL error") << ")" << std::endl;
+        return false;
+    }
+    setVolumeLoadStatus(load, "Uploading " + baseName(load->filename));
+    return true;
+}
+
+// Lists the timesteps of a sequence, given as a printf or wildcard
+// pattern that matches volume files (see cg::volumeListSlices()).
+// Returns false for any other path, e.g., a PNG slice stack.
+bool listSequenceFrames(const std::string &pattern, std::vector<std::string> *filenames)
+{
+    if (pattern.find_first_of("%*?") == std::string::npos || !isVolumeFile(pattern)) {
+        return false;
+    }
+    return cg::volumeListSlices(pattern, filenames, true);
+}
+
+// Stops playing back a sequence and frees its textures. The most
+// recently used resident dataset (if any) is shown instead.
+void stopSequencePlayback(Context &ctx)
+{
+    SequencePlayback &playback = ctx.sequencePlayback;
+    if (!playback.active) {
+        return;
+    }
+    if (playback.preparing.valid()) {
+        playback.preparing.wait();
+    }
+    if (playback.sequence) {
+        cg::volumeSequenceClose(playback.sequence.get());
+        playback.sequence.reset();
+    }
+    glDeleteTextures(sequenceTexturePoolSize, playback.textures);
+    for (int i = 0; i < sequenceTexturePoolSize; i++) {
+        playback.textures[i] = 0;
+        playback.textureFrames[i] = -1;
+    }
+    playback.active = false;
+    if (ctx.rayCastVolume.dataset == &playback.dataset) {
+        std::list<VolumeDataset> &datasets = ctx.datasetCache.datasets;
+        ctx.rayCastVolume.dataset = datasets.empty() ? nullptr : &datasets.front();
+    }
+}
+
+// Starts playing back a sequence (see SequencePlayback). The first
+// timestep is read in the background; it determines the size and the
+// texture format of all timesteps.
+void startSequencePlayback(Context &ctx, const std::string &pattern,
+                           const std::vector<std::string> &filenames)
+{
+    stopSequencePlayback(ctx);
+    SequencePlayback &playback = ctx.sequencePlayback;
+    playback.active = true;
+    playback.pattern = pattern;
+    playback.filenames = filenames;
+    playback.brokenFrames.assign(filenames.size(), false);
+    playback.position = 0.0;
+    playback.step = 0;
+    playback.shownStep = 0;
+    playback.frame = 0;
+    playback.droppedFrames = 0;
+    playback.prefetchDepth = 0;
+    playback.residentFrames = 0;
+    setVolumeLoadStatus(&ctx.volumeLoad, "Reading " + baseName(filenames[0]));
+    playback.preparing = std::async(std::launch::async, prepareVolume, filenames[0],
+                                    ctx.volumeUploadSettings, TextureLimits(), true);
+}
+
+// Creates the texture pool of a sequence whose first timestep has been
+// read, uploads that timestep, and starts prefetching the following
+// ones. Returns false if the first timestep cannot be converted or the
+// texture pool does not fit on the GPU.
+bool beginSequencePlayback(Context &ctx, const PreparedVolume &first)
+{
+    SequencePlayback &playback = ctx.sequencePlayback;
+    glm::ivec3 dims = first.volume.dimensions;
+    std::string datatype = first.volume.datatype;
+    VolumeTextureFormat format = first.format;
+    std::size_t texelSize = volumeTextureTexelSize(format);
+    if (!textureFits(getTextureLimits(ctx), dims, texelSize * sequenceTexturePoolSize)) {
+        std::cerr << "Error: The textures of a sequence of " << dims.x << "x" << dims.y << "x"
+                  << dims.z << " voxels are too large for the GPU" << std::endl;
+        return false;
+    }
+    std::vector<std::uint8_t> texels(cg::volumeNumVoxels(first.volume) * texelSize);
+    if (!first.readSlab(0, dims.z, &texels[0])) {
+        return false;
+    }
+
+    while (glGetError() != GL_NO_ERROR) {}  // errors of earlier calls
+    glGenTextures(sequenceTexturePoolSize, playback.textures);
+    for (int i = 0; i < sequenceTexturePoolSize; i++) {
+        glBindTexture(GL_TEXTURE_3D, playback.textures[i]);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexImage3D(GL_TEXTURE_3D, 0, format.internalFormat, dims.x, dims.y, dims.z,
+                     0, GL_RED, format.type, nullptr);
+    }
+    if (glGetError() != GL_NO_ERROR) {
+        std::cerr << "Error: Could not allocate the textures of the sequence" << std::endl;
+        glBindTexture(GL_TEXTURE_3D, 0);
+        return false;
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);  // rows of odd length
+    glBindTexture(GL_TEXTURE_3D, playback.textures[0]);
+    glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, dims.x, dims.y, dims.z,
+                    GL_RED, format.type, &texels[0]);
+    glBindTexture(GL_TEXTURE_3D, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    playback.textureFrames[0] = 0;
+    playback.format = format;
+
+    VolumeDataset &dataset = playback.dataset;
+    dataset.volume.dimensions = dims;
+    dataset.volume.origin = first.volume.origin;
+    dataset.volume.spacing = first.volume.spacing;
+    dataset.volume.datatype = datatype;
+    dataset.volume.data.clear();
+    dataset.filename = playback.pattern;
+    dataset.valueScale = format.valueScale;
+    dataset.valueOffset = format.valueOffset;
+    dataset.statistics = first.statistics;
+    dataset.texture = playback.textures[0];
+    dataset.textureBytes = texels.size() * sequenceTexturePoolSize;
+    ctx.rayCastVolume.dataset = &dataset;
+
+    // The decoding threads also convert the timesteps to texels, so that
+    // the render loop only has to upload them
+    cg::SequenceDecoder decoder = [=](const std::string &filename, cg::VolumeBase *volume) {
+        if (!loadVolumeFile(volume, filename)) {
+            return false;
+        }
+        if (volume->dimensions != dims || volume->datatype != datatype) {
+            std::cerr << "Error: " << filename << " differs in size or data type "
+                      << "from the first timestep" << std::endl;
+            return false;
+        }
+        if (format.convert) {
+            std::vector<std::uint8_t> converted(cg::volumeNumVoxels(*volume) * texelSize);
+            if (!cg::convertVoxels(format.conversion, &converted[0], &volume->data[0],
+                                   cg::volumeNumVoxels(*volume))) {
+                return false;
+            }
+            volume->data.swap(converted);
+        }
+        return true;
+    };
+    playback.sequence.reset(new cg::VolumeSequence());
+    cg::volumeSequenceOpen(playback.sequence.get(), playback.filenames, decoder, 1,
+                           sequencePrefetchFrames, sequenceDecodeThreads);
+    playback.lastUpdate = glfwGetTime();
+    setVolumeLoadStatus(&ctx.volumeLoad, "Playing " + baseName(playback.pattern));
+    return true;
+}
+
+// Returns the pool texture holding the given timestep, or -1
+int findSequenceTexture(const SequencePlayback &playback, int frame)
+{
+    for (int i = 0; i < sequenceTexturePoolSize; i++) {
+        if (playback.textureFrames[i] == frame) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Advances sequence playback by one frame: moves the playback position
+// on at the target rate, uploads the first of the upcoming timesteps
+// that is decoded but not on the GPU yet into a free pool texture, and
+// shows the timestep of the current position if it is on the GPU.
+// Never waits for the decoding threads.
+void updateSequencePlayback(Context &ctx)
+{
+    SequencePlayback &playback = ctx.sequencePlayback;
+    if (!playback.active) {
+        return;
+    }
+    if (!playback.sequence) {
+        if (playback.preparing.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+            return;
+        }
+        std::shared_ptr<PreparedVolume> first = playback.preparing.get();
+        if (!first || !beginSequencePlayback(ctx, *first)) {
+            std::cerr << "Error: Could not load " << playback.filenames[0] << std::endl;
+            setVolumeLoadStatus(&ctx.volumeLoad, "Failed to load " + baseName(playback.pattern));
+            stopSequencePlayback(ctx);
+            return;
+        }
+    }
+
+    // Timesteps whose turn has passed without being shown are dropped
+    int numFrames = int(playback.filenames.size());
+    double now = glfwGetTime();
+    if (playback.playing) {
+        playback.position += (now - playback.lastUpdate) * std::max(playback.frameRate, 0.0f);
+    }
+    playback.lastUpdate = now;
+    std::int64_t step = std::int64_t(playback.position);
+    if (step > playback.step) {
+        playback.droppedFrames += int(step - playback.step - 1) +
+                                  (playback.shownStep != playback.step ? 1 : 0);
+        playback.step = step;
+    }
+    int frame = int(step % numFrames);
+
+    // The pool holds the upcoming timesteps (and the one on screen)
+    int window = std::min(sequenceTexturePoolSize, numFrames);
+    for (int i = 0; i < window; i++) {
+        int wanted = (frame + i) % numFrames;
+        if (playback.brokenFrames[wanted] || findSequenceTexture(playback, wanted) >= 0) {
+            continue;
+        }
+        int freeTexture = -1;
+        for (int j = 0; j < sequenceTexturePoolSize; j++) {
+            int held = playback.textureFrames[j];
+            if (playback.textures[j] != playback.dataset.texture &&
+                (held < 0 || (held - frame + numFrames) % numFrames >= window)) {
+                freeTexture = j;
+            }
+        }
+        cg::VolumeBase volume;
+        if (freeTexture < 0 || !cg::volumeSequenceTake(playback.sequence.get(), wanted, &volume)) {
+            break;
+        }
+        if (volume.data.empty()) {
+            playback.brokenFrames[wanted] = true;
+            continue;
+        }
+        const glm::ivec3 &dims = volume.dimensions;
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glBindTexture(GL_TEXTURE_3D, playback.textures[freeTexture]);
+        glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, dims.x, dims.y, dims.z,
+                        GL_RED, playback.format.type, &volume.data[0]);
+        glBindTexture(GL_TEXTURE_3D, 0);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        playback.textureFrames[freeTexture] = wanted;
+        break;  // at most one upload per frame
+    }
+
+    int texture = findSequenceTexture(playback, frame);
+    if (texture >= 0) {
+        playback.dataset.texture = playback.textures[texture];
+        playback.shownStep = step;
+        playback.frame = frame;
+    }
+
+    playback.prefetchDepth = cg::volumeSequencePrefetched(playback.sequence.get());
+    playback.residentFrames = 0;
+    for (int i = 0; i < window; i++) {
+        playback.residentFrames += findSequenceTexture(playback, (frame + i) % numFrames) >= 0 ? 1 : 0;
+    }
+}
+
+// Returns the CPU memory used by a dataset: its voxels (or their
+// compressed bricks) and, while it is being edited, its levels of detail
+std::size_t datasetCpuBytes(const VolumeDataset &dataset)
+{
+    std::size_t bytes = dataset.volume.data.size();
+    if (dataset.compressed) {
+        bytes += cg::compressedVolumeSizeInBytes(*dataset.compressed);
+    }
+    for (std::size_t i = 0; i < dataset.edits.levels.size(); i++) {
+        bytes += dataset.edits.levels[i].data.size();
+    }
+    return bytes;
+}
+
+// Updates the memory statistics of the dataset cache and enforces its
+// budgets (see DatasetCache)
+void enforceDatasetBudgets(Context &ctx)
+{
+    DatasetCache &cache = ctx.datasetCache;
+    const VolumeDataset *current = ctx.rayCastVolume.dataset;
+    std::size_t cpuBytes = 0, gpuBytes = 0;
+    for (auto it = cache.datasets.begin(); it != cache.datasets.end(); ++it) {
+        cpuBytes += datasetCpuBytes(*it);
+        gpuBytes += it->textureBytes;
+    }
+
+    // With the drop policy, no CPU copies are kept at all, except for
+    // the current dataset while it is being set up for editing. The CPU
+    // copy of an edited dataset is never dropped: it is the only copy of
+    // the edits, which reading the file again would revert.
+    bool dropAll = ctx.volumeUploadSettings.cpuCopy == CPU_COPY_DROP;
+    std::size_t cpuBudget = std::size_t(double(cache.cpuBudgetMB) * (1 << 20));
+    for (auto it = cache.datasets.rbegin();
+         it != cache.datasets.rend() && (cpuBytes > cpuBudget || dropAll); ++it) {
+        bool droppable = !it->edited && (&*it != current || (dropAll && !it->edits.active));
+        if (droppable && (!it->volume.data.empty() || it->compressed)) {
+            cpuBytes -= datasetCpuBytes(*it);
+            std::vector<std::uint8_t>().swap(it->volume.data);
+            it->compressed.reset();
+            it->edits = VolumeEdits();
+        }
+    }
+    std::size_t gpuBudget = std::size_t(double(cache.gpuBudgetMB) * (1 << 20));
+    for (auto it = cache.datasets.end(); it != cache.datasets.begin() && gpuBytes > gpuBudget; ) {
+        --it;
+        if (&*it != current && !it->edited) {
+            cpuBytes -= datasetCpuBytes(*it);
+            gpuBytes -= it->textureBytes;
+            glDeleteTextures(1, &it->texture);
+            glDeleteTextures(1, &it->gradientTexture);
+            glDeleteTextures(1, &it->brickTexture);
+            it = cache.datasets.erase(it);
+        }
+    }
+
+    cache.cpuResidentMB = float(double(cpuBytes) / (1 << 20));
+    cache.gpuResidentMB = float(double(gpuBytes) / (1 << 20));
+    cache.numResident = int(cache.datasets.size());
+}
+
+// Shows the dataset with the given filename: a resident dataset is
+// swapped in right away, any other one is loaded in the background. A
+// pattern matching several volume files is played back as a sequence.
+void selectDataset(Context &ctx, const std::string &filename)
+{
+    DatasetCache &cache = ctx.datasetCache;
+    cache.selected = filename;
+    std::vector<std::string> frames;
+    if (listSequenceFrames(filename, &frames)) {
+        startSequencePlayback(ctx, filename, frames);
+        return;
+    }
+    stopSequencePlayback(ctx);
+    for (auto it = cache.datasets.begin(); it != cache.datasets.end(); ++it) {
+        if (it->filename == filename) {
+            cache.datasets.splice(cache.datasets.begin(), cache.datasets, it);
+            ctx.rayCastVolume.dataset = &cache.datasets.front();
+            setVolumeLoadStatus(&ctx.volumeLoad, "Showing " + baseName(filename) + " (resident)");
+            return;
+        }
+    }
+    startVolumeLoad(ctx, filename);
+}
+
+// Uploads the coarser levels of detail of a volume as mip levels 1, 2,
+// ... of its texture, which then filters between levels. Adds their size
+// to textureBytes and returns the number of levels in the texture.
+int uploadTextureLevels(GLuint texture, const VolumeTextureFormat &format,
+                        const std::vector<cg::VolumeBase> &levels, std::size_t *textureBytes)
+{
+    if (levels.empty()) {
+        return 1;
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);  // rows of odd length
+    glBindTexture(GL_TEXTURE_3D, texture);
+    for (std::size_t i = 0; i < levels.size(); i++) {
+        const glm::ivec3 &dims = levels[i].dimensions;
+        glTexImage3D(GL_TEXTURE_3D, GLint(i + 1), format.internalFormat, dims.x, dims.y, dims.z,
+                     0, GL_RED, format.type, &levels[i].data[0]);
+        *textureBytes += levels[i].data.size();
+    }
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAX_LEVEL, GLint(levels.size()));
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glBindTexture(GL_TEXTURE_3D, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    return int(levels.size()) + 1;
+}
+
+// Creates the texture of the precomputed gradients of a volume (see
+// cg::volumeComputeGradientTexels()). Returns 0 if there are none.
+GLuint createGradientTexture(const glm::ivec3 &dims, const std::vector<std::uint8_t> &texels)
+{
+    if (texels.empty()) {
+        return 0;
+    }
+    GLuint texture = 0;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_3D, texture);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA8, dims.x, dims.y, dims.z,
+                 0, GL_RGBA, GL_UNSIGNED_BYTE, &texels[0]);
+    glBindTexture(GL_TEXTURE_3D, 0);
+    return texture;
+}
+
+// Sets a dataset up for editing (see VolumeEdits). Voxels that are only
+// paged out, compressed or mapped are read back into memory; streamed
+// volumes (too large for memory) and dropped voxels cannot be edited.
+// Neither can smoothed volumes, whose texture, levels and gradients are
+// made from smoothed voxels that are not kept. Returns false if the
+// dataset cannot be edited.
+bool beginVolumeEditing(VolumeDataset *dataset)
+{
+    VolumeEdits &edits = dataset->edits;
+    if (edits.active) {
+        return true;
+    }
+    cg::VolumeBase &volume = dataset->volume;
+    if (dataset->streamed) {
+        std::cerr << "Error: " << dataset->filename << " is streamed and cannot be edited"
+                  << std::endl;
+        return false;
+    }
+    if (dataset->settings.smoothing > 0.0f) {
+        std::cerr << "Error: " << dataset->filename << " is smoothed and cannot be edited "
+                  << "(reload it without smoothing)" << std::endl;
+        return false;
+    }
+    if (volume.data.empty() && dataset->edited) {
+        // Never re-read the voxels from the file, which would revert the edits
+        std::cerr << "Error: The edited voxels of " << dataset->filename << " are lost"
+                  << std::endl;
+        return false;
+    }
+    if (volume.data.empty()) {
+        const std::uint8_t *voxels = datasetVoxels(*dataset);
+        cg::VolumeBase read;
+        if (voxels != nullptr) {
+            volume.data.assign(voxels, voxels + dataset->pagedOut->size);
+        }
+        else if (dataset->compressed && cg::volumeDecompress(*dataset->compressed, &read)) {
+            volume.data.swap(read.data);
+        }
+        else if (dataset->source && cg::volumeSourceMaterialize(dataset->source.get(), &read) &&
+                 read.datatype == volume.datatype && read.dimensions == volume.dimensions) {
+            volume.data.swap(read.data);
+        }
+        else {
+            std::cerr << "Error: No voxels of " << dataset->filename << " to edit "
+                      << "(the CPU copy has been dropped)" << std::endl;
+            return false;
+        }
+    }
+    // The paged out or compressed voxels are not edited along
+    dataset->pagedOut.reset();
+    dataset->compressed.reset();
+
+    edits.levels.clear();
+    if (dataset->numLevels > 1) {
+        cg::PyramidReduction reduction = dataset->settings.lodPyramid == LOD_PYRAMID_MAX ?
+                                         cg::PYRAMID_MAX : cg::PYRAMID_AVERAGE;
+        if (!cg::volumeBuildPyramid(volume, &edits.levels, reduction) ||
+            int(edits.levels.size()) != dataset->numLevels - 1) {
+            std::cerr << "Error: Could not build the levels of detail of " << dataset->filename
+                      << " for editing" << std::endl;
+            edits.levels.clear();
+            return false;
+        }
+    }
+    cg::dirtyBricksInit(&edits.dirty, volume.dimensions, editBrickSize);
+    edits.active = true;
+    return true;
+}
+
+// Applies a brush to the current volume on the CPU and marks the bricks
+// it touches dirty, including the voxels around them whose gradients
+// change. The texture is updated by uploadVolumeEdits(). Returns false if
+// the volume cannot be edited.
+bool editRayCastVolume(RayCastVolume *rayCastVolume, const cg::VolumeBrush &brush)
+{
+    VolumeDataset *dataset = rayCastVolume->dataset;
+    if (dataset == nullptr || !beginVolumeEditing(dataset)) {
+        return false;
+    }
+    glm::ivec3 origin, size;
+    if (!cg::volumeApplyBrush(&dataset->volume, brush, &origin, &size)) {
+        return false;
+    }
+    if (glm::all(glm::greaterThan(size, glm::ivec3(0)))) {
+        cg::dirtyBricksMark(&dataset->edits.dirty, origin - 1, size + 2);
+        dataset->edited = true;
+    }
+    return true;
+}
+
+// Uploads the region [origin, origin + size) of a volume image to a
+// level of the bound 3D texture, converting the voxels to texels
+bool uploadVolumeRegion(const cg::VolumeBase &volume, const VolumeTextureFormat &format,
+                        GLint level, const glm::ivec3 &origin, const glm::ivec3 &size)
+{
+    const glm::ivec3 &dims = volume.dimensions;
+    std::size_t elementSize = cg::datatypeSizeInBytes(volume.datatype);
+    std::size_t texelSize = volumeTextureTexelSize(format);
+    std::vector<std::uint8_t> texels(std::size_t(size.x) * size.y * size.z * texelSize);
+    for (int z = 0; z < size.z; z++) {
+        for (int y = 0; y < size.y; y++) {
+            std::size_t src = (std::size_t(origin.z + z) * dims.y + origin.y + y) * dims.x +
+                              origin.x;
+            std::size_t dst = (std::size_t(z) * size.y + y) * size.x;
+            if (!cg::convertVoxels(format.conversion, &texels[dst * texelSize],
+                                   &volume.data[src * elementSize], size.x)) {
+                return false;
+            }
+        }
+    }
+    glTexSubImage3D(GL_TEXTURE_3D, level, origin.x, origin.y, origin.z, size.x, size.y, size.z,
+                    GL_RED, format.type, &texels[0]);
+    return true;
+}
+
+// Uploads the dirty bricks of a dataset to its texture, level by level,
+// and updates the gradients and the min/max grid of the dirty bricks.
+// The cost is proportional to the number of dirty bricks. The statistics
+// are marked stale and computed anew once editing pauses (see
+// updateStatisticsView()).
+void uploadDatasetEdits(VolumeDataset *dataset)
+{
+    VolumeEdits &edits = dataset->edits;
+    if (!edits.active || edits.dirty.bricks.empty()) {
+        return;
+    }
+    const cg::BrickGrid &grid = edits.dirty.grid;
+    std::vector<glm::ivec3> origins, sizes;  // of the dirty regions of the current level
+    for (std::size_t i = 0; i < edits.dirty.bricks.size(); i++) {
+        glm::ivec3 brick = cg::brickGridCoord(grid, edits.dirty.bricks[i]);
+        origins.push_back(cg::brickGridBrickOrigin(grid, brick));
+        sizes.push_back(cg::brickGridBrickExtent(grid, brick));
+    }
+
+    // The brick texture is made anew from the grid before the next frame
+    if (!dataset->minMax.minValues.empty()) {
+        for (std::size_t i = 0; i < origins.size(); i++) {
+            cg::volumeUpdateMinMaxGrid(dataset->volume, origins[i], sizes[i], &dataset->minMax);
+        }
+        dataset->brickTextureVersion = -1;
+    }
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);  // rows of odd length
+    if (dataset->gradientTexture != 0) {
+        cg::GradientOperator op = dataset->settings.gradients == GRADIENTS_SOBEL ?
+                                  cg::GRADIENT_SOBEL : cg::GRADIENT_CENTRAL_DIFFERENCES;
+        glBindTexture(GL_TEXTURE_3D, dataset->gradientTexture);
+        std::vector<std::uint8_t> texels;
+        for (std::size_t i = 0; i < origins.size(); i++) {
+            if (cg::volumeComputeGradientTexelsRegion(dataset->volume, op, origins[i], sizes[i],
+                                                      dataset->gradientMaxMagnitude, &texels)) {
+                glTexSubImage3D(GL_TEXTURE_3D, 0, origins[i].x, origins[i].y, origins[i].z,
+                                sizes[i].x, sizes[i].y, sizes[i].z, GL_RGBA, GL_UNSIGNED_BYTE,
+                                &texels[0]);
+            }
+        }
+    }
+
+    glBindTexture(GL_TEXTURE_3D, dataset->texture);
+    cg::PyramidReduction reduction = dataset->settings.lodPyramid == LOD_PYRAMID_MAX ?
+                                     cg::PYRAMID_MAX : cg::PYRAMID_AVERAGE;
+    const cg::VolumeBase *level = &dataset->volume;
+    for (std::size_t l = 0; l <= edits.levels.size(); l++) {
+        if (l > 0) {
+            // The dirty regions of a level are reduced from those of the
+            // level above it
+            cg::VolumeBase *reduced = &edits.levels[l - 1];
+            for (std::size_t i = 0; i < origins.size(); i++) {
+                cg::pyramidReducedRegion(level->dimensions, reduced->dimensions, origins[i],
+                                         sizes[i], &origins[i], &sizes[i]);
+                cg::volumeReduceRegion(*level, reduced, origins[i], sizes[i], reduction);
+            }
+            level = reduced;
+        }
+        for (std::size_t i = 0; i < origins.size(); i++) {
+            if (glm::all(glm::greaterThan(sizes[i], glm::ivec3(0)))) {
+                uploadVolumeRegion(*level, dataset->format, GLint(l), origins[i], sizes[i]);
+            }
+        }
+    }
+    glBindTexture(GL_TEXTURE_3D, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    cg::dirtyBricksClear(&edits.dirty);
+    dataset->statisticsEditTime = glfwGetTime();
+}
+
+// Uploads the edits of all resident datasets (see uploadDatasetEdits()).
+// Called once per frame, so that any number of edits in a frame cost one
+// upload per dirty brick.
+void uploadVolumeEdits(Context &ctx)
+{
+    std::list<VolumeDataset> &datasets = ctx.datasetCache.datasets;
+    for (auto it = datasets.begin(); it != datasets.end(); ++it) {
+        uploadDatasetEdits(&*it);
+    }
+}
+
+// Ends a volume load. On success, the volume becomes a resident dataset
+// (replacing an older copy of the same file), and it replaces the
+// current volume in a single step if it is the one selected.
+void finishVolumeLoad(Context &ctx, bool success)
+{
+    VolumeLoad &load = ctx.volumeLoad;
+    if (success) {
+        DatasetCache &cache = ctx.datasetCache;
+        RayCastVolume &rayCastVolume = ctx.rayCastVolume;
+        bool wasCurrent = false;
+        for (auto it = cache.datasets.begin(); it != cache.datasets.end(); ++it) {
+            if (it->filename == load.filename) {
+                wasCurrent = rayCastVolume.dataset == &*it;
+                glDeleteTextures(1, &it->texture);
+                glDeleteTextures(1, &it->gradientTexture);
+                glDeleteTextures(1, &it->brickTexture);
+                cache.datasets.erase(it);
+                break;
+            }
+        }
+
+        cache.datasets.push_front(VolumeDataset());
+        VolumeDataset &dataset = cache.datasets.front();
+        dataset.volume = std::move(load.prepared->volume);
+        dataset.pagedOut = load.prepared->pagedOut;
+        dataset.compressed = load.prepared->compressed;
+        dataset.source = load.prepared->source;
+        dataset.streamed = load.prepared->streamed;
+        dataset.settings = load.prepared->settings;
+        dataset.format = load.prepared->format;
+        if (ctx.volumeUploadSettings.cpuCopy == CPU_COPY_DROP || dataset.compressed) {
+            std::vector<std::uint8_t>().swap(dataset.volume.data);
+        }
+        const glm::ivec3 &dims = dataset.volume.dimensions;
+        dataset.filename = load.filename;
+        dataset.valueScale = load.prepared->format.valueScale;
+        dataset.valueOffset = load.prepared->format.valueOffset;
+        dataset.statistics = std::move(load.prepared->statistics);
+        dataset.jointHistogram = std::move(load.prepared->jointHistogram);
+        dataset.texture = load.texture;
+        dataset.textureBytes = std::size_t(dims.x) * std::size_t(dims.y) * std::size_t(dims.z) *
+                               volumeTextureTexelSize(load.prepared->format);
+        dataset.numLevels = uploadTextureLevels(load.texture, load.prepared->format,
+                                                load.prepared->levels, &dataset.textureBytes);
+        dataset.gradientTexture = createGradientTexture(dims, load.prepared->gradientTexels);
+        dataset.gradientMaxMagnitude = load.prepared->gradientMaxMagnitude;
+        dataset.textureBytes += load.prepared->gradientTexels.size();
+        dataset.minMax = std::move(load.prepared->minMax);
+        if (wasCurrent || rayCastVolume.dataset == nullptr || load.filename == cache.selected) {
+            rayCastVolume.dataset = &dataset;
+        }
+        enforceDatasetBudgets(ctx);
+        setVolumeLoadStatus(&load, "Loaded " + baseName(load.filename));
+    }
+    else {
+        std::cerr << "Error: Could not load " << load.filename << std::endl;
+        glDeleteTextures(1, &load.texture);
+        setVolumeLoadStatus(&load, "Failed to load " + baseName(load.filename));
+    }
+    load.texture = 0;
+    for (int i = 0; i < uploadRingSize; i++) {
+        glDeleteBuffers(1, &load.slots[i].pbo);
+        load.slots[i].pbo = 0;
+    }
+    dropPreparedVolume(&load);
+    load.active = false;
+
+    if (!load.queuedFilename.empty()) {
+        std::string filename = load.queuedFilename;
+        load.queuedFilename.clear();
+        startVolumeLoad(ctx, filename);
+    }
+}
+
+// Advances the background volume load by one frame: once the volume has
+// been read, every ring buffer that a worker thread has filled with a
+// slab is uploaded to the new texture (the copy runs asynchronously on
+// the GPU) and handed on to the next slab. Never waits for a worker.
+void updateVolumeLoad(Context &ctx)
+{
+    VolumeLoad &load = ctx.volumeLoad;
+    if (!load.active) {
+        return;
+    }
+    if (!load.prepared) {
+        if (load.preparing.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+            return;
+        }
+        load.prepared = load.preparing.get();
+        if (!load.prepared) {
+            finishVolumeLoad(ctx, false);
+            return;
+        }
+        if (!beginVolumeUpload(ctx, &load)) {
+            load.failed = true;
+            finishVolumeLoad(ctx, false);
+            return;
+        }
+    }
+
+    const glm::ivec3 &dims = load.prepared->volume.dimensions;
+    const VolumeTextureFormat &format = load.prepared->format;
+    std::size_t sliceBytes = std::size_t(dims.x) * std::size_t(dims.y) * volumeTextureTexelSize(format);
+    bool busy = false;
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);  // rows of odd length
+    glBindTexture(GL_TEXTURE_3D, load.texture);
+    for (int i = 0; i < uploadRingSize; i++) {
+        UploadSlot &slot = load.slots[i];
+        if (slot.numSlices > 0) {
+            if (slot.pending.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+                busy = true;
+                continue;
+            }
+            bool filled = slot.pending.get();
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.pbo);
+            if (!glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER) || !filled) {
+                load.failed = true;
+            }
+            else {
+                glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, slot.firstSlice, dims.x, dims.y,
+                                slot.numSlices, GL_RED, format.type, nullptr);
+                load.uploadedSlices += slot.numSlices;
+            }
+            slot.numSlices = 0;
+        }
+        if (!load.failed && load.nextSlice < dims.z) {
+            int numSlices = std::min(load.slabSlices, dims.z - load.nextSlice);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.pbo);
+            void *dst = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, numSlices * sliceBytes,
+                                         GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+            if (dst == nullptr) {
+                load.failed = true;
+                continue;
+            }
+            slot.firstSlice = load.nextSlice;
+            slot.numSlices = numSlices;
+            slot.pending = std::async(std::launch::async, load.prepared->readSlab, slot.firstSlice,
+                                      numSlices, static_cast<std::uint8_t *>(dst));
+            load.nextSlice += numSlices;
+            busy = true;
+        }
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glBindTexture(GL_TEXTURE_3D, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+    load.progress = 100.0f * float(load.uploadedSlices) / float(dims.z);
+    if (!busy && (load.failed || load.uploadedSlices == dims.z)) {
+        finishVolumeLoad(ctx, !load.failed);
+    }
+}
+
+// Waits for the worker threads of a volume load and drops it, e.g.,
+// before the GL context goes away. Also waits for cache files that are
+// still being written.
+void cancelVolumeLoad(Context &ctx)
+{
+    VolumeLoad &load = ctx.volumeLoad;
+    load.queuedFilename.clear();
+    if (load.active) {
+        if (!load.prepared && load.preparing.valid()) {
+            load.prepared = load.preparing.get();
+        }
+        for (int i = 0; i < uploadRingSize; i++) {
+            if (load.slots[i].numSlices > 0) {
+                load.slots[i].pending.wait();
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, load.slots[i].pbo);
+                glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+                load.slots[i].numSlices = 0;
+            }
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glDeleteTextures(1, &load.texture);
+        load.texture = 0;
+        for (int i = 0; i < uploadRingSize; i++) {
+            glDeleteBuffers(1, &load.slots[i].pbo);
+            load.slots[i].pbo = 0;
+        }
+        load.active = false;
+    }
+    dropPreparedVolume(&load);
+    for (auto it = load.cgvolWrites.begin(); it != load.cgvolWrites.end(); ++it) {
+        it->wait();
+    }
+    load.cgvolWrites.clear();
+}
+
 void createTransferFunctionFBO(Context &ctx, TransferFunction *transferFunction) 
 {
 	glDeleteTextures(1, &transferFunction->texture);
@@ -398,6 +2378,7 @@ void reloadShaders(Context *ctx, bool firstTime=false)
 	ctx->transferFunctionProgram = loadShaderProgram(
 		shaderDir() + "transferFunction.vert",
 		shaderDir() + "transferFunction.frag");
+	ctx->transferFunction.visible.clear();  // read back again once baked
 }
 
 void init(Context &ctx)
@@ -412,9 +2393,24 @@ void init(Context &ctx)
     // Create fullscreen quad for ray-casting
     createQuadVAO(ctx, &ctx.quadVAO);
 
-    // Load volume data
-    loadRayCastVolume(ctx, (volumeDataDir() + "/foot.vtk"), &ctx.rayCastVolume);
-    ctx.rayCastVolume.volume.spacing *= 0.008f;  // FIXME
+    // Offer the volumes given on the command line, or else the ones in
+    // the data directory, and load the first one (in the background)
+    if (ctx.datasetFilenames.empty()) {
+        ctx.datasetFilenames.push_back(volumeDataDir() + "/foot.vtk");
+        const char *patterns[] = { "*.vtk", "*.nrrd", "*.nhdr", "*.mha", "*.mhd" };
+        for (int i = 0; i < 5; i++) {
+            std::vector<std::string> filenames;
+            cg::volumeListSlices(volumeDataDir() + "/" + patterns[i], &filenames);
+            for (auto it = filenames.begin(); it != filenames.end(); ++it) {
+                if (baseName(*it) != "foot.vtk") {
+                    ctx.datasetFilenames.push_back(*it);
+                }
+            }
+        }
+    }
+    ctx.datasetIndex = 0;
+    createRayCastFBOs(ctx, &ctx.rayCastVolume);
+    selectDataset(ctx, ctx.datasetFilenames[0]);
 
 	createTransferFunctionFBO(ctx, &(ctx.transferFunction));
 	ctx.transferFunction.bSpline.degree = 1;
@@ -450,6 +2446,10 @@ void init(Context &ctx)
 	ctx.rayCasterSettings.color_mode = MAX_INTENSITY;
 	ctx.rayCasterSettings.use_gamma_correction = 1;
 	ctx.rayCasterSettings.use_color_inversion = 0;
+	ctx.rayCasterSettings.use_lod = 1;
+	ctx.rayCasterSettings.lod_bias = 0.0f;
+	ctx.rayCasterSettings.iso_value = 0.5f;
+	ctx.rayCasterSettings.use_empty_space_skipping = 1;
 
 	ctx.backgroundColor = glm::vec4(0.1, 0.1, 0.1, 0.0);
 }
@@ -482,12 +2482,42 @@ void getProjectionMatrix(Context& ctx, Camera* camera, glm::mat4 *dst)
 	}
 }
 
+// Returns the scale of the bounding cube of a volume: the cube spans two
+// units along the longest axis of the volume, and the other axes in
+// proportion to their extent
+glm::vec3 getVolumeBoxScale(const cg::VolumeBase &volume)
+{
+	glm::vec3 extent = cg::volumeComputeExtent(volume);
+	float maxExtent = std::max(extent.x, std::max(extent.y, extent.z));
+	if (!(maxExtent > 0.0f) || glm::any(glm::lessThanEqual(extent, glm::vec3(0.0f)))) {
+		return glm::vec3(1.0f);
+	}
+	return extent / maxExtent;
+}
+
+// Returns the number of pixels one voxel of a volume covers on screen, at
+// the center of the volume, along its axis of finest spacing
+float getVoxelFootprint(Context &ctx, Camera *camera, const cg::VolumeBase &volume)
+{
+	float viewHeight;  // in units, at the distance of the center
+	if (camera->lensMode == CameraLensMode::PERSPECTIVE) {
+		viewHeight = 2.0f * 2.0f * std::tan(0.5f * getFovy(camera));
+	}
+	else {
+		viewHeight = 2.0f * 2.0f / pow(2.0f, camera->zoom);
+	}
+	glm::vec3 voxelSize = 2.0f * getVolumeBoxScale(volume) / glm::vec3(glm::max(volume.dimensions, 1));
+	float minVoxelSize = std::min(voxelSize.x, std::min(voxelSize.y, voxelSize.z));
+	return float(ctx.height) / viewHeight * minVoxelSize;
+}
+
 void drawBoundingGeometry(Context &ctx, GLuint program, const MeshVAO &cubeVAO,
                           const RayCastVolume &rayCastVolume)
 {
-    //glm::mat4 model = cg::volumeComputeModelMatrix(rayCastVolume.volume);
-    //model = trackballGetRotationMatrix(ctx.trackball) * model;
 	glm::mat4 model = trackballGetRotationMatrix(ctx.trackball);
+	if (rayCastVolume.dataset != nullptr) {
+		model = glm::scale(model, getVolumeBoxScale(rayCastVolume.dataset->volume));
+	}
 	glm::mat4 view;
 	getViewMatrix(&view);
 	glm::mat4 projection;
@@ -527,6 +2557,123 @@ void drawTransferFunction(Context &ctx, GLuint program, const MeshVAO &quadVAO,
 }
 
 
+// Takes the statistics shown in the tweak bar from the current dataset
+// if it has changed, or if it has been edited and editing has paused for
+// editStatisticsDelay, in which case its statistics (and its joint
+// histogram) are computed anew.
+// Datasets without statistics show zeros.
+void updateStatisticsView(Context &ctx)
+{
+    VolumeDataset *dataset = ctx.rayCastVolume.dataset;
+    GLuint texture = dataset != nullptr ? dataset->texture : 0;
+    StatisticsView &view = ctx.statisticsView;
+    bool edited = false;
+    if (dataset != nullptr && dataset->statisticsEditTime >= 0.0 &&
+        ctx.elapsed_time - dataset->statisticsEditTime >= editStatisticsDelay) {
+        cg::VolumeStatistics stats;
+        cg::JointHistogram histogram;
+        const cg::VolumeBase &volume = dataset->volume;
+        if (!volume.data.empty() && cg::volumeComputeStatistics(volume, &stats)) {
+            dataset->statistics = std::move(stats);
+        }
+        if (!volume.data.empty() && !dataset->jointHistogram.bins.empty() &&
+            cg::volumeComputeJointHistogram(volume, &histogram, dataset->jointHistogram.numValueBins,
+                                            dataset->jointHistogram.numGradientBins)) {
+            dataset->jointHistogram = std::move(histogram);
+        }
+        dataset->statisticsEditTime = -1.0;
+        edited = true;
+    }
+    if (texture == view.texture && !edited) {
+        return;
+    }
+    view = StatisticsView();
+    view.texture = texture;
+    if (dataset == nullptr || dataset->statistics.numValues == 0) {
+        return;
+    }
+    const cg::VolumeStatistics &stats = dataset->statistics;
+    view.minValue = stats.minValue;
+    view.maxValue = stats.maxValue;
+    view.mean = float(stats.mean);
+    view.standardDeviation = float(stats.standardDeviation);
+    view.lowPercentile = cg::volumeStatisticsPercentile(stats, 0.01f);
+    view.median = cg::volumeStatisticsPercentile(stats, 0.5f);
+    view.highPercentile = cg::volumeStatisticsPercentile(stats, 0.99f);
+}
+
+// Reads the baked transfer function back from its texture if the spline
+// has changed, and records which texels contribute to the image: color
+// is accumulated even where opacity is zero, so any nonzero channel
+// counts. Each texel also counts as visible if one within a few texels
+// is, so that values rounded by 8-bit textures are covered.
+void readTransferFunctionVisibility(TransferFunction *transferFunction)
+{
+	if (!transferFunction->visible.empty() &&
+	    std::memcmp(&transferFunction->bakedSpline, &transferFunction->bSpline,
+	                sizeof(BSpline)) == 0) {
+		return;
+	}
+	const int width = TRANSFER_FUNCTION_TEXTURE_WIDTH;
+	const int reach = width / 255 + 1;
+	std::vector<std::uint8_t> texels(4 * width);
+	glBindTexture(GL_TEXTURE_1D, transferFunction->texture);
+	glGetTexImage(GL_TEXTURE_1D, 0, GL_RGBA, GL_UNSIGNED_BYTE, &texels[0]);
+	glBindTexture(GL_TEXTURE_1D, 0);
+	transferFunction->visible.assign(width, 0);
+	for (int i = 0; i < width; i++) {
+		if (texels[4 * i] || texels[4 * i + 1] || texels[4 * i + 2] || texels[4 * i + 3]) {
+			for (int j = std::max(i - reach, 0); j <= std::min(i + reach, width - 1); j++) {
+				transferFunction->visible[j] = 1;
+			}
+		}
+	}
+	transferFunction->bakedSpline = transferFunction->bSpline;
+	transferFunction->version++;
+}
+
+// Makes the brick texture of a dataset anew from its min/max grid if the
+// transfer function or the grid has changed: red is 1 for the bricks
+// that the transfer function does not map to zero, green is the maximum
+// value of the brick mapped to [0, 1] like the texture values (plus one
+// 8-bit step, for rounding)
+void updateBrickTexture(VolumeDataset *dataset, const TransferFunction &transferFunction)
+{
+	const cg::MinMaxGrid &minMax = dataset->minMax;
+	if (minMax.minValues.empty() || transferFunction.visible.empty() ||
+	    dataset->brickTextureVersion == transferFunction.version) {
+		return;
+	}
+	const VolumeTextureFormat &format = dataset->format;
+	std::vector<std::uint8_t> occupancy;
+	cg::minMaxGridOccupancy(minMax, &transferFunction.visible[0],
+	                        int(transferFunction.visible.size()), format.windowMin,
+	                        format.windowMax, &occupancy);
+	float windowWidth = std::max(format.windowMax - format.windowMin, 1e-30f);
+	std::vector<float> texels(2 * occupancy.size());
+	for (std::size_t i = 0; i < occupancy.size(); i++) {
+		texels[2 * i] = float(occupancy[i]);
+		texels[2 * i + 1] = (minMax.maxValues[i] - format.windowMin) / windowWidth + 1.0f / 255.0f;
+	}
+
+	const glm::ivec3 &numBricks = minMax.grid.numBricks;
+	if (dataset->brickTexture == 0) {
+		glGenTextures(1, &dataset->brickTexture);
+		glBindTexture(GL_TEXTURE_3D, dataset->brickTexture);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		dataset->textureBytes += texels.size() * sizeof(float);
+	}
+	glBindTexture(GL_TEXTURE_3D, dataset->brickTexture);
+	glTexImage3D(GL_TEXTURE_3D, 0, GL_RG32F, numBricks.x, numBricks.y, numBricks.z,
+	             0, GL_RG, GL_FLOAT, &texels[0]);
+	glBindTexture(GL_TEXTURE_3D, 0);
+	dataset->brickTextureVersion = transferFunction.version;
+}
+
 void drawRayCasting(Context &ctx, GLuint program, const MeshVAO &quadVAO,
                     const RayCastVolume &rayCastVolume)
 {
@@ -534,7 +2681,8 @@ void drawRayCasting(Context &ctx, GLuint program, const MeshVAO &quadVAO,
 
     // Set uniforms and bind textures
 	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_3D, ctx.rayCastVolume.volumeTexture);
+	const VolumeDataset *dataset = ctx.rayCastVolume.dataset;
+	glBindTexture(GL_TEXTURE_3D, dataset != nullptr ? dataset->texture : 0);
 	glUniform1i(glGetUniformLocation(program, "u_volumeTexture"), 0);
 
 	glActiveTexture(GL_TEXTURE1);
@@ -549,6 +2697,13 @@ void drawRayCasting(Context &ctx, GLuint program, const MeshVAO &quadVAO,
 	glBindTexture(GL_TEXTURE_1D, ctx.transferFunction.texture);
 	glUniform1i(glGetUniformLocation(program, "u_transferFuncTexture"), 3);
 
+	GLuint gradientTexture = dataset != nullptr ? dataset->gradientTexture : 0;
+	glActiveTexture(GL_TEXTURE4);
+	glBindTexture(GL_TEXTURE_3D, gradientTexture);
+	glUniform1i(glGetUniformLocation(program, "u_gradientTexture"), 4);
+	glUniform1i(glGetUniformLocation(program, "u_use_gradient_texture"), gradientTexture != 0);
+	glActiveTexture(GL_TEXTURE0);
+
 	glUniform1f(glGetUniformLocation(program, "u_rayStepLength"), 
 		ctx.rayCasterSettings.ray_step_length);
 	glUniform1i(glGetUniformLocation(program, "u_color_mode"), 
@@ -560,6 +2715,36 @@ void drawRayCasting(Context &ctx, GLuint program, const MeshVAO &quadVAO,
 
 	glUniform1f(glGetUniformLocation(program, "u_density"), 
 		ctx.rayCasterSettings.density);
+	glUniform1f(glGetUniformLocation(program, "u_isoValue"), 
+		ctx.rayCasterSettings.iso_value);
+	glUniform1f(glGetUniformLocation(program, "u_valueScale"), 
+		dataset != nullptr ? dataset->valueScale : 1.0f);
+	glUniform1f(glGetUniformLocation(program, "u_valueOffset"), 
+		dataset != nullptr ? dataset->valueOffset : 0.0f);
+	glm::vec3 boxScale = dataset != nullptr ? getVolumeBoxScale(dataset->volume) : glm::vec3(1.0f);
+	glUniform3fv(glGetUniformLocation(program, "u_boxScale"), 1, &boxScale[0]);
+
+	// Coarser levels of detail are sampled when voxels get smaller than
+	// a pixel
+	float lod = 0.0f;
+	if (dataset != nullptr && dataset->numLevels > 1 && ctx.rayCasterSettings.use_lod) {
+		float voxelPixels = getVoxelFootprint(ctx, &ctx.camera, dataset->volume);
+		lod = cg::pyramidLevelForFootprint(voxelPixels, dataset->numLevels,
+		                                   ctx.rayCasterSettings.lod_bias);
+	}
+	glUniform1f(glGetUniformLocation(program, "u_lod"), lod);
+
+	// Empty bricks are skipped at full resolution only, since the
+	// samples of coarser levels reach beyond the margins of the bricks
+	GLuint brickTexture = dataset != nullptr ? dataset->brickTexture : 0;
+	bool useBricks = brickTexture != 0 && ctx.rayCasterSettings.use_empty_space_skipping &&
+	                 lod == 0.0f;
+	glActiveTexture(GL_TEXTURE5);
+	glBindTexture(GL_TEXTURE_3D, brickTexture);
+	glUniform1i(glGetUniformLocation(program, "u_brickTexture"), 5);
+	glUniform1i(glGetUniformLocation(program, "u_use_brick_texture"), useBricks);
+	glUniform1f(glGetUniformLocation(program, "u_brickSize"), float(minMaxBrickSize));
+	glActiveTexture(GL_TEXTURE0);
 
 	// Issue draw call
     glBindVertexArray(quadVAO.vao);
@@ -601,6 +2786,10 @@ void display(Context &ctx)
 	glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
     glClear(GL_COLOR_BUFFER_BIT);
 	drawTransferFunction(ctx, ctx.transferFunctionProgram, ctx.quadVAO, ctx.transferFunction);
+	readTransferFunctionVisibility(&ctx.transferFunction);
+	if (ctx.rayCastVolume.dataset != nullptr) {
+		updateBrickTexture(ctx.rayCastVolume.dataset, ctx.transferFunction);
+	}
 
 
     // Perform ray-casting
@@ -619,6 +2808,103 @@ void display(Context &ctx)
 
 }
 
+// Returns a value of a dataset mapped to [0, 1] like the texture values
+// that the transfer function sees
+float normalizedValue(const VolumeDataset &dataset, float value)
+{
+    const VolumeTextureFormat &format = dataset.format;
+    return (value - format.windowMin) / std::max(format.windowMax - format.windowMin, 1e-30f);
+}
+
+// Casts the ray through a point of the window (in normalized device
+// coordinates) into a dataset that is set up for editing, on the CPU
+// copy of its voxels. Returns the voxel coordinates of the first sample
+// (half a voxel apart, interpolated trilinearly like the texture) whose
+// value reaches the iso value, or false if there is none.
+bool pickVolume(Context &ctx, const VolumeDataset &dataset, const glm::vec2 &ndc,
+                glm::vec3 *voxel)
+{
+    const cg::VolumeBase &volume = dataset.volume;
+    glm::mat4 model = glm::scale(trackballGetRotationMatrix(ctx.trackball),
+                                 getVolumeBoxScale(volume));
+    glm::mat4 view;
+    getViewMatrix(&view);
+    glm::mat4 projection;
+    getProjectionMatrix(ctx, &(ctx.camera), &projection);
+    glm::mat4 inverse = glm::inverse(projection * view * model);
+    glm::vec4 nearPoint = inverse * glm::vec4(ndc, -1.0f, 1.0f);
+    glm::vec4 farPoint = inverse * glm::vec4(ndc, 1.0f, 1.0f);
+
+    // From the bounding cube to voxel coordinates, then clipped to the
+    // volume
+    glm::vec3 dims = glm::vec3(volume.dimensions);
+    glm::vec3 a = (0.5f * glm::vec3(nearPoint) / nearPoint.w + 0.5f) * dims - 0.5f;
+    glm::vec3 b = (0.5f * glm::vec3(farPoint) / farPoint.w + 0.5f) * dims - 0.5f;
+    glm::vec3 d = b - a;
+    float t0 = 0.0f, t1 = 1.0f;
+    for (int axis = 0; axis < 3; axis++) {
+        float lo = -0.5f, hi = dims[axis] - 0.5f;
+        if (std::fabs(d[axis]) < 1e-12f) {
+            if (a[axis] < lo || a[axis] > hi) {
+                return false;
+            }
+            continue;
+        }
+        float ta = (lo - a[axis]) / d[axis], tb = (hi - a[axis]) / d[axis];
+        t0 = std::max(t0, std::min(ta, tb));
+        t1 = std::min(t1, std::max(ta, tb));
+    }
+    if (t0 > t1) {
+        return false;
+    }
+
+    // The samples along the ray are interpolated in one batch
+    int numSamples = int(glm::length(d) * (t1 - t0) / 0.5f) + 1;
+    std::vector<glm::vec3> positions(numSamples + 1);
+    for (int i = 0; i <= numSamples; i++) {
+        positions[i] = a + d * (t0 + (t1 - t0) * float(i) / float(numSamples));
+    }
+    std::vector<float> values(positions.size());
+    if (!cg::volumeSampleTrilinear(volume, &positions[0], positions.size(), &values[0])) {
+        return false;
+    }
+    float iso = ctx.rayCasterSettings.iso_value;
+    for (std::size_t i = 0; i < values.size(); i++) {
+        if (normalizedValue(dataset, values[i]) >= iso) {
+            *voxel = positions[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+// Applies the brush to the current volume where the ray under the given
+// cursor position reaches the iso value (see pickVolume())
+void applyBrushAt(Context *ctx, double x, double y)
+{
+    VolumeDataset *dataset = ctx->rayCastVolume.dataset;
+    if (dataset == nullptr || !beginVolumeEditing(dataset)) {
+        return;
+    }
+    int windowWidth, windowHeight;
+    glfwGetWindowSize(ctx->window, &windowWidth, &windowHeight);
+    glm::vec2 ndc(2.0f * float(x) / float(windowWidth) - 1.0f,
+                  1.0f - 2.0f * float(y) / float(windowHeight));
+    cg::VolumeBrush brush;
+    if (!pickVolume(*ctx, *dataset, ndc, &brush.center)) {
+        return;
+    }
+    // The brush is round on screen: its radius along each axis shrinks
+    // with the size of the voxels along it
+    const cg::VolumeBase &volume = dataset->volume;
+    glm::vec3 voxelSize = getVolumeBoxScale(volume) / glm::vec3(volume.dimensions);
+    float finest = std::min(voxelSize.x, std::min(voxelSize.y, voxelSize.z));
+    brush.radius = ctx->brush.radius * finest / voxelSize;
+    const VolumeTextureFormat &format = dataset->format;
+    brush.value = format.windowMin + ctx->brush.value * (format.windowMax - format.windowMin);
+    editRayCastVolume(&ctx->rayCastVolume, brush);
+}
+
 void mouseButtonPressed(Context *ctx, int button, int x, int y)
 {
     if (button == GLFW_MOUSE_BUTTON_LEFT) {
@@ -668,6 +2954,15 @@ void mouseButtonCallback(GLFWwindow* window, int button, int action, int mods)
     glfwGetCursorPos(window, &x, &y);
 
     Context *ctx = static_cast<Context *>(glfwGetWindowUserPointer(window));
+    if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS && (mods & GLFW_MOD_SHIFT)) {
+        ctx->brush.stroking = true;
+        applyBrushAt(ctx, x, y);
+        return;
+    }
+    if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_RELEASE && ctx->brush.stroking) {
+        ctx->brush.stroking = false;
+        return;
+    }
     if (action == GLFW_PRESS) {
         mouseButtonPressed(ctx, button, x, y);
     }
@@ -679,6 +2974,10 @@ void mouseButtonCallback(GLFWwindow* window, int button, int action, int mods)
 void cursorPosCallback(GLFWwindow* window, double x, double y)
 {
     Context *ctx = static_cast<Context *>(glfwGetWindowUserPointer(window));
+	if (ctx->brush.stroking) {
+		applyBrushAt(ctx, x, y);
+		return;
+	}
 	if (ctx->trackball.tracking) {
 		moveTrackball(ctx, x, y);
 		return;
@@ -729,6 +3028,79 @@ void resizeCallback(GLFWwindow* window, int width, int height)
     glBindTexture(GL_TEXTURE_2D, 0);
 }
 
+// Reloads the current volume, e.g., after its upload settings changed
+void reloadRayCastVolume(Context *ctx)
+{
+    if (ctx->sequencePlayback.active) {
+        std::string pattern = ctx->sequencePlayback.pattern;
+        std::vector<std::string> filenames = ctx->sequencePlayback.filenames;
+        startSequencePlayback(*ctx, pattern, filenames);
+    }
+    else if (ctx->volumeLoad.active) {
+        startVolumeLoad(*ctx, ctx->volumeLoad.filename);
+    }
+    else if (ctx->rayCastVolume.dataset != nullptr) {
+        const VolumeDataset &dataset = *ctx->rayCastVolume.dataset;
+        startVolumeLoad(*ctx, dataset.filename);
+    }
+}
+
+void TW_CALL reloadRayCastVolumeCallback(void *clientData)
+{
+    reloadRayCastVolume(static_cast<Context *>(clientData));
+}
+
+// Turns the transfer function into a preset for the boundaries between
+// materials, from the joint histogram of the current dataset: its points
+// are spread evenly over the value range, each as opaque as the largest
+// mean gradient magnitude of the values around it (relative to that of
+// all values). The colors are kept.
+void applyBoundaryTransferFunction(Context *ctx)
+{
+    const VolumeDataset *dataset = ctx->rayCastVolume.dataset;
+    if (dataset == nullptr || dataset->jointHistogram.bins.empty()) {
+        std::cerr << "Warning: The current volume has no joint histogram" << std::endl;
+        return;
+    }
+    const cg::JointHistogram &histogram = dataset->jointHistogram;
+    std::vector<float> means = cg::jointHistogramMeanGradients(histogram);
+    float largest = *std::max_element(means.begin(), means.end());
+    BSpline &spline = ctx->transferFunction.bSpline;
+    int numPoints = spline.num_colors;
+    int numBins = histogram.numValueBins;
+    float low = normalizedValue(*dataset, histogram.minValue);
+    float high = normalizedValue(*dataset, histogram.maxValue);
+    for (int i = 0; i < numPoints; i++) {
+        float t = numPoints > 1 ? float(i) / float(numPoints - 1) : 0.0f;
+        float reach = 0.5f / float(std::max(numPoints - 1, 1));
+        int first = std::max(int((t - reach) * float(numBins)), 0);
+        int last = std::min(int(std::ceil((t + reach) * float(numBins))), numBins);
+        float mean = 0.0f;
+        for (int bin = first; bin < last; bin++) {
+            mean = std::max(mean, means[bin]);
+        }
+        spline.knots[1 + i] = glm::vec4(glm::clamp(low + t * (high - low), 0.0f, 1.0f));
+        spline.colors[i].a = largest > 0.0f ? mean / largest : 0.0f;
+    }
+}
+
+void TW_CALL applyBoundaryTransferFunctionCallback(void *clientData)
+{
+    applyBoundaryTransferFunction(static_cast<Context *>(clientData));
+}
+
+void TW_CALL setDatasetCallback(const void *value, void *clientData)
+{
+    Context *ctx = static_cast<Context *>(clientData);
+    ctx->datasetIndex = *static_cast<const int *>(value);
+    selectDataset(*ctx, ctx->datasetFilenames[ctx->datasetIndex]);
+}
+
+void TW_CALL getDatasetCallback(void *value, void *clientData)
+{
+    *static_cast<int *>(value) = static_cast<Context *>(clientData)->datasetIndex;
+}
+
 void createTweakBar(Context& ctx) {
     TwBar *tweakbar = TwNewBar("Settings");
 	TwDefine(" Settings size='400 500' valueswidth=200 ");
@@ -748,21 +3120,155 @@ void createTweakBar(Context& ctx) {
 											 -3 {Debug: Back Face Texture}, \
 											 -4 {Debug: Transfer Function Texture}, \
 											 0 {Maximum Intensity}, \
-											 1 {Front To Back Alpha}' ");
+											 1 {Front To Back Alpha}, \
+											 2 {Isosurface (Blinn-Phong)}' ");
 	TwAddVarRW(tweakbar, "Ray step length", TW_TYPE_FLOAT, 
 		&(ctx.rayCasterSettings.ray_step_length), "min=0.0001 max=1 step=0.0001");
 	TwAddVarRW(tweakbar, "Density", TW_TYPE_FLOAT, 
 		&(ctx.rayCasterSettings.density), "min=0.1 max=1000 step=0.1");
+	TwAddVarRW(tweakbar, "Iso value", TW_TYPE_FLOAT, 
+		&(ctx.rayCasterSettings.iso_value), "min=0 max=1 step=0.01");
 	TwAddVarRW(tweakbar, "Use gamma correction", TW_TYPE_BOOL32, 
 		&(ctx.rayCasterSettings.use_gamma_correction), "true='Yes' false='No'");
 	TwAddVarRW(tweakbar, "Use color inversion", TW_TYPE_BOOL32, 
 		&(ctx.rayCasterSettings.use_color_inversion), "true='Yes' false='No'");
+	TwAddVarRW(tweakbar, "Use level of detail", TW_TYPE_BOOL32, 
+		&(ctx.rayCasterSettings.use_lod), "true='Yes' false='No'");
+	TwAddVarRW(tweakbar, "Level of detail bias", TW_TYPE_FLOAT, 
+		&(ctx.rayCasterSettings.lod_bias), "min=-4 max=4 step=0.1");
+	TwAddVarRW(tweakbar, "Skip empty space", TW_TYPE_BOOL32, 
+		&(ctx.rayCasterSettings.use_empty_space_skipping), "true='Yes' false='No'");
 
 	TwAddVarRW(tweakbar, "Background color", TW_TYPE_COLOR3F, 
 		&(ctx.backgroundColor), nullptr);
+	TwAddVarRW(tweakbar, "Brush radius (voxels)", TW_TYPE_FLOAT, 
+		&(ctx.brush.radius), "min=0.5 max=256 step=0.5");
+	TwAddVarRW(tweakbar, "Brush value (0 = erase)", TW_TYPE_FLOAT, 
+		&(ctx.brush.value), "min=0 max=1 step=0.01");
 
 	TwAddSeparator(tweakbar, nullptr, nullptr);
 
+	std::vector<std::string> datasetNames;
+	std::vector<TwEnumVal> datasetEV;
+	for (std::size_t i = 0; i < ctx.datasetFilenames.size(); i++) {
+		datasetNames.push_back(baseName(ctx.datasetFilenames[i]));
+	}
+	for (std::size_t i = 0; i < datasetNames.size(); i++) {
+		TwEnumVal value = { int(i), datasetNames[i].c_str() };
+		datasetEV.push_back(value);
+	}
+	TwType datasetType = TwDefineEnum("DatasetType", &datasetEV[0], unsigned(datasetEV.size()));
+	TwAddVarCB(tweakbar, "Dataset", datasetType, setDatasetCallback, getDatasetCallback, 
+		&ctx, nullptr);
+	TwAddVarRW(tweakbar, "CPU budget (MB)", TW_TYPE_FLOAT, 
+		&(ctx.datasetCache.cpuBudgetMB), "min=0 step=64");
+	TwAddVarRW(tweakbar, "GPU budget (MB)", TW_TYPE_FLOAT, 
+		&(ctx.datasetCache.gpuBudgetMB), "min=0 step=64");
+	TwAddVarRO(tweakbar, "Resident datasets", TW_TYPE_INT32, 
+		&(ctx.datasetCache.numResident), nullptr);
+	TwAddVarRO(tweakbar, "CPU resident (MB)", TW_TYPE_FLOAT, 
+		&(ctx.datasetCache.cpuResidentMB), "precision=0");
+	TwAddVarRO(tweakbar, "GPU resident (MB)", TW_TYPE_FLOAT, 
+		&(ctx.datasetCache.gpuResidentMB), "precision=0");
+	TwAddVarRO(tweakbar, "Value min", TW_TYPE_FLOAT, 
+		&(ctx.statisticsView.minValue), nullptr);
+	TwAddVarRO(tweakbar, "Value max", TW_TYPE_FLOAT, 
+		&(ctx.statisticsView.maxValue), nullptr);
+	TwAddVarRO(tweakbar, "Value mean", TW_TYPE_FLOAT, 
+		&(ctx.statisticsView.mean), nullptr);
+	TwAddVarRO(tweakbar, "Value std. deviation", TW_TYPE_FLOAT, 
+		&(ctx.statisticsView.standardDeviation), nullptr);
+	TwAddVarRO(tweakbar, "Value 1st percentile", TW_TYPE_FLOAT, 
+		&(ctx.statisticsView.lowPercentile), nullptr);
+	TwAddVarRO(tweakbar, "Value median", TW_TYPE_FLOAT, 
+		&(ctx.statisticsView.median), nullptr);
+	TwAddVarRO(tweakbar, "Value 99th percentile", TW_TYPE_FLOAT, 
+		&(ctx.statisticsView.highPercentile), nullptr);
+	TwAddVarRW(tweakbar, "Play sequence", TW_TYPE_BOOLCPP, 
+		&(ctx.sequencePlayback.playing), nullptr);
+	TwAddVarRW(tweakbar, "Sequence rate (fps)", TW_TYPE_FLOAT, 
+		&(ctx.sequencePlayback.frameRate), "min=0.1 max=120 step=0.5");
+	TwAddVarRO(tweakbar, "Sequence timestep", TW_TYPE_INT32, 
+		&(ctx.sequencePlayback.frame), nullptr);
+	TwAddVarRO(tweakbar, "Dropped timesteps", TW_TYPE_INT32, 
+		&(ctx.sequencePlayback.droppedFrames), nullptr);
+	TwAddVarRO(tweakbar, "Prefetch depth (CPU)", TW_TYPE_INT32, 
+		&(ctx.sequencePlayback.prefetchDepth), nullptr);
+	TwAddVarRO(tweakbar, "Prefetch depth (GPU)", TW_TYPE_INT32, 
+		&(ctx.sequencePlayback.residentFrames), nullptr);
+
+	TwEnumVal volumePrecisionEV[] = {
+		{PRECISION_FULL, "Full"},
+		{PRECISION_HALF, "Half float"},
+		{PRECISION_8BIT, "8-bit quantized"}
+	};
+	TwType volumePrecisionType = TwDefineEnum("VolumePrecisionType", volumePrecisionEV, 3);
+	TwAddVarRW(tweakbar, "Volume precision", volumePrecisionType, 
+		&(ctx.volumeUploadSettings.precision), nullptr);
+	TwEnumVal cpuCopyPolicyEV[] = {
+		{CPU_COPY_KEEP, "Keep"},
+		{CPU_COPY_PAGE_OUT, "Page out to cache"},
+		{CPU_COPY_DROP, "Drop"},
+		{CPU_COPY_COMPRESS, "Compress in memory"}
+	};
+	TwType cpuCopyPolicyType = TwDefineEnum("CpuCopyPolicyType", cpuCopyPolicyEV, 4);
+	TwAddVarRW(tweakbar, "CPU copy after upload", cpuCopyPolicyType, 
+		&(ctx.volumeUploadSettings.cpuCopy), nullptr);
+	TwAddVarRW(tweakbar, "Quantize low percentile", TW_TYPE_FLOAT, 
+		&(ctx.volumeUploadSettings.lowPercentile), "min=0 max=100 step=0.1");
+	TwAddVarRW(tweakbar, "Quantize high percentile", TW_TYPE_FLOAT, 
+		&(ctx.volumeUploadSettings.highPercentile), "min=0 max=100 step=0.1");
+	TwAddVarRW(tweakbar, "Window level", TW_TYPE_FLOAT, 
+		&(ctx.volumeUploadSettings.windowLevel), "step=1");
+	TwAddVarRW(tweakbar, "Window width (0 = percentiles)", TW_TYPE_FLOAT, 
+		&(ctx.volumeUploadSettings.windowWidth), "min=0 step=1");
+	TwAddVarRW(tweakbar, "Smoothing sigma (0 = off)", TW_TYPE_FLOAT, 
+		&(ctx.volumeUploadSettings.smoothing), "min=0 max=8 step=0.1");
+	TwEnumVal lodPyramidModeEV[] = {
+		{LOD_PYRAMID_OFF, "Off"},
+		{LOD_PYRAMID_AVERAGE, "Average"},
+		{LOD_PYRAMID_MAX, "Maximum"}
+	};
+	TwType lodPyramidModeType = TwDefineEnum("LodPyramidModeType", lodPyramidModeEV, 3);
+	TwAddVarRW(tweakbar, "Levels of detail", lodPyramidModeType, 
+		&(ctx.volumeUploadSettings.lodPyramid), nullptr);
+	TwEnumVal gradientPrecomputeEV[] = {
+		{GRADIENTS_OFF, "Off (in shader)"},
+		{GRADIENTS_CENTRAL_DIFFERENCES, "Central differences"},
+		{GRADIENTS_SOBEL, "Sobel"}
+	};
+	TwType gradientPrecomputeType = TwDefineEnum("GradientPrecomputeType", gradientPrecomputeEV, 3);
+	TwAddVarRW(tweakbar, "Precomputed gradients", gradientPrecomputeType, 
+		&(ctx.volumeUploadSettings.gradients), nullptr);
+	TwEnumVal volumeResamplingEV[] = {
+		{RESAMPLING_OFF, "Off"},
+		{RESAMPLING_ISOTROPIC, "Isotropic"},
+		{RESAMPLING_BUDGET, "Isotropic, within budget"}
+	};
+	TwType volumeResamplingType = TwDefineEnum("VolumeResamplingType", volumeResamplingEV, 3);
+	TwAddVarRW(tweakbar, "Resampling", volumeResamplingType, 
+		&(ctx.volumeUploadSettings.resampling), nullptr);
+	TwEnumVal resampleFilterEV[] = {
+		{cg::RESAMPLE_TRILINEAR, "Trilinear"},
+		{cg::RESAMPLE_LANCZOS, "Lanczos"}
+	};
+	TwType resampleFilterType = TwDefineEnum("ResampleFilterType", resampleFilterEV, 2);
+	TwAddVarRW(tweakbar, "Resampling filter", resampleFilterType, 
+		&(ctx.volumeUploadSettings.resampleFilter), nullptr);
+	TwAddVarRW(tweakbar, "Resampling budget (MB)", TW_TYPE_FLOAT, 
+		&(ctx.volumeUploadSettings.resampleBudgetMB), "min=1 step=64");
+	TwAddVarRW(tweakbar, "Max texture size (MB)", TW_TYPE_FLOAT, 
+		&(ctx.volumeUploadSettings.maxTextureMB), "min=0 step=64");
+	TwAddButton(tweakbar, "Reload volume", reloadRayCastVolumeCallback, &ctx, nullptr);
+	TwAddVarRO(tweakbar, "Volume status", TW_TYPE_CSSTRING(sizeof(ctx.volumeLoad.status)), 
+		ctx.volumeLoad.status, nullptr);
+	TwAddVarRO(tweakbar, "Upload progress (%)", TW_TYPE_FLOAT, 
+		&(ctx.volumeLoad.progress), "precision=0");
+
+	TwAddSeparator(tweakbar, nullptr, nullptr);
+
+	TwAddButton(tweakbar, "TF preset from boundaries", applyBoundaryTransferFunctionCallback,
+		&ctx, nullptr);
 
 	for (int i = 0; i < ctx.transferFunction.bSpline.num_colors; i++) {
 		std::string point_name = "TF point " + std::to_string(i+1);
@@ -774,9 +3280,12 @@ void createTweakBar(Context& ctx) {
 	}
 }
 
-int main(void)
+int main(int argc, char *argv[])
 {
     Context ctx;
+    for (int i = 1; i < argc; i++) {
+        ctx.datasetFilenames.push_back(argv[i]);
+    }
 
     // Create a GLFW window
     glfwSetErrorCallback(errorCallback);
@@ -825,6 +3334,11 @@ int main(void)
     while (!glfwWindowShouldClose(ctx.window)) {
         glfwPollEvents();
         ctx.elapsed_time = glfwGetTime();
+        updateVolumeLoad(ctx);
+        updateSequencePlayback(ctx);
+        updateStatisticsView(ctx);
+        uploadVolumeEdits(ctx);
+        enforceDatasetBudgets(ctx);
         display(ctx);
 #ifdef WITH_TWEAKBAR
         TwDraw();
@@ -833,6 +3347,8 @@ int main(void)
     }
 
     // Shutdown
+    stopSequencePlayback(ctx);
+    cancelVolumeLoad(ctx);
 #ifdef WITH_TWEAKBAR
     TwTerminate();
 #endif // WITH_TWEAKBAR
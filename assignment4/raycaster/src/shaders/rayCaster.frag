@@ -7,7 +7,7 @@
 #define MODE_TRANSFER_FUNCTION_TEXTURE -4
 #define MODE_MAX_INTENSITY 0
 #define MODE_FRONT_TO_BACK_ALPHA 1
-//#define MODE_ISOSURFACE_BLINN_PHONG 2
+#define MODE_ISOSURFACE_BLINN_PHONG 2
 
 uniform int u_color_mode;
 uniform int u_use_gamma_correction;
@@ -17,22 +17,73 @@ uniform sampler3D u_volumeTexture;
 uniform sampler2D u_backFaceTexture;
 uniform sampler2D u_frontFaceTexture;
 uniform sampler1D u_transferFuncTexture;
+uniform sampler3D u_gradientTexture;
+uniform int u_use_gradient_texture;
+uniform sampler3D u_brickTexture;
+uniform int u_use_brick_texture;
+uniform float u_brickSize;
+uniform vec3 u_boxScale;  // size of the volume's box in model space
 
 uniform float u_rayStepLength;
 uniform float u_density;
+uniform float u_valueScale;
+uniform float u_valueOffset;
+uniform float u_lod;
+uniform float u_isoValue;
 
 in vec2 v_texcoord;
 
 out vec4 frag_color;
 
 
+// Samples the volume at the current level of detail, mapping its values
+// to [0, 1]
+float sampleVolume(vec3 samplePoint) {
+	return textureLod(u_volumeTexture, samplePoint, u_lod).r * u_valueScale + u_valueOffset;
+}
+
+// Returns the brick of the min/max grid that a sample point lies in
+ivec3 brickOf(vec3 samplePoint) {
+	ivec3 brick = ivec3(floor(samplePoint * vec3(textureSize(u_volumeTexture, 0)) / u_brickSize));
+	return clamp(brick, ivec3(0), textureSize(u_brickTexture, 0) - 1);
+}
+
+// Returns the occupancy (r) and the maximum value (g) of a brick
+vec2 fetchBrick(ivec3 brick) {
+	return texelFetch(u_brickTexture, brick, 0).rg;
+}
+
+// Returns the index of the first sample of the ray after the one with
+// index i that lies beyond the brick
+int sampleAfterBrick(vec3 front, vec3 front2back, ivec3 brick, int i, int numIterations) {
+	vec3 dims = vec3(textureSize(u_volumeTexture, 0));
+	vec3 lo = vec3(brick) * u_brickSize / dims;
+	vec3 hi = vec3(brick + 1) * u_brickSize / dims;
+	bvec3 axisParallel = lessThan(abs(front2back), vec3(1e-9));
+	vec3 t = (mix(lo, hi, greaterThan(front2back, vec3(0.0))) - front) /
+		mix(front2back, vec3(1.0), axisParallel);
+	t = mix(t, vec3(1e30), axisParallel);
+	float tExit = min(t.x, min(t.y, t.z));
+	return max(i + 1, int(floor(tExit * numIterations - 0.5)) + 1);
+}
+
+// Skips the bricks whose maximum cannot beat the running maximum
 float rayMaxIntensity(vec3 front, vec3 front2back, int numIterations) {
 	float maxIntensity = 0.0;
-	for (int i = 0; i < numIterations; i++) {
+	int i = 0;
+	while (i < numIterations) {
 		vec3 samplePoint = front + front2back * (i + 0.5) / numIterations;
-		float volumeSample = texture(u_volumeTexture, samplePoint).r;
+		if (u_use_brick_texture != 0) {
+			ivec3 brick = brickOf(samplePoint);
+			if (fetchBrick(brick).g <= maxIntensity) {
+				i = sampleAfterBrick(front, front2back, brick, i, numIterations);
+				continue;
+			}
+		}
+		float volumeSample = sampleVolume(samplePoint);
 		if (maxIntensity < volumeSample)
 			maxIntensity = volumeSample;
+		i++;
 	}
 	return maxIntensity;
 }
@@ -45,16 +96,76 @@ float sampleToOcclusion(float sample) {
 	return texture(u_transferFuncTexture, sample).a;
 }
 
+// Returns the gradient of the volume at a sample point in model space
+// (xyz) and its magnitude (w, zero where there is no gradient): one fetch
+// of the precomputed gradient texture (normal in RGB, magnitude in A) if
+// there is one, otherwise central differences of six volume samples,
+// divided by their distance in model space
+vec4 sampleGradient(vec3 samplePoint) {
+	if (u_use_gradient_texture != 0) {
+		vec4 texel = texture(u_gradientTexture, samplePoint);
+		return vec4(texel.rgb * 2.0 - 1.0, texel.a);
+	}
+	vec3 d = 1.0 / vec3(textureSize(u_volumeTexture, 0));
+	vec3 gradient = vec3(
+		sampleVolume(samplePoint + vec3(d.x, 0, 0)) - sampleVolume(samplePoint - vec3(d.x, 0, 0)),
+		sampleVolume(samplePoint + vec3(0, d.y, 0)) - sampleVolume(samplePoint - vec3(0, d.y, 0)),
+		sampleVolume(samplePoint + vec3(0, 0, d.z)) - sampleVolume(samplePoint - vec3(0, 0, d.z)))
+		/ (2.0 * d * u_boxScale);
+	return vec4(gradient, length(gradient));
+}
+
+// Shades the first crossing of the iso value along the ray with a
+// headlight (Blinn-Phong), colored by the transfer function
+vec4 rayIsosurfaceBlinnPhong(vec3 front, vec3 front2back, int numIterations) {
+	vec3 previousPoint = front;
+	float previousSample = sampleVolume(front);
+	for (int i = 0; i < numIterations; i++) {
+		vec3 samplePoint = front + front2back * (i + 0.5) / numIterations;
+		float volumeSample = sampleVolume(samplePoint);
+		if (volumeSample >= u_isoValue) {
+			// Interpolate the crossing between the last two samples
+			float t = clamp((u_isoValue - previousSample) / (volumeSample - previousSample), 0.0, 1.0);
+			vec3 hit = mix(previousPoint, samplePoint, t);
+			// Shading is done in model space, where the box has the
+			// proportions of the volume
+			vec3 viewDir = normalize(-front2back * u_boxScale);
+			vec4 gradient = sampleGradient(hit);
+			vec3 normal = gradient.w > 0.0 ? -normalize(gradient.xyz) : viewDir;
+			if (dot(normal, viewDir) < 0.0)
+				normal = -normal;
+			vec3 halfway = viewDir;  // light and view directions coincide
+			float diffuse = max(dot(normal, viewDir), 0.0);
+			float specular = pow(max(dot(normal, halfway), 0.0), 32.0);
+			vec3 base = sampleToColor(u_isoValue);
+			return vec4(0.1 * base + 0.8 * diffuse * base + vec3(0.3 * specular), 1.0);
+		}
+		previousPoint = samplePoint;
+		previousSample = volumeSample;
+	}
+	return vec4(0.0);
+}
+
+// Skips the bricks that the transfer function maps to zero
 vec4 rayFrontToBackAlpha(vec3 front, vec3 front2back, int numIterations) {
 	float dt = length(front2back) / numIterations; // delta step length
 	float dm = dt * u_density; // delta mass per step
 	vec3 C = vec3(0.0);
 	float A = 0.0;
-	for (int i = 0; i < numIterations; i++) {
+	int i = 0;
+	while (i < numIterations) {
 		vec3 samplePoint = front + front2back * (i + 0.5) / numIterations;
-		float volumeSample = texture(u_volumeTexture, samplePoint).r;
+		if (u_use_brick_texture != 0) {
+			ivec3 brick = brickOf(samplePoint);
+			if (fetchBrick(brick).r == 0.0) {
+				i = sampleAfterBrick(front, front2back, brick, i, numIterations);
+				continue;
+			}
+		}
+		float volumeSample = sampleVolume(samplePoint);
 		C += (1-A) * sampleToColor(volumeSample) * dm;
 		A += (1-A) * (1 - exp(-sampleToOcclusion(volumeSample) * dm));
+		i++;
 	}
 	return vec4(C,A);
 }
@@ -96,6 +207,9 @@ void main()
 		case MODE_FRONT_TO_BACK_ALPHA:
 			color = rayFrontToBackAlpha(front, front2back, numIterations);
 			break;
+		case MODE_ISOSURFACE_BLINN_PHONG:
+			color = rayIsosurfaceBlinnPhong(front, front2back, numIterations);
+			break;
 		default:
 			break;
 	}